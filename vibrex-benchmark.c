@@ -2,14 +2,28 @@
  * Performance benchmark for vibrex, comparing it to PCRE2 and the system
  * (POSIX) regex.
  *
- * This program benchmarks the compilation and matching performance of three
- * different regular expression engines on a variety of patterns and texts.
+ * This program benchmarks the compilation and matching performance of four
+ * regular expression engines (vibrex, PCRE2, PCRE2 with JIT and the system
+ * regex) on a built-in set of patterns and texts, or on pattern and subject
+ * corpus files.
+ *
+ * Each case is a pattern and the subjects it is matched against.  A sample
+ * times enough passes over the subjects to last at least MIN_SAMPLE_NS, and
+ * samples are taken until the median settles within a tolerance, so that
+ * results are stable enough to compare between releases.  The median and
+ * 99th percentile time per match, the time and cycles per subject byte and
+ * the median compile time are reported as text, CSV or JSON, along with the
+ * engine vibrex selected for the pattern.
  *
  * To compile:
  * cc -O2 `pcre2-config --cflags` -o vibrex-benchmark vibrex-benchmark.c vibrex.c `pcre2-config --libs8`
  *********************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,279 +35,587 @@
 #define PCRE2_CODE_UNIT_WIDTH 8
 #include <pcre2.h>
 
+/* PCRE2 before 10.43 reports a build without JIT support as a bad option */
+#ifndef PCRE2_ERROR_JIT_UNSUPPORTED
+#define PCRE2_ERROR_JIT_UNSUPPORTED PCRE2_ERROR_JIT_BADOPTION
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#else
+#define HAVE_CYCLES 0
+#endif
+
+#define MIN_SAMPLE_NS 200000.0 // Shortest sample, so timer resolution does not matter
+#define COMPILE_RUNS 9         // Compiles timed per case and engine
+
 // --- Timing utility ---
 
 /**
  * @brief Get high-resolution time.
- * @return The current time in seconds.
+ * @return The current time in nanoseconds.
  */
 static double
-get_time_s ()
+get_time_ns ()
 {
   struct timespec ts;
   clock_gettime (CLOCK_MONOTONIC, &ts);
-  return ts.tv_sec + ts.tv_nsec / 1e9;
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
 }
 
-// --- Benchmark Functions ---
+/**
+ * @brief Read the CPU time stamp counter.
+ * @return The counter, or 0 where there is none.
+ */
+static uint64_t
+get_cycles ()
+{
+#if HAVE_CYCLES
+  return __rdtsc ();
+#else
+  return 0;
+#endif
+}
+
+// --- Engines ---
 
+/* An engine under test, compiling patterns to an opaque handle */
 typedef struct
 {
-  double compile_time;
-  double match_time;
-  int match_count;
-} benchmark_result;
+  const char *name;
+  void *(*compile) (const char *pattern, char *error, size_t error_size);
+  bool (*match) (void *compiled, const char *text, size_t text_len);
+  void (*release) (void *compiled);
+} engine;
 
-/**
- * @brief Benchmark the vibrex engine.
- */
-static bool
-benchmark_vibrex (const char *name, const char *pattern, const char *text, int iterations, benchmark_result *result)
+static void *
+vibrex_engine_compile (const char *pattern, char *error, size_t error_size)
 {
-  printf ("--- Vibrex: %s ---\n", name);
-  double start_time, end_time, compile_time, match_time;
   const char *error_message = NULL;
+  vibrex_t *rex             = vibrex_compile (pattern, &error_message);
+  if (!rex)
+    snprintf (error, error_size, "%s", error_message ? error_message : "Unknown error");
+  return rex;
+}
 
-  start_time    = get_time_s ();
-  vibrex_t *rex = vibrex_compile (pattern, &error_message);
-  end_time      = get_time_s ();
-  compile_time  = end_time - start_time;
+static bool
+vibrex_engine_match (void *compiled, const char *text, size_t text_len)
+{
+  return vibrex_match_n (compiled, text, text_len);
+}
 
-  if (!rex)
+static void
+vibrex_engine_release (void *compiled)
+{
+  vibrex_free (compiled);
+}
+
+/* A PCRE2 pattern with the match data it is matched with */
+typedef struct
+{
+  pcre2_code *re;
+  pcre2_match_data *match_data;
+} pcre2_handle;
+
+static void *
+pcre2_compile_handle (const char *pattern, bool jit, char *error, size_t error_size)
+{
+  int errorcode;
+  PCRE2_SIZE erroroffset;
+  pcre2_code *re = pcre2_compile ((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, 0, &errorcode, &erroroffset, NULL);
+  if (!re)
   {
-    printf ("Vibrex compilation failed: %s\n", error_message ? error_message : "Unknown error");
-    result->compile_time = -1;
-    result->match_time   = -1;
-    result->match_count  = -1;
-    return false;
+    PCRE2_UCHAR buffer[256];
+    pcre2_get_error_message (errorcode, buffer, sizeof (buffer));
+    snprintf (error, error_size, "at offset %d: %s", (int)erroroffset, buffer);
+    return NULL;
   }
 
-  /* Warm-up run to load caches, etc. */
-  (void)vibrex_match (rex, text);
-
-  start_time      = get_time_s ();
-  int match_count = 0;
-  for (int i = 0; i < iterations; i++)
+  if (jit)
   {
-    if (vibrex_match (rex, text))
+    int jit_rc = pcre2_jit_compile (re, PCRE2_JIT_COMPLETE);
+    if (!(jit_rc == 0 || jit_rc == PCRE2_ERROR_JIT_UNSUPPORTED))
     {
-      match_count++;
+      snprintf (error, error_size, "JIT compilation failed");
+      pcre2_code_free (re);
+      return NULL;
     }
   }
-  end_time   = get_time_s ();
-  match_time = end_time - start_time;
 
-  printf ("Compilation time: %.6f s\n", compile_time);
-  printf ("Matching time (%d iterations): %.6f s\n", iterations, match_time);
-  printf ("Average match time: %.9f s\n", match_time / iterations);
-  printf ("Matches found: %d/%d\n", match_count, iterations);
+  pcre2_handle *handle = malloc (sizeof (pcre2_handle));
+  if (!handle)
+  {
+    snprintf (error, error_size, "Out of memory");
+    pcre2_code_free (re);
+    return NULL;
+  }
+  handle->re         = re;
+  handle->match_data = pcre2_match_data_create_from_pattern (re, NULL);
+  return handle;
+}
 
-  result->compile_time = compile_time;
-  result->match_time   = match_time;
-  result->match_count  = match_count;
+static void *
+pcre2_engine_compile (const char *pattern, char *error, size_t error_size)
+{
+  return pcre2_compile_handle (pattern, false, error, error_size);
+}
 
-  vibrex_free (rex);
-  return true;
+static void *
+pcre2_jit_engine_compile (const char *pattern, char *error, size_t error_size)
+{
+  return pcre2_compile_handle (pattern, true, error, error_size);
 }
 
-/**
- * @brief Benchmark the PCRE2 engine.
- */
 static bool
-benchmark_pcre2 (const char *name, const char *pattern, const char *text, int iterations, benchmark_result *result)
+pcre2_engine_match (void *compiled, const char *text, size_t text_len)
 {
-  printf ("--- PCRE2: %s ---\n", name);
-  double start_time, end_time, compile_time, match_time;
-  pcre2_code *re;
-  int errorcode;
-  PCRE2_SIZE erroroffset;
+  pcre2_handle *handle = compiled;
+  return pcre2_match (handle->re, (PCRE2_SPTR)text, text_len, 0, 0, handle->match_data, NULL) >= 0;
+}
 
-  start_time   = get_time_s ();
-  re           = pcre2_compile ((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, 0, &errorcode, &erroroffset, NULL);
-  end_time     = get_time_s ();
-  compile_time = end_time - start_time;
+static void
+pcre2_engine_release (void *compiled)
+{
+  pcre2_handle *handle = compiled;
+  pcre2_match_data_free (handle->match_data);
+  pcre2_code_free (handle->re);
+  free (handle);
+}
 
-  if (re == NULL)
+static void *
+system_engine_compile (const char *pattern, char *error, size_t error_size)
+{
+  regex_t *regex = malloc (sizeof (regex_t));
+  if (!regex)
   {
-    PCRE2_UCHAR buffer[256];
-    pcre2_get_error_message (errorcode, buffer, sizeof (buffer));
-    printf ("PCRE2 compilation failed at offset %d: %s\n", (int)erroroffset, buffer);
-    result->compile_time = -1;
-    result->match_time   = -1;
-    result->match_count  = -1;
-    return false;
+    snprintf (error, error_size, "Out of memory");
+    return NULL;
+  }
+  int reti = regcomp (regex, pattern, REG_EXTENDED | REG_NOSUB);
+  if (reti)
+  {
+    regerror (reti, regex, error, error_size);
+    free (regex);
+    return NULL;
   }
+  return regex;
+}
 
-  pcre2_match_data *match_data = pcre2_match_data_create_from_pattern (re, NULL);
+/* Subjects are NUL-terminated, as regexec() needs */
+static bool
+system_engine_match (void *compiled, const char *text, size_t text_len)
+{
+  (void)text_len;
+  return regexec (compiled, text, 0, NULL, 0) == 0;
+}
 
-  size_t textsize = strlen (text);
+static void
+system_engine_release (void *compiled)
+{
+  regfree (compiled);
+  free (compiled);
+}
 
-  /* Warm-up run */
-  (void)pcre2_match (re, (PCRE2_SPTR)text, textsize, 0, 0, match_data, NULL);
+static const engine engines[] = {
+    {"Vibrex", vibrex_engine_compile, vibrex_engine_match, vibrex_engine_release},
+    {"PCRE2", pcre2_engine_compile, pcre2_engine_match, pcre2_engine_release},
+    {"PCRE2-JIT", pcre2_jit_engine_compile, pcre2_engine_match, pcre2_engine_release},
+    {"system", system_engine_compile, system_engine_match, system_engine_release},
+};
+#define NUM_ENGINES (sizeof (engines) / sizeof (engines[0]))
+#define SYSTEM_ENGINE 3
 
-  start_time      = get_time_s ();
-  int match_count = 0;
-  for (int i = 0; i < iterations; i++)
-  {
-    int rc = pcre2_match (re, (PCRE2_SPTR)text, textsize, 0, 0, match_data, NULL);
-    if (rc >= 0)
-    {
-      match_count++;
-    }
-  }
-  end_time   = get_time_s ();
-  match_time = end_time - start_time;
+// --- Benchmark Functions ---
 
-  printf ("Compilation time: %.6f s\n", compile_time);
-  printf ("Matching time (%d iterations): %.6f s\n", iterations, match_time);
-  printf ("Average match time: %.9f s\n", match_time / iterations);
-  printf ("Matches found: %d/%d\n", match_count, iterations);
+/* A pattern and the subjects it is matched against */
+typedef struct
+{
+  const char *name;
+  const char *pattern;
+  const char *const *subjects;
+  size_t *lengths;
+  size_t count;
+  size_t bytes;
+} benchmark_case;
 
-  result->compile_time = compile_time;
-  result->match_time   = match_time;
-  result->match_count  = match_count;
+typedef struct
+{
+  bool ran;               /* Pattern compiled and was matched */
+  char error[256];        /* Why it did not compile */
+  size_t match_count;     /* Subjects matched */
+  int runs;               /* Samples taken */
+  double compile_ns;      /* Median compile time */
+  double median_ns;       /* Median time per match */
+  double p99_ns;          /* 99th percentile time per match */
+  double ns_per_byte;     /* Median time per subject byte */
+  double cycles_per_byte; /* Median cycles per subject byte, negative if not available */
+} benchmark_result;
 
-  pcre2_match_data_free (match_data);
-  pcre2_code_free (re);
-  return true;
+/* How samples are taken */
+typedef struct
+{
+  int min_runs;     /* Samples taken before checking for stability */
+  int max_runs;     /* Samples taken at most */
+  double tolerance; /* Relative change of the median that counts as stable */
+  double max_ns;    /* Time budget per case and engine */
+} benchmark_options;
+
+static int
+compare_doubles (const void *a, const void *b)
+{
+  double x = *(const double *)a;
+  double y = *(const double *)b;
+  return (x > y) - (x < y);
 }
 
 /**
- * @brief Benchmark the PCRE2 JIT engine.
+ * @brief The value at a percentile of sorted samples.
  */
-static bool
-benchmark_pcre2_jit (const char *name, const char *pattern, const char *text, int iterations, benchmark_result *result)
+static double
+percentile (const double *sorted, int count, double fraction)
 {
-  printf ("--- PCRE2-JIT: %s ---\n", name);
-  double start_time, end_time, compile_time, match_time;
-  pcre2_code *re;
-  int errorcode;
-  PCRE2_SIZE erroroffset;
+  int index = (int)ceil (fraction * count) - 1;
+  if (index < 0)
+    index = 0;
+  return sorted[index];
+}
 
-  start_time   = get_time_s ();
-  re           = pcre2_compile ((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, 0, &errorcode, &erroroffset, NULL);
-  end_time     = get_time_s ();
-  compile_time = end_time - start_time;
+/**
+ * @brief Median of unsorted samples, sorting a copy.
+ */
+static double
+median_of (const double *samples, int count, double *scratch)
+{
+  memcpy (scratch, samples, count * sizeof (double));
+  qsort (scratch, count, sizeof (double), compare_doubles);
+  return percentile (scratch, count, 0.5);
+}
 
-  if (re == NULL)
+/**
+ * @brief Match every subject of a case a number of times.
+ * @return The number of subjects that matched in one pass.
+ */
+static size_t
+match_passes (const engine *eng, void *compiled, const benchmark_case *bc, int passes)
+{
+  size_t matched = 0;
+  for (int pass = 0; pass < passes; pass++)
   {
-    PCRE2_UCHAR buffer[256];
-    pcre2_get_error_message (errorcode, buffer, sizeof (buffer));
-    printf ("PCRE2-JIT compilation failed at offset %d: %s\n", (int)erroroffset, buffer);
-    result->compile_time = -1;
-    result->match_time   = -1;
-    result->match_count  = -1;
-    return false;
+    matched = 0;
+    for (size_t i = 0; i < bc->count; i++)
+      matched += eng->match (compiled, bc->subjects[i], bc->lengths[i]);
   }
+  return matched;
+}
+
+/**
+ * @brief Benchmark one engine on one case.
+ */
+static void
+benchmark_engine (const engine *eng, const benchmark_case *bc, const benchmark_options *options,
+                  benchmark_result *result)
+{
+  memset (result, 0, sizeof (*result));
+  result->cycles_per_byte = -1;
 
-  // Enable JIT compilation
-  int jit_rc = pcre2_jit_compile (re, PCRE2_JIT_COMPLETE);
-  if (!(jit_rc == 0 || jit_rc == PCRE2_ERROR_JIT_UNSUPPORTED))
+  double compile_samples[COMPILE_RUNS];
+  void *compiled = NULL;
+  for (int i = 0; i < COMPILE_RUNS; i++)
   {
-    printf ("JIT compilation failed.\n");
-    pcre2_code_free (re);
-    return 1;
+    if (compiled)
+      eng->release (compiled);
+    double start = get_time_ns ();
+    compiled     = eng->compile (bc->pattern, result->error, sizeof (result->error));
+    double end   = get_time_ns ();
+    if (!compiled)
+      return;
+    compile_samples[i] = end - start;
   }
+  qsort (compile_samples, COMPILE_RUNS, sizeof (double), compare_doubles);
+  result->compile_ns = percentile (compile_samples, COMPILE_RUNS, 0.5);
 
-  pcre2_match_data *match_data = pcre2_match_data_create_from_pattern(re, NULL);
-
-  size_t textsize = strlen (text);
+  /* Warm-up pass to load caches, and enough passes per sample to last MIN_SAMPLE_NS */
+  result->match_count = match_passes (eng, compiled, bc, 1);
+  int passes          = 1;
+  for (;;)
+  {
+    double start = get_time_ns ();
+    match_passes (eng, compiled, bc, passes);
+    if (get_time_ns () - start >= MIN_SAMPLE_NS || passes >= (1 << 24))
+      break;
+    passes *= 2;
+  }
 
-  /* Warm-up run */
-  (void)pcre2_match (re, (PCRE2_SPTR)text, textsize, 0, 0, match_data, NULL);
+  double *samples = malloc (options->max_runs * sizeof (double));
+  double *cycles  = malloc (options->max_runs * sizeof (double));
+  double *sorted  = malloc (options->max_runs * sizeof (double));
+  if (!samples || !cycles || !sorted)
+  {
+    snprintf (result->error, sizeof (result->error), "Out of memory");
+    free (samples);
+    free (cycles);
+    free (sorted);
+    eng->release (compiled);
+    return;
+  }
 
-  start_time      = get_time_s ();
-  int match_count = 0;
-  for (int i = 0; i < iterations; i++)
+  /* Sample until the median moves less than the tolerance between checks */
+  double matches    = (double)passes * bc->count;
+  double budget_end = get_time_ns () + options->max_ns;
+  double last_median = -1;
+  int runs           = 0;
+  while (runs < options->max_runs)
   {
-    int rc = pcre2_match (re, (PCRE2_SPTR)text, textsize, 0, 0, match_data, NULL);
-    if (rc >= 0)
+    double start       = get_time_ns ();
+    uint64_t start_tsc = get_cycles ();
+    match_passes (eng, compiled, bc, passes);
+    uint64_t end_tsc = get_cycles ();
+    double end       = get_time_ns ();
+    samples[runs]    = (end - start) / matches;
+    cycles[runs]     = (double)(end_tsc - start_tsc) / matches;
+    runs++;
+
+    if (runs >= options->min_runs && runs % options->min_runs == 0)
     {
-      match_count++;
+      double median = median_of (samples, runs, sorted);
+      if (last_median > 0 && fabs (median - last_median) <= options->tolerance * last_median)
+        break;
+      last_median = median;
+      if (end > budget_end)
+        break;
     }
   }
-  end_time   = get_time_s ();
-  match_time = end_time - start_time;
 
-  printf ("Compilation time: %.6f s\n", compile_time);
-  printf ("Matching time (%d iterations): %.6f s\n", iterations, match_time);
-  printf ("Average match time: %.9f s\n", match_time / iterations);
-  printf ("Matches found: %d/%d\n", match_count, iterations);
+  memcpy (sorted, samples, runs * sizeof (double));
+  qsort (sorted, runs, sizeof (double), compare_doubles);
+  double bytes_per_match = bc->count ? (double)bc->bytes / bc->count : 0;
+  result->ran            = true;
+  result->runs           = runs;
+  result->median_ns      = percentile (sorted, runs, 0.5);
+  result->p99_ns         = percentile (sorted, runs, 0.99);
+  result->ns_per_byte    = bytes_per_match > 0 ? result->median_ns / bytes_per_match : 0;
+  if (HAVE_CYCLES && bytes_per_match > 0)
+    result->cycles_per_byte = median_of (cycles, runs, sorted) / bytes_per_match;
+
+  free (samples);
+  free (cycles);
+  free (sorted);
+  eng->release (compiled);
+}
 
-  result->compile_time = compile_time;
-  result->match_time   = match_time;
-  result->match_count  = match_count;
+// --- Output ---
 
-  pcre2_match_data_free (match_data);
-  pcre2_code_free (re);
-  return true;
-}
+typedef enum
+{
+  FORMAT_TEXT,
+  FORMAT_CSV,
+  FORMAT_JSON
+} output_format;
 
 /**
- * @brief Benchmark the system (libc) regex engine.
+ * @brief Print a string as a CSV field or JSON string, quoted and escaped.
  */
-static bool
-benchmark_system (const char *name, const char *pattern, const char *text, int iterations, benchmark_result *result)
+static void
+print_quoted (const char *s, output_format format)
 {
-  printf ("--- system (libc): %s ---\n", name);
-  double start_time, end_time, compile_time, match_time;
-  regex_t regex;
-  int reti;
-
-  start_time   = get_time_s ();
-  reti         = regcomp (&regex, pattern, REG_EXTENDED | REG_NOSUB);
-  end_time     = get_time_s ();
-  compile_time = end_time - start_time;
+  putchar ('"');
+  for (const unsigned char *p = (const unsigned char *)s; *p; p++)
+  {
+    if (format == FORMAT_CSV)
+    {
+      if (*p == '"')
+        putchar ('"');
+      putchar (*p);
+    }
+    else if (*p == '"' || *p == '\\')
+    {
+      printf ("\\%c", *p);
+    }
+    else if (*p < 0x20)
+    {
+      printf ("\\u%04x", *p);
+    }
+    else
+    {
+      putchar (*p);
+    }
+  }
+  putchar ('"');
+}
 
-  if (reti)
+/**
+ * @brief Describe the engine and prefilters vibrex matches a pattern with.
+ */
+static void
+describe_vibrex_path (const char *pattern, char *path, size_t path_size)
+{
+  vibrex_t *rex = vibrex_compile (pattern, NULL);
+  vibrex_info_t info;
+  if (!rex || !vibrex_info (rex, &info))
   {
-    char msgbuf[100];
-    regerror (reti, &regex, msgbuf, sizeof (msgbuf));
-    fprintf (stderr, "system regex compilation failed: %s\n", msgbuf);
-    result->compile_time = -1;
-    result->match_time   = -1;
-    result->match_count  = -1;
-    return false;
+    snprintf (path, path_size, "none");
+    vibrex_free (rex);
+    return;
   }
 
-  /* Warm-up run */
-  (void)regexec (&regex, text, 0, NULL, 0);
+  size_t len = snprintf (path, path_size, "%s", info.engine);
+  if (info.start_search && len < path_size)
+    len += snprintf (path + len, path_size - len, ", %s search", info.start_search);
+  if (info.required_literals && len < path_size)
+    snprintf (path + len, path_size - len, ", %zu required literal%s", info.required_literals,
+              info.required_literals == 1 ? "" : "s");
+  vibrex_free (rex);
+}
 
-  start_time      = get_time_s ();
-  int match_count = 0;
-  for (int i = 0; i < iterations; i++)
+static void
+print_result (const benchmark_case *bc, const char *path, const engine *eng, const benchmark_result *r,
+              output_format format, bool first)
+{
+  if (format == FORMAT_TEXT)
+  {
+    if (!r->ran)
+    {
+      printf ("  %-10s compile failed: %s\n", eng->name, r->error);
+      return;
+    }
+    printf ("  %-10s %12.1f %12.1f %10.3f ", eng->name, r->median_ns, r->p99_ns, r->ns_per_byte);
+    if (r->cycles_per_byte >= 0)
+      printf ("%10.3f ", r->cycles_per_byte);
+    else
+      printf ("%10s ", "-");
+    printf ("%12.1f %8zu/%-8zu %5d\n", r->compile_ns / 1e3, r->match_count, bc->count, r->runs);
+  }
+  else if (format == FORMAT_CSV)
+  {
+    print_quoted (bc->name, format);
+    putchar (',');
+    print_quoted (bc->pattern, format);
+    putchar (',');
+    print_quoted (path, format);
+    printf (",%s,%zu,%zu,", eng->name, bc->count, bc->bytes);
+    if (!r->ran)
+    {
+      printf (",,,,,,,");
+      print_quoted (r->error, format);
+      putchar ('\n');
+      return;
+    }
+    printf ("%zu,%d,%.1f,%.2f,%.2f,%.4f,", r->match_count, r->runs, r->compile_ns, r->median_ns, r->p99_ns,
+            r->ns_per_byte);
+    if (r->cycles_per_byte >= 0)
+      printf ("%.4f", r->cycles_per_byte);
+    printf (",\n");
+  }
+  else
   {
-    if (regexec (&regex, text, 0, NULL, 0) == 0)
+    printf ("%s\n      {\"engine\": \"%s\", ", first ? "" : ",", eng->name);
+    if (!r->ran)
     {
-      match_count++;
+      printf ("\"error\": ");
+      print_quoted (r->error, format);
+      printf ("}");
+      return;
     }
+    printf ("\"matches\": %zu, \"runs\": %d, \"compile_ns\": %.1f, \"median_ns\": %.2f, \"p99_ns\": %.2f, "
+            "\"ns_per_byte\": %.4f, \"cycles_per_byte\": ",
+            r->match_count, r->runs, r->compile_ns, r->median_ns, r->p99_ns, r->ns_per_byte);
+    if (r->cycles_per_byte >= 0)
+      printf ("%.4f}", r->cycles_per_byte);
+    else
+      printf ("null}");
   }
-  end_time   = get_time_s ();
-  match_time = end_time - start_time;
+}
+
+// --- Corpus files ---
 
-  printf ("Compilation time: %.6f s\n", compile_time);
-  printf ("Matching time (%d iterations): %.6f s\n", iterations, match_time);
-  printf ("Average match time: %.9f s\n", match_time / iterations);
-  printf ("Matches found: %d/%d\n", match_count, iterations);
+/**
+ * @brief Read the non-empty lines of a file, without their line endings.
+ * @return The number of lines, or -1 on error.
+ */
+static long
+read_lines (const char *path, char ***lines_out)
+{
+  FILE *file = fopen (path, "r");
+  if (!file)
+  {
+    perror (path);
+    return -1;
+  }
 
-  result->compile_time = compile_time;
-  result->match_time   = match_time;
-  result->match_count  = match_count;
+  char **lines    = NULL;
+  long count      = 0;
+  long capacity   = 0;
+  char *line      = NULL;
+  size_t line_cap = 0;
+  ssize_t len;
+  while ((len = getline (&line, &line_cap, file)) >= 0)
+  {
+    while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+      line[--len] = '\0';
+    if (len == 0)
+      continue;
+    if (count == capacity)
+    {
+      capacity     = capacity ? capacity * 2 : 256;
+      char **grown = realloc (lines, capacity * sizeof (char *));
+      if (!grown)
+      {
+        fprintf (stderr, "Out of memory reading %s\n", path);
+        count = -1;
+        break;
+      }
+      lines = grown;
+    }
+    lines[count++] = line;
+    line           = NULL;
+    line_cap       = 0;
+  }
+  free (line);
+  fclose (file);
+  *lines_out = lines;
+  return count;
+}
 
-  regfree (&regex);
-  return true;
+/**
+ * @brief Strip the expected match status of a vibrex-compare pattern line.
+ */
+static const char *
+strip_status (const char *line)
+{
+  const char *statuses[] = {"MATCH_TRUE ", "MATCH_FALSE ", "MATCH_UNSET "};
+  for (size_t i = 0; i < sizeof (statuses) / sizeof (statuses[0]); i++)
+  {
+    size_t len = strlen (statuses[i]);
+    if (strncmp (line, statuses[i], len) == 0)
+    {
+      line += len;
+      while (*line == ' ' || *line == '\t')
+        line++;
+      return line;
+    }
+  }
+  return line;
 }
 
 static void
 print_usage (const char *prog_name)
 {
-  printf ("Usage: %s [options] [iterations]\n\n", prog_name);
+  printf ("Usage: %s [options]\n\n", prog_name);
   printf ("A performance benchmark for vibrex, comparing it to PCRE2 and the system regex library.\n\n");
   printf ("Options:\n");
-  printf ("  --no-system    Do not run benchmarks against the system (libc) regex library.\n");
-  printf ("  -h, --help     Display this help message and exit.\n\n");
-  printf ("Arguments:\n");
-  printf ("  iterations     Number of matching iterations for each test. Defaults to 100000.\n");
+  printf ("  --patterns FILE   Patterns to benchmark, one per line, optionally prefixed with a\n");
+  printf ("                    vibrex-compare status (MATCH_TRUE, MATCH_FALSE or MATCH_UNSET).\n");
+  printf ("  --subjects FILE   Subjects every pattern is matched against, one per line.\n");
+  printf ("                    Without corpus files the built-in cases are run.\n");
+  printf ("  --format FORMAT   Output format: text (default), csv or json.\n");
+  printf ("  --min-runs N      Samples taken between stability checks. Defaults to 10.\n");
+  printf ("  --max-runs N      Most samples per case and engine. Defaults to 1000.\n");
+  printf ("  --tolerance PCT   Change of the median between checks that counts as stable.\n");
+  printf ("                    Defaults to 1.\n");
+  printf ("  --max-time SEC    Time budget per case and engine. Defaults to 2.\n");
+  printf ("  --no-system       Do not run benchmarks against the system (libc) regex library.\n");
+  printf ("  -h, --help        Display this help message and exit.\n");
 }
 
 // --- Test Cases ---
@@ -302,13 +624,13 @@ typedef struct
   const char *name;
   const char *pattern;
   const char *text;
-} benchmark_case;
+} builtin_case;
 
 /* A long string of text for searching */
-static const char *long_text = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum. The quick brown fox jumps over the lazy dog.";
+static const char long_text[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore et dolore magna aliqua. Ut enim ad minim veniam, quis nostrud exercitation ullamco laboris nisi ut aliquip ex ea commodo consequat. Duis aute irure dolor in reprehenderit in voluptate velit esse cillum dolore eu fugiat nulla pariatur. Excepteur sint occaecat cupidatat non proident, sunt in culpa qui officia deserunt mollit anim id est laborum. The quick brown fox jumps over the lazy dog.";
 
 /* Special case: many alternations, all start anchored and some containing '.*' */
-static const char *many_alts_pattern =
+static const char many_alts_pattern[] =
     "FDSN:NET_STA_LOC_L_H_N/MSEED3?$|"
     "FDSN:NET_STA_LOC_L_H_E/MSEED3?$|"
     "FDSN:NET_STA_LOC_L_H_Z/MSEED3?$|"
@@ -322,261 +644,304 @@ static const char *many_alts_pattern =
     "FDSN:NET_STA2__.*_.*_Z/MSEED3?$|"
     "FDSN:NET_STA3__.*_.*_Z/MSEED3?$";
 
-static const char *many_alts_text_first   = "FDSN:NET_STA_LOC_L_H_N/MSEED";
-static const char *many_alts_text_last    = "FDSN:NET_STA3__C_H_A/MSEED3";
-static const char *many_alts_text_nomatch = "The quick brown fox jumps over the lazy cat.";
+static const char many_alts_text_first[]   = "FDSN:NET_STA_LOC_L_H_N/MSEED";
+static const char many_alts_text_last[]    = "FDSN:NET_STA3__C_H_A/MSEED3";
+static const char many_alts_text_nomatch[] = "The quick brown fox jumps over the lazy cat.";
 
 /* Additional test texts */
-static const char *numeric_text          = "12345 67890 abc123def 456ghi789 000111222333444555666777888999";
-static const char *mixed_case_text       = "HelloWorld FDSN:TestStation_01_BHZ ThisIsATest";
-static const char *special_chars_text    = "test@example.com http://www.test.org/path?param=value 192.168.1.1";
-static const char *repeated_pattern_text = "aaaaaaaaaabbbbbbbbbbccccccccccddddddddddeeeeeeeeee";
-static const char *very_long_text        = "This is a very long string that contains many words and should test the performance of regex engines when dealing with longer input texts. It contains various patterns including numbers like 12345, special characters like @#$%, and repeating sections like abcdefgh abcdefgh abcdefgh. The purpose is to see how well different regex engines handle longer input when searching for patterns that may or may not exist within the text.";
+static const char numeric_text[]          = "12345 67890 abc123def 456ghi789 000111222333444555666777888999";
+static const char mixed_case_text[]       = "HelloWorld FDSN:TestStation_01_BHZ ThisIsATest";
+static const char special_chars_text[]    = "test@example.com http://www.test.org/path?param=value 192.168.1.1";
+static const char repeated_pattern_text[] = "aaaaaaaaaabbbbbbbbbbccccccccccddddddddddeeeeeeeeee";
+static const char very_long_text[]        = "This is a very long string that contains many words and should test the performance of regex engines when dealing with longer input texts. It contains various patterns including numbers like 12345, special characters like @#$%, and repeating sections like abcdefgh abcdefgh abcdefgh. The purpose is to see how well different regex engines handle longer input when searching for patterns that may or may not exist within the text.";
+
+static const builtin_case builtin_cases[] = {
+    // Basic literal matching
+    {"Simple literal match", "brown", long_text},
+    {"Simple literal no match", "blue", long_text},
+
+    // Quantifiers and wildcards
+    {"Dot star", "quis.*laboris", long_text},
+    {"Greedy plus quantifier", "a+", repeated_pattern_text},
+    {"Optional quantifier", "colou?r", "The color and colour are both valid"},
+
+    // Character classes
+    {"Character class", "[a-z]+", "abcdefghijklmnopqrstuvwxyz"},
+    {"Negated character class", "[^0-9]+", numeric_text},
+    {"Complex character class", "[a-zA-Z0-9_.-]+", special_chars_text},
+
+    // Anchoring
+    {"Anchored start", "^Lorem", long_text},
+    {"Anchored end", "dog.$", long_text},
+    {"Both anchors", "^This.*text.$", very_long_text},
+
+    // Alternations
+    {"Alternation match", "fox|dog|cat", long_text},
+    {"Alternation no match", "bird|fish|cow", long_text},
+    {"Nested alternation", "(cat|dog)|(bird|fish)", "I saw a cat today"},
+
+    // Performance stress tests
+    {"End of long text match", "text\\.$", very_long_text},
+    {"Multiple matches in long text", "a", very_long_text},
+
+    // Real-world patterns
+    {"Email pattern", "[a-zA-Z0-9._%+-]+@[a-zA-Z0-9.-]+\\.[a-zA-Z]+", special_chars_text},
+    {"URL pattern", "https?://[a-zA-Z0-9.-]+", special_chars_text},
+
+    // Edge cases
+    {"Multiple consecutive wildcards", "a.*b.*c", "axbxc and axxxbxxxcxxx"},
+    {"Escaped special chars", "\\[\\]\\(\\)\\{\\}\\*\\+\\?", "[](){}*+?"},
+    {"Long literal", "abcdefghijklmnopqrstuvwxyz", "The alphabet: abcdefghijklmnopqrstuvwxyz is here"},
+
+    // FDSN benchmark tests
+    {"FDSN station code", "FDSN:[A-Z0-9]+_[A-Z0-9]+_[A-Z0-9]*_[A-Z0-9]+_[A-Z]+_[A-Z]/MSEED3?", mixed_case_text},
+    {"Many alts, first match", many_alts_pattern, many_alts_text_first},
+    {"Many alts, last match", many_alts_pattern, many_alts_text_last},
+    {"Many alts, no match", many_alts_pattern, many_alts_text_nomatch},
+};
 
 int
 main (int argc, char *argv[])
 {
-  int iterations        = 100000;
-  bool run_system_tests = true;
+  benchmark_options options = {.min_runs = 10, .max_runs = 1000, .tolerance = 0.01, .max_ns = 2e9};
+  output_format format      = FORMAT_TEXT;
+  bool run_system_tests     = true;
+  const char *pattern_file  = NULL;
+  const char *subject_file  = NULL;
 
   for (int i = 1; i < argc; i++)
   {
+    bool has_value = i + 1 < argc;
     if (strcmp (argv[i], "--no-system") == 0)
     {
       run_system_tests = false;
     }
+    else if (strcmp (argv[i], "--patterns") == 0 && has_value)
+    {
+      pattern_file = argv[++i];
+    }
+    else if (strcmp (argv[i], "--subjects") == 0 && has_value)
+    {
+      subject_file = argv[++i];
+    }
+    else if (strcmp (argv[i], "--format") == 0 && has_value)
+    {
+      const char *name = argv[++i];
+      if (strcmp (name, "text") == 0)
+        format = FORMAT_TEXT;
+      else if (strcmp (name, "csv") == 0)
+        format = FORMAT_CSV;
+      else if (strcmp (name, "json") == 0)
+        format = FORMAT_JSON;
+      else
+      {
+        fprintf (stderr, "Unknown format: %s\n", name);
+        return 1;
+      }
+    }
+    else if (strcmp (argv[i], "--min-runs") == 0 && has_value)
+    {
+      options.min_runs = atoi (argv[++i]);
+    }
+    else if (strcmp (argv[i], "--max-runs") == 0 && has_value)
+    {
+      options.max_runs = atoi (argv[++i]);
+    }
+    else if (strcmp (argv[i], "--tolerance") == 0 && has_value)
+    {
+      options.tolerance = atof (argv[++i]) / 100.0;
+    }
+    else if (strcmp (argv[i], "--max-time") == 0 && has_value)
+    {
+      options.max_ns = atof (argv[++i]) * 1e9;
+    }
     else if (strcmp (argv[i], "-h") == 0 || strcmp (argv[i], "--help") == 0)
     {
       print_usage (argv[0]);
       return 0;
     }
-    else if (atoi (argv[i]) > 0)
+    else
     {
-      iterations = atoi (argv[i]);
+      fprintf (stderr, "Unrecognized argument: %s\n", argv[i]);
+      print_usage (argv[0]);
+      return 1;
     }
   }
 
-  benchmark_case tests[] = {
-      // Basic literal matching
-      {"Simple literal match", "brown", long_text},
-      {"Simple literal no match", "blue", long_text},
-
-      // Quantifiers and wildcards
-      {"Dot star", "quis.*laboris", long_text},
-      {"Greedy plus quantifier", "a+", repeated_pattern_text},
-      {"Optional quantifier", "colou?r", "The color and colour are both valid"},
-
-      // Character classes
-      {"Character class", "[a-z]+", "abcdefghijklmnopqrstuvwxyz"},
-      {"Negated character class", "[^0-9]+", numeric_text},
-      {"Complex character class", "[a-zA-Z0-9_.-]+", special_chars_text},
-
-      // Anchoring
-      {"Anchored start", "^Lorem", long_text},
-      {"Anchored end", "dog.$", long_text},
-      {"Both anchors", "^This.*text.$", very_long_text},
-
-      // Alternations
-      {"Alternation match", "fox|dog|cat", long_text},
-      {"Alternation no match", "bird|fish|cow", long_text},
-      {"Nested alternation", "(cat|dog)|(bird|fish)", "I saw a cat today"},
-
-      // Performance stress tests
-      {"End of long text match", "text\\.$", very_long_text},
-      {"Multiple matches in long text", "a", very_long_text},
-
-      // Real-world patterns
-      {"Email pattern", "[a-zA-Z0-9._%+-]+@[a-zA-Z0-9.-]+\\.[a-zA-Z]+", special_chars_text},
-      {"URL pattern", "https?://[a-zA-Z0-9.-]+", special_chars_text},
-
-      // Edge cases
-      {"Multiple consecutive wildcards", "a.*b.*c", "axbxc and axxxbxxxcxxx"},
-      {"Escaped special chars", "\\[\\]\\(\\)\\{\\}\\*\\+\\?", "[](){}*+?"},
-      {"Long literal", "abcdefghijklmnopqrstuvwxyz", "The alphabet: abcdefghijklmnopqrstuvwxyz is here"},
-
-      // FDSN benchmark tests
-      {"FDSN station code", "FDSN:[A-Z0-9]+_[A-Z0-9]+_[A-Z0-9]*_[A-Z0-9]+_[A-Z]+_[A-Z]/MSEED3?", mixed_case_text},
-      {"Many alts, first match", many_alts_pattern, many_alts_text_first},
-      {"Many alts, last match", many_alts_pattern, many_alts_text_last},
-      {"Many alts, no match", many_alts_pattern, many_alts_text_nomatch},
-  };
-
-  int num_tests = sizeof (tests) / sizeof (tests[0]);
-
-  benchmark_result vibrex_results[num_tests];
-  benchmark_result pcre2_results[num_tests];
-  benchmark_result pcre2_jit_results[num_tests];
-  benchmark_result system_results[num_tests];
-
-  printf ("Running benchmarks with %d iterations per test.\n", iterations);
-
-  for (int i = 0; i < num_tests; i++)
+  if (options.min_runs < 1 || options.max_runs < options.min_runs)
   {
-    printf ("\n======================================================\n");
-    printf ("Benchmark: %s\n", tests[i].name);
-    if (strlen(tests[i].pattern) > 45)
-      printf ("Pattern: '%.45s...'\n", tests[i].pattern);
-    else
-      printf ("Pattern: '%s'\n", tests[i].pattern);
-    if (strlen(tests[i].text) > 70)
-      printf ("Text: '%.70s...'\n", tests[i].text);
-    else
-      printf ("Text: '%s'\n", tests[i].text);
-    printf ("------------------------------------------------------\n");
-    benchmark_vibrex (tests[i].name, tests[i].pattern, tests[i].text, iterations, &vibrex_results[i]);
-    printf ("\n");
-    benchmark_pcre2 (tests[i].name, tests[i].pattern, tests[i].text, iterations, &pcre2_results[i]);
-    printf ("\n");
-    benchmark_pcre2_jit (tests[i].name, tests[i].pattern, tests[i].text, iterations, &pcre2_jit_results[i]);
-    if (run_system_tests)
-    {
-      printf ("\n");
-      benchmark_system (tests[i].name, tests[i].pattern, tests[i].text, iterations, &system_results[i]);
-    }
+    fprintf (stderr, "--min-runs must be at least 1 and no more than --max-runs\n");
+    return 1;
+  }
+  if (!pattern_file != !subject_file)
+  {
+    fprintf (stderr, "--patterns and --subjects must be given together\n");
+    return 1;
+  }
 
-    // Check if match counts differ between engines
-    bool match_count_error = false;
-    if (vibrex_results[i].match_count >= 0 && pcre2_results[i].match_count >= 0)
-    {
-      if (vibrex_results[i].match_count != pcre2_results[i].match_count)
-      {
-        printf ("\nERROR: Match count mismatch between Vibrex (%d) and PCRE2 (%d)!\n",
-                vibrex_results[i].match_count, pcre2_results[i].match_count);
-        match_count_error = true;
-      }
-    }
-    if (vibrex_results[i].match_count >= 0 && pcre2_jit_results[i].match_count >= 0)
+  // Cases from the corpus files, every pattern against all subjects, or the built-in ones
+  benchmark_case *cases = NULL;
+  size_t num_cases      = 0;
+  char **patterns       = NULL;
+  char **subjects       = NULL;
+  long num_patterns     = 0;
+  long num_subjects     = 0;
+  size_t *lengths       = NULL;
+  if (pattern_file)
+  {
+    num_patterns = read_lines (pattern_file, &patterns);
+    num_subjects = read_lines (subject_file, &subjects);
+    if (num_patterns <= 0 || num_subjects <= 0)
     {
-      if (vibrex_results[i].match_count != pcre2_jit_results[i].match_count)
-      {
-        printf ("\nERROR: Match count mismatch between Vibrex (%d) and PCRE2-JIT (%d)!\n",
-                vibrex_results[i].match_count, pcre2_jit_results[i].match_count);
-        match_count_error = true;
-      }
+      fprintf (stderr, "Pattern and subject files must each have at least one line\n");
+      return 1;
     }
-    if (pcre2_results[i].match_count >= 0 && pcre2_jit_results[i].match_count >= 0)
+    lengths = malloc (num_subjects * sizeof (size_t));
+    cases   = calloc (num_patterns, sizeof (benchmark_case));
+    if (!lengths || !cases)
     {
-      if (pcre2_results[i].match_count != pcre2_jit_results[i].match_count)
-      {
-        printf ("\nERROR: Match count mismatch between PCRE2 (%d) and PCRE2-JIT (%d)!\n",
-                pcre2_results[i].match_count, pcre2_jit_results[i].match_count);
-        match_count_error = true;
-      }
+      fprintf (stderr, "Out of memory\n");
+      return 1;
     }
-    if (run_system_tests && vibrex_results[i].match_count >= 0 && system_results[i].match_count >= 0)
+    size_t bytes = 0;
+    for (long i = 0; i < num_subjects; i++)
     {
-      if (vibrex_results[i].match_count != system_results[i].match_count)
-      {
-        printf ("\nERROR: Match count mismatch between Vibrex (%d) and system (%d)!\n",
-                vibrex_results[i].match_count, system_results[i].match_count);
-        match_count_error = true;
-      }
+      lengths[i] = strlen (subjects[i]);
+      bytes += lengths[i];
     }
-    if (run_system_tests && pcre2_results[i].match_count >= 0 && system_results[i].match_count >= 0)
+    for (long i = 0; i < num_patterns; i++)
     {
-      if (pcre2_results[i].match_count != system_results[i].match_count)
-      {
-        printf ("\nERROR: Match count mismatch between PCRE2 (%d) and system (%d)!\n",
-                pcre2_results[i].match_count, system_results[i].match_count);
-        match_count_error = true;
-      }
+      const char *pattern = strip_status (patterns[i]);
+      cases[num_cases++]  = (benchmark_case){pattern, pattern, (const char *const *)subjects, lengths, num_subjects, bytes};
     }
-    if (run_system_tests && pcre2_jit_results[i].match_count >= 0 && system_results[i].match_count >= 0)
+  }
+  else
+  {
+    num_cases = sizeof (builtin_cases) / sizeof (builtin_cases[0]);
+    cases     = calloc (num_cases, sizeof (benchmark_case));
+    lengths   = malloc (num_cases * sizeof (size_t));
+    if (!cases || !lengths)
     {
-      if (pcre2_jit_results[i].match_count != system_results[i].match_count)
-      {
-        printf ("\nERROR: Match count mismatch between PCRE2-JIT (%d) and system (%d)!\n",
-                pcre2_jit_results[i].match_count, system_results[i].match_count);
-        match_count_error = true;
-      }
+      fprintf (stderr, "Out of memory\n");
+      return 1;
     }
-
-    if (match_count_error)
+    for (size_t i = 0; i < num_cases; i++)
     {
-      printf ("BENCHMARK FAILED: Engines produced different match counts for test '%s'\n", tests[i].name);
-      printf ("This indicates a correctness issue with one or more regex engines.\n");
-      return 1;
+      lengths[i] = strlen (builtin_cases[i].text);
+      cases[i]   = (benchmark_case){builtin_cases[i].name, builtin_cases[i].pattern, &builtin_cases[i].text,
+                                    &lengths[i], 1, lengths[i]};
     }
   }
 
-  printf ("\n======================================================\n");
-  printf ("Benchmark finished.\n");
+  size_t num_engines = run_system_tests ? NUM_ENGINES : SYSTEM_ENGINE;
+  benchmark_result results[NUM_ENGINES];
+  double total_compile[NUM_ENGINES] = {0};
+  double total_match[NUM_ENGINES]   = {0};
+  int mismatches                    = 0;
 
-  // --- Summary ---
-  double vibrex_total_compile = 0, vibrex_total_match = 0;
-  double pcre2_total_compile = 0, pcre2_total_match = 0;
-  double pcre2_jit_total_compile = 0, pcre2_jit_total_match = 0;
-  double system_total_compile = 0, system_total_match = 0;
-
-  for (int i = 0; i < num_tests; i++)
+  if (format == FORMAT_TEXT)
+  {
+    printf ("Running %zu benchmarks, sampling until the median settles within %.2f%%.\n", num_cases,
+            options.tolerance * 100);
+  }
+  else if (format == FORMAT_CSV)
+  {
+    printf ("case,pattern,vibrex_path,engine,subjects,bytes,matches,runs,compile_ns,median_ns,p99_ns,ns_per_byte,"
+            "cycles_per_byte,error\n");
+  }
+  else
   {
-    if (vibrex_results[i].compile_time >= 0)
-      vibrex_total_compile += vibrex_results[i].compile_time;
-    if (vibrex_results[i].match_time >= 0)
-      vibrex_total_match += vibrex_results[i].match_time;
+    printf ("{\"cases\": [");
+  }
 
-    if (pcre2_results[i].compile_time >= 0)
-      pcre2_total_compile += pcre2_results[i].compile_time;
-    if (pcre2_results[i].match_time >= 0)
-      pcre2_total_match += pcre2_results[i].match_time;
+  for (size_t c = 0; c < num_cases; c++)
+  {
+    const benchmark_case *bc = &cases[c];
+    char path[128];
+    describe_vibrex_path (bc->pattern, path, sizeof (path));
+    if (format == FORMAT_TEXT)
+    {
+      printf ("\n%s\n", bc->name);
+      if (strlen (bc->pattern) > 60)
+        printf ("Pattern: '%.60s...'\n", bc->pattern);
+      else
+        printf ("Pattern: '%s'\n", bc->pattern);
+      printf ("Subjects: %zu, %zu bytes\n", bc->count, bc->bytes);
+      printf ("Vibrex path: %s\n", path);
+      printf ("  %-10s %12s %12s %10s %10s %12s %17s %5s\n", "Engine", "Median (ns)", "p99 (ns)", "ns/byte",
+              "cyc/byte", "Compile (us)", "Matches", "Runs");
+    }
+    else if (format == FORMAT_JSON)
+    {
+      printf ("%s\n  {\"case\": ", c ? "," : "");
+      print_quoted (bc->name, format);
+      printf (", \"pattern\": ");
+      print_quoted (bc->pattern, format);
+      printf (", \"vibrex_path\": ");
+      print_quoted (path, format);
+      printf (", \"subjects\": %zu, \"bytes\": %zu, \"results\": [", bc->count, bc->bytes);
+    }
 
-    if (pcre2_jit_results[i].compile_time >= 0)
-      pcre2_jit_total_compile += pcre2_jit_results[i].compile_time;
-    if (pcre2_jit_results[i].match_time >= 0)
-      pcre2_jit_total_match += pcre2_jit_results[i].match_time;
+    for (size_t e = 0; e < num_engines; e++)
+    {
+      benchmark_engine (&engines[e], bc, &options, &results[e]);
+      print_result (bc, path, &engines[e], &results[e], format, e == 0);
+      if (results[e].ran)
+      {
+        total_compile[e] += results[e].compile_ns;
+        total_match[e] += results[e].median_ns * bc->count;
+      }
+    }
+    if (format == FORMAT_JSON)
+      printf ("]}");
 
-    if (run_system_tests)
+    // Engines that ran must agree on the number of subjects matched
+    for (size_t e = 1; e < num_engines; e++)
     {
-      if (system_results[i].compile_time >= 0)
-        system_total_compile += system_results[i].compile_time;
-      if (system_results[i].match_time >= 0)
-        system_total_match += system_results[i].match_time;
+      if (results[0].ran && results[e].ran && results[0].match_count != results[e].match_count)
+      {
+        fprintf (stderr, "ERROR: Match count mismatch between %s (%zu) and %s (%zu) for '%s'\n", engines[0].name,
+                 results[0].match_count, engines[e].name, results[e].match_count, bc->name);
+        mismatches++;
+      }
     }
   }
 
-  double vibrex_total = vibrex_total_compile + vibrex_total_match;
-  double pcre2_total  = pcre2_total_compile + pcre2_total_match;
-  double pcre2_jit_total = pcre2_jit_total_compile + pcre2_jit_total_match;
-  double system_total = system_total_compile + system_total_match;
-
-  printf ("\n======================================================\n");
-  printf ("Benchmark Summary (Total Times for %d iterations per test)\n", iterations);
-  printf ("------------------------------------------------------\n");
-  printf ("%-10s | %-15s | %-15s | %-15s\n", "Engine", "Compile Time (s)", "Match Time (s)", "Total Time (s)");
-  printf ("-----------|-----------------|-----------------|-----------------\n");
-  printf ("%-10s | %-15.6f | %-15.6f | %-15.6f\n", "Vibrex", vibrex_total_compile, vibrex_total_match, vibrex_total);
-  printf ("%-10s | %-15.6f | %-15.6f | %-15.6f\n", "PCRE2", pcre2_total_compile, pcre2_total_match, pcre2_total);
-  printf ("%-10s | %-15.6f | %-15.6f | %-15.6f\n", "PCRE2-JIT", pcre2_jit_total_compile, pcre2_jit_total_match, pcre2_jit_total);
-  if (run_system_tests)
+  if (format == FORMAT_JSON)
   {
-    printf ("%-10s | %-15.6f | %-15.6f | %-15.6f\n", "system", system_total_compile, system_total_match, system_total);
+    printf ("\n]}\n");
   }
-
-  if (run_system_tests)
+  else if (format == FORMAT_TEXT)
   {
-    printf ("\nRelative Performance (higher is better, system = 1.00x)\n");
+    // --- Summary ---
+    size_t baseline = run_system_tests ? SYSTEM_ENGINE : 1;
+    printf ("\n======================================================\n");
+    printf ("Benchmark Summary (sum over cases of median times for one pass over the subjects)\n");
     printf ("------------------------------------------------------\n");
-    printf ("%-10s | %-15s | %-15s | %-15s\n", "Engine", "Compile Speed", "Match Speed", "Overall Speed");
-    printf ("-----------|-----------------|-----------------|-----------------\n");
-
-    if (vibrex_total_compile > 0)
-      printf ("%-10s | %-15.2fx | %-15.2fx | %-15.2fx\n", "Vibrex", system_total_compile / vibrex_total_compile, system_total_match / vibrex_total_match, system_total / vibrex_total);
-    else
-      printf ("%-10s | %-15s | %-15.2fx | %-15.2fx\n", "Vibrex", "N/A", system_total_match / vibrex_total_match, system_total / vibrex_total);
-
-    if (pcre2_total_compile > 0)
-      printf ("%-10s | %-15.2fx | %-15.2fx | %-15.2fx\n", "PCRE2", system_total_compile / pcre2_total_compile, system_total_match / pcre2_total_match, system_total / pcre2_total);
-    else
-      printf ("%-10s | %-15s | %-15.2fx | %-15.2fx\n", "PCRE2", "N/A", system_total_match / pcre2_total_match, system_total / pcre2_total);
-
-    if (pcre2_jit_total_compile > 0)
-      printf ("%-10s | %-15.2fx | %-15.2fx | %-15.2fx\n", "PCRE2-JIT", system_total_compile / pcre2_jit_total_compile, system_total_match / pcre2_jit_total_match, system_total / pcre2_jit_total);
-    else
-      printf ("%-10s | %-15s | %-15.2fx | %-15.2fx\n", "PCRE2-JIT", "N/A", system_total_match / pcre2_jit_total_match, system_total / pcre2_jit_total);
+    printf ("%-10s | %-16s | %-15s | %s\n", "Engine", "Compile (us)", "Match (us)", "Relative Speed");
+    printf ("-----------|------------------|-----------------|-----------------\n");
+    for (size_t e = 0; e < num_engines; e++)
+    {
+      printf ("%-10s | %-16.1f | %-15.3f | %.2fx\n", engines[e].name, total_compile[e] / 1e3, total_match[e] / 1e3,
+              total_match[e] > 0 ? total_match[baseline] / total_match[e] : 0.0);
+    }
+    printf ("(Relative match speed, higher is better, %s = 1.00x)\n", engines[baseline].name);
+    printf ("======================================================\n");
+  }
 
-    printf ("%-10s | %-15.2fx | %-15.2fx | %-15.2fx\n", "system", 1.00, 1.00, 1.00);
+  if (mismatches)
+  {
+    fprintf (stderr, "BENCHMARK FAILED: Engines produced different match counts in %d cases\n", mismatches);
+    fprintf (stderr, "This indicates a correctness issue with one or more regex engines.\n");
   }
-  printf ("======================================================\n");
 
-  return 0;
-}
\ No newline at end of file
+  for (long i = 0; i < num_patterns; i++)
+    free (patterns[i]);
+  for (long i = 0; i < num_subjects; i++)
+    free (subjects[i]);
+  free (patterns);
+  free (subjects);
+  free (lengths);
+  free (cases);
+  return mismatches ? 1 : 0;
+}
@@ -2,42 +2,363 @@
  * A simple command-line tool to demonstrate the usage of the vibrex
  * regular expression library.
  *
- * It takes two arguments:
- * 1. A regular expression pattern.
- * 2. A string to match against the pattern.
+ * Given a pattern and a string, the program compiles the pattern, performs
+ * the match, and reports the result (Matched or Not Matched) along with the
+ * time taken for the matching operation.
  *
- * The program compiles the pattern, performs the match, and reports
- * the result (Matched or Not Matched) along with the time taken for
- * the matching operation.
+ * Given a pattern and a file with -f, the program matches every line of the
+ * file and prints the matching lines, or their count with -c, like grep.
+ * Regular files are mapped into memory and may be split across threads
+ * with -t, other input such as a pipe is read in blocks.  The number of
+ * lines, matches and the throughput are reported on standard error.
+ *
+ * The exit status is 0 if anything matched, 1 if nothing did and 2 on
+ * errors.
  *
  * Usage: ./vibrex-cli <pattern> <string>
+ *        ./vibrex-cli [-c] [-t threads] -f <file> <pattern>
  *********************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include "vibrex.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
+#include <unistd.h>
+
+#define READ_BLOCK_SIZE (1 << 20) // Bytes read at a time from input that cannot be mapped
+#define MAX_THREADS 256
+
+// Lines of a file matched by one thread
+typedef struct
+{
+  const vibrex_t *pattern; // Compiled pattern shared by all threads
+  const char *start;       // First line of this thread's range
+  const char *end;         // End of this thread's range, just after a newline or at the end of the file
+  bool count_only;         // Count matches without recording them
+  size_t lines;            // Lines in the range
+  size_t matched;          // Matching lines in the range
+  size_t *offsets;         // Offset of each matching line from start
+  size_t capacity;         // Offsets allocated
+  bool failed;             // Ran out of memory
+} LineRange;
+
+static double
+elapsed_seconds (const struct timespec *start, const struct timespec *end)
+{
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+// Length of the line at p, not counting its newline
+static size_t
+line_length (const char *p, const char *end)
+{
+  const char *newline = memchr (p, '\n', end - p);
+  return newline ? (size_t)(newline - p) : (size_t)(end - p);
+}
+
+// Match every line of a range with the thread's own scratch space
+static void *
+match_range (void *arg)
+{
+  LineRange *range          = arg;
+  vibrex_scratch_t *scratch = vibrex_scratch_create (range->pattern);
+  if (!scratch)
+  {
+    range->failed = true;
+    return NULL;
+  }
+
+  for (const char *p = range->start; p < range->end;)
+  {
+    size_t len = line_length (p, range->end);
+    range->lines++;
+    if (vibrex_match_scratch_n (range->pattern, scratch, p, len))
+    {
+      if (!range->count_only)
+      {
+        if (range->matched == range->capacity)
+        {
+          size_t new_capacity = range->capacity ? range->capacity * 2 : 1024;
+          size_t *grown       = realloc (range->offsets, new_capacity * sizeof (size_t));
+          if (!grown)
+          {
+            range->failed = true;
+            break;
+          }
+          range->offsets  = grown;
+          range->capacity = new_capacity;
+        }
+        range->offsets[range->matched] = p - range->start;
+      }
+      range->matched++;
+    }
+    p += len + 1;
+  }
+
+  vibrex_scratch_free (scratch);
+  return NULL;
+}
+
+// Match the lines of a mapped file, split at line boundaries across threads
+static int
+grep_mapped (const vibrex_t *pattern, const char *data, size_t size, int nthreads, bool count_only, size_t *lines,
+             size_t *matched)
+{
+  LineRange ranges[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  const char *end = data + size;
+  const char *p   = data;
+
+  // Lines are much shorter than the ranges, so a range that would start
+  // past the end of the file is just left empty
+  for (int t = 0; t < nthreads; t++)
+  {
+    const char *range_end = end;
+    if (t < nthreads - 1 && (size_t)(end - p) > size / nthreads)
+    {
+      range_end = p + size / nthreads;
+      const char *newline = memchr (range_end, '\n', end - range_end);
+      range_end           = newline ? newline + 1 : end;
+    }
+    ranges[t] = (LineRange){.pattern = pattern, .start = p, .end = range_end, .count_only = count_only};
+    p         = range_end;
+  }
+
+  int started = 0;
+  for (; started < nthreads - 1; started++)
+  {
+    if (pthread_create (&threads[started], NULL, match_range, &ranges[started]) != 0)
+      break;
+  }
+  // The calling thread matches the last range, and any whose thread did not start
+  for (int t = started; t < nthreads; t++)
+    match_range (&ranges[t]);
+  for (int t = 0; t < started; t++)
+    pthread_join (threads[t], NULL);
+
+  int status = 0;
+  *lines     = 0;
+  *matched   = 0;
+  for (int t = 0; t < nthreads; t++)
+  {
+    const LineRange *range = &ranges[t];
+    if (range->failed)
+      status = -1;
+    *lines += range->lines;
+    *matched += range->matched;
+    for (size_t i = 0; !count_only && !range->failed && i < range->matched; i++)
+    {
+      const char *line = range->start + range->offsets[i];
+      fwrite (line, 1, line_length (line, range->end), stdout);
+      fputc ('\n', stdout);
+    }
+    free (range->offsets);
+  }
+  return status;
+}
+
+// Match the lines of input that cannot be mapped, read in blocks
+static int
+grep_stream (const vibrex_t *pattern, int fd, bool count_only, size_t *lines, size_t *matched, size_t *bytes)
+{
+  vibrex_scratch_t *scratch = vibrex_scratch_create (pattern);
+  size_t capacity           = READ_BLOCK_SIZE;
+  char *buffer              = malloc (capacity);
+  size_t used               = 0;
+  bool eof                  = false;
+  int status                = 0;
+  if (!scratch || !buffer)
+    status = -1;
+
+  *lines   = 0;
+  *matched = 0;
+  *bytes   = 0;
+  while (status == 0 && !eof)
+  {
+    // A line longer than the buffer doubles it
+    if (used == capacity)
+    {
+      char *grown = realloc (buffer, capacity * 2);
+      if (!grown)
+      {
+        status = -1;
+        break;
+      }
+      buffer = grown;
+      capacity *= 2;
+    }
+
+    ssize_t got = read (fd, buffer + used, capacity - used);
+    if (got < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      status = -1;
+      break;
+    }
+    eof = (got == 0);
+    used += got;
+    *bytes += got;
+
+    // Match the complete lines, keeping a partial last line for the next read
+    const char *p   = buffer;
+    const char *end = buffer + used;
+    for (;;)
+    {
+      const char *newline = memchr (p, '\n', end - p);
+      if (!newline && (!eof || p == end))
+        break;
+      size_t len = newline ? (size_t)(newline - p) : (size_t)(end - p);
+      (*lines)++;
+      if (vibrex_match_scratch_n (pattern, scratch, p, len))
+      {
+        (*matched)++;
+        if (!count_only)
+        {
+          fwrite (p, 1, len, stdout);
+          fputc ('\n', stdout);
+        }
+      }
+      p += len + (newline ? 1 : 0);
+    }
+    used = end - p;
+    memmove (buffer, p, used);
+  }
+
+  free (buffer);
+  vibrex_scratch_free (scratch);
+  return status;
+}
+
+// Match every line of a file and report the matches and throughput
+static int
+grep_file (const vibrex_t *pattern, const char *path, int nthreads, bool count_only)
+{
+  int fd = strcmp (path, "-") == 0 ? STDIN_FILENO : open (path, O_RDONLY);
+  if (fd < 0)
+  {
+    fprintf (stderr, "Error opening %s: %s\n", path, strerror (errno));
+    return 2;
+  }
+
+  struct timespec start, end;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  size_t lines   = 0;
+  size_t matched = 0;
+  size_t bytes   = 0;
+  int status;
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat (fd, &st) == 0 && S_ISREG (st.st_mode) && st.st_size > 0)
+    data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data != MAP_FAILED)
+  {
+    bytes  = st.st_size;
+    status = grep_mapped (pattern, data, bytes, nthreads, count_only, &lines, &matched);
+    munmap (data, st.st_size);
+  }
+  else
+  {
+    status = grep_stream (pattern, fd, count_only, &lines, &matched, &bytes);
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &end);
+  if (fd != STDIN_FILENO)
+    close (fd);
+
+  if (status != 0)
+  {
+    fprintf (stderr, "Error reading %s\n", path);
+    return 2;
+  }
+
+  if (count_only)
+    printf ("%zu\n", matched);
+
+  double seconds = elapsed_seconds (&start, &end);
+  fprintf (stderr, "Matched %zu of %zu lines, %zu bytes in %f seconds (%.1f MB/s)\n", matched, lines, bytes, seconds,
+           seconds > 0 ? bytes / seconds / 1e6 : 0.0);
+
+  return matched ? 0 : 1;
+}
+
+static void
+usage (const char *program)
+{
+  fprintf (stderr, "Usage: %s <pattern> <string>\n", program);
+  fprintf (stderr, "       %s [-c] [-t threads] -f <file> <pattern>\n", program);
+  fprintf (stderr, "  -f file     Match every line of file, - for standard input\n");
+  fprintf (stderr, "  -c          Print the number of matching lines instead of the lines\n");
+  fprintf (stderr, "  -t threads  Split a file across threads, 0 for one per core\n");
+}
 
 int
 main (int argc, char *argv[])
 {
-  if (argc < 3)
+  const char *file = NULL;
+  bool count_only  = false;
+  int nthreads     = 1;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "cf:t:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'c':
+      count_only = true;
+      break;
+    case 'f':
+      file = optarg;
+      break;
+    case 't':
+      nthreads = atoi (optarg);
+      if (nthreads <= 0)
+        nthreads = (int)sysconf (_SC_NPROCESSORS_ONLN);
+      if (nthreads <= 0)
+        nthreads = 1;
+      if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS;
+      break;
+    default:
+      usage (argv[0]);
+      return 2;
+    }
+  }
+
+  if (argc - optind != (file ? 1 : 2))
   {
-    fprintf (stderr, "Usage: %s <pattern> <string>\n", argv[0]);
-    return 1;
+    usage (argv[0]);
+    return 2;
   }
 
-  const char *pattern_str = argv[1];
-  const char *text        = argv[2];
+  const char *pattern_str   = argv[optind];
   const char *error_message = NULL;
 
   vibrex_t *compiled_pattern = vibrex_compile (pattern_str, &error_message);
   if (!compiled_pattern)
   {
     fprintf (stderr, "Error compiling pattern: %s\n", error_message ? error_message : pattern_str);
-    return 1;
+    return 2;
   }
 
+  if (file)
+  {
+    int status = grep_file (compiled_pattern, file, nthreads, count_only);
+    vibrex_free (compiled_pattern);
+    return status;
+  }
+
+  const char *text = argv[optind + 1];
+
   struct timespec start, end;
   clock_gettime (CLOCK_MONOTONIC, &start);
 
@@ -45,8 +366,7 @@ main (int argc, char *argv[])
 
   clock_gettime (CLOCK_MONOTONIC, &end);
 
-  double time_taken = (end.tv_sec - start.tv_sec) * 1e9;
-  time_taken        = (time_taken + (end.tv_nsec - start.tv_nsec)) * 1e-9;
+  double time_taken = elapsed_seconds (&start, &end);
 
   printf ("Pattern:  \"%s\"\n", pattern_str);
   printf ("Text:     \"%s\"\n", text);
@@ -7,6 +7,7 @@
  *
  * Usage:
  *   compare_vibrex [-v] <regex_list_file> <test_string_file>
+ *   compare_vibrex [-v] --fuzz <count> [--seed <seed>] [--subjects <count>]
  *
  * Arguments:
  *   -v: Optional flag for verbose output. Reports all successful checks.
@@ -19,6 +20,21 @@
  *   test_string_file: A file containing input strings to be matched,
  *     one string per line.
  *
+ *   --fuzz: Instead of files, generate count random patterns, each with
+ *     --subjects subjects (32 by default) that mostly match or nearly
+ *     match, after a fixed set of patterns that are slow for backtracking
+ *     engines.  Each pattern is compiled for every engine path, the
+ *     engine vibrex selects, the same pattern serialized and loaded, and
+ *     with VIBREX_NO_* flags down to the plain NFA simulation, with and
+ *     without VIBREX_ICASE.  Every path must agree with the system regex
+ *     on which subjects match and where, the first leftmost-longest match,
+ *     whether matched whole, in place, in batches or streamed in random
+ *     chunks, and on the matches counted and iterated over in all of the
+ *     subjects joined.  PCRE2, with and without JIT, must agree on which
+ *     subjects match.  The throughput of each path, labelled with the
+ *     engine vibrex_info() reports, and of the reference engines is
+ *     printed at the end.  --seed makes a run repeatable.
+ *
  * The program reports two types of failures:
  *
  * 1. Mismatch: If vibrex and the system regex library produce different
@@ -31,15 +47,23 @@
  * issues with file I/O or memory allocation.
  *********************************************************************************/
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <ctype.h>
 #include <regex.h>
+#include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "vibrex.h"
 
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+
 #define MAX_LINE 4096
 
 typedef enum
@@ -55,51 +79,1205 @@ typedef struct
   match_status expected_match;
 } RegexTest;
 
-int
-main (int argc, char **argv)
+/********************************************************************************
+ * Differential fuzzing
+ *
+ * Random patterns are generated from a tree of the supported syntax, so
+ * that subjects that match can be sampled from the same tree.  Every
+ * pattern is compiled once for each of the paths below and each path
+ * must give the answers of the system regex, which also provides the
+ * leftmost-longest match bounds, and of PCRE2.
+ *********************************************************************************/
+
+#define MAX_NODES 512
+#define MAX_CHILDREN 16
+#define MAX_ALTERNATIVES 8
+#define MAX_PATTERN 1024
+#define MAX_SUBJECT 2048
+#define MAX_THROUGHPUT_ROWS 64
+#define MAX_REPORTED_FAILURES 30
+#define MIN_TIMING_NS 20000.0 // Shortest time each path is timed for per pattern
+#define PARALLEL_BUFFER (256 * 1024) // Large enough for the subjects to be split across threads
+#define PCRE_MATCH_LIMIT 100000
+
+typedef enum
 {
-  int verbose                  = 0;
-  const char *test_string_file = NULL;
-  const char *regex_list_file  = NULL;
+  NODE_LITERAL,
+  NODE_ANY,
+  NODE_CLASS,
+  NODE_CONCAT,
+  NODE_ALTERNATION,
+  NODE_REPEAT
+} NodeType;
 
-  for (int argi = 1; argi < argc; ++argi)
+typedef struct
+{
+  NodeType type;
+  unsigned char byte;        // NODE_LITERAL
+  unsigned char members[32]; // NODE_CLASS bitmap
+  bool negated;              // NODE_CLASS
+  int min;                   // NODE_REPEAT
+  int max;                   // NODE_REPEAT, -1 if unbounded
+  int children[MAX_CHILDREN];
+  int child_count;
+} Node;
+
+typedef struct
+{
+  Node nodes[MAX_NODES];
+  int node_count;
+  int alternatives[MAX_ALTERNATIVES]; // Top-level alternatives
+  bool anchor_start[MAX_ALTERNATIVES];
+  bool anchor_end[MAX_ALTERNATIVES];
+  int alternative_count;
+} PatternTree;
+
+// A way of compiling the pattern that selects a different engine
+typedef struct
+{
+  const char *name;
+  unsigned flags;
+  bool deserialized; // The default compiled pattern through vibrex_serialize()
+} EnginePath;
+
+static const EnginePath engine_paths[] = {
+    {"default", 0, false},
+    {"deserialized", 0, true},
+    {"no-specialized", VIBREX_NO_SPECIALIZED, false},
+    {"lazy-dfa", VIBREX_NO_SPECIALIZED | VIBREX_NO_BITNFA, false},
+    {"nfa-simulation", VIBREX_NO_SPECIALIZED | VIBREX_NO_BITNFA | VIBREX_NO_LAZY_DFA, false},
+    {"icase", VIBREX_ICASE, false},
+    {"icase-nfa-simulation", VIBREX_ICASE | VIBREX_NO_SPECIALIZED | VIBREX_NO_BITNFA | VIBREX_NO_LAZY_DFA, false},
+};
+#define ENGINE_PATH_COUNT (sizeof (engine_paths) / sizeof (engine_paths[0]))
+
+typedef struct
+{
+  char label[64];
+  size_t patterns;
+  size_t subjects;
+  size_t bytes;
+  double ns;
+} ThroughputRow;
+
+typedef struct
+{
+  char *text;
+  size_t len;
+} Subject;
+
+typedef struct
+{
+  pcre2_code *code;
+  pcre2_match_data *match_data;
+  pcre2_match_context *context; // Limits backtracking on the adversarial patterns
+} PcreHandle;
+
+typedef bool (*MatchFunction) (const void *handle, const char *text, size_t text_len);
+
+static uint64_t rng_state              = 88172645463325252ULL;
+static int verbose                     = 0;
+static size_t failures                 = 0;
+static size_t reference_disagreements  = 0; // Subjects PCRE2 and the system regex disagree on
+static size_t patterns_checked         = 0; // Patterns passed to check_pattern()
+static int throughput_row_count        = 0;
+static ThroughputRow throughput_rows[MAX_THROUGHPUT_ROWS];
+
+// Bytes literals and subjects are made of, weighted by repetition
+static const char literal_bytes[]  = "aaaabbbbccccxyz01._- +$(\xe9";
+static const char subject_bytes[]  = "aaaabbbbccccxyz01._- +$(\xe9"
+                                     "ABCXYZ";
+static const char class_members[]  = "abcxyz01._ ";
+static const char metacharacters[] = ".?*+[]()|\\{}^$";
+
+static unsigned
+rnd (void)
+{
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return (unsigned)(rng_state >> 16);
+}
+
+static unsigned
+rnd_below (unsigned n)
+{
+  return rnd () % n;
+}
+
+static double
+get_time_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/********************************************************************************
+ * Pattern trees
+ *********************************************************************************/
+
+static int
+new_node (PatternTree *tree, NodeType type)
+{
+  if (tree->node_count == MAX_NODES)
   {
-    if (strcmp (argv[argi], "-v") == 0)
+    fprintf (stderr, "Pattern tree too large\n");
+    exit (1);
+  }
+  Node *node = &tree->nodes[tree->node_count];
+  memset (node, 0, sizeof (*node));
+  node->type = type;
+  return tree->node_count++;
+}
+
+static void
+add_child (PatternTree *tree, int parent, int child)
+{
+  Node *node = &tree->nodes[parent];
+  if (node->child_count < MAX_CHILDREN)
+    node->children[node->child_count++] = child;
+}
+
+static int
+new_literal (PatternTree *tree, unsigned char byte)
+{
+  int node                 = new_node (tree, NODE_LITERAL);
+  tree->nodes[node].byte   = byte;
+  return node;
+}
+
+static int
+new_literal_string (PatternTree *tree, const char *text)
+{
+  int node = new_node (tree, NODE_CONCAT);
+  for (; *text; text++)
+    add_child (tree, node, new_literal (tree, (unsigned char)*text));
+  return node;
+}
+
+static int
+new_repeat (PatternTree *tree, int child, int min, int max)
+{
+  int node               = new_node (tree, NODE_REPEAT);
+  tree->nodes[node].min  = min;
+  tree->nodes[node].max  = max;
+  add_child (tree, node, child);
+  return node;
+}
+
+static void
+random_literal_text (char *text, int max_len)
+{
+  int len = 1 + rnd_below (max_len);
+  for (int i = 0; i < len; i++)
+    text[i] = literal_bytes[rnd_below (sizeof (literal_bytes) - 1)];
+  text[len] = '\0';
+}
+
+// Generate a random subexpression, only leaves below max_depth
+static int
+generate_node (PatternTree *tree, int depth, int max_depth)
+{
+  unsigned kind = (depth >= max_depth) ? rnd_below (5) : rnd_below (12);
+  int node;
+
+  switch (kind)
+  {
+  case 0:
+  case 1:
+  case 2:
+    return new_literal (tree, (unsigned char)literal_bytes[rnd_below (sizeof (literal_bytes) - 1)]);
+
+  case 3:
+    return new_node (tree, NODE_ANY);
+
+  case 4:
+  {
+    node            = new_node (tree, NODE_CLASS);
+    Node *class     = &tree->nodes[node];
+    class->negated  = rnd_below (3) == 0;
+    int members     = 1 + rnd_below (4);
+    for (int i = 0; i < members; i++)
     {
-      verbose = 1;
+      unsigned char byte = (unsigned char)class_members[rnd_below (sizeof (class_members) - 1)];
+      class->members[byte >> 3] |= (unsigned char)(1u << (byte & 7));
     }
-    else if (argv[argi][0] != '-')
+    if (rnd_below (4) == 0)
+      for (unsigned char byte = 'a'; byte <= 'c'; byte++)
+        class->members[byte >> 3] |= (unsigned char)(1u << (byte & 7));
+    return node;
+  }
+
+  case 5:
+  case 6:
+  case 7:
+  {
+    node      = new_node (tree, NODE_CONCAT);
+    int count = 2 + rnd_below (3);
+    for (int i = 0; i < count; i++)
+      add_child (tree, node, generate_node (tree, depth + 1, max_depth));
+    return node;
+  }
+
+  case 8:
+  case 9:
+  {
+    node      = new_node (tree, NODE_ALTERNATION);
+    int count = 2 + rnd_below (3);
+    for (int i = 0; i < count; i++)
+      add_child (tree, node, generate_node (tree, depth + 1, max_depth));
+    return node;
+  }
+
+  default:
+  {
+    int child = generate_node (tree, depth + 1, max_depth);
+    switch (rnd_below (6))
     {
-      if (regex_list_file == NULL)
+    case 0: return new_repeat (tree, child, 0, -1);
+    case 1: return new_repeat (tree, child, 1, -1);
+    case 2: return new_repeat (tree, child, 0, 1);
+    case 3: return new_repeat (tree, child, 1 + rnd_below (3), -1);
+    case 4:
+    {
+      int count = 1 + rnd_below (3);
+      return new_repeat (tree, child, count, count);
+    }
+    default:
+    {
+      int min = rnd_below (3);
+      return new_repeat (tree, child, min, min + 1 + rnd_below (3));
+    }
+    }
+  }
+  }
+}
+
+static void
+add_alternative (PatternTree *tree, int node, bool anchor_start, bool anchor_end)
+{
+  if (tree->alternative_count == MAX_ALTERNATIVES)
+    return;
+  tree->alternatives[tree->alternative_count] = node;
+  tree->anchor_start[tree->alternative_count] = anchor_start;
+  tree->anchor_end[tree->alternative_count]   = anchor_end;
+  tree->alternative_count++;
+}
+
+// Generate a random pattern, shaped half of the time like the patterns the
+// specialized engines are selected for, so each of them is exercised
+static void
+generate_tree (PatternTree *tree)
+{
+  tree->node_count        = 0;
+  tree->alternative_count = 0;
+  char text[16];
+  char prefix[16];
+  char suffix[16];
+  int count = 1 + rnd_below (4);
+
+  switch (rnd_below (8))
+  {
+  case 0: // Literal alternatives, for the literal and DFA engines
+  {
+    bool anchor_start = rnd_below (3) == 0;
+    bool anchor_end   = rnd_below (3) == 0;
+    bool mixed        = rnd_below (4) == 0;
+    count             = 1 + rnd_below (MAX_ALTERNATIVES);
+    for (int i = 0; i < count; i++)
+    {
+      random_literal_text (text, 6);
+      add_alternative (tree, new_literal_string (tree, text), mixed ? rnd_below (2) == 0 : anchor_start,
+                       mixed ? rnd_below (2) == 0 : anchor_end);
+    }
+    return;
+  }
+
+  case 1: // Anchored alternatives sharing a prefix and suffix
+  {
+    random_literal_text (prefix, 4);
+    random_literal_text (suffix, 4);
+    count = 2 + rnd_below (MAX_ALTERNATIVES - 1);
+    for (int i = 0; i < count; i++)
+    {
+      int node = new_node (tree, NODE_CONCAT);
+      add_child (tree, node, new_literal_string (tree, prefix));
+      if (rnd_below (2))
       {
-        regex_list_file = argv[argi];
+        random_literal_text (text, 4);
+        add_child (tree, node, new_literal_string (tree, text));
       }
-      else if (test_string_file == NULL)
+      else
       {
-        test_string_file = argv[argi];
+        add_child (tree, node, generate_node (tree, 2, 3));
       }
-      else
+      add_child (tree, node, new_literal_string (tree, suffix));
+      add_alternative (tree, node, rnd_below (8) != 0, rnd_below (8) != 0);
+    }
+    return;
+  }
+
+  case 2: // Literals joined by .*, for the anchor and dotstar engines
+  {
+    for (int i = 0; i < count; i++)
+    {
+      int node = new_node (tree, NODE_CONCAT);
+      bool dot_first = rnd_below (2) == 0;
+      if (dot_first)
+        add_child (tree, node, new_repeat (tree, new_node (tree, NODE_ANY), 0, -1));
+      random_literal_text (text, 4);
+      add_child (tree, node, new_literal_string (tree, text));
+      if (!dot_first || rnd_below (2))
       {
-        fprintf (stderr, "Too many arguments provided.\n");
-        fprintf (stderr, "Usage: %s [-v] <regex_list_file> <test_string_file>\n", argv[0]);
-        return 1;
+        add_child (tree, node, new_repeat (tree, new_node (tree, NODE_ANY), 0, -1));
+        if (rnd_below (2))
+        {
+          random_literal_text (text, 4);
+          add_child (tree, node, new_literal_string (tree, text));
+        }
+      }
+      add_alternative (tree, node, rnd_below (2) == 0, rnd_below (2) == 0);
+    }
+    return;
+  }
+
+  default:
+    for (int i = 0; i < count; i++)
+      add_alternative (tree, generate_node (tree, 0, 3), rnd_below (4) == 0, rnd_below (4) == 0);
+    return;
+  }
+}
+
+static void
+append_char (char *buffer, size_t *len, size_t size, char c)
+{
+  if (*len + 1 < size)
+    buffer[(*len)++] = c;
+}
+
+static void
+append_string (char *buffer, size_t *len, size_t size, const char *text)
+{
+  for (; *text; text++)
+    append_char (buffer, len, size, *text);
+}
+
+static void
+print_node (const PatternTree *tree, int index, char *buffer, size_t *len, size_t size)
+{
+  const Node *node = &tree->nodes[index];
+
+  switch (node->type)
+  {
+  case NODE_LITERAL:
+    if (strchr (metacharacters, node->byte))
+      append_char (buffer, len, size, '\\');
+    append_char (buffer, len, size, (char)node->byte);
+    break;
+
+  case NODE_ANY:
+    append_char (buffer, len, size, '.');
+    break;
+
+  case NODE_CLASS:
+    append_char (buffer, len, size, '[');
+    if (node->negated)
+      append_char (buffer, len, size, '^');
+    for (int byte = 0; byte < 256; byte++)
+    {
+      if (!(node->members[byte >> 3] & (1u << (byte & 7))))
+        continue;
+      int last = byte;
+      while (last < 255 && isalnum (last + 1) && (node->members[(last + 1) >> 3] & (1u << ((last + 1) & 7))))
+        last++;
+      append_char (buffer, len, size, (char)byte);
+      if (isalnum (byte) && last - byte >= 2)
+      {
+        append_char (buffer, len, size, '-');
+        append_char (buffer, len, size, (char)last);
+        byte = last;
       }
     }
+    append_char (buffer, len, size, ']');
+    break;
+
+  case NODE_CONCAT:
+    for (int i = 0; i < node->child_count; i++)
+      print_node (tree, node->children[i], buffer, len, size);
+    break;
+
+  case NODE_ALTERNATION:
+    append_char (buffer, len, size, '(');
+    for (int i = 0; i < node->child_count; i++)
+    {
+      if (i > 0)
+        append_char (buffer, len, size, '|');
+      print_node (tree, node->children[i], buffer, len, size);
+    }
+    append_char (buffer, len, size, ')');
+    break;
+
+  case NODE_REPEAT:
+  {
+    const Node *child = &tree->nodes[node->children[0]];
+    bool group        = child->type == NODE_CONCAT || child->type == NODE_REPEAT;
+    if (group)
+      append_char (buffer, len, size, '(');
+    print_node (tree, node->children[0], buffer, len, size);
+    if (group)
+      append_char (buffer, len, size, ')');
+
+    char bounds[32];
+    if (node->min == 0 && node->max < 0)
+      strcpy (bounds, "*");
+    else if (node->min == 1 && node->max < 0)
+      strcpy (bounds, "+");
+    else if (node->min == 0 && node->max == 1)
+      strcpy (bounds, "?");
+    else if (node->max < 0)
+      snprintf (bounds, sizeof (bounds), "{%d,}", node->min);
+    else if (node->min == node->max)
+      snprintf (bounds, sizeof (bounds), "{%d}", node->min);
     else
+      snprintf (bounds, sizeof (bounds), "{%d,%d}", node->min, node->max);
+    append_string (buffer, len, size, bounds);
+    break;
+  }
+  }
+}
+
+// Print the tree as a pattern, false if it does not fit
+static bool
+print_tree (const PatternTree *tree, char *pattern, size_t size)
+{
+  size_t len = 0;
+  for (int i = 0; i < tree->alternative_count; i++)
+  {
+    if (i > 0)
+      append_char (pattern, &len, size, '|');
+    if (tree->anchor_start[i])
+      append_char (pattern, &len, size, '^');
+    print_node (tree, tree->alternatives[i], pattern, &len, size);
+    if (tree->anchor_end[i])
+      append_char (pattern, &len, size, '$');
+  }
+  pattern[len] = '\0';
+  return len + 1 < size;
+}
+
+static bool
+class_contains (const Node *node, unsigned char byte)
+{
+  bool member = (node->members[byte >> 3] & (1u << (byte & 7))) != 0;
+  return member != node->negated;
+}
+
+// Append text that the node matches
+static void
+sample_node (const PatternTree *tree, int index, char *buffer, size_t *len, size_t size)
+{
+  const Node *node = &tree->nodes[index];
+
+  switch (node->type)
+  {
+  case NODE_LITERAL:
+    append_char (buffer, len, size, (char)node->byte);
+    break;
+
+  case NODE_ANY:
+    append_char (buffer, len, size, subject_bytes[rnd_below (sizeof (subject_bytes) - 1)]);
+    break;
+
+  case NODE_CLASS:
+    for (int attempt = 0; attempt < 32; attempt++)
     {
-      fprintf (stderr, "Unrecognized argument: %s\n", argv[argi]);
-      fprintf (stderr, "Usage: %s [-v] <regex_list_file> <test_string_file>\n", argv[0]);
-      return 1;
+      unsigned char byte = (unsigned char)subject_bytes[rnd_below (sizeof (subject_bytes) - 1)];
+      if (class_contains (node, byte))
+      {
+        append_char (buffer, len, size, (char)byte);
+        return;
+      }
     }
+    append_char (buffer, len, size, 'Q');
+    break;
+
+  case NODE_CONCAT:
+    for (int i = 0; i < node->child_count; i++)
+      sample_node (tree, node->children[i], buffer, len, size);
+    break;
+
+  case NODE_ALTERNATION:
+    sample_node (tree, node->children[rnd_below (node->child_count)], buffer, len, size);
+    break;
+
+  case NODE_REPEAT:
+  {
+    int extra = (node->max < 0) ? 3 : node->max - node->min;
+    int count = node->min + rnd_below (extra + 1);
+    for (int i = 0; i < count; i++)
+      sample_node (tree, node->children[0], buffer, len, size);
+    break;
+  }
   }
+}
 
-  if (test_string_file == NULL || regex_list_file == NULL)
+static void
+append_junk (char *buffer, size_t *len, size_t size, int max_len)
+{
+  int count = rnd_below (max_len + 1);
+  for (int i = 0; i < count; i++)
+    append_char (buffer, len, size, subject_bytes[rnd_below (sizeof (subject_bytes) - 1)]);
+}
+
+// Generate a subject, most of them sampled from the tree so they match or
+// nearly match
+static void
+generate_subject (const PatternTree *tree, char *buffer, size_t size)
+{
+  size_t len  = 0;
+  unsigned kind = rnd_below (8);
+
+  if (kind < 2 || !tree)
   {
-    fprintf (stderr, "Error: regex_list_file and test_string_file are required arguments.\n");
-    fprintf (stderr, "Usage: %s [-v] <regex_list_file> <test_string_file>\n", argv[0]);
+    append_junk (buffer, &len, size, 24);
+  }
+  else
+  {
+    int alternative = rnd_below (tree->alternative_count);
+    if (!tree->anchor_start[alternative] || kind == 2)
+      append_junk (buffer, &len, size, 6);
+    sample_node (tree, tree->alternatives[alternative], buffer, &len, size);
+    if (!tree->anchor_end[alternative] || kind == 3)
+      append_junk (buffer, &len, size, 6);
+
+    // Mutate some samples by a byte so they only nearly match
+    if (kind == 4 && len > 0)
+    {
+      size_t at = rnd_below ((unsigned)len);
+      switch (rnd_below (3))
+      {
+      case 0:
+        buffer[at] = subject_bytes[rnd_below (sizeof (subject_bytes) - 1)];
+        break;
+      case 1:
+        memmove (buffer + at, buffer + at + 1, len - at - 1);
+        len--;
+        break;
+      default:
+        if (len + 1 < size)
+        {
+          memmove (buffer + at + 1, buffer + at, len - at);
+          buffer[at] = subject_bytes[rnd_below (sizeof (subject_bytes) - 1)];
+          len++;
+        }
+        break;
+      }
+    }
+  }
+
+  // Change the case of some letters, for the case insensitive paths
+  if (rnd_below (4) == 0)
+    for (size_t i = 0; i < len; i++)
+      if (isalpha ((unsigned char)buffer[i]) && rnd_below (2))
+        buffer[i] = (char)(isupper ((unsigned char)buffer[i]) ? tolower ((unsigned char)buffer[i])
+                                                              : toupper ((unsigned char)buffer[i]));
+  buffer[len] = '\0';
+}
+
+/********************************************************************************
+ * Differential checks
+ *********************************************************************************/
+
+static void
+print_escaped (const char *text, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char c = (unsigned char)text[i];
+    if (c == '"' || c == '\\')
+      printf ("\\%c", c);
+    else if (isprint (c))
+      putchar (c);
+    else
+      printf ("\\x%02x", c);
+  }
+}
+
+// Report a failure, only the first of each path for each pattern
+static void
+report_failure (const char *pattern, const char *path, const char *text, size_t len, const char *format, ...)
+{
+  static size_t last_pattern = SIZE_MAX;
+  static const char *last_path = NULL;
+  failures++;
+  if (failures > MAX_REPORTED_FAILURES || (patterns_checked == last_pattern && path == last_path))
+    return;
+  last_pattern = patterns_checked;
+  last_path    = path;
+
+  printf ("FAIL [Pattern: \"");
+  print_escaped (pattern, strlen (pattern));
+  printf ("\"] [Path: %s]", path);
+  if (text)
+  {
+    printf (" [Subject: \"");
+    print_escaped (text, len);
+    printf ("\"]");
+  }
+  printf (" => ");
+  va_list args;
+  va_start (args, format);
+  vprintf (format, args);
+  va_end (args);
+  printf ("\n");
+}
+
+static void
+add_throughput (const char *label, size_t subjects, size_t bytes, double ns)
+{
+  ThroughputRow *row = NULL;
+  for (int i = 0; i < throughput_row_count; i++)
+    if (strcmp (throughput_rows[i].label, label) == 0)
+      row = &throughput_rows[i];
+
+  if (!row)
+  {
+    if (throughput_row_count == MAX_THROUGHPUT_ROWS)
+      return;
+    row = &throughput_rows[throughput_row_count++];
+    memset (row, 0, sizeof (*row));
+    snprintf (row->label, sizeof (row->label), "%s", label);
+  }
+  row->patterns++;
+  row->subjects += subjects;
+  row->bytes += bytes;
+  row->ns += ns;
+}
+
+// Time passes over all of the subjects for at least MIN_TIMING_NS
+static void
+time_subjects (const char *label, MatchFunction match, const void *handle, const Subject *subjects, int count)
+{
+  size_t bytes = 0;
+  for (int i = 0; i < count; i++)
+    bytes += subjects[i].len;
+
+  int passes    = 0;
+  size_t hits   = 0;
+  double start  = get_time_ns ();
+  double elapsed;
+  do
+  {
+    for (int i = 0; i < count; i++)
+      hits += match (handle, subjects[i].text, subjects[i].len);
+    passes++;
+    elapsed = get_time_ns () - start;
+  } while (elapsed < MIN_TIMING_NS);
+
+  // Keep the matches from being optimized away
+  if (hits == SIZE_MAX)
+    printf (" ");
+  add_throughput (label, (size_t)passes * count, (size_t)passes * bytes, elapsed);
+}
+
+static bool
+vibrex_match_function (const void *handle, const char *text, size_t text_len)
+{
+  return vibrex_match_n ((const vibrex_t *)handle, text, text_len);
+}
+
+static bool
+posix_match_function (const void *handle, const char *text, size_t text_len)
+{
+  (void)text_len;
+  return regexec ((const regex_t *)handle, text, 0, NULL, 0) == 0;
+}
+
+static bool
+pcre_match_function (const void *handle, const char *text, size_t text_len)
+{
+  const PcreHandle *pcre = (const PcreHandle *)handle;
+  return pcre2_match (pcre->code, (PCRE2_SPTR)text, text_len, 0, 0, pcre->match_data, pcre->context) >= 0;
+}
+
+// Match with PCRE2, -1 if it gave up on the subject
+static int
+pcre_match (const PcreHandle *pcre, const char *text, size_t text_len, uint32_t options)
+{
+  int rc = pcre2_match (pcre->code, (PCRE2_SPTR)text, text_len, 0, options, pcre->match_data, pcre->context);
+  if (rc >= 0)
     return 1;
+  return (rc == PCRE2_ERROR_NOMATCH) ? 0 : -1;
+}
+
+static bool
+pcre_compile_handle (PcreHandle *pcre, const char *pattern, bool jit)
+{
+  int error_code;
+  PCRE2_SIZE error_offset;
+  pcre->code = pcre2_compile ((PCRE2_SPTR)pattern, PCRE2_ZERO_TERMINATED, PCRE2_DOTALL | PCRE2_DOLLAR_ENDONLY,
+                              &error_code, &error_offset, NULL);
+  if (!pcre->code)
+    return false;
+  if (jit && pcre2_jit_compile (pcre->code, PCRE2_JIT_COMPLETE) != 0)
+  {
+    pcre2_code_free (pcre->code);
+    pcre->code = NULL;
+    return false;
+  }
+  pcre->match_data = pcre2_match_data_create_from_pattern (pcre->code, NULL);
+  pcre->context    = pcre2_match_context_create (NULL);
+  pcre2_set_match_limit (pcre->context, PCRE_MATCH_LIMIT);
+  return true;
+}
+
+static void
+pcre_free_handle (PcreHandle *pcre)
+{
+  if (!pcre->code)
+    return;
+  pcre2_match_context_free (pcre->context);
+  pcre2_match_data_free (pcre->match_data);
+  pcre2_code_free (pcre->code);
+}
+
+static vibrex_t *
+compile_path (const EnginePath *path, const char *pattern, const vibrex_t *serialize_from)
+{
+  if (!path->deserialized)
+    return vibrex_compile_ex (pattern, path->flags, NULL);
+  if (!serialize_from)
+    return NULL;
+
+  size_t size  = vibrex_serialize (serialize_from, NULL, 0);
+  void *buffer = malloc (size);
+  if (!buffer)
+    return NULL;
+  vibrex_serialize (serialize_from, buffer, size);
+  vibrex_t *loaded = vibrex_deserialize (buffer, size, NULL);
+  free (buffer);
+  return loaded;
+}
+
+// Match a subject fed to a stream in random chunks, -1 if streams are
+// not available for the pattern
+static int
+stream_match (const vibrex_t *compiled, const Subject *subject)
+{
+  vibrex_stream_t *stream = vibrex_stream_begin (compiled);
+  if (!stream)
+    return -1;
+  size_t offset = 0;
+  while (offset < subject->len)
+  {
+    size_t chunk = rnd_below (6);
+    if (chunk > subject->len - offset)
+      chunk = subject->len - offset;
+    if (vibrex_stream_feed (stream, subject->text + offset, chunk))
+      break;
+    offset += chunk;
+  }
+  return vibrex_stream_end (stream) ? 1 : 0;
+}
+
+// Whether a pattern has a ^ or $ anchor
+static bool
+has_anchor (const char *pattern)
+{
+  for (const char *p = pattern; *p; p++)
+  {
+    if (*p == '\\' && p[1])
+      p++;
+    else if (*p == '[' && strchr (p + 1, ']'))
+      p = strchr (p + 1, ']'); // The generated classes never have ']' as a member
+    else if (*p == '^' || *p == '$')
+      return true;
+  }
+  return false;
+}
+
+// Every match of a buffer with vibrex_find_iter(), as start and end pairs
+static size_t
+collect_matches (const vibrex_t *compiled, const char *text, size_t text_len, size_t **spans)
+{
+  size_t count    = 0;
+  size_t capacity = 0;
+  *spans          = NULL;
+  vibrex_iter_t *iter = vibrex_find_iter (compiled, text, text_len);
+  size_t start, end;
+  while (iter && vibrex_iter_next (iter, &start, &end))
+  {
+    if (count == capacity)
+    {
+      capacity = capacity ? capacity * 2 : 16;
+      size_t *grown = realloc (*spans, capacity * 2 * sizeof (size_t));
+      if (!grown)
+        break;
+      *spans = grown;
+    }
+    (*spans)[count * 2]     = start;
+    (*spans)[count * 2 + 1] = end;
+    count++;
+  }
+  vibrex_iter_free (iter);
+  return count;
+}
+
+// Check every path against the system regex and PCRE2 on the subjects,
+// and add their times to the throughput table.  Returns false if the
+// pattern was skipped because a reference engine does not accept it.
+static bool
+check_pattern (const char *pattern, const Subject *subjects, int subject_count)
+{
+  regex_t posix;
+  regex_t posix_icase;
+  patterns_checked++;
+  if (regcomp (&posix, pattern, REG_EXTENDED))
+    return false;
+  if (regcomp (&posix_icase, pattern, REG_EXTENDED | REG_ICASE))
+  {
+    regfree (&posix);
+    return false;
+  }
+
+  vibrex_t *compiled[ENGINE_PATH_COUNT] = {NULL};
+  for (size_t p = 0; p < ENGINE_PATH_COUNT; p++)
+    compiled[p] = compile_path (&engine_paths[p], pattern, compiled[0]);
+
+  if (!compiled[0])
+  {
+    if (verbose)
+      printf ("Skipped \"%s\", not compiled by vibrex\n", pattern);
+    for (size_t p = 1; p < ENGINE_PATH_COUNT; p++)
+      vibrex_free (compiled[p]);
+    regfree (&posix);
+    regfree (&posix_icase);
+    return false;
+  }
+  for (size_t p = 1; p < ENGINE_PATH_COUNT; p++)
+    if (!compiled[p])
+      report_failure (pattern, engine_paths[p].name, NULL, 0, "not compiled");
+
+  vibrex_info_t info;
+  vibrex_info (compiled[0], &info);
+  if (verbose)
+    printf ("Pattern \"%s\" engine %s\n", pattern, info.engine);
+
+  PcreHandle pcre     = {NULL, NULL, NULL};
+  PcreHandle pcre_jit = {NULL, NULL, NULL};
+  pcre_compile_handle (&pcre, pattern, false);
+  pcre_compile_handle (&pcre_jit, pattern, true);
+
+  // The references: the system regex for matches and their bounds
+  bool *expected       = malloc (subject_count * sizeof (bool));
+  bool *expected_icase = malloc (subject_count * sizeof (bool));
+  regmatch_t *bounds   = malloc (subject_count * sizeof (regmatch_t));
+  uint8_t *results     = malloc (subject_count);
+  const char **texts   = malloc (subject_count * sizeof (char *));
+  size_t *lens         = malloc (subject_count * sizeof (size_t));
+  for (int i = 0; i < subject_count; i++)
+  {
+    expected[i]       = regexec (&posix, subjects[i].text, 1, &bounds[i], 0) == 0;
+    expected_icase[i] = regexec (&posix_icase, subjects[i].text, 0, NULL, 0) == 0;
+    texts[i]          = subjects[i].text;
+    lens[i]           = subjects[i].len;
+  }
+
+  // Subjects joined into one buffer for counting and iterating
+  size_t joined_len = 0;
+  for (int i = 0; i < subject_count; i++)
+    joined_len += subjects[i].len + 1;
+  char *joined  = malloc (joined_len + 1);
+  size_t offset = 0;
+  for (int i = 0; i < subject_count; i++)
+  {
+    memcpy (joined + offset, subjects[i].text, subjects[i].len);
+    offset += subjects[i].len;
+    joined[offset++] = '\n';
+  }
+  joined[offset] = '\0';
+
+  size_t *reference_spans     = NULL;
+  size_t reference_count      = 0;
+  size_t *reference_spans_ic  = NULL;
+  size_t reference_count_ic   = 0;
+  bool have_reference         = false;
+  bool have_reference_ic      = false;
+
+  for (size_t p = 0; p < ENGINE_PATH_COUNT; p++)
+  {
+    const EnginePath *path = &engine_paths[p];
+    const vibrex_t *re     = compiled[p];
+    if (!re)
+      continue;
+    bool icase = (path->flags & VIBREX_ICASE) != 0;
+
+    for (int i = 0; i < subject_count; i++)
+    {
+      const Subject *subject = &subjects[i];
+      bool want              = icase ? expected_icase[i] : expected[i];
+
+      bool got = vibrex_match (re, subject->text);
+      if (got != want)
+        report_failure (pattern, path->name, subject->text, subject->len, "vibrex_match %d, expected %d", got, want);
+
+      // Match a copy without a terminator, so reading past the end is caught
+      char *copy = malloc (subject->len ? subject->len : 1);
+      memcpy (copy, subject->text, subject->len);
+      got = vibrex_match_n (re, copy, subject->len);
+      free (copy);
+      if (got != want)
+        report_failure (pattern, path->name, subject->text, subject->len, "vibrex_match_n %d, expected %d", got,
+                        want);
+
+      int streamed = stream_match (re, subject);
+      if (streamed >= 0 && streamed != want)
+        report_failure (pattern, path->name, subject->text, subject->len, "stream %d, expected %d", streamed, want);
+
+      if (!icase)
+      {
+        size_t start = 0;
+        size_t end   = 0;
+        got          = vibrex_search (re, subject->text, subject->len, &start, &end);
+        if (got != want)
+          report_failure (pattern, path->name, subject->text, subject->len, "vibrex_search %d, expected %d", got,
+                          want);
+        else if (got && (start != (size_t)bounds[i].rm_so || end != (size_t)bounds[i].rm_eo))
+          report_failure (pattern, path->name, subject->text, subject->len, "match at %zu-%zu, expected %d-%d", start,
+                          end, (int)bounds[i].rm_so, (int)bounds[i].rm_eo);
+      }
+    }
+
+    size_t matched = vibrex_match_batch (re, texts, lens, subject_count, results);
+    size_t wanted  = 0;
+    for (int i = 0; i < subject_count; i++)
+    {
+      bool want = icase ? expected_icase[i] : expected[i];
+      wanted += want;
+      if (results[i] != want)
+        report_failure (pattern, path->name, subjects[i].text, subjects[i].len, "vibrex_match_batch %d, expected %d",
+                        results[i], want);
+    }
+    if (matched != wanted)
+      report_failure (pattern, path->name, NULL, 0, "vibrex_match_batch counted %zu, expected %zu", matched, wanted);
+
+    // Every path must find the same matches in the joined subjects
+    size_t *spans;
+    size_t count = collect_matches (re, joined, joined_len, &spans);
+    if (vibrex_count (re, joined, joined_len) != count)
+      report_failure (pattern, path->name, NULL, 0, "vibrex_count %zu, vibrex_iter_next found %zu",
+                      vibrex_count (re, joined, joined_len), count);
+    size_t **compare_spans = icase ? &reference_spans_ic : &reference_spans;
+    size_t *compare_count  = icase ? &reference_count_ic : &reference_count;
+    bool *have             = icase ? &have_reference_ic : &have_reference;
+    if (!*have)
+    {
+      *compare_spans = spans;
+      *compare_count = count;
+      *have          = true;
+    }
+    else
+    {
+      if (count != *compare_count || (count && memcmp (spans, *compare_spans, count * 2 * sizeof (size_t)) != 0))
+        report_failure (pattern, path->name, NULL, 0, "vibrex_iter_next found %zu matches, %s found %zu", count,
+                        icase ? "icase" : "default", *compare_count);
+      free (spans);
+    }
+
+    char label[64];
+    snprintf (label, sizeof (label), "%s (%s)", path->name, vibrex_info (re, &info) ? info.engine : "?");
+    time_subjects (label, vibrex_match_function, re, subjects, subject_count);
+  }
+
+  // Matches split across threads must be the matches found on one, checked
+  // for some patterns with the default and bit-parallel engines.  Patterns
+  // with anchors are never split, and searching large buffers for their
+  // longest matches is slow.
+  for (size_t p = 0; p < ENGINE_PATH_COUNT; p += 2)
+  {
+    if (!compiled[p] || (engine_paths[p].flags & VIBREX_NO_BITNFA) || has_anchor (pattern) || joined_len == 0 ||
+        rnd_below (4) != 0)
+      continue;
+    size_t big_len = 0;
+    char *big      = malloc (PARALLEL_BUFFER + joined_len);
+    while (big_len < PARALLEL_BUFFER)
+    {
+      memcpy (big + big_len, joined, joined_len);
+      big_len += joined_len;
+    }
+    size_t single   = vibrex_count (compiled[p], big, big_len);
+    size_t parallel = vibrex_count_parallel (compiled[p], big, big_len, 4);
+    if (single != parallel)
+      report_failure (pattern, engine_paths[p].name, NULL, 0, "vibrex_count_parallel %zu, vibrex_count %zu", parallel,
+                      single);
+    bool any = vibrex_match_parallel (compiled[p], big, big_len, 4);
+    if (any != vibrex_match_n (compiled[p], big, big_len))
+      report_failure (pattern, engine_paths[p].name, NULL, 0, "vibrex_match_parallel %d", any);
+    free (big);
+  }
+
+  // PCRE2 has no leftmost-longest bounds, so only whether it matches is
+  // compared.  The paths were checked against the system regex already, so
+  // a difference is between the reference engines and not a failure.
+  PcreHandle *pcres[2] = {&pcre, &pcre_jit};
+  for (int h = 0; h < 2; h++)
+  {
+    if (!pcres[h]->code)
+      continue;
+    for (int i = 0; i < subject_count; i++)
+    {
+      int got = pcre_match (pcres[h], subjects[i].text, subjects[i].len, 0);
+      if (got >= 0 && got != expected[i] && ++reference_disagreements <= MAX_REPORTED_FAILURES)
+      {
+        printf ("DISAGREE [Pattern: \"");
+        print_escaped (pattern, strlen (pattern));
+        printf ("\"] [Subject: \"");
+        print_escaped (subjects[i].text, subjects[i].len);
+        printf ("\"] => %s %d, system regex %d\n", h ? "PCRE2-JIT" : "PCRE2", got, expected[i]);
+      }
+    }
+    time_subjects (h ? "pcre2-jit" : "pcre2", pcre_match_function, pcres[h], subjects, subject_count);
+  }
+  time_subjects ("system regex", posix_match_function, &posix, subjects, subject_count);
+
+  free (reference_spans);
+  free (reference_spans_ic);
+  free (joined);
+  free (expected);
+  free (expected_icase);
+  free (bounds);
+  free (results);
+  free (texts);
+  free (lens);
+  pcre_free_handle (&pcre);
+  pcre_free_handle (&pcre_jit);
+  for (size_t p = 0; p < ENGINE_PATH_COUNT; p++)
+    vibrex_free (compiled[p]);
+  regfree (&posix);
+  regfree (&posix_icase);
+  return true;
+}
+
+static void
+free_subjects (Subject *subjects, int count)
+{
+  for (int i = 0; i < count; i++)
+    free (subjects[i].text);
+}
+
+static void
+set_subject (Subject *subject, const char *text, size_t len)
+{
+  subject->text = malloc (len + 1);
+  memcpy (subject->text, text, len);
+  subject->text[len] = '\0';
+  subject->len       = len;
+}
+
+// Patterns that are slow for backtracking engines, matched against long
+// runs of the bytes they repeat
+static int
+check_adversarial_patterns (void)
+{
+  static const char *patterns[] = {
+      "a*a*a*a*a*a*b", "(a*)*b",      "(a|aa)*b",  "(a+)+b",           "(a|a?)+b",
+      "(.*a){8}",      "^(a?){20}a{20}$", "(x+x+)+y", "a{0,5}a{0,5}a{0,5}b", "(.*){3}b",
+      ".*.*.*=.*",     "^(a+)+$",    "(a|b|ab)*c", "^(.*a.*a.*)*b$",  "(aa|a)*(ab|b)",
+  };
+  static const int runs[]     = {0, 1, 2, 5, 19, 20, 21, 40, 41, 64, 255};
+  static const char *tails[]  = {"", "b", "c", "y", "=", "ab"};
+  const int run_count         = sizeof (runs) / sizeof (runs[0]);
+  const int tail_count        = sizeof (tails) / sizeof (tails[0]);
+  const int subject_count     = run_count * tail_count * 2;
+  Subject *subjects           = malloc (subject_count * sizeof (Subject));
+  char text[MAX_SUBJECT];
+
+  int count = 0;
+  for (int r = 0; r < run_count; r++)
+    for (int t = 0; t < tail_count; t++)
+      for (int b = 0; b < 2; b++)
+      {
+        memset (text, b ? 'x' : 'a', runs[r]);
+        strcpy (text + runs[r], tails[t]);
+        set_subject (&subjects[count++], text, strlen (text));
+      }
+
+  int checked = 0;
+  for (size_t i = 0; i < sizeof (patterns) / sizeof (patterns[0]); i++)
+    checked += check_pattern (patterns[i], subjects, count);
+  free_subjects (subjects, count);
+  free (subjects);
+  return checked;
+}
+
+static int
+compare_throughput_rows (const void *a, const void *b)
+{
+  return strcmp (((const ThroughputRow *)a)->label, ((const ThroughputRow *)b)->label);
+}
+
+static void
+print_throughput (void)
+{
+  qsort (throughput_rows, throughput_row_count, sizeof (ThroughputRow), compare_throughput_rows);
+  printf ("\n%-40s %10s %12s %12s %10s\n", "Path (engine)", "Patterns", "Subjects", "Bytes", "MB/s");
+  for (int i = 0; i < throughput_row_count; i++)
+  {
+    const ThroughputRow *row = &throughput_rows[i];
+    printf ("%-40s %10zu %12zu %12zu %10.1f\n", row->label, row->patterns, row->subjects, row->bytes,
+            row->ns > 0 ? row->bytes * 1e3 / row->ns : 0.0);
+  }
+}
+
+static int
+fuzz (long iterations, int subjects_per_pattern)
+{
+  PatternTree *tree = malloc (sizeof (PatternTree));
+  Subject *subjects = malloc (subjects_per_pattern * sizeof (Subject));
+  char pattern[MAX_PATTERN];
+  char text[MAX_SUBJECT];
+  long checked = check_adversarial_patterns ();
+  long skipped = 0;
+
+  for (long iteration = 0; iteration < iterations; iteration++)
+  {
+    generate_tree (tree);
+    if (!print_tree (tree, pattern, sizeof (pattern)))
+    {
+      skipped++;
+      continue;
+    }
+
+    for (int i = 0; i < subjects_per_pattern; i++)
+    {
+      generate_subject (tree, text, sizeof (text));
+      set_subject (&subjects[i], text, strlen (text));
+    }
+    if (check_pattern (pattern, subjects, subjects_per_pattern))
+      checked++;
+    else
+      skipped++;
+    free_subjects (subjects, subjects_per_pattern);
   }
 
+  free (subjects);
+  free (tree);
+
+  print_throughput ();
+  printf ("\nChecked %ld patterns (%ld skipped) on %zu paths, %zu failures, %zu reference disagreements\n",
+          checked, skipped, ENGINE_PATH_COUNT, failures, reference_disagreements);
+  return failures ? 1 : 0;
+}
+
+/********************************************************************************
+ * File comparison
+ *********************************************************************************/
+
+// Compare every pattern of regex_list_file on every line of test_string_file
+static int
+compare_files (const char *regex_list_file, const char *test_string_file)
+{
   FILE *regex_file = fopen (regex_list_file, "r");
   if (!regex_file)
   {
@@ -246,6 +1424,7 @@ main (int argc, char **argv)
       {
         printf ("Line %d: \"%s\" [Pattern: \"%s\"] => FAIL (vibrex mismatch with system regexec)\n",
                 line_num, line, tests[i].pattern);
+        failures++;
       }
       else if (tests[i].expected_match != MATCH_UNSET && tests[i].expected_match != matched_vibrex)
       {
@@ -253,6 +1432,7 @@ main (int argc, char **argv)
                 line_num, line, tests[i].pattern,
                 tests[i].expected_match == MATCH_TRUE ? "match" : "no match",
                 matched_vibrex == MATCH_TRUE ? "match" : "no match");
+        failures++;
       }
       else if (verbose)
       {
@@ -280,5 +1460,83 @@ main (int argc, char **argv)
   free (tests);
 
   fclose (file);
-  return 0;
-}
\ No newline at end of file
+  return failures ? 1 : 0;
+}
+
+static void
+usage (const char *program)
+{
+  fprintf (stderr, "Usage: %s [-v] <regex_list_file> <test_string_file>\n", program);
+  fprintf (stderr, "       %s [-v] --fuzz <count> [--seed <seed>] [--subjects <count>]\n", program);
+}
+
+int
+main (int argc, char **argv)
+{
+  const char *test_string_file = NULL;
+  const char *regex_list_file  = NULL;
+  long fuzz_iterations         = -1;
+  int subjects_per_pattern     = 32;
+
+  for (int argi = 1; argi < argc; ++argi)
+  {
+    if (strcmp (argv[argi], "-v") == 0)
+    {
+      verbose = 1;
+    }
+    else if (strcmp (argv[argi], "--fuzz") == 0 && argi + 1 < argc)
+    {
+      fuzz_iterations = strtol (argv[++argi], NULL, 10);
+    }
+    else if (strcmp (argv[argi], "--seed") == 0 && argi + 1 < argc)
+    {
+      rng_state = strtoull (argv[++argi], NULL, 10) * 2654435761ULL + 1;
+    }
+    else if (strcmp (argv[argi], "--subjects") == 0 && argi + 1 < argc)
+    {
+      subjects_per_pattern = atoi (argv[++argi]);
+    }
+    else if (argv[argi][0] != '-')
+    {
+      if (regex_list_file == NULL)
+      {
+        regex_list_file = argv[argi];
+      }
+      else if (test_string_file == NULL)
+      {
+        test_string_file = argv[argi];
+      }
+      else
+      {
+        fprintf (stderr, "Too many arguments provided.\n");
+        usage (argv[0]);
+        return 1;
+      }
+    }
+    else
+    {
+      fprintf (stderr, "Unrecognized argument: %s\n", argv[argi]);
+      usage (argv[0]);
+      return 1;
+    }
+  }
+
+  if (fuzz_iterations >= 0)
+  {
+    if (subjects_per_pattern < 1)
+    {
+      fprintf (stderr, "Error: --subjects must be at least 1.\n");
+      return 1;
+    }
+    return fuzz (fuzz_iterations, subjects_per_pattern);
+  }
+
+  if (test_string_file == NULL || regex_list_file == NULL)
+  {
+    fprintf (stderr, "Error: regex_list_file and test_string_file are required arguments.\n");
+    usage (argv[0]);
+    return 1;
+  }
+
+  return compare_files (regex_list_file, test_string_file);
+}
@@ -1,5 +1,7 @@
 #include "vibrex.h"
 #include <assert.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,6 +17,8 @@
 #define MAX_PERFORMANCE_TIME_MS 10.0
 #define CATASTROPHIC_TEST_STRING_LENGTH 30
 #define EVIL_STRING_LENGTH 31
+#define THREAD_TEST_COUNT 4
+#define THREAD_TEST_ITERATIONS 20000
 
 // Test output constants
 #define TEST_PASS_SYMBOL "✓"
@@ -388,6 +392,156 @@ test_optional_quantifier_char ()
   printf (TEST_PASS_SYMBOL " Optional (?) on characters tests passed\n");
 }
 
+void
+test_bounded_repetition ()
+{
+  printf ("Testing bounded repetition ({m}, {m,} and {m,n})...\n");
+
+  const char *exact_cases[][2] = {
+      {"aaa", "true"},
+      {"xaaay", "true"},
+      {"aa", "false"},
+      {"a{3}", "false"}};
+  vibrex_t *pattern = compile_and_verify ("a{3}", true);
+  test_multiple_matches (pattern, exact_cases, 4, "a{3}");
+  vibrex_free (pattern);
+
+  const char *range_cases[][2] = {
+      {"FDSN:IU_ANMO", "true"},
+      {"FDSN:I_A", "true"},
+      {"FDSN:ABCDE_12345", "true"},
+      {"FDSN:ABCDEF_1", "false"},
+      {"FDSN:_ANMO", "false"},
+      {"FDSN:iu_anmo", "false"}};
+  pattern = compile_and_verify ("^FDSN:[A-Z0-9]{1,5}_[A-Z0-9]{1,5}$", true);
+  test_multiple_matches (pattern, range_cases, 6, "^FDSN:[A-Z0-9]{1,5}_[A-Z0-9]{1,5}$");
+  vibrex_free (pattern);
+
+  const char *open_cases[][2] = {
+      {"ab", "false"},
+      {"abb", "true"},
+      {"abbbbbbb", "true"},
+      {"bbb", "false"}};
+  pattern = compile_and_verify ("^ab{2,}$", true);
+  test_multiple_matches (pattern, open_cases, 4, "^ab{2,}$");
+  vibrex_free (pattern);
+
+  const char *optional_cases[][2] = {
+      {"", "true"},
+      {"a", "true"},
+      {"aa", "true"},
+      {"aaa", "false"}};
+  pattern = compile_and_verify ("^a{0,2}$", true);
+  test_multiple_matches (pattern, optional_cases, 4, "^a{0,2}$");
+  vibrex_free (pattern);
+
+  // Groups, nesting and alternatives repeat as a whole
+  const char *group_cases[][2] = {
+      {"catdog", "true"},
+      {"dogdogcat", "true"},
+      {"cat", "false"},
+      {"catcow", "false"}};
+  pattern = compile_and_verify ("(cat|dog){2}", true);
+  test_multiple_matches (pattern, group_cases, 4, "(cat|dog){2}");
+  vibrex_free (pattern);
+
+  const char *nested_cases[][2] = {
+      {"abbabb", "true"},
+      {"abbbabbabb", "true"},
+      {"ababb", "false"},
+      {"abb", "false"}};
+  pattern = compile_and_verify ("^(ab{2,3}){2,3}$", true);
+  test_multiple_matches (pattern, nested_cases, 4, "^(ab{2,3}){2,3}$");
+  vibrex_free (pattern);
+
+  const char *zero_cases[][2] = {
+      {"bc", "true"},
+      {"bac", "false"}};
+  pattern = compile_and_verify ("^ba{0}c$", true);
+  test_multiple_matches (pattern, zero_cases, 2, "^ba{0}c$");
+  vibrex_free (pattern);
+
+  // Required literals and match bounds see the expanded pattern
+  pattern = compile_and_verify ("[0-9]{3}_needle", true);
+  test_match_case (pattern, "sta 123_needle", true, "digits before literal");
+  test_match_case (pattern, "sta 12_needle", false, "too few digits");
+  vibrex_bounds_t bounds;
+  assert (vibrex_bounds (pattern, &bounds));
+  assert (bounds.min_length == 10 && bounds.max_length == 10);
+  vibrex_free (pattern);
+
+  // Large bounds stay within the NFA limits
+  pattern = compile_and_verify ("^x[a-z]{0,1000}y$", true);
+  char *long_text = create_repeated_string ('q', 1003);
+  long_text[0]    = 'x';
+  long_text[1002] = 'y';
+  test_match_case (pattern, long_text, false, "one more than 1000 optional copies");
+  long_text[1001] = 'y';
+  long_text[1002] = '\0';
+  test_match_case (pattern, long_text, true, "1000 optional copies");
+  free (long_text);
+  vibrex_free (pattern);
+
+  // Bounds are expanded into copies of their atom, matched by the
+  // bit-parallel NFA up to 64 positions and then by the lazy DFA up to the
+  // NFA state limit, which nested bounds reach soonest
+  const char *limits[][2] = {
+      {"x{1,62}y", "bitnfa"}, {"x{1,63}y", "nfa"}, {"^(a{1,40}){1,40}$", "nfa"}, {"(abc){1,1000}", "nfa"}};
+  for (size_t i = 0; i < sizeof (limits) / sizeof (limits[0]); i++)
+  {
+    pattern = compile_and_verify (limits[i][0], true);
+    vibrex_info_t info;
+    assert (vibrex_info (pattern, &info));
+    assert (strcmp (info.engine, limits[i][1]) == 0 && info.nfa_states <= 4096);
+    vibrex_free (pattern);
+  }
+  pattern   = compile_and_verify ("^(a{1,40}){1,40}$", true);
+  long_text = create_repeated_string ('a', 1601);
+  test_match_case (pattern, long_text, false, "one more than 40 by 40 copies");
+  long_text[1600] = '\0';
+  test_match_case (pattern, long_text, true, "40 by 40 copies");
+  free (long_text);
+  vibrex_free (pattern);
+  const char *state_error = NULL;
+  assert (vibrex_compile ("(abcd){1,1000}", &state_error) == NULL);
+  assert (state_error != NULL && strstr (state_error, "too many NFA states") != NULL);
+  state_error = NULL;
+  assert (vibrex_compile ("(a{1,70}){1,70}", &state_error) == NULL);
+  assert (state_error != NULL && strstr (state_error, "too many NFA states") != NULL);
+
+  // Braces that do not form a bound are literal bytes
+  pattern = compile_and_verify ("^a{,2}b{x}c{$", true);
+  test_match_case (pattern, "a{,2}b{x}c{", true, "literal braces");
+  vibrex_free (pattern);
+  pattern = compile_and_verify ("^a\\{2}$", true);
+  test_match_case (pattern, "a{2}", true, "escaped brace");
+  test_match_case (pattern, "aa", false, "escaped brace is not a bound");
+  vibrex_free (pattern);
+
+  // Invalid bounds are rejected
+  const char *error = NULL;
+  assert (vibrex_compile ("a{3,2}", &error) == NULL && error != NULL);
+  assert (vibrex_compile ("{2}", NULL) == NULL);
+  assert (vibrex_compile ("(|{2})", NULL) == NULL);
+  assert (vibrex_compile ("a*{2}", NULL) == NULL);
+  assert (vibrex_compile ("a{2}*", NULL) == NULL);
+  assert (vibrex_compile ("a{2}{3}", NULL) == NULL);
+  assert (vibrex_compile ("a{1001}", &error) == NULL && error != NULL);
+  assert (vibrex_compile ("(((a{1000}){1000}){1000})", &error) == NULL && error != NULL);
+
+  // Pattern sets expand bounds too
+  const char *set_patterns[] = {"^[0-9]{2}$", "x{2,3}"};
+  vibrex_set_t *set          = vibrex_set_compile (set_patterns, 2, NULL);
+  assert (set != NULL);
+  unsigned char matches[1];
+  assert (vibrex_set_match (set, "12", 2, matches) == 1 && matches[0] == 1);
+  assert (vibrex_set_match (set, "axxb", 4, matches) == 1 && matches[0] == 2);
+  assert (vibrex_set_match (set, "123", 3, matches) == 0);
+  vibrex_set_free (set);
+
+  printf (TEST_PASS_SYMBOL " Bounded repetition tests passed\n");
+}
+
 void
 test_anchors ()
 {
@@ -1549,7 +1703,7 @@ test_catastrophic_backtracking ()
   vibrex_t *nested_plus = compile_and_verify ("(a+)+", true);
 
   /* Create a string that would cause catastrophic backtracking: many 'a's followed by 'X' */
-  char *evil_string                                = create_repeated_string ('a', CATASTROPHIC_TEST_STRING_LENGTH);
+  char *evil_string                                = create_repeated_string ('a', CATASTROPHIC_TEST_STRING_LENGTH + 1);
   evil_string[CATASTROPHIC_TEST_STRING_LENGTH]     = 'X'; /* Non-matching character at end */
   evil_string[CATASTROPHIC_TEST_STRING_LENGTH + 1] = '\0';
 
@@ -1592,7 +1746,7 @@ test_catastrophic_backtracking ()
   assert (vibrex_match (evil_anchored, "aaaaaaaaaa") == true);
 
   /* String that doesn't match - this would cause catastrophic backtracking in backtracking engines */
-  char *evil_nomatch = create_repeated_string ('a', 29);
+  char *evil_nomatch = create_repeated_string ('a', 30);
   evil_nomatch[29]   = 'X'; /* Non-matching character at end */
   evil_nomatch[30]   = '\0';
 
@@ -1683,6 +1837,9 @@ test_malicious_patterns ()
   deep_pattern[MAX_RECURSION_DEPTH_TEST * 2 + 1] = '\0';
 
   compile_and_verify (deep_pattern, false);
+  const char *depth_error = NULL;
+  assert (vibrex_compile (deep_pattern, &depth_error) == NULL);
+  assert (depth_error != NULL && strstr (depth_error, "nested too deeply") != NULL);
 
   free (deep_pattern);
 
@@ -1825,7 +1982,7 @@ test_malicious_patterns ()
   printf ("  Testing error message accuracy...\n");
 
   // Test a pattern that definitely exceeds limits
-  char *error_test = malloc (3000);
+  char *error_test = malloc (3002);
   assert (error_test != NULL);
 
   // Create very deep nesting
@@ -1934,6 +2091,129 @@ test_alternations ()
   assert (vibrex_match (multi_alt, "fish") == false);
   vibrex_free (multi_alt);
 
+  // Overlapping literals are all found in a single pass
+  vibrex_t *overlap_alt = vibrex_compile ("she|he|hers|his", NULL);
+  assert (overlap_alt != NULL);
+  assert (vibrex_match (overlap_alt, "ushers") == true);
+  assert (vibrex_match (overlap_alt, "this") == true);
+  assert (vibrex_match (overlap_alt, "sh hi s") == false);
+  vibrex_free (overlap_alt);
+
+  // Literal groups and escapes expand to plain literals
+  vibrex_t *group_alt = vibrex_compile ("ab(c|d)|x\\.y|(p|q)(r|s)", NULL);
+  assert (group_alt != NULL);
+  assert (vibrex_match (group_alt, "--abd--") == true);
+  assert (vibrex_match (group_alt, "abe") == false);
+  assert (vibrex_match (group_alt, "x.y") == true);
+  assert (vibrex_match (group_alt, "xzy") == false);
+  assert (vibrex_match (group_alt, "qs") == true);
+  assert (vibrex_match (group_alt, "pq") == false);
+  vibrex_free (group_alt);
+
+  // Alternatives sharing a prefix and suffix match the middle of the
+  // subject in place, including subjects that are not NUL-terminated
+  vibrex_t *shared_alt = vibrex_compile ("^pre_(x+)_suf|^pre_yy_suf", NULL);
+  assert (shared_alt != NULL);
+  assert (vibrex_match (shared_alt, "pre_xxx_suf") == true);
+  assert (vibrex_match (shared_alt, "pre_yy_suf") == true);
+  assert (vibrex_match (shared_alt, "pre__suf") == false);
+  assert (vibrex_match (shared_alt, "pre_suf") == false);
+  assert (vibrex_match_n (shared_alt, "pre_yy_suf_trailing", 10) == true);
+  assert (vibrex_match_n (shared_alt, "pre_xx_sufpre_yy_suf", 9) == false);
+  vibrex_free (shared_alt);
+
+  // Hundreds of alternatives between a shared prefix and suffix are matched
+  // in one pass, literal middle parts by a trie whose common endings share
+  // states
+  size_t capacity = 64 * 1024;
+  char *selector  = malloc (capacity);
+  assert (selector != NULL);
+  size_t len = 0;
+  for (int i = 0; i < 300; i++)
+    len += snprintf (selector + len, capacity - len, "%s^FDSN:IU_S%03d_00_B_H_Z$", i ? "|" : "", i * 3);
+  vibrex_t *literal_middles = vibrex_compile (selector, NULL);
+  assert (literal_middles != NULL);
+  vibrex_info_t info;
+  assert (vibrex_info (literal_middles, &info));
+  assert (strcmp (info.engine, "advanced-alt") == 0);
+  assert (info.dfa_states > 0 && info.dfa_states < 64);
+  assert (vibrex_match (literal_middles, "FDSN:IU_S000_00_B_H_Z") == true);
+  assert (vibrex_match (literal_middles, "FDSN:IU_S897_00_B_H_Z") == true);
+  assert (vibrex_match (literal_middles, "FDSN:IU_S001_00_B_H_Z") == false);
+  assert (vibrex_match (literal_middles, "FDSN:IU_S900_00_B_H_Z") == false);
+  assert (vibrex_match (literal_middles, "FDSN:IU_S000_00_B_H_Zx") == false);
+  vibrex_free (literal_middles);
+
+  len = 0;
+  for (int i = 0; i < 300; i++)
+    len += snprintf (selector + len, capacity - len, "%s^FDSN:IU_S%03d_.*_B_H_Z$", i ? "|" : "", i * 3);
+  vibrex_t *regex_middles = vibrex_compile (selector, NULL);
+  assert (regex_middles != NULL);
+  assert (vibrex_info (regex_middles, &info));
+  assert (strcmp (info.engine, "advanced-alt") == 0);
+  assert (vibrex_match (regex_middles, "FDSN:IU_S003_10_B_H_Z") == true);
+  assert (vibrex_match (regex_middles, "FDSN:IU_S003__B_H_Z") == true);
+  assert (vibrex_match (regex_middles, "FDSN:IU_S004_10_B_H_Z") == false);
+  assert (vibrex_match (regex_middles, "FDSN:IU_S003_10_B_H_N") == false);
+  vibrex_free (regex_middles);
+
+  // Middle parts too many for one pattern are matched one by one
+  len = 0;
+  for (int i = 0; i < 1000; i++)
+    len += snprintf (selector + len, capacity - len, "%s^FDSN:XX_S%04d_.HZ$", i ? "|" : "", i);
+  const char *selector_error = NULL;
+  vibrex_t *many_middles     = vibrex_compile (selector, &selector_error);
+  assert (many_middles != NULL && selector_error == NULL);
+  assert (vibrex_info (many_middles, &info));
+  assert (strcmp (info.engine, "advanced-alt") == 0);
+  assert (vibrex_match (many_middles, "FDSN:XX_S0000_BHZ") == true);
+  assert (vibrex_match (many_middles, "FDSN:XX_S0999_LHZ") == true);
+  assert (vibrex_match (many_middles, "FDSN:XX_S1000_BHZ") == false);
+  assert (vibrex_match (many_middles, "FDSN:XX_S0999_BHN") == false);
+  vibrex_free (many_middles);
+  free (selector);
+
+  // Middle parts that may be empty, prefixes that stop before a repeated
+  // byte and '|' in groups, which only whole-pattern engines split on
+  const char *middle_patterns[][2] = {
+      {"^abcxyz$|^abcd*xyz$|^abcexyz$", "abcxyz"},
+      {"^abc+de$|^abcfde$|^abcgde$", "abccde"},
+      {"^abc(d|e)fgh$|^abcxfgh$|^abcyfgh$", "abcefgh"},
+      {"^abcde$|^abcdf|^abcdg$", "abcdfz"},
+  };
+  const char *middle_misses[] = {"abcdexyz", "abde", "abcfgh", "abcdgz"};
+  for (size_t i = 0; i < sizeof (middle_patterns) / sizeof (middle_patterns[0]); i++)
+  {
+    vibrex_t *middles = vibrex_compile (middle_patterns[i][0], NULL);
+    assert (middles != NULL);
+    test_match_case (middles, middle_patterns[i][1], true, middle_patterns[i][0]);
+    test_match_case (middles, middle_misses[i], false, middle_patterns[i][0]);
+    vibrex_free (middles);
+  }
+
+  // Anchors and a leading or trailing .* only apply to their own
+  // alternative, whichever engine the alternation is given to
+  const char *own_anchors[][3] = {
+      {"^abc.x|^abcy", "abcyzz", "zabcy"},
+      {".*abc|.*xyz", "abc--", "ab-c"},
+      {"abc.*|xyz.*", "--xyz", "x-yz"},
+      {".*a?b$|.*cd$", "xb", "cdx"},
+      {"^.*a?cxyz$|^q", "zcxyz", "zcxyzq"},
+      {"x\\($|b1x$|cb$|0a\\.cb$", "bZbcb", "bcbZ"},
+      {"^abcx|abcxba$", "zabcxba", "zabcx"},
+      {"c|a$", "c-", "a-"},
+      {"a$|b|c", "-b-", "a-"},
+      {"a\\(x*|bc", "bc", "ab"},
+  };
+  for (size_t i = 0; i < sizeof (own_anchors) / sizeof (own_anchors[0]); i++)
+  {
+    vibrex_t *anchors = vibrex_compile (own_anchors[i][0], NULL);
+    assert (anchors != NULL);
+    test_match_case (anchors, own_anchors[i][1], true, own_anchors[i][0]);
+    test_match_case (anchors, own_anchors[i][2], false, own_anchors[i][0]);
+    vibrex_free (anchors);
+  }
+
   printf (TEST_PASS_SYMBOL " Basic alternation tests passed\n");
 }
 
@@ -1962,6 +2242,91 @@ test_complex_nested_patterns ()
   printf (TEST_PASS_SYMBOL " Complex nested pattern tests passed\n");
 }
 
+void
+test_pattern_set ()
+{
+  printf ("Testing pattern sets...\n");
+
+  const char *patterns[] = {
+      "^FDSN:NET_STA_.*_Z/MSEED3?$", // 0
+      "_B_H_[ENZ]",                  // 1
+      "^FDSN:XY_",                   // 2
+      "MSEED3$",                     // 3
+      "(a|^FDSN:NET)",               // 4
+      "x*",                          // 5, matches everything
+      "^$",                          // 6, matches only empty text
+  };
+  size_t count = sizeof (patterns) / sizeof (patterns[0]);
+
+  const char *error_message = "unset";
+  vibrex_set_t *set         = vibrex_set_compile (patterns, count, &error_message);
+  assert (set != NULL);
+  assert (error_message == NULL);
+  assert (vibrex_set_size (set) == count);
+
+  unsigned char matches[1];
+  const char *text = "FDSN:NET_STA_00_B_H_Z/MSEED3";
+  assert (vibrex_set_match (set, text, strlen (text), matches) == 5);
+  assert (matches[0] == 0x3b); // 0, 1, 3, 4, 5
+
+  text = "FDSN:XY_STA_00_L_H_N/MSEED";
+  assert (vibrex_set_match (set, text, strlen (text), matches) == 2);
+  assert (matches[0] == 0x24); // 2, 5
+
+  assert (vibrex_set_match (set, "", 0, matches) == 2);
+  assert (matches[0] == 0x60); // 5, 6
+
+  // Results agree with matching each pattern on its own
+  const char *texts[] = {"MSEED3", "zzz_B_H_E", "FDSN:NET_STA_10_B_H_Z/MSEED", "FDSN:NET_STA_10_B_H_Z/MSEED3x", "b"};
+  for (size_t t = 0; t < sizeof (texts) / sizeof (texts[0]); t++)
+  {
+    size_t found = vibrex_set_match (set, texts[t], strlen (texts[t]), matches);
+    size_t expected = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      vibrex_t *single = vibrex_compile (patterns[i], NULL);
+      assert (single != NULL);
+      bool matched = vibrex_match (single, texts[t]);
+      assert (matched == ((matches[i / 8] >> (i % 8)) & 1));
+      expected += matched;
+      vibrex_free (single);
+    }
+    assert (found == expected);
+  }
+  vibrex_set_free (set);
+
+  // Many patterns report their own index
+  char buffers[300][32];
+  const char *many[300];
+  for (int i = 0; i < 300; i++)
+  {
+    snprintf (buffers[i], sizeof (buffers[i]), "^ID%d_[A-Z]+$", i);
+    many[i] = buffers[i];
+  }
+  set = vibrex_set_compile (many, 300, NULL);
+  assert (set != NULL);
+  unsigned char bitmap[(300 + 7) / 8];
+  assert (vibrex_set_match (set, "ID257_ABC", 9, bitmap) == 1);
+  for (int i = 0; i < 300; i++)
+    assert (((bitmap[i / 8] >> (i % 8)) & 1) == (i == 257));
+  assert (vibrex_set_match (set, "ID257_abc", 9, bitmap) == 0);
+  vibrex_set_free (set);
+
+  // An invalid pattern fails the whole set
+  const char *invalid[] = {"abc", "(unclosed"};
+  error_message         = NULL;
+  assert (vibrex_set_compile (invalid, 2, &error_message) == NULL);
+  assert (error_message != NULL);
+
+  // An empty set matches nothing
+  set = vibrex_set_compile (NULL, 0, NULL);
+  assert (set != NULL);
+  assert (vibrex_set_match (set, "abc", 3, matches) == 0);
+  vibrex_set_free (set);
+
+  printf (TEST_PASS_SYMBOL " Pattern set tests passed\n");
+}
+
 void
 test_dotstar_optimization ()
 {
@@ -2007,9 +2372,393 @@ test_optimization_scenarios ()
   assert (vibrex_match (suffix, "world hello") == false);
   vibrex_free (suffix);
 
+  // Unanchored literal search resumes correctly after partial matches
+  vibrex_t *overlap = vibrex_compile ("abab", NULL);
+  assert (overlap != NULL);
+  assert (vibrex_match (overlap, "abaabab") == true);
+  assert (vibrex_match (overlap, "ababa") == true);
+  assert (vibrex_match (overlap, "abaaba") == false);
+  vibrex_free (overlap);
+
+  vibrex_t *overlap_end = vibrex_compile ("aab$", NULL);
+  assert (overlap_end != NULL);
+  assert (vibrex_match (overlap_end, "aaab") == true);
+  assert (vibrex_match (overlap_end, "aabx") == false);
+  assert (vibrex_match (overlap_end, "aab aab") == true);
+  vibrex_free (overlap_end);
+
+  // Near misses at every offset of a long text are scanned in one pass
+  char *near_miss = create_repeated_string ('a', 200000);
+  vibrex_t *long_literal = vibrex_compile ("aaaaaaaaaaaaaaaaaaab", NULL);
+  assert (long_literal != NULL);
+  test_performance (long_literal, near_miss, false, "literal near misses");
+  vibrex_free (long_literal);
+  free (near_miss);
+
   printf (TEST_PASS_SYMBOL " Optimization scenario tests passed\n");
 }
 
+void
+test_lazy_dfa ()
+{
+  printf ("Testing lazy DFA state cache...\n");
+
+  // Patterns here have more than 64 states so they are not matched by the
+  // bit-parallel engine.  Repeated scans are served from the state cache.
+  vibrex_t *cached = vibrex_compile ("[0-9]+x[a-z]*y(ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOP)?", NULL);
+  assert (cached != NULL);
+  for (int i = 0; i < 100; i++)
+  {
+    assert (vibrex_match (cached, "abc 123 456xzy yes") == true);
+    assert (vibrex_match (cached, "abc 123 456 no") == false);
+  }
+  vibrex_dfa_stats_t stats;
+  assert (vibrex_dfa_stats (cached, NULL, &stats) == true);
+  assert (stats.cache_hits > stats.cache_misses);
+  assert (stats.cache_flushes == 0);
+  assert (stats.nfa_fallbacks == 0);
+  assert (stats.cache_states > 0);
+  vibrex_free (cached);
+
+  // Literal prefix skipping must not miss overlapping candidates
+  vibrex_t *prefix = vibrex_compile ("bbb.", NULL);
+  assert (prefix != NULL);
+  assert (vibrex_match (prefix, "abbbba") == true);
+  assert (vibrex_match (prefix, "xxabbbb") == true);
+  assert (vibrex_match (prefix, "abbb") == false);
+  vibrex_free (prefix);
+
+  // "21st byte from the end is 'a'" needs 2^21 DFA states, far more than
+  // the cache holds, so matching flushes and then falls back to the NFA
+  vibrex_t *blowup = vibrex_compile ("(a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]|"
+                                     "cccccccccccccccccccccccccccccccccccccccccccccc)$",
+                                     NULL);
+  assert (blowup != NULL);
+  size_t text_len = 300000;
+  char *text      = malloc (text_len + 1);
+  assert (text != NULL);
+  unsigned seed = 12345;
+  for (size_t i = 0; i < text_len; i++)
+  {
+    seed    = seed * 1103515245 + 12345;
+    text[i] = (seed >> 16) & 1 ? 'a' : 'b';
+  }
+  text[text_len] = '\0';
+  text[text_len - 21] = 'a';
+  assert (vibrex_match (blowup, text) == true);
+  text[text_len - 21] = 'b';
+  assert (vibrex_match (blowup, text) == false);
+  assert (vibrex_dfa_stats (blowup, NULL, &stats) == true);
+  assert (stats.cache_flushes > 0);
+  assert (stats.nfa_fallbacks > 0);
+
+  // Every position starts an attempt that lives to the end of the text, so
+  // the NFA fallback must advance them all in one pass instead of rescanning
+  vibrex_t *quadratic = vibrex_compile ("(a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]|"
+                                        "cccccccccccccccccccccccccccccccccccccccccccccc|[ab]*x)$",
+                                        NULL);
+  assert (quadratic != NULL);
+  assert (vibrex_match (quadratic, text) == false);
+  assert (vibrex_dfa_stats (quadratic, NULL, &stats) == true);
+  assert (stats.nfa_fallbacks > 0);
+  text[text_len - 1] = 'x';
+  assert (vibrex_match (quadratic, text) == true);
+  text[text_len - 1] = 'a';
+  vibrex_free (quadratic);
+
+  // Caller-owned scratch keeps its own statistics
+  vibrex_scratch_t *scratch = vibrex_scratch_create (blowup);
+  assert (scratch != NULL);
+  assert (vibrex_match_scratch (blowup, scratch, "xxabbbbbbbbbbbbbbbbbbbb") == true);
+  assert (vibrex_dfa_stats (NULL, scratch, &stats) == true);
+  assert (stats.nfa_fallbacks == 0);
+  assert (stats.cache_misses > 0);
+  vibrex_scratch_free (scratch);
+  free (text);
+  vibrex_free (blowup);
+
+  // Cached states that loop on a class skip the rest of the run at once
+  vibrex_t *span = vibrex_compile ("x[A-Z0-9_]+y(ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOP)?", NULL);
+  assert (span != NULL);
+  size_t run_len = 1 << 20;
+  char *run      = malloc (run_len + 3);
+  assert (run != NULL);
+  run[0] = 'x';
+  for (size_t i = 1; i <= run_len; i++)
+    run[i] = "AZ09_Q"[i % 6];
+  run[run_len + 1] = 'y';
+  run[run_len + 2] = '\0';
+  assert (vibrex_match (span, run) == true);
+  run[run_len / 2] = '\xc1';
+  assert (vibrex_match (span, run) == false);
+  run[run_len / 2] = '-';
+  assert (vibrex_match (span, run) == false);
+  assert (vibrex_dfa_stats (span, NULL, &stats) == true);
+  assert (stats.nfa_fallbacks == 0);
+  assert (stats.cache_misses < 100);
+  vibrex_free (span);
+  free (run);
+
+  // Patterns without an NFA have no scratch space to report on
+  vibrex_t *literal = vibrex_compile ("cat|dog", NULL);
+  assert (literal != NULL);
+  assert (vibrex_dfa_stats (literal, NULL, &stats) == false);
+  vibrex_free (literal);
+
+  printf (TEST_PASS_SYMBOL " Lazy DFA tests passed\n");
+}
+
+void
+test_bitnfa ()
+{
+  printf ("Testing bit-parallel NFA...\n");
+
+  const char *test_cases[][2] = {
+      {"FDSN:XX_STA_00_B_H_Z/MSEED3", "true"},
+      {"FDSN:XX_STA_00_B_H_Z/MSEED", "true"},
+      {"FDSN:XX_STA_00_X_H_Z/MSEED", "false"},
+      {"FDSN:XX_STA_00_B_H_N/MSEED", "false"},
+      {"FDSN:XX_STA_00_B_H_Z/MSEE", "false"},
+      {"junk FDSN:XX_STA_00_L_H_Z/MSEED3 junk", "true"},
+  };
+  vibrex_t *fdsn = vibrex_compile ("FDSN:XX_.*_[HBL]_.*_Z/MSEED3?", NULL);
+  assert (fdsn != NULL);
+  test_multiple_matches (fdsn, test_cases, sizeof (test_cases) / sizeof (test_cases[0]), "Small FDSN pattern");
+
+  // The engine keeps no state between matches, so there are no cache statistics
+  vibrex_dfa_stats_t stats;
+  assert (vibrex_dfa_stats (fdsn, NULL, &stats) == false);
+  vibrex_free (fdsn);
+
+  // Anchors inside groups and alternatives
+  vibrex_t *anchors = vibrex_compile ("(^a|b)c(d$|e)", NULL);
+  assert (anchors != NULL);
+  test_match_case (anchors, "acd", true, "Start anchor at the start");
+  test_match_case (anchors, "xacd", false, "Start anchor past the start");
+  test_match_case (anchors, "xbce", true, "Unanchored alternative");
+  test_match_case (anchors, "bcdx", false, "End anchor before the end");
+  test_match_case (anchors, "bcex", true, "Unanchored end alternative");
+  vibrex_free (anchors);
+
+  // No DFA state explosion: a byte 21 from the end fits in one word
+  vibrex_t *blowup = vibrex_compile ("a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]$", NULL);
+  assert (blowup != NULL);
+  char text[4097];
+  for (int i = 0; i < 4096; i++)
+    text[i] = (i * 7919) % 3 ? 'b' : 'a';
+  text[4096]      = '\0';
+  text[4096 - 21] = 'a';
+  assert (vibrex_match (blowup, text) == true);
+  text[4096 - 21] = 'b';
+  assert (vibrex_match (blowup, text) == false);
+  vibrex_free (blowup);
+
+  // Long runs of bytes a state loops on are skipped with span scans, which
+  // must stop at the first byte outside the loop, including high bytes
+  size_t run_len = 1 << 20;
+  char *run      = malloc (run_len + 3);
+  assert (run != NULL);
+  vibrex_t *span = vibrex_compile ("x[A-Z0-9_]+y", NULL);
+  assert (span != NULL);
+  run[0] = 'x';
+  for (size_t i = 1; i <= run_len; i++)
+    run[i] = "AZ09_Q"[i % 6];
+  run[run_len + 1] = 'y';
+  run[run_len + 2] = '\0';
+  assert (vibrex_match (span, run) == true);
+  run[run_len / 2] = '\xc1';
+  assert (vibrex_match (span, run) == false);
+  run[run_len + 1] = 'z';
+  run[run_len / 2] = 'A';
+  assert (vibrex_match (span, run) == false);
+  vibrex_free (span);
+
+  vibrex_t *high = vibrex_compile ("k[\x80-\xff]+z", NULL);
+  assert (high != NULL);
+  run[0] = 'k';
+  for (size_t i = 1; i <= run_len; i++)
+    run[i] = (char)(0x80 + i % 128);
+  run[run_len + 1] = 'z';
+  assert (vibrex_match (high, run) == true);
+  run[run_len - 7] = 'A';
+  assert (vibrex_match (high, run) == false);
+  vibrex_free (high);
+
+  vibrex_t *dotstar = vibrex_compile ("ab.*cd", NULL);
+  assert (dotstar != NULL);
+  memset (run, 'a', run_len + 2);
+  run[1] = 'b';
+  assert (vibrex_match (dotstar, run) == false);
+  run[run_len]     = 'c';
+  run[run_len + 1] = 'd';
+  assert (vibrex_match (dotstar, run) == true);
+  vibrex_free (dotstar);
+  free (run);
+
+  // Empty subjects and patterns that match the empty string
+  vibrex_t *optional = vibrex_compile ("(ab)*c?", NULL);
+  assert (optional != NULL);
+  test_match_case (optional, "", true, "Empty subject");
+  vibrex_free (optional);
+
+  printf (TEST_PASS_SYMBOL " Bit-parallel NFA tests passed\n");
+}
+
+void
+test_dense_dfa ()
+{
+  printf ("Testing dense DFA tables...\n");
+
+  // Hundreds of anchored source identifiers share one compact trie
+  size_t capacity = 64 * 1024;
+  char *many      = malloc (capacity);
+  assert (many != NULL);
+  size_t len = 0;
+  for (int i = 0; i < 500; i++)
+    len += snprintf (many + len, capacity - len, "%s^FDSN:NET_S%03d_00_B_H_Z", i ? "|" : "", i);
+  vibrex_t *trie = vibrex_compile (many, NULL);
+  assert (trie != NULL);
+  vibrex_info_t info;
+  assert (vibrex_info (trie, &info));
+  assert (info.dfa_states < 64); // The common "_00_B_H_Z" ending is stored once
+  assert (vibrex_match (trie, "FDSN:NET_S000_00_B_H_Z") == true);
+  assert (vibrex_match (trie, "FDSN:NET_S499_00_B_H_Z/MSEED") == true);
+  assert (vibrex_match (trie, "FDSN:NET_S500_00_B_H_Z") == false);
+  assert (vibrex_match (trie, "FDSN:NET_S12_00_B_H_Z") == false);
+  assert (vibrex_match (trie, "xFDSN:NET_S000_00_B_H_Z") == false);
+  vibrex_free (trie);
+
+  // The same set anchored at the end, which needs an anchor on every
+  // alternative like the start did
+  len = 0;
+  for (int i = 0; i < 500; i++)
+    len += snprintf (many + len, capacity - len, "%sFDSN:NET_S%03d_00_B_H_Z$", i ? "|" : "", i);
+  vibrex_t *suffix = vibrex_compile (many, NULL);
+  assert (suffix != NULL);
+  assert (vibrex_info (suffix, &info));
+  assert (strcmp (info.engine, "dfa") == 0);
+  assert (vibrex_match (suffix, "id FDSN:NET_S250_00_B_H_Z") == true);
+  assert (vibrex_match (suffix, "id FDSN:NET_S250_00_B_H_Z ") == false);
+  assert (vibrex_match (suffix, "FDSN:NET_S250_00_B_H") == false);
+  vibrex_free (suffix);
+  free (many);
+
+  // Escaped metacharacters, including '|', are literal bytes
+  vibrex_t *escaped = vibrex_compile ("^a\\|b$", NULL);
+  assert (escaped != NULL);
+  assert (vibrex_match (escaped, "a|b") == true);
+  assert (vibrex_match (escaped, "a") == false);
+  assert (vibrex_match (escaped, "b") == false);
+  vibrex_free (escaped);
+
+  // Bytes outside every literal share a class but still break a match
+  vibrex_t *high = vibrex_compile ("^\xc3\xa9t\xc3\xa9$", NULL);
+  assert (high != NULL);
+  assert (vibrex_match (high, "\xc3\xa9t\xc3\xa9") == true);
+  assert (vibrex_match (high, "\xc3\xa9t\xc3\xa8") == false);
+  vibrex_free (high);
+
+  printf (TEST_PASS_SYMBOL " Dense DFA tests passed\n");
+}
+
+void
+test_literal_search ()
+{
+  printf ("Testing vectorized literal search...\n");
+
+  const char *patterns[] = {"FDSN:NET", "qqqq", "xyzzy[0-9]+", "cat|dog|bird", "hello|world|foo|bar",
+                            "a1|b2|c3|d4|e5"};
+  const char *needles[]  = {"FDSN:NET", "qqqq", "xyzzy7", "bird", "bar", "e5"};
+
+  // Every position in a buffer longer than one vector block, so each match
+  // is found by the vector loop or the scalar tail
+  char text[300];
+  for (size_t i = 0; i < sizeof (patterns) / sizeof (patterns[0]); i++)
+  {
+    vibrex_t *pattern = vibrex_compile (patterns[i], NULL);
+    assert (pattern != NULL);
+    size_t needle_len = strlen (needles[i]);
+
+    for (size_t len = needle_len; len <= sizeof (text); len += 37)
+    {
+      for (size_t at = 0; at + needle_len <= len; at++)
+      {
+        memset (text, needles[i][0] == 'q' ? 'x' : 'q', len);
+        memcpy (text + at, needles[i], needle_len);
+        assert (vibrex_match_n (pattern, text, len) == true);
+
+        // Breaking the last byte leaves the rare bytes in place but no match
+        text[at + needle_len - 1] = '\0';
+        assert (vibrex_match_n (pattern, text, len) == false);
+      }
+    }
+    vibrex_free (pattern);
+  }
+
+  // Partial literals at the end of the text must not match
+  vibrex_t *tail = vibrex_compile ("FDSN:NET", NULL);
+  assert (tail != NULL);
+  memset (text, '.', sizeof (text));
+  memcpy (text + sizeof (text) - 7, "FDSN:NE", 7);
+  assert (vibrex_match_n (tail, text, sizeof (text)) == false);
+  vibrex_free (tail);
+
+  printf (TEST_PASS_SYMBOL " Literal search tests passed\n");
+}
+
+void
+test_required_literals ()
+{
+  printf ("Testing required literal prefilter...\n");
+
+  const char *test_cases[][2] = {
+      // Required suffix after a leading .*
+      {"IU_ANMO_00_BHZ/MSEED", "true"},
+      {"IU_ANMO_00_BHZ/MSEE", "false"},
+      {"_BHZ/MSEED", "true"},
+      {"IU_ANMO_00_BHN/MSEED", "false"},
+  };
+  vibrex_t *suffix = vibrex_compile (".*_BHZ/MSEED", NULL);
+  assert (suffix != NULL);
+  test_multiple_matches (suffix, test_cases, sizeof (test_cases) / sizeof (test_cases[0]),
+                         "Required suffix literal");
+  vibrex_free (suffix);
+
+  // Inner literal after a repeated class
+  vibrex_t *inner = vibrex_compile ("[A-Z]+_STA_.*", NULL);
+  assert (inner != NULL);
+  test_match_case (inner, "NET_STA_00", true, "Inner literal present");
+  test_match_case (inner, "_STA_00", false, "Inner literal without the class before it");
+  test_match_case (inner, "NET_ST_A", false, "Inner literal missing");
+  vibrex_free (inner);
+
+  // One of several literals across alternations and small classes
+  vibrex_t *set = vibrex_compile ("FDSN:[A-Z]+_(BHZ|HHZ|[Ll]HZ)", NULL);
+  assert (set != NULL);
+  test_match_case (set, "FDSN:IU_HHZ", true, "Second alternative");
+  test_match_case (set, "FDSN:IU_lHZ", true, "Class inside an alternative");
+  test_match_case (set, "FDSN:IU_EHZ", false, "No required literal");
+  test_match_case (set, "FDSN:_BHZ", false, "Required literal but no match");
+  vibrex_free (set);
+
+  // Optional and repeated parts require nothing on their own
+  vibrex_t *optional = vibrex_compile ("x(abc)*y|(def)?z", NULL);
+  assert (optional != NULL);
+  test_match_case (optional, "xy", true, "Zero repetitions");
+  test_match_case (optional, "z", true, "Optional group absent");
+  test_match_case (optional, "w", false, "Neither alternative");
+  vibrex_free (optional);
+
+  // Subjects with embedded NUL bytes are scanned to their full length
+  vibrex_t *nul = vibrex_compile ("[0-9]+needle", NULL);
+  assert (nul != NULL);
+  assert (vibrex_match_n (nul, "hay\0stack 42needle", 19) == true);
+  assert (vibrex_match_n (nul, "hay\0stack 42needl", 18) == false);
+  vibrex_free (nul);
+
+  printf (TEST_PASS_SYMBOL " Required literal tests passed\n");
+}
+
 void
 test_empty_and_edge_cases ()
 {
@@ -2033,6 +2782,1080 @@ test_empty_and_edge_cases ()
   printf (TEST_PASS_SYMBOL " Empty and edge case tests passed\n");
 }
 
+void
+test_length_aware_matching ()
+{
+  printf ("Testing length-aware matching...\n");
+
+  // One pattern per optimization engine, each matched against a record
+  // that is not NUL-terminated and one with a NUL byte inside it
+  struct
+  {
+    const char *pattern;
+    const char *record; // Matching record, followed by bytes that must be ignored
+    size_t record_len;
+    const char *nul_record; // Record with a NUL byte before the match
+    size_t nul_record_len;
+  } cases[] = {
+      {"cat|dog", "my dogXX", 6, "my \0dog", 7},
+      {"^ab.*yz$", "ab12yzXX", 6, "ab\0" "1yz", 6},
+      {"https?://[a-z]+", "go http://xX", 11, "\0http://x", 9},
+      {"hello", "hellXhello", 4 + 1 + 5, "\0hello", 6},
+      {"a[0-9]+b", "xa12bXX", 5, "x\0a1b", 6},
+      {"^(foo|bar)baz$", "barbazXX", 6, "foobaz", 6},
+  };
+
+  for (size_t i = 0; i < sizeof (cases) / sizeof (cases[0]); i++)
+  {
+    vibrex_t *pattern = vibrex_compile (cases[i].pattern, NULL);
+    assert (pattern != NULL);
+    assert (vibrex_match_n (pattern, cases[i].record, cases[i].record_len) == true);
+    assert (vibrex_match_n (pattern, cases[i].record, cases[i].record_len - 1) == false);
+    assert (vibrex_match_n (pattern, cases[i].nul_record, cases[i].nul_record_len) == true);
+    vibrex_free (pattern);
+  }
+
+  // NUL bytes are ordinary text bytes
+  vibrex_t *any = vibrex_compile ("^a.b$", NULL);
+  assert (any != NULL);
+  assert (vibrex_match_n (any, "a\0b", 3) == true);
+  assert (vibrex_match (any, "a\0b") == false);
+  vibrex_free (any);
+
+  vibrex_t *negated = vibrex_compile ("x[^a-z]y", NULL);
+  assert (negated != NULL);
+  assert (vibrex_match_n (negated, "x\0y", 3) == true);
+  vibrex_scratch_t *scratch = vibrex_scratch_create (negated);
+  assert (scratch != NULL);
+  assert (vibrex_match_scratch_n (negated, scratch, "x\0y", 3) == true);
+  assert (vibrex_match_scratch_n (negated, scratch, "x\0yz", 2) == false);
+  vibrex_scratch_free (scratch);
+  vibrex_free (negated);
+
+  // Empty records and NULL arguments
+  vibrex_t *empty = vibrex_compile ("^$", NULL);
+  assert (empty != NULL);
+  assert (vibrex_match_n (empty, "abc", 0) == true);
+  assert (vibrex_match_n (empty, NULL, 0) == false);
+  assert (vibrex_match_n (NULL, "abc", 3) == false);
+  vibrex_free (empty);
+
+  printf (TEST_PASS_SYMBOL " Length-aware matching tests passed\n");
+}
+
+void
+test_match_bounds ()
+{
+  printf ("Testing match length and byte bounds...\n");
+
+  vibrex_bounds_t bounds;
+
+  // Both anchors engine, bounds come from a separate NFA
+  vibrex_t *fdsn = vibrex_compile ("^FDSN:IU_.*_Z$", NULL);
+  assert (fdsn != NULL);
+  assert (vibrex_bounds (fdsn, &bounds) == true);
+  assert (bounds.min_length == 10);
+  assert (bounds.max_length == SIZE_MAX);
+  assert (bounds.anchored_start && bounds.anchored_end);
+  assert (bounds.first_bytes['F' / 8] == (1 << ('F' % 8)));
+  assert (bounds.first_bytes['G' / 8] == (1 << ('F' % 8)));
+  assert (bounds.last_bytes['Z' / 8] == (1 << ('Z' % 8)));
+  assert (vibrex_match (fdsn, "FDSN:IU__Z") == true);
+  assert (vibrex_match (fdsn, "FDSN:IU_Z") == false);
+  assert (vibrex_match (fdsn, "FDSN:IU_ANMO_Z ") == false);
+  vibrex_free (fdsn);
+
+  // Fully anchored patterns have a longest subject too
+  vibrex_t *bounded = vibrex_compile ("^abc(de|f)?$", NULL);
+  assert (bounded != NULL);
+  assert (vibrex_bounds (bounded, &bounds) == true);
+  assert (bounds.min_length == 3 && bounds.max_length == 5);
+  assert ((bounds.last_bytes['c' / 8] & (1 << ('c' % 8))) && (bounds.last_bytes['e' / 8] & (1 << ('e' % 8))));
+  assert (!(bounds.last_bytes['d' / 8] & (1 << ('d' % 8))));
+  assert (vibrex_match (bounded, "abcde") == true);
+  assert (vibrex_match (bounded, "abcf") == true);
+  assert (vibrex_match (bounded, "abcdef") == false);
+  assert (vibrex_match (bounded, "abcd") == false);
+  vibrex_free (bounded);
+
+  // Unanchored patterns only reject short subjects
+  vibrex_t *loose = vibrex_compile ("x[0-9]+y", NULL);
+  assert (loose != NULL);
+  assert (vibrex_bounds (loose, &bounds) == true);
+  assert (bounds.min_length == 3 && bounds.max_length == SIZE_MAX);
+  assert (!bounds.anchored_start && !bounds.anchored_end);
+  assert (vibrex_match (loose, "x1") == false);
+  assert (vibrex_match (loose, "ax1yb") == true);
+  vibrex_free (loose);
+
+  // An anchor in one alternative does not anchor the pattern
+  vibrex_t *mixed = vibrex_compile ("(^a|b$)", NULL);
+  assert (mixed != NULL);
+  assert (vibrex_bounds (mixed, &bounds) == true);
+  assert (bounds.min_length == 1 && bounds.max_length == 1);
+  assert (!bounds.anchored_start && !bounds.anchored_end);
+  assert (vibrex_match (mixed, "xba") == false);
+  assert (vibrex_match (mixed, "xb") == true);
+  vibrex_free (mixed);
+
+  // Empty matches leave the first and last bytes unchecked
+  vibrex_t *optional = vibrex_compile ("^(ab)*$", NULL);
+  assert (optional != NULL);
+  assert (vibrex_bounds (optional, &bounds) == true);
+  assert (bounds.min_length == 0 && bounds.max_length == SIZE_MAX);
+  assert (vibrex_match (optional, "") == true);
+  assert (vibrex_match (optional, "abab") == true);
+  assert (vibrex_match (optional, "aba") == false);
+  vibrex_free (optional);
+
+  // Patterns that can never match have no bounds
+  vibrex_t *never = vibrex_compile ("a^b", NULL);
+  assert (never != NULL);
+  assert (vibrex_bounds (never, &bounds) == false);
+  assert (vibrex_match (never, "a^b") == false);
+  vibrex_free (never);
+  assert (vibrex_bounds (NULL, &bounds) == false);
+
+  printf (TEST_PASS_SYMBOL " Match bounds tests passed\n");
+}
+
+void
+test_pattern_info ()
+{
+  printf ("Testing engine introspection...\n");
+
+  vibrex_info_t info;
+  vibrex_counters_t counters;
+
+  // Specialized engines have no NFA
+  vibrex_t *url = vibrex_compile ("https?://[a-z]+", NULL);
+  assert (url != NULL);
+  assert (vibrex_info (url, &info) == true);
+  assert (strcmp (info.engine, "url") == 0);
+  assert (info.nfa_states == 0 && info.start_search == NULL && info.scratch_bytes == 0);
+  assert (info.memory_bytes > 0);
+  vibrex_free (url);
+
+  vibrex_t *words = vibrex_compile ("cat|dog|bird", NULL);
+  assert (words != NULL);
+  assert (vibrex_info (words, &info) == true);
+  assert (strcmp (info.engine, "literal-alt") == 0);
+  assert (info.dfa_states > 0 && info.dfa_bytes > 0);
+  vibrex_free (words);
+
+  // Small patterns run in the bit-parallel NFA behind a prefix search and
+  // a required literal
+  vibrex_t *station = vibrex_compile ("FDSN:[A-Z]+_ANMO_[0-9]+x", NULL);
+  assert (station != NULL);
+  assert (vibrex_info (station, &info) == true);
+  assert (strcmp (info.engine, "bitnfa") == 0);
+  assert (info.bitnfa_states > 0 && info.bitnfa_states <= info.nfa_states);
+  assert (strcmp (info.start_search, "prefix") == 0);
+  assert (info.prefix_len == 5 && memcmp (info.prefix, "FDSN:", 5) == 0);
+  assert (info.required_literals == 1);
+  assert (info.literal_len == 6 && memcmp (info.literal, "_ANMO_", 6) == 0);
+  vibrex_free (station);
+
+  // Anchored patterns never search for a start
+  vibrex_t *anchored = vibrex_compile ("^a(foo|bar)baz[0-9]*.*x", NULL);
+  assert (anchored != NULL);
+  assert (vibrex_info (anchored, &info) == true);
+  assert (info.start_search == NULL);
+  assert (info.required_literals == 2 && info.literal == NULL);
+  vibrex_free (anchored);
+
+  // Larger patterns use the lazy DFA and need scratch space
+  vibrex_t *large = vibrex_compile ("x(abcdefgh|ijklmnop|qrstuvwx|yz012345|6789ABCD|EFGHIJKL|MNOPQRST|UVWXYZ)+y", NULL);
+  assert (large != NULL);
+  assert (vibrex_info (large, &info) == true);
+  assert (strcmp (info.engine, "nfa") == 0);
+  assert (info.bitnfa_states == 0 && info.nfa_states > 64);
+  assert (strcmp (info.start_search, "first-byte") == 0 && info.prefix == NULL);
+  assert (info.byte_classes > 1 && info.scratch_bytes > 0);
+
+  // Counters are only kept in builds with VIBREX_COUNTERS
+  assert (vibrex_match (large, "xy") == false);
+  assert (vibrex_match (large, "--xabcdefgh--") == false);
+  assert (vibrex_match (large, "--xijklmnopUVWXYZy--") == true);
+  if (vibrex_counters (large, &counters, true))
+  {
+    assert (counters.subjects == 3 && counters.matches == 1);
+    assert (counters.bounds_rejects == 1 && counters.prefilter_rejects == 0);
+    assert (counters.bytes_scanned == 13 + 20);
+    assert (vibrex_counters (large, &counters, false) && counters.subjects == 0);
+  }
+  else
+  {
+    assert (counters.subjects == 0 && counters.nfa_steps == 0);
+  }
+  vibrex_free (large);
+
+  assert (vibrex_info (NULL, &info) == false);
+  assert (vibrex_counters (NULL, &counters, false) == false);
+
+  printf (TEST_PASS_SYMBOL " Engine introspection tests passed\n");
+}
+
+void
+test_batch_matching ()
+{
+  printf ("Testing batch matching...\n");
+
+  // One pattern per engine, batch results must agree with single matches
+  const char *patterns[] = {
+      "^FDSN:.*MSEED$",                     // Both anchors
+      "https?://[a-z.]+",                  // URL
+      "cat|dog|bird",                       // Literal alternation
+      "^FDSN:NET_(STA|ST1)_.*|^FDSN:XY_.*", // Advanced alternation
+      "^FDSN:NET_STA|FDSN:XY_STA",          // Anchored literal DFA
+      "_B_H_Z|_L_H_N$",                     // Unanchored literal DFA
+      "^AB$",                               // Exact literal
+      ".*",                                 // Dotstar
+      "[0-9]+_[A-Z]?_H_[ENZ]",              // Lazy DFA
+  };
+  const char *texts[] = {
+      "FDSN:NET_STA_00_B_H_Z/MSEED",
+      "FDSN:XY_STA_10_L_H_N",
+      "see https://example.org now",
+      "hotdog",
+      "",
+      "AB",
+      "ABC",
+      "FDSN:NET_ST1__B_H_E/MSEED3",
+      NULL,
+      "x_L_H_N",
+      "http:/bad",
+      "birdcat",
+  };
+  size_t num_texts = sizeof (texts) / sizeof (texts[0]);
+  size_t lens[sizeof (texts) / sizeof (texts[0])];
+  for (size_t t = 0; t < num_texts; t++)
+    lens[t] = texts[t] ? strlen (texts[t]) : 0;
+
+  for (size_t i = 0; i < sizeof (patterns) / sizeof (patterns[0]); i++)
+  {
+    vibrex_t *pattern = vibrex_compile (patterns[i], NULL);
+    assert (pattern != NULL);
+
+    uint8_t results[sizeof (texts) / sizeof (texts[0])];
+    uint8_t results_nul[sizeof (texts) / sizeof (texts[0])];
+    size_t matched     = vibrex_match_batch (pattern, texts, lens, num_texts, results);
+    size_t matched_nul = vibrex_match_batch (pattern, texts, NULL, num_texts, results_nul);
+    size_t expected    = 0;
+    for (size_t t = 0; t < num_texts; t++)
+    {
+      bool single = texts[t] && vibrex_match (pattern, texts[t]);
+      assert (results[t] == single);
+      assert (results_nul[t] == single);
+      expected += single;
+    }
+    assert (matched == expected);
+    assert (matched_nul == expected);
+    vibrex_free (pattern);
+  }
+
+  // Lengths limit each subject, embedded NUL bytes are matched as bytes
+  vibrex_t *exact = vibrex_compile ("^AB$", NULL);
+  assert (exact != NULL);
+  const char *buffers[] = {"ABC", "AB\0", "A"};
+  size_t sub_lens[]     = {2, 3, 1};
+  uint8_t results[3];
+  assert (vibrex_match_batch (exact, buffers, sub_lens, 3, results) == 1);
+  assert (results[0] == 1 && results[1] == 0 && results[2] == 0);
+
+  // An empty batch is not an error
+  assert (vibrex_match_batch (exact, buffers, sub_lens, 0, results) == 0);
+  vibrex_free (exact);
+
+  printf (TEST_PASS_SYMBOL " Batch matching tests passed\n");
+}
+
+// Feed a text to a new stream in chunks of a fixed size and end it
+static bool
+stream_match_chunks (const vibrex_t *pattern, const char *text, size_t text_len, size_t chunk)
+{
+  vibrex_stream_t *stream = vibrex_stream_begin (pattern);
+  assert (stream != NULL);
+  for (size_t offset = 0; offset < text_len; offset += chunk)
+    vibrex_stream_feed (stream, text + offset, text_len - offset < chunk ? text_len - offset : chunk);
+  return vibrex_stream_end (stream);
+}
+
+void
+test_streaming ()
+{
+  printf ("Testing streaming matching...\n");
+
+  // One pattern per engine, streams in any chunking must agree with single matches
+  const char *patterns[] = {
+      "^FDSN:.*MSEED$",                     // Both anchors
+      "https?://[a-z.]+",                  // URL
+      "cat|dog|bird",                       // Literal alternation
+      "^FDSN:NET_(STA|ST1)_.*|^FDSN:XY_.*", // Advanced alternation
+      "_B_H_Z|_L_H_N",                      // Unanchored literal DFA
+      "^AB$",                               // Exact literal
+      ".*",                                 // Dotstar
+      "[0-9]+_[A-Z]?_H_[ENZ]",              // Bit-parallel NFA
+      "[0-9]+_[A-Z]?_H_[ENZ](ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOP)?$", // Lazy DFA
+  };
+  const char *texts[] = {
+      "FDSN:NET_STA_00_B_H_Z/MSEED",
+      "FDSN:XY_STA_10_L_H_N",
+      "see https://example.org now",
+      "hotdog",
+      "",
+      "AB",
+      "ABC",
+      "FDSN:NET_ST1__B_H_E/MSEED3",
+      "x_L_H_N",
+      "http:/bad",
+      "birdcat",
+      "STA 10_B_H_Z",
+  };
+  for (size_t i = 0; i < sizeof (patterns) / sizeof (patterns[0]); i++)
+  {
+    vibrex_t *pattern = vibrex_compile (patterns[i], NULL);
+    assert (pattern != NULL);
+    for (size_t t = 0; t < sizeof (texts) / sizeof (texts[0]); t++)
+    {
+      bool single = vibrex_match (pattern, texts[t]);
+      for (size_t chunk = 1; chunk <= 8; chunk++)
+        assert (stream_match_chunks (pattern, texts[t], strlen (texts[t]), chunk) == single);
+    }
+    vibrex_free (pattern);
+  }
+
+  // A match is reported by the chunk it ends in, empty chunks change nothing
+  vibrex_t *literal = vibrex_compile ("needle", NULL);
+  assert (literal != NULL);
+  vibrex_stream_t *stream = vibrex_stream_begin (literal);
+  assert (stream != NULL);
+  assert (vibrex_stream_feed (stream, "hay nee", 7) == false);
+  assert (vibrex_stream_feed (stream, "", 0) == false);
+  assert (vibrex_stream_feed (stream, "dle hay", 7) == true);
+  assert (vibrex_stream_feed (stream, "more", 4) == true);
+  assert (vibrex_stream_end (stream) == true);
+
+  // End anchors only match once the text ends
+  vibrex_t *suffix = vibrex_compile ("MSEED$", NULL);
+  assert (suffix != NULL);
+  stream = vibrex_stream_begin (suffix);
+  assert (stream != NULL);
+  assert (vibrex_stream_feed (stream, "x/MSE", 5) == false);
+  assert (vibrex_stream_feed (stream, "ED", 2) == false);
+  assert (vibrex_stream_end (stream) == true);
+  stream = vibrex_stream_begin (suffix);
+  assert (stream != NULL);
+  assert (vibrex_stream_feed (stream, "x/MSEED", 7) == false);
+  assert (vibrex_stream_feed (stream, "3", 1) == false);
+  assert (vibrex_stream_end (stream) == false);
+  vibrex_free (suffix);
+
+  // Start anchors only match in the first chunk, however short
+  vibrex_t *prefix = vibrex_compile ("^(FDSN|SEED):[A-Z]+_", NULL);
+  assert (prefix != NULL);
+  assert (stream_match_chunks (prefix, "FDSN:NET_STA", 12, 1) == true);
+  assert (stream_match_chunks (prefix, "xFDSN:NET_STA", 13, 1) == false);
+  stream = vibrex_stream_begin (prefix);
+  assert (stream != NULL);
+  assert (vibrex_stream_feed (stream, "", 0) == false);
+  assert (vibrex_stream_feed (stream, "SEED:NET_", 9) == true);
+  assert (vibrex_stream_end (stream) == true);
+  vibrex_free (prefix);
+
+  // Embedded NUL bytes are matched as bytes
+  const char binary[] = "\0\0needle\0";
+  assert (stream_match_chunks (literal, binary, sizeof (binary) - 1, 3) == true);
+  assert (stream_match_chunks (literal, binary, 5, 3) == false);
+
+  // The text of an ended stream may be empty
+  stream = vibrex_stream_begin (literal);
+  assert (stream != NULL);
+  assert (vibrex_stream_end (stream) == false);
+  vibrex_free (literal);
+
+  // A pattern that thrashes the lazy DFA carries on in the NFA simulation
+  // across chunk boundaries
+  vibrex_t *blowup = vibrex_compile ("(a[ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab][ab]|"
+                                     "cccccccccccccccccccccccccccccccccccccccccccccc)$",
+                                     NULL);
+  assert (blowup != NULL);
+  size_t text_len = 300000;
+  char *text      = malloc (text_len);
+  assert (text != NULL);
+  unsigned seed = 12345;
+  for (size_t i = 0; i < text_len; i++)
+  {
+    seed    = seed * 1103515245 + 12345;
+    text[i] = (seed >> 16) & 1 ? 'a' : 'b';
+  }
+  text[text_len - 21] = 'a';
+  assert (stream_match_chunks (blowup, text, text_len, 250007) == true);
+  text[text_len - 21] = 'b';
+  assert (stream_match_chunks (blowup, text, text_len, 250007) == false);
+  free (text);
+  vibrex_free (blowup);
+
+  assert (vibrex_stream_begin (NULL) == NULL);
+  assert (vibrex_stream_feed (NULL, "x", 1) == false);
+  assert (vibrex_stream_end (NULL) == false);
+
+  printf (TEST_PASS_SYMBOL " Streaming matching tests passed\n");
+}
+
+// Search one text and check the reported bounds, (0, 0) expects no match
+static void
+check_search (const char *pattern_str, const char *text, bool expected, size_t start, size_t end)
+{
+  vibrex_t *pattern = vibrex_compile (pattern_str, NULL);
+  assert (pattern != NULL);
+  size_t match_start = SIZE_MAX;
+  size_t match_end   = SIZE_MAX;
+  bool found         = vibrex_search (pattern, text, strlen (text), &match_start, &match_end);
+  if (found != expected || (found && (match_start != start || match_end != end)))
+  {
+    printf ("FAILED: search '%s' in '%s', expected %s (%zu, %zu), got %s (%zu, %zu)\n", pattern_str, text,
+            expected ? "true" : "false", start, end, found ? "true" : "false", match_start, match_end);
+    assert (false);
+  }
+  assert (found == vibrex_match (pattern, text));
+
+  vibrex_scratch_t *scratch = vibrex_scratch_create (pattern);
+  assert (scratch != NULL);
+  size_t scratch_start = SIZE_MAX;
+  size_t scratch_end   = SIZE_MAX;
+  assert (vibrex_search_scratch (pattern, scratch, text, strlen (text), &scratch_start, &scratch_end) == found);
+  assert (!found || (scratch_start == start && scratch_end == end));
+  vibrex_scratch_free (scratch);
+  vibrex_free (pattern);
+}
+
+void
+test_search ()
+{
+  printf ("Testing match position reporting...\n");
+
+  // One pattern per engine
+  check_search ("^FDSN:.*MSEED$", "FDSN:NET_STA/MSEED", true, 0, 18);         // Both anchors
+  check_search ("https?://[a-z.]+", "see https://example.org now", true, 4, 23); // URL
+  check_search ("cat|dog|bird", "hotdog and cat", true, 3, 6);                 // Literal alternation
+  check_search ("^FDSN:NET_(STA|ST1)_.*|^FDSN:XY_.*", "FDSN:XY_10", true, 0, 10);
+  check_search ("_B_H_Z|_L_H_N", "STA_10_L_H_N_B_H_Z", true, 6, 12);           // Literal DFA
+  check_search ("^AB$", "AB", true, 0, 2);                                     // Exact literal
+  check_search (".*", "anything", true, 0, 8);                                 // Dotstar
+  check_search ("[0-9]+_[A-Z]?_H_[ENZ]", "STA 10_B_H_Z", true, 4, 12);         // Bit-parallel NFA
+  check_search ("[0-9]+_[A-Z]?_H_[ENZ](ABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOPQRSTUVWXYZABCDEFGHIJKLMNOP)?$",
+                "x 12_B_H_N", true, 2, 10); // Lazy DFA
+
+  // Leftmost start first, then the longest match from it
+  check_search ("abcd|bc", "abcd", true, 0, 4);
+  check_search ("bc|abcd", "xabcx", true, 2, 4);
+  check_search ("a+", "baaab", true, 1, 4);
+  check_search ("a(b|c)*d", "xxabcbcdd", true, 2, 8);
+
+  // Empty matches are found at the first position
+  check_search ("a*", "bbb", true, 0, 0);
+  check_search ("x?", "", true, 0, 0);
+
+  // Anchors bound the span
+  check_search ("b+$", "bbabb", true, 3, 5);
+  check_search ("^a.", "abab", true, 0, 2);
+  check_search ("^b", "ab", false, 0, 0);
+  check_search ("dog|cat", "horse", false, 0, 0);
+
+  // End anchors in a row all hold at the end of the text, in every engine
+  const char *chained[] = {"a$$", "(a$)$", "(a$|b)c*$", "(a|b$)$"};
+  const unsigned flags[] = {0, VIBREX_NO_BITNFA, VIBREX_NO_BITNFA | VIBREX_NO_LAZY_DFA};
+  for (size_t i = 0; i < sizeof (chained) / sizeof (chained[0]); i++)
+  {
+    check_search (chained[i], "ba", true, 1, 2);
+    for (size_t f = 0; f < sizeof (flags) / sizeof (flags[0]); f++)
+    {
+      vibrex_t *pattern = vibrex_compile_ex (chained[i], flags[f], NULL);
+      assert (pattern != NULL);
+      assert (vibrex_match (pattern, "ba") == true);
+      assert (vibrex_match (pattern, "ax") == false);
+      assert (vibrex_count (pattern, "ba", 2) == 1);
+      vibrex_free (pattern);
+    }
+  }
+
+  // Embedded NUL bytes and missing outputs
+  vibrex_t *needle = vibrex_compile ("ne+dle", NULL);
+  assert (needle != NULL);
+  size_t start = 0;
+  size_t end   = 0;
+  assert (vibrex_search (needle, "\0\0needle\0", 9, &start, &end) == true);
+  assert (start == 2 && end == 8);
+  assert (vibrex_search (needle, "xneedle", 7, NULL, NULL) == true);
+  assert (vibrex_search (needle, "xneedl", 6, NULL, &end) == false);
+  vibrex_free (needle);
+
+  assert (vibrex_search (NULL, "x", 1, NULL, NULL) == false);
+
+  printf (TEST_PASS_SYMBOL " Match position reporting tests passed\n");
+}
+
+// Find every match of a pattern in a text and check the bounds, given as
+// start and end pairs
+static void
+check_find_all (const char *pattern_str, const char *text, const size_t *bounds, size_t count)
+{
+  vibrex_t *pattern = vibrex_compile (pattern_str, NULL);
+  assert (pattern != NULL);
+  vibrex_iter_t *iter = vibrex_find_iter (pattern, text, strlen (text));
+  assert (iter != NULL);
+  size_t found = 0;
+  size_t start, end;
+  while (vibrex_iter_next (iter, &start, &end))
+  {
+    if (found >= count || start != bounds[2 * found] || end != bounds[2 * found + 1])
+    {
+      printf ("FAILED: find all '%s' in '%s', match %zu at (%zu, %zu)\n", pattern_str, text, found, start, end);
+      assert (false);
+    }
+    found++;
+  }
+  assert (found == count);
+  assert (vibrex_iter_next (iter, NULL, NULL) == false);
+  vibrex_iter_free (iter);
+  assert (vibrex_count (pattern, text, strlen (text)) == count);
+  vibrex_free (pattern);
+}
+
+// Find every match of a pattern in a run of 'A's, each a match of its own,
+// followed by a tail whose match bounds are given from the end of the run
+static void
+check_find_after_run (const char *pattern_str, size_t run_len, const char *tail, const size_t *bounds, size_t count)
+{
+  size_t tail_len = strlen (tail);
+  char *text      = malloc (run_len + tail_len + 1);
+  size_t *all     = malloc (2 * (run_len + count) * sizeof (size_t));
+  assert (text != NULL && all != NULL);
+  memset (text, 'A', run_len);
+  memcpy (text + run_len, tail, tail_len + 1);
+  for (size_t i = 0; i < run_len; i++)
+  {
+    all[2 * i]     = i;
+    all[2 * i + 1] = i + 1;
+  }
+  for (size_t i = 0; i < 2 * count; i++)
+    all[2 * run_len + i] = run_len + bounds[i];
+  check_find_all (pattern_str, text, all, run_len + count);
+  free (all);
+  free (text);
+}
+
+void
+test_find_all ()
+{
+  printf ("Testing finding every match...\n");
+
+  // Non-overlapping matches, each leftmost-longest after the one before
+  check_find_all ("_B_H_Z", "A_B_H_Z_B_H_Z x_B_H_", (const size_t[]){1, 7, 7, 13}, 2);
+  check_find_all ("cat|dog|bird", "catdog, hotdog and a bird", (const size_t[]){0, 3, 3, 6, 11, 14, 21, 25}, 4);
+  check_find_all ("https?://[a-z.]+", "http://a.org https://b.net", (const size_t[]){0, 12, 13, 26}, 2);
+  check_find_all ("[0-9]+_[A-Z]?_H_[ENZ]", "10_B_H_Z 20__H_N 3_X_H", (const size_t[]){0, 8, 9, 16}, 2);
+  check_find_all ("aa|a", "aaaaa", (const size_t[]){0, 2, 2, 4, 4, 5}, 3);
+  check_find_all ("NET_(STA|ST1)_[0-9]+", "NET_STA_1 NET_ST1_22 NET_ST2_3", (const size_t[]){0, 9, 10, 20}, 2);
+
+  // Empty matches move on by one byte
+  check_find_all ("a*", "baab", (const size_t[]){0, 0, 1, 3, 3, 3, 4, 4}, 4);
+  check_find_all ("x?", "", (const size_t[]){0, 0}, 1);
+
+  // Anchors only match at the ends of the whole buffer
+  check_find_all ("^ab", "ababab", (const size_t[]){0, 2}, 1);
+  check_find_all ("ab$", "ababab", (const size_t[]){4, 6}, 1);
+  check_find_all ("^FDSN:.*MSEED$", "FDSN:A/MSEED", (const size_t[]){0, 12}, 1);
+  check_find_all ("dog|cat", "horse", NULL, 0);
+
+  // Attempts that could replace a match run on to the end of a long run, so
+  // the matches after it are found in the same pass rather than searched
+  // for again from each one, which would take hours
+  check_find_after_run ("A.*Z|A", 1 << 20, "", NULL, 0);
+  check_find_after_run ("[A-Z]*X|A", 1 << 20, ".BX", (const size_t[]){1, 3}, 1);
+  check_find_after_run ("A.*Z|A|xa|a*b", 1 << 13, "xaab", (const size_t[]){0, 2, 2, 4}, 2);
+  check_find_after_run ("A.*Z|A|a*", 1 << 13, "baab", (const size_t[]){0, 0, 1, 3, 3, 3, 4, 4}, 4);
+
+  // A large buffer with embedded NUL bytes
+  size_t text_len = 1 << 20;
+  char *text      = calloc (text_len, 1);
+  assert (text != NULL);
+  size_t expected = 0;
+  for (size_t i = 0; i + 16 < text_len; i += 4099)
+  {
+    memcpy (text + i, i % 3 ? "STA_00_B_H_Z" : "STA_00_L_H_N", 12);
+    expected += i % 3 ? 1 : 0;
+  }
+  vibrex_t *channel = vibrex_compile ("_[0-9]+_B_H_[ENZ]", NULL);
+  assert (channel != NULL);
+  assert (vibrex_count (channel, text, text_len) == expected);
+  vibrex_iter_t *iter = vibrex_find_iter (channel, text, text_len);
+  assert (iter != NULL);
+  size_t start, end;
+  assert (vibrex_iter_next (iter, &start, &end) == true);
+  assert (start == 4099 + 3 && end == 4099 + 12);
+  vibrex_iter_free (iter);
+  vibrex_free (channel);
+  free (text);
+
+  assert (vibrex_find_iter (NULL, "x", 1) == NULL);
+  assert (vibrex_iter_next (NULL, NULL, NULL) == false);
+  assert (vibrex_count (NULL, "x", 1) == 0);
+  vibrex_iter_free (NULL);
+
+  printf (TEST_PASS_SYMBOL " Find all matches tests passed\n");
+}
+
+// Check that parallel scans of a buffer agree with vibrex_match_n() and vibrex_count()
+static void
+check_parallel (const char *pattern_str, const char *text, size_t text_len)
+{
+  vibrex_t *pattern = vibrex_compile (pattern_str, NULL);
+  assert (pattern != NULL);
+  bool matched = vibrex_match_n (pattern, text, text_len);
+  size_t count = vibrex_count (pattern, text, text_len);
+
+  const int thread_counts[] = {1, 2, 3, 4, 8};
+  for (size_t i = 0; i < sizeof (thread_counts) / sizeof (thread_counts[0]); i++)
+  {
+    bool parallel_matched = vibrex_match_parallel (pattern, text, text_len, thread_counts[i]);
+    size_t parallel_count = vibrex_count_parallel (pattern, text, text_len, thread_counts[i]);
+    if (parallel_matched != matched || parallel_count != count)
+    {
+      printf ("FAILED: parallel scan of '%s' on %d threads, expected %s and %zu matches, got %s and %zu\n",
+              pattern_str, thread_counts[i], matched ? "true" : "false", count, parallel_matched ? "true" : "false",
+              parallel_count);
+      assert (false);
+    }
+  }
+  vibrex_free (pattern);
+}
+
+void
+test_parallel_scan ()
+{
+  printf ("Testing parallel scans of large buffers...\n");
+
+  // Station lines, so chunk boundaries fall inside matches
+  const char *line = "FDSN:IU_ANMO_00_B_H_Z 2024-01-01T00:00:00 12345\n";
+  size_t line_len  = strlen (line);
+  size_t text_len  = 1 << 20;
+  char *text       = malloc (text_len);
+  assert (text != NULL);
+  for (size_t i = 0; i < text_len; i++)
+    text[i] = line[i % line_len];
+
+  check_parallel ("B_H_Z", text, text_len);                // Literal, chunks overlap
+  check_parallel ("[0-9]{5}", text, text_len);             // Bounded, chunks overlap
+  check_parallel ("(IU|II)_[A-Z]+_[0-9]+", text, text_len); // Unbounded, chunks end at lines
+  check_parallel ("[A-Z]*", text, text_len);               // Empty matches
+  check_parallel ("1234|34 F", text, text_len);            // Matches across lines
+  check_parallel ("^FDSN", text, text_len);                // Anchored, one thread
+  check_parallel ("12345.FDSN", text, text_len);           // Unbounded across lines, one thread
+  check_parallel ("XYZZY", text, text_len);                // No match
+
+  // Matches straddling a chunk boundary are found once
+  memset (text, 'x', text_len);
+  memcpy (text + (64 * 1024) - 3, "NEEDLE", 6);
+  check_parallel ("NEEDLE", text, text_len);
+  check_parallel ("NE+D", text, text_len);
+  check_parallel ("x{3}N", text, text_len);
+
+  // Counts where the chunks' own searches never join the merged one
+  memset (text, 'a', text_len);
+  check_parallel ("aaa", text, text_len);
+  check_parallel ("a{2,5}", text, text_len);
+  vibrex_t *pattern = vibrex_compile ("aaa", NULL);
+  assert (pattern != NULL);
+  assert (vibrex_count_parallel (pattern, text, text_len, 4) == text_len / 3);
+  vibrex_free (pattern);
+
+  // Small buffers and invalid arguments
+  check_parallel ("a+", "baab", 4);
+  assert (vibrex_match_parallel (NULL, text, text_len, 4) == false);
+  assert (vibrex_count_parallel (NULL, text, text_len, 4) == 0);
+  free (text);
+
+  printf (TEST_PASS_SYMBOL " Parallel scan tests passed\n");
+}
+
+// Build an alternation of count alternatives, each format printed with its index
+static char *
+alternation_of (const char *format, int count)
+{
+  size_t capacity = (strlen (format) + 8) * count + 1;
+  char *text      = malloc (capacity);
+  assert (text != NULL);
+  size_t len = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (i)
+      text[len++] = '|';
+    len += snprintf (text + len, capacity - len, format, i);
+  }
+  return text;
+}
+
+void
+test_oversized_alternations ()
+{
+  printf ("Testing alternations too large for the NFA engines...\n");
+
+  // Alternations past MAX_NFA_STATES (4096) that a specialized engine
+  // accepts are searched, streamed and counted like any other pattern
+  const char *text = "IU_S0007_BHZ IU_S0400_BHZ IU_S0399_BHZIU_S0001_BHZ";
+  const struct
+  {
+    const char *format;
+    const char *engine;
+    const char *subject;
+    size_t bounds[6];
+    size_t count;
+  } cases[] = {
+      {"IU_S%04d_BHZ", "literal-alt", text, {0, 12, 26, 38, 38, 50}, 3},
+      {"^IU_S%04d_BHZ", "dfa", text, {0, 12}, 1},
+      {"IU_S%04d_BHZ$", "dfa", text, {38, 50}, 1},
+      {"^IU_S%04d_.HZ$", "advanced-alt", "IU_S0123_LHZ", {0, 12}, 1},
+      {".*IU_S%04d_BHZ", "advanced-alt", text, {0, 50}, 1},
+  };
+  for (size_t i = 0; i < sizeof (cases) / sizeof (cases[0]); i++)
+  {
+    char *alternation = alternation_of (cases[i].format, 400);
+    vibrex_t *pattern = vibrex_compile (alternation, NULL);
+    assert (pattern != NULL);
+    vibrex_info_t info;
+    assert (vibrex_info (pattern, &info));
+    assert (strcmp (info.engine, cases[i].engine) == 0 && info.nfa_states == 0);
+
+    const char *subject = cases[i].subject;
+    check_search (alternation, subject, true, cases[i].bounds[0], cases[i].bounds[1]);
+    check_search (alternation, "IU_S0400_BHZ", false, 0, 0);
+    check_find_all (alternation, subject, cases[i].bounds, cases[i].count);
+    for (size_t chunk = 1; chunk <= 13; chunk += 4)
+    {
+      assert (stream_match_chunks (pattern, subject, strlen (subject), chunk) == true);
+      assert (stream_match_chunks (pattern, "IU_S0400_BHZ", 12, chunk) == false);
+    }
+
+    // The serialized pattern searches the same way
+    size_t size = vibrex_serialize (pattern, NULL, 0);
+    void *data  = malloc (size);
+    assert (data != NULL && vibrex_serialize (pattern, data, size) == size);
+    vibrex_t *loaded = vibrex_deserialize (data, size, NULL);
+    assert (loaded != NULL);
+    assert (vibrex_count (loaded, subject, strlen (subject)) == cases[i].count);
+    vibrex_free (loaded);
+    free (data);
+    vibrex_free (pattern);
+    free (alternation);
+  }
+
+  // Large buffers, scanned in chunks where the pattern allows it
+  const char *line = "IU_S0123_BHZ 2024-01-01 IU_S0456_BHN\n";
+  size_t line_len  = strlen (line);
+  size_t text_len  = 1 << 20;
+  char *buffer     = malloc (text_len);
+  assert (buffer != NULL);
+  for (size_t i = 0; i < text_len; i++)
+    buffer[i] = line[i % line_len];
+  const char *formats[] = {"IU_S%04d_BHZ", "^IU_S%04d_BHZ", "IU_S%04d_BHZ$"};
+  for (size_t i = 0; i < sizeof (formats) / sizeof (formats[0]); i++)
+  {
+    char *alternation = alternation_of (formats[i], 400);
+    check_parallel (alternation, buffer, text_len);
+    free (alternation);
+  }
+  char *stations    = alternation_of ("IU_S%04d_BHZ", 400);
+  vibrex_t *pattern = vibrex_compile (stations, NULL);
+  assert (pattern != NULL);
+  assert (vibrex_count_parallel (pattern, buffer, text_len, 4) == (text_len - 13) / line_len + 1);
+  vibrex_free (pattern);
+  free (stations);
+  free (buffer);
+
+  printf (TEST_PASS_SYMBOL " Oversized alternation tests passed\n");
+}
+
+// Match one text case-insensitively, on its own and through a serialized copy
+static void
+check_icase (const char *pattern_str, const char *text, bool expected)
+{
+  const char *error = NULL;
+  vibrex_t *pattern = vibrex_compile_ex (pattern_str, VIBREX_ICASE, &error);
+  if (!pattern)
+  {
+    printf ("FAILED: compiling '%s' with VIBREX_ICASE: %s\n", pattern_str, error ? error : "unknown");
+    assert (false);
+  }
+  bool found = vibrex_match (pattern, text);
+  if (found != expected)
+  {
+    printf ("FAILED: ICASE '%s' on '%s', expected %s, got %s\n", pattern_str, text, expected ? "true" : "false",
+            found ? "true" : "false");
+    assert (false);
+  }
+
+  size_t size = vibrex_serialize (pattern, NULL, 0);
+  char *data  = malloc (size);
+  assert (data != NULL);
+  assert (vibrex_serialize (pattern, data, size) == size);
+  vibrex_t *loaded = vibrex_deserialize (data, size, NULL);
+  assert (loaded != NULL);
+  assert (vibrex_match (loaded, text) == expected);
+  vibrex_free (loaded);
+  free (data);
+  vibrex_free (pattern);
+}
+
+void
+test_case_insensitive ()
+{
+  printf ("Testing case-insensitive matching...\n");
+
+  // One pattern per engine
+  check_icase ("brown", "The BROWN fox", true);                                    // Literal DFA
+  check_icase ("^Hello$", "hELLO", true);                                          // Exact literal
+  check_icase ("cat|dog|bird", "HOT DOG", true);                                   // Literal alternation
+  check_icase ("cat|dog|bird", "HORSE", false);
+  check_icase ("^FDSN:.*mseed$", "fdsn:NET_STA/MSEED", true);                      // Both anchors
+  check_icase ("^FDSN:.*mseed$", "fdsn:NET_STA/MSEEX", false);
+  check_icase ("https?://[a-z.]+", "SEE HTTPS://EXAMPLE.ORG", true);               // No URL engine
+  check_icase ("^FDSN:NET_(STA|ST1)_.*|^FDSN:XY_.*", "fdsn:xy_10", true);          // No advanced alternation
+  check_icase ("[0-9]+_[a-z]?_h_[enz]", "STA 10_B_H_Z", true);                     // Bit-parallel NFA
+  check_icase ("(ab|cd)*e+$", "ABcdCdEE", true);                                   // NFA
+  check_icase (".*", "ANYTHING", true);                                            // Dotstar
+
+  // Classes gain the other case before negation
+  check_icase ("^[a-c]+$", "AbC", true);
+  check_icase ("^[^a]$", "A", false);
+  check_icase ("^[^a]$", "b", true);
+  check_icase ("^[A-Z0-9_]+$", "net_01", true);
+
+  // Non-letters and escapes are unchanged
+  check_icase ("^a\\.b$", "A.B", true);
+  check_icase ("^a\\.b$", "AXB", false);
+  check_icase ("^1_2$", "1_2", true);
+  check_icase ("^[@`]$", "@", true);
+  check_icase ("^[@`]$", "`", true);
+  check_icase ("^@$", "`", false);
+  check_icase ("^\xe9$", "\xc9", false);
+
+  // Required literals are searched for in either case
+  check_icase ("[0-9]+_needle_[0-9]+", "xx 12_NeEdLe_34 yy", true);
+  check_icase ("[0-9]+_needle_[0-9]+", "xx 12_NEEDL_34 yy", false);
+  check_icase ("(x|y)+abc.*def", "YXABCxxDEF", true);
+
+  // Match bounds and iteration find matches in either case
+  vibrex_t *pattern = vibrex_compile_ex ("B+", VIBREX_ICASE, NULL);
+  assert (pattern != NULL);
+  size_t start = 0;
+  size_t end   = 0;
+  assert (vibrex_search (pattern, "aabBbc", 6, &start, &end) == true);
+  assert (start == 2 && end == 5);
+  assert (vibrex_count (pattern, "b B bb BcB", 10) == 5);
+  vibrex_free (pattern);
+
+  // Without the flag matching stays case-sensitive
+  pattern = vibrex_compile_ex ("brown", 0, NULL);
+  assert (pattern != NULL);
+  assert (vibrex_match (pattern, "BROWN") == false);
+  assert (vibrex_match (pattern, "brown") == true);
+  vibrex_free (pattern);
+
+  const char *error = NULL;
+  assert (vibrex_compile_ex ("brown", 0x80u, &error) == NULL);
+  assert (error != NULL && strcmp (error, "Unknown compile flags") == 0);
+  assert (vibrex_compile_ex (NULL, VIBREX_ICASE, NULL) == NULL);
+
+  printf (TEST_PASS_SYMBOL " Case-insensitive matching tests passed\n");
+}
+
+void
+test_engine_flags ()
+{
+  printf ("Testing compile flags that turn engines off...\n");
+
+  // Each pattern is given to a different engine by default, and every
+  // engine below it must give the same answers
+  const char *patterns[]   = {"brown", "^FDSN:.*mseed$", "cat|dog|bird", "^pre_(x+)_suf|^pre_yy_suf", ".*",
+                              "[0-9]+_[a-z]?_h_[enz]", "(ab|cd)*e+$"};
+  const char *subjects[]   = {"the brown fox", "FDSN:NET_STA/mseed", "hot dog", "pre_xxx_suf", "",
+                              "sta 10_b_h_z", "abcdee", "pre_x_suff", "FDSN:x", "horse", "abce"};
+  const unsigned flags[]   = {VIBREX_NO_SPECIALIZED, VIBREX_NO_SPECIALIZED | VIBREX_NO_BITNFA,
+                              VIBREX_NO_SPECIALIZED | VIBREX_NO_BITNFA | VIBREX_NO_LAZY_DFA};
+  const char *engines[][2] = {{"bitnfa", "nfa"}, {"nfa", "nfa"}, {"nfa", "nfa"}};
+  for (size_t i = 0; i < sizeof (patterns) / sizeof (patterns[0]); i++)
+  {
+    vibrex_t *reference = vibrex_compile (patterns[i], NULL);
+    assert (reference != NULL);
+    for (size_t f = 0; f < sizeof (flags) / sizeof (flags[0]); f++)
+    {
+      vibrex_t *pattern = vibrex_compile_ex (patterns[i], flags[f], NULL);
+      assert (pattern != NULL);
+      vibrex_info_t info;
+      assert (vibrex_info (pattern, &info));
+      assert (strcmp (info.engine, engines[f][0]) == 0 || strcmp (info.engine, engines[f][1]) == 0);
+      for (size_t j = 0; j < sizeof (subjects) / sizeof (subjects[0]); j++)
+        assert (vibrex_match (pattern, subjects[j]) == vibrex_match (reference, subjects[j]));
+
+      // Streams work for every pattern once the specialized engines are off
+      vibrex_stream_t *stream = vibrex_stream_begin (pattern);
+      assert (stream != NULL);
+      vibrex_stream_feed (stream, subjects[i], strlen (subjects[i]));
+      assert (vibrex_stream_end (stream) == true);
+      vibrex_free (pattern);
+    }
+    vibrex_free (reference);
+  }
+
+  // Without the lazy DFA no states are cached
+  vibrex_t *simulated = vibrex_compile_ex ("(a|b)*abb", VIBREX_NO_LAZY_DFA, NULL);
+  assert (simulated != NULL);
+  vibrex_scratch_t *scratch = vibrex_scratch_create (simulated);
+  assert (scratch != NULL);
+  assert (vibrex_match_scratch (simulated, scratch, "ababababb ") == true);
+  assert (vibrex_match_scratch (simulated, scratch, "abababab") == false);
+  vibrex_dfa_stats_t stats;
+  assert (vibrex_dfa_stats (simulated, scratch, &stats) == true);
+  assert (stats.cache_states == 0 && stats.cache_misses == 0);
+  vibrex_scratch_free (scratch);
+  vibrex_free (simulated);
+
+  // The flags are kept through serialization
+  vibrex_t *plain = vibrex_compile_ex ("cat|dog|bird", VIBREX_NO_SPECIALIZED | VIBREX_ICASE, NULL);
+  assert (plain != NULL);
+  size_t size  = vibrex_serialize (plain, NULL, 0);
+  void *buffer = malloc (size);
+  assert (buffer != NULL && vibrex_serialize (plain, buffer, size) == size);
+  vibrex_t *loaded = vibrex_deserialize (buffer, size, NULL);
+  assert (loaded != NULL);
+  vibrex_info_t info;
+  assert (vibrex_info (loaded, &info) && strcmp (info.engine, "bitnfa") == 0);
+  assert (vibrex_match (loaded, "HOT DOG") == true);
+  vibrex_free (loaded);
+  free (buffer);
+  vibrex_free (plain);
+
+  printf (TEST_PASS_SYMBOL " Engine flag tests passed\n");
+}
+
+void
+test_serialization ()
+{
+  printf ("Testing pattern serialization...\n");
+
+  // One pattern for each matching engine, with subjects that match and not
+  const struct
+  {
+    const char *pattern;
+    const char *match;
+    const char *no_match;
+  } cases[] = {
+      {"IU_ANMO", "XX_IU_ANMO_00", "IU_ANM"},                       // Dense DFA
+      {"cat|dog|bird", "hotdog", "cow"},                            // Literal alternation
+      {"^FDSN:.*_BHZ$", "FDSN:IU_ANMO_BHZ", "FDSN:IU_ANMO_BHN"},    // Both anchors
+      {"https?://[a-z.]+", "see https://example.org", "http:/x"},   // URL
+      {"^IU.*|^II.*|^G.*", "GE_WLF", "US_WLF"},                     // Advanced alternation
+      {"^AB[0-9]+|^CD[0-9]+|^EF", "CD42", "CDx42"},                 // Nested sub-patterns
+      {".*_BHZ/MSEED", "IU_ANMO_00_BHZ/MSEED", "IU_ANMO_00_BHZ"},   // Required literal
+      {"^[0-9]+(\\.[0-9]*)?$", "3.14", "3.14.15"},                  // NFA
+      {"^[0-9a-f]{70}$", "0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef012345",
+       "0123456789abcdef"},                                         // Too large for the bit-parallel NFA
+      {"^FDSN:IU_ANMO_00_BHZ$|^FDSN:IU_COLA_00_BHZ$|^FDSN:IU_KONO_00_BHZ$", "FDSN:IU_COLA_00_BHZ",
+       "FDSN:IU_COLA_10_BHZ"},                                      // Trie of middle parts
+      {"^FDSN:IU_ANMO_.*_BHZ$|^FDSN:IU_COLA_[0-9]+_BHZ$|^FDSN:IU_KONO_00_BHZ$", "FDSN:IU_COLA_10_BHZ",
+       "FDSN:IU_COLA_x_BHZ"},                                       // One pattern for all middle parts
+      {".*", "anything", NULL},                                     // Dotstar
+      {"", "anything", NULL},                                       // Empty concatenations
+      {"()", "anything", NULL},
+      {"a()b", "xaby", "a b"},
+      {"a|", "anything", NULL},
+      {"(a|)", "anything", NULL},
+      {"c{0}", "anything", NULL},
+      {"x(b{0})y", "xy", "xby"},
+      {"(a|b{0})$", "anything", NULL},
+  };
+
+  for (size_t i = 0; i < sizeof (cases) / sizeof (cases[0]); i++)
+  {
+    vibrex_t *pattern = vibrex_compile (cases[i].pattern, NULL);
+    assert (pattern != NULL);
+
+    size_t size = vibrex_serialize (pattern, NULL, 0);
+    assert (size > 0);
+    char *data = malloc (size);
+    assert (data != NULL);
+    assert (vibrex_serialize (pattern, data, size - 1) == size);
+    assert (vibrex_serialize (pattern, data, size) == size);
+
+    vibrex_t *copied = vibrex_deserialize (data, size, NULL);
+    vibrex_t *mapped = vibrex_deserialize_mapped (data, size, NULL);
+    assert (copied != NULL && mapped != NULL);
+
+    // Serializing a loaded pattern writes the same data
+    char *again = malloc (size);
+    assert (again != NULL);
+    assert (vibrex_serialize (mapped, again, size) == size);
+    assert (memcmp (data, again, size) == 0);
+    free (again);
+
+    vibrex_t *loaded[] = {copied, mapped};
+    for (int j = 0; j < 2; j++)
+    {
+      assert (vibrex_match (loaded[j], cases[i].match) == true);
+      if (cases[i].no_match)
+        assert (vibrex_match (loaded[j], cases[i].no_match) == false);
+    }
+
+    // A copied pattern no longer needs the data
+    memset (data, 0, size);
+    assert (vibrex_match (copied, cases[i].match) == true);
+
+    vibrex_free (copied);
+    vibrex_free (mapped);
+    vibrex_free (pattern);
+    free (data);
+  }
+
+  // Large literal alternations keep their tables in the data
+  vibrex_t *many = vibrex_compile ("AAAA|BBBB|CCCC|DDDD|EEEE|FFFF|GGGG|HHHH|IIII|JJJJ", NULL);
+  assert (many != NULL);
+  size_t size = vibrex_serialize (many, NULL, 0);
+  char *data  = malloc (size);
+  assert (data != NULL);
+  vibrex_serialize (many, data, size);
+  vibrex_t *mapped = vibrex_deserialize_mapped (data, size, NULL);
+  assert (mapped != NULL);
+  assert (vibrex_match (mapped, "xxHHHHxx") == true);
+  assert (vibrex_match (mapped, "xxHHHxx") == false);
+  vibrex_free (mapped);
+
+  // Truncated, foreign and corrupted data are rejected
+  const char *error = NULL;
+  assert (vibrex_deserialize (NULL, 0, &error) == NULL && error != NULL);
+  assert (vibrex_deserialize (data, 16, NULL) == NULL);
+  assert (vibrex_deserialize (data, size - 1, NULL) == NULL);
+  assert (vibrex_deserialize ("not a pattern at all, not even close to one", 44, NULL) == NULL);
+
+  char *bad = malloc (size);
+  assert (bad != NULL);
+  memcpy (bad, data, size);
+  bad[8] ^= 0x7f; // Version
+  error = NULL;
+  assert (vibrex_deserialize (bad, size, &error) == NULL && error != NULL);
+  memcpy (bad, data, size);
+  memset (bad + size - 64, 0xff, 64); // Dense DFA table entries
+  assert (vibrex_deserialize (bad, size, NULL) == NULL);
+  free (bad);
+
+  assert (vibrex_serialize (NULL, data, size) == 0);
+  vibrex_free (many);
+  free (data);
+
+  printf (TEST_PASS_SYMBOL " Serialization tests passed\n");
+}
+
 void
 test_error_handling_and_limits ()
 {
@@ -2070,35 +3893,82 @@ test_error_handling_and_limits ()
 
   free (oversized_pattern);
 
-  // Test 3: Maximum alternations limit (MAX_ALTERNATIONS = 1000)
+  // Test 3: Maximum alternations limit (MAX_ALTERNATIONS = 16384)
   printf ("  Testing maximum alternations limit...\n");
   error_message = NULL;
 
-  // Create a pattern with more than MAX_ALTERNATIONS (1000) alternations
-  size_t max_alts         = 1100;              // Exceed the limit
-  size_t pattern_size     = max_alts * 3 + 10; // Each alt needs "a|" plus extras
+  // Create a pattern with more than MAX_ALTERNATIONS (16384) alternations
+  size_t max_alts         = 17000;             // Exceed the limit
+  size_t pattern_size     = max_alts * 2 + 10; // Each alt needs "a|" plus extras
   char *many_alts_pattern = malloc (pattern_size);
   assert (many_alts_pattern != NULL);
 
-  strcpy (many_alts_pattern, "^(");
+  size_t alts_pos = 0;
+  many_alts_pattern[alts_pos++] = '^';
+  many_alts_pattern[alts_pos++] = '(';
   for (size_t i = 0; i < max_alts; i++)
   {
     if (i > 0)
     {
-      strcat (many_alts_pattern, "|");
+      many_alts_pattern[alts_pos++] = '|';
     }
-    char alt_char = 'a' + (i % 26);
-    strncat (many_alts_pattern, &alt_char, 1);
+    many_alts_pattern[alts_pos++] = 'a' + (i % 26);
   }
-  strcat (many_alts_pattern, ")$");
+  many_alts_pattern[alts_pos++] = ')';
+  many_alts_pattern[alts_pos++] = '$';
+  many_alts_pattern[alts_pos]   = '\0';
 
   vibrex_t *many_alts = vibrex_compile (many_alts_pattern, &error_message);
   assert (many_alts == NULL);
   // Note: This might not trigger the MAX_ALTERNATIONS limit depending on implementation
   // but it should at least fail gracefully
 
+  // The same number of unanchored literals also exceeds the limit
+  vibrex_t *many_literals = vibrex_compile (many_alts_pattern + 2, &error_message);
+  assert (many_literals == NULL);
+
   free (many_alts_pattern);
 
+  // Thousands of literal alternatives under the limit compile to a single
+  // search automaton
+  size_t literal_count = 5000;
+  char *literal_alts   = malloc (literal_count * 8 + 10);
+  assert (literal_alts != NULL);
+  alts_pos = 0;
+  for (size_t i = 0; i < literal_count; i++)
+  {
+    alts_pos += sprintf (literal_alts + alts_pos, "%s=%zu=", i > 0 ? "|" : "", i);
+  }
+  vibrex_t *literal_set = vibrex_compile (literal_alts, &error_message);
+  assert (literal_set != NULL);
+  assert (vibrex_match (literal_set, "prefix =0= suffix") == true);
+  assert (vibrex_match (literal_set, "prefix =4999=") == true);
+  assert (vibrex_match (literal_set, "=49=99=") == true);
+  assert (vibrex_match (literal_set, "prefix =5000= suffix") == false);
+  assert (vibrex_match (literal_set, "=12 34=") == false);
+  vibrex_free (literal_set);
+  free (literal_alts);
+
+  // Patterns needing more NFA states than MAX_NFA_STATES (4096) are rejected
+  size_t piece_count = 3000;
+  char *many_states  = malloc (piece_count * 2 + 1);
+  assert (many_states != NULL);
+  for (size_t i = 0; i < piece_count; i++)
+  {
+    many_states[i * 2]     = 'a';
+    many_states[i * 2 + 1] = '.';
+  }
+  many_states[piece_count * 2] = '\0';
+  error_message                = NULL;
+  vibrex_t *too_complex        = vibrex_compile (many_states, &error_message);
+  assert (too_complex == NULL);
+  assert (error_message != NULL && strstr (error_message, "too complex") != NULL);
+  many_states[2000] = '\0';
+  too_complex       = vibrex_compile (many_states, &error_message);
+  assert (too_complex != NULL);
+  vibrex_free (too_complex);
+  free (many_states);
+
   // Test 4: Complex nested pattern that might exceed recursion
   printf ("  Testing complex nested patterns...\n");
   error_message = NULL;
@@ -2314,9 +4184,286 @@ test_memory_and_resource_limits ()
     vibrex_free (repeat_quant);
   }
 
+  // Test 6: Many compiled patterns of every engine, each packed into one
+  // block with its nested sub-patterns, alive at the same time
+  printf ("  Testing many packed patterns...\n");
+
+  const char *engines[] = {"^ab.*yz$", "https?://[a-z]+", "cat|dog", "^FDSN:", "^pre_(x+)_suf|^pre_yy_suf",
+                           ".*_BHZ/MSEED", "[a-z]+[0-9]", ".*"};
+  size_t engine_count   = sizeof (engines) / sizeof (engines[0]);
+  vibrex_t *many[800];
+  for (size_t i = 0; i < 800; i++)
+  {
+    many[i] = vibrex_compile (engines[i % engine_count], NULL);
+    assert (many[i] != NULL);
+  }
+  for (size_t i = 0; i < 800; i++)
+  {
+    const char *subjects[] = {"abxyz", "see https://example", "hotdog", "FDSN:IU", "pre_xx_suf",
+                              "IU_ANMO_BHZ/MSEED", "abc1", ""};
+    assert (vibrex_match (many[i], subjects[i % engine_count]) == true);
+    assert (vibrex_match (many[i], subjects[(i + 1) % engine_count]) == (i % engine_count == engine_count - 1));
+  }
+  for (size_t i = 0; i < 800; i++)
+    vibrex_free (many[i]);
+
   printf (TEST_PASS_SYMBOL " Memory and resource limit tests passed\n");
 }
 
+/********************************************************************************
+ * REENTRANCY TESTS
+ ********************************************************************************/
+
+// Patterns and subjects shared by all threads in the concurrency test
+static const char *thread_patterns[] = {
+    "a(b|c)*d",
+    "^[A-Z]+_[0-9]+$",
+    "FDSN:XX_STA_LOC_C_H_N/MSEED3?|FDSN:XY_STA_.*/MSEED3?|FDSN:ZZ_.*_[HBL]_.*_Z/MSEED3?"};
+
+static const char *thread_subjects[][2] = {
+    {"xxabcbcbdyy", "xxabcbcbyy"},
+    {"ABC_123", "ABC_12a"},
+    {"FDSN:ZZ_STA_00_B_H_Z/MSEED", "FDSN:ZZ_STA_00_X_H_Z/MSEED"}};
+
+typedef struct
+{
+  vibrex_t **patterns;
+  bool use_scratch;
+  int failures;
+} thread_test_args;
+
+static void *
+thread_test_worker (void *arg)
+{
+  thread_test_args *args    = arg;
+  vibrex_scratch_t *scratch = NULL;
+  size_t num_patterns       = sizeof (thread_patterns) / sizeof (thread_patterns[0]);
+
+  if (args->use_scratch)
+  {
+    scratch = vibrex_scratch_create (NULL);
+    assert (scratch != NULL);
+  }
+
+  for (int i = 0; i < THREAD_TEST_ITERATIONS; i++)
+  {
+    size_t p            = i % num_patterns;
+    const char *match   = thread_subjects[p][0];
+    const char *nomatch = thread_subjects[p][1];
+
+    bool matched   = scratch ? vibrex_match_scratch (args->patterns[p], scratch, match) : vibrex_match (args->patterns[p], match);
+    bool unmatched = scratch ? vibrex_match_scratch (args->patterns[p], scratch, nomatch) : vibrex_match (args->patterns[p], nomatch);
+
+    if (!matched || unmatched)
+      args->failures++;
+  }
+
+  vibrex_scratch_free (scratch);
+  return NULL;
+}
+
+// Match a pattern with a long chain of epsilon transitions
+static void *
+deep_closure_worker (void *arg)
+{
+  vibrex_t *pattern = arg;
+  bool ok           = vibrex_match (pattern, "aaaab") && vibrex_match (pattern, "b") && !vibrex_match (pattern, "aaaa");
+  return ok ? pattern : NULL;
+}
+
+void
+test_reentrant_matching ()
+{
+  printf ("Testing reentrant and concurrent matching...\n");
+
+  size_t num_patterns = sizeof (thread_patterns) / sizeof (thread_patterns[0]);
+  vibrex_t *patterns[sizeof (thread_patterns) / sizeof (thread_patterns[0])];
+  for (size_t i = 0; i < num_patterns; i++)
+  {
+    patterns[i] = compile_and_verify (thread_patterns[i], true);
+  }
+
+  // A single scratch space serves patterns of different sizes
+  printf ("  Testing caller-owned scratch space...\n");
+  vibrex_scratch_t *scratch = vibrex_scratch_create (patterns[0]);
+  assert (scratch != NULL);
+  for (size_t i = 0; i < num_patterns; i++)
+  {
+    assert (vibrex_match_scratch (patterns[i], scratch, thread_subjects[i][0]) == true);
+    assert (vibrex_match_scratch (patterns[i], scratch, thread_subjects[i][1]) == false);
+    assert (vibrex_match (patterns[i], thread_subjects[i][0]) == true);
+  }
+  assert (vibrex_match_scratch (NULL, scratch, "text") == false);
+  assert (vibrex_match_scratch (patterns[0], NULL, "text") == false);
+  assert (vibrex_match_scratch (patterns[0], scratch, NULL) == false);
+  vibrex_scratch_free (scratch);
+  vibrex_scratch_free (NULL);
+
+  // Many threads share the same compiled patterns
+  for (int mode = 0; mode < 2; mode++)
+  {
+    printf ("  Testing %d threads sharing patterns (%s)...\n", THREAD_TEST_COUNT,
+            mode ? "own scratch" : "default scratch");
+
+    pthread_t threads[THREAD_TEST_COUNT];
+    thread_test_args args[THREAD_TEST_COUNT];
+    for (int t = 0; t < THREAD_TEST_COUNT; t++)
+    {
+      args[t] = (thread_test_args){patterns, mode == 1, 0};
+      assert (pthread_create (&threads[t], NULL, thread_test_worker, &args[t]) == 0);
+    }
+    for (int t = 0; t < THREAD_TEST_COUNT; t++)
+    {
+      pthread_join (threads[t], NULL);
+      assert (args[t].failures == 0);
+    }
+  }
+
+  for (size_t i = 0; i < num_patterns; i++)
+  {
+    vibrex_free (patterns[i]);
+  }
+
+  // Epsilon closures are walked without recursion, so threads with small
+  // stacks can match patterns with thousands of split states
+  printf ("  Testing deep epsilon closures on a small thread stack...\n");
+  char deep_pattern[4 * 901 + 2] = "";
+  for (int block = 0; block < 4; block++)
+  {
+    char *p = deep_pattern + block * 901;
+    memset (p, '(', 300);
+    p[300] = 'a';
+    for (int i = 0; i < 300; i++)
+      memcpy (p + 301 + i * 2, ")?", 2);
+  }
+  strcpy (deep_pattern + 4 * 901, "b");
+  vibrex_t *deep = vibrex_compile (deep_pattern, NULL);
+  assert (deep != NULL);
+
+  pthread_attr_t attr;
+  pthread_t thread;
+  void *result     = NULL;
+  size_t stack_min = PTHREAD_STACK_MIN;
+  assert (pthread_attr_init (&attr) == 0);
+  assert (pthread_attr_setstacksize (&attr, stack_min > 32768 ? stack_min : 32768) == 0);
+  assert (pthread_create (&thread, &attr, deep_closure_worker, deep) == 0);
+  pthread_join (thread, &result);
+  pthread_attr_destroy (&attr);
+  assert (result == deep);
+  vibrex_free (deep);
+
+  printf (TEST_PASS_SYMBOL " Reentrant matching tests passed\n");
+}
+
+
+typedef struct
+{
+  vibrex_cache_t *cache;
+  int failures;
+} cache_test_args;
+
+// Look up the shared patterns in a cache that keeps evicting them
+static void *
+cache_test_worker (void *arg)
+{
+  cache_test_args *args = arg;
+  vibrex_cache_t *cache = args->cache;
+  size_t num_patterns   = sizeof (thread_patterns) / sizeof (thread_patterns[0]);
+
+  for (int i = 0; i < THREAD_TEST_ITERATIONS / 10; i++)
+  {
+    size_t p                = i % num_patterns;
+    const vibrex_t *pattern = vibrex_cache_get (cache, thread_patterns[p], NULL);
+    if (!pattern || !vibrex_match (pattern, thread_subjects[p][0]) || vibrex_match (pattern, thread_subjects[p][1]))
+      args->failures++;
+    vibrex_cache_release (cache, pattern);
+  }
+  return NULL;
+}
+
+void
+test_pattern_cache ()
+{
+  printf ("Testing the compiled pattern cache...\n");
+
+  // Lookups of the same text share one pattern
+  vibrex_cache_t *cache = vibrex_cache_create (0);
+  assert (cache != NULL);
+  const vibrex_t *first = vibrex_cache_get (cache, "FDSN:IU_.*_[BH]H_Z", NULL);
+  assert (first != NULL);
+  const vibrex_t *again = vibrex_cache_get (cache, "FDSN:IU_.*_[BH]H_Z", NULL);
+  assert (again == first);
+  assert (vibrex_match (again, "FDSN:IU_ANMO_00_BH_Z"));
+  const vibrex_t *other = vibrex_cache_get (cache, "FDSN:IU_.*_[BH]H_N", NULL);
+  assert (other != NULL && other != first);
+
+  vibrex_cache_stats_t stats;
+  assert (vibrex_cache_stats (cache, &stats));
+  assert (stats.entries == 2 && stats.hits == 1 && stats.misses == 2 && stats.evictions == 0);
+  assert (stats.bytes > 0);
+
+  // Patterns that do not compile are reported and not cached
+  const char *error = NULL;
+  assert (vibrex_cache_get (cache, "(unclosed", &error) == NULL);
+  assert (error != NULL);
+  assert (vibrex_cache_stats (cache, &stats) && stats.entries == 2);
+
+  vibrex_cache_release (cache, first);
+  vibrex_cache_release (cache, again);
+  vibrex_cache_release (cache, other);
+  vibrex_cache_free (cache);
+
+  // Many more patterns than the budget holds, the least recent are evicted
+  vibrex_cache_t *small = vibrex_cache_create (32 * 1024);
+  assert (small != NULL);
+  const vibrex_t *held = vibrex_cache_get (small, "held_[0-9]+", NULL);
+  assert (held != NULL);
+  char pattern_str[64];
+  for (int i = 0; i < 500; i++)
+  {
+    snprintf (pattern_str, sizeof (pattern_str), "STA%d_[0-9]+_[BH]H_Z", i);
+    const vibrex_t *pattern = vibrex_cache_get (small, pattern_str, NULL);
+    assert (pattern != NULL);
+    vibrex_cache_release (small, pattern);
+  }
+  assert (vibrex_cache_stats (small, &stats));
+  assert (stats.evictions > 0 && stats.bytes <= 32 * 1024);
+  assert (stats.entries + stats.evictions == 501);
+
+  // A pattern evicted while in use stays valid until it is released, and
+  // looking its text up again compiles a new one
+  assert (vibrex_match (held, "x held_42"));
+  const vibrex_t *recompiled = vibrex_cache_get (small, "held_[0-9]+", NULL);
+  assert (recompiled != NULL && recompiled != held);
+  vibrex_cache_release (small, held);
+  assert (vibrex_match (recompiled, "x held_42"));
+  vibrex_cache_release (small, recompiled);
+  vibrex_cache_free (small);
+
+  // Threads sharing a cache that evicts on almost every lookup
+  vibrex_cache_t *shared = vibrex_cache_create (1);
+  assert (shared != NULL);
+  pthread_t threads[THREAD_TEST_COUNT];
+  cache_test_args args[THREAD_TEST_COUNT];
+  for (int t = 0; t < THREAD_TEST_COUNT; t++)
+  {
+    args[t] = (cache_test_args){shared, 0};
+    assert (pthread_create (&threads[t], NULL, cache_test_worker, &args[t]) == 0);
+  }
+  for (int t = 0; t < THREAD_TEST_COUNT; t++)
+  {
+    pthread_join (threads[t], NULL);
+    assert (args[t].failures == 0);
+  }
+  vibrex_cache_free (shared);
+
+  assert (vibrex_cache_get (NULL, "x", NULL) == NULL);
+  assert (vibrex_cache_stats (NULL, &stats) == false);
+  vibrex_cache_release (NULL, NULL);
+  vibrex_cache_free (NULL);
+
+  printf (TEST_PASS_SYMBOL " Pattern cache tests passed\n");
+}
 int
 main ()
 {
@@ -2336,6 +4483,7 @@ main ()
   test_star_quantifier ();
   test_plus_quantifier ();
   test_optional_quantifier_char ();
+  test_bounded_repetition ();
 
   // === CHARACTER CLASS TESTS ===
   printf ("\n=== Character Class Tests ===\n");
@@ -2361,14 +4509,35 @@ main ()
   test_complex_nested_patterns ();
   test_quis_laboris_patterns ();
 
+  // === PATTERN SET TESTS ===
+  printf ("\n=== Pattern Set Tests ===\n");
+  test_pattern_set ();
+
   // === OPTIMIZATION TESTS ===
   printf ("\n=== Optimization Tests ===\n");
   test_dotstar_optimization ();
   test_optimization_scenarios ();
+  test_lazy_dfa ();
+  test_bitnfa ();
+  test_dense_dfa ();
+  test_literal_search ();
+  test_required_literals ();
 
   // === EDGE CASES AND ERROR HANDLING ===
   printf ("\n=== Edge Cases and Error Handling ===\n");
   test_empty_and_edge_cases ();
+  test_length_aware_matching ();
+  test_match_bounds ();
+  test_pattern_info ();
+  test_batch_matching ();
+  test_streaming ();
+  test_search ();
+  test_find_all ();
+  test_parallel_scan ();
+  test_oversized_alternations ();
+  test_case_insensitive ();
+  test_engine_flags ();
+  test_serialization ();
   test_bad_input ();
   test_error_handling_and_limits ();
   test_memory_and_resource_limits ();
@@ -2378,6 +4547,11 @@ main ()
   test_catastrophic_backtracking ();
   test_malicious_patterns ();
 
+  // === REENTRANCY TESTS ===
+  printf ("\n=== Reentrancy Tests ===\n");
+  test_reentrant_matching ();
+  test_pattern_cache ();
+
   printf ("\n" TEST_CELEBRATION " All tests passed! The vibrex regex engine is working correctly.\n");
   return 0;
 }
\ No newline at end of file
@@ -9,6 +9,7 @@
  *     *    - Zero or more of the preceding atom
  *     +    - One or more of the preceding atom
  *     ?    - Zero or one of the preceding atom
+ *     {m,n} - Between m and n of the preceding atom, also {m} and {m,}
  *     ^    - Anchor to the start of the string
  *     $    - Anchor to the end of the string
  *     |    - Alternation (logical OR)
@@ -56,11 +57,18 @@
  *********************************************************************************/
 
 #include "vibrex.h"
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef VIBREX_NO_THREADS
+#include <pthread.h>
+#else
+#include <sched.h>
+#endif
 
 /********************************************************************************
  * CONSTANTS AND CONFIGURATION
@@ -68,17 +76,96 @@
 
 // NFA construction limits
 #define MAX_NFA_STATES 4096
-#define MAX_PTRLIST_ENTRIES 8192
+#define PTRLISTS_PER_STATE 2     // Dangling arrow lists per NFA state
+#define SEARCH_STATES_PER_BYTE 2 // NFA states per pattern byte allowed for searches and streams
 #define MAX_RECURSION_DEPTH 1000
+#define MAX_FOLLOW_ENTRIES (1 << 16) // Precomputed closure entries, larger patterns walk the NFA
+#define REPEAT_NEST_MAX 8           // Nested optional copies per block when expanding {m,n}
 
 // Pattern matching constants
 #define CHAR_CLASS_BYTES 32
 #define TRANSITION_TABLE_SIZE 256
-#define PATTERN_BUFFER_SIZE 4096
+#define ALT_METACHARACTERS ".?*+[]()|\\{}^$" // Bytes the alternation engine never compares literally
+
+// Multi-literal automaton limits
+#define LITERAL_AUTOMATON_MAX_BYTES (16 << 20) // Transition table budget, larger sets search each literal
+
+// Required literal prefilter limits
+#define REQUIRED_EXACT_MAX 16   // Strings tracked for a sub-expression matching a finite set
+#define REQUIRED_SET_MAX 8      // Literals in a required set, one of which each match contains
+#define REQUIRED_CLASS_MAX 4    // Largest character class expanded into single-byte strings
+#define REQUIRED_MIN_LEN 3      // Shortest literal worth searching for before matching
+
+// Lazy DFA limits
+#define LAZY_DFA_CACHE_BYTES (1 << 20)                                           // Memory budget for cached transitions
+#define LAZY_DFA_MAX_SET_POOL (LAZY_DFA_CACHE_BYTES / sizeof (int))             // NFA state indices stored for cached states
+#define LAZY_DFA_INITIAL_STATES 16                                               // Initial state capacity
+#define LAZY_DFA_MAX_FLUSHES 8                                                   // Flushes per match before falling back to the NFA
+
+// Match iterator limits
+#define PENDING_MATCHES_MAX (1 << 20) // Matches held while an earlier attempt may still displace them
+#define RESCAN_SLACK_BYTES 4096       // Bytes searches may step through again beyond those a pass has come by
+
+// Pattern cache limits
+#define CACHE_INITIAL_BUCKETS 64 // Hash buckets of a new cache, doubled as it fills
+
+// Index of the lowest set bit of a nonzero 64-bit word
+#if defined(__GNUC__) || defined(__clang__)
+#define VIBREX_CTZ64(x) __builtin_ctzll (x)
+#else
+#define VIBREX_CTZ64(x) vibrex_ctz64 (x)
+static inline int
+vibrex_ctz64 (uint64_t x)
+{
+  int n = 0;
+  while (!(x & 1))
+  {
+    x >>= 1;
+    n++;
+  }
+  return n;
+}
+#endif
+
+// Prefetch memory that will be read soon
+#if defined(__GNUC__) || defined(__clang__)
+#define VIBREX_PREFETCH(addr) __builtin_prefetch (addr)
+#else
+#define VIBREX_PREFETCH(addr) ((void)(addr))
+#endif
+
+// Vector literal search, define VIBREX_NO_SIMD to build the scalar search only
+#if !defined(VIBREX_NO_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define VIBREX_SIMD_X86 1
+#include <immintrin.h>
+#elif !defined(VIBREX_NO_SIMD) && defined(__aarch64__) && defined(__ARM_NEON)
+#define VIBREX_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Match counters, define VIBREX_COUNTERS to keep them.  Only top-level
+// patterns count, nested sub-patterns are part of their parent's match.
+#ifdef VIBREX_COUNTERS
+#define VIBREX_COUNT(pattern, field, n)                                                                          \
+  do                                                                                                             \
+  {                                                                                                              \
+    if (!(pattern)->nested)                                                                                      \
+      atomic_fetch_add_explicit (&((struct vibrex_pattern *)(pattern))->counters.field, (n), memory_order_relaxed); \
+  } while (0)
+#else
+#define VIBREX_COUNT(pattern, field, n) ((void)0)
+#endif
+
+// Parallel scan limits
+#define PARALLEL_MAX_THREADS 256
+#define PARALLEL_MIN_CHUNK (64 * 1024) // Fewest bytes a thread claims at a time
+#define PARALLEL_CHUNKS_PER_THREAD 4   // Chunks per thread, so threads that finish early take over
+#define PARALLEL_SYNC_OFFSETS 16       // Offsets recorded per chunk for joining the search entering it
 
 // Security limits to prevent DoS attacks
 #define MAX_PATTERN_LENGTH 65536
-#define MAX_ALTERNATIONS 1000
+#define MAX_ALTERNATIONS 16384
+#define MAX_REPEAT_COUNT 1000
 
 /********************************************************************************
  * TYPE DEFINITIONS
@@ -110,7 +197,6 @@ typedef struct State
   } data;
   struct State *out;  // Primary transition
   struct State *out1; // Secondary transition (for SPLIT)
-  int lastlist;       // Used for tracking active states
 } State;
 
 // Pointer list for managing dangling arrows during NFA construction
@@ -127,12 +213,25 @@ typedef struct Frag
   Ptrlist *out; // List of dangling arrows
 } Frag;
 
-// Boyer-Moore bad character table for string search optimization
+// Literal substring searcher: candidate positions are those where two of the
+// literal's rarest bytes appear at their offsets, and are verified in full
 typedef struct
 {
-  int skip[TRANSITION_TABLE_SIZE];
   bool enabled;
-} BadCharTable;
+  unsigned char rare1; // Rarest byte of the literal
+  unsigned char rare2; // Second rarest byte, at a different offset
+  size_t offset1;      // Offset of rare1 in the literal
+  size_t offset2;      // Offset of rare2 in the literal
+} LiteralSearcher;
+
+// Byte set laid out for vector span scans with two 16-entry nibble lookups.
+// Byte b is in the set if bit (b >> 4) & 7 of low[b & 15] is set for b <
+// 128, or of high[b & 15] for b >= 128.
+typedef struct
+{
+  unsigned char low[16];
+  unsigned char high[16];
+} ByteSpan;
 
 // Both anchors optimization for patterns like ^prefix.*suffix$
 typedef struct
@@ -141,6 +240,7 @@ typedef struct
   char *suffix;
   size_t prefix_len;
   size_t suffix_len;
+  bool fold_case; // Compare letters in either case
   bool enabled;
 } BothAnchorsOpt;
 
@@ -151,32 +251,96 @@ typedef struct
   unsigned char char_table[256]; // Lookup table for allowed characters after ://
 } UrlPatternOpt;
 
+// Subjects matched in lockstep by the batch kernel, which is unrolled for 4
+#define BATCH_LANES 4
+
+// Dense DFA entry flag: the target state accepts
+#define DENSE_DFA_FINAL 0x80000000u
+#define DENSE_DFA_ROW_MASK 0x7fffffffu
+
+// Two-byte literal prefixes searched for at the Aho-Corasick root
+#define DENSE_DFA_MAX_PAIRS 4
+
+// Dense DFA over byte classes, used for literal tries and Aho-Corasick
+// automata.  Each entry holds the premultiplied row offset of the target state
+// (state index * num_classes), so a step is one classmap load and one table
+// load with no multiply, and DENSE_DFA_FINAL marks accepting targets.
+typedef struct
+{
+  bool enabled;                                  // Whether the automaton was built
+  bool anchored;                                 // Trie matched from the start, row 0 is a dead state
+  unsigned char classmap[TRANSITION_TABLE_SIZE]; // Byte to byte class
+  int num_classes;                               // Number of byte classes
+  int num_states;                                // Number of rows in the table
+  uint32_t *table;                               // num_classes entries per state
+  uint32_t start;                                // Entry for the start state
+  int start_count;                               // Number of distinct starting bytes
+  unsigned char start_set[3];                    // The starting bytes when start_count is at most 3
+  ByteSpan idle;                                 // Bytes that keep the start state, for span scans
+  unsigned char start_pairs[DENSE_DFA_MAX_PAIRS][2]; // Distinct two-byte literal prefixes
+  int pair_count;                                // Number of start_pairs, 0 when not used
+  LiteralSearcher pair_search;                   // Searcher for a single start pair
+} DenseDFA;
+
 // Literal alternation optimization for patterns like cat|dog|bird|fish
 typedef struct
 {
-  bool enabled;        // Whether this optimization is active
-  char **alternatives; // Array of literal alternatives
-  size_t *alt_lengths; // Lengths of each alternative
-  size_t alt_count;    // Number of alternatives
+  bool enabled;               // Whether this optimization is active
+  char **alternatives;        // Array of literal alternatives
+  size_t *alt_lengths;        // Lengths of each alternative
+  size_t alt_count;           // Number of alternatives
+  DenseDFA automaton;         // Single pass search over all alternatives
+  DenseDFA trie;              // The alternatives as a trie, to find where matches lie
 } LiteralAltOpt;
 
+// Set of literals expanded from a pattern
+typedef struct
+{
+  char **literals;  // NUL-terminated copies of the literals
+  size_t *lengths;  // Length of each literal
+  size_t count;     // Number of literals
+  size_t capacity;  // Allocated entries
+  size_t total_len; // Sum of all literal lengths
+} LiteralSet;
+
+// Parser state for expanding literal alternations
+typedef struct
+{
+  const char *re; // Pattern being parsed
+  size_t pos;     // Current position
+  int depth;      // Current group nesting depth
+} LiteralParser;
+
+// Literals one of which every match contains, searched for before running
+// the NFA so most subjects that cannot match are rejected by a literal scan
+typedef struct
+{
+  bool enabled;               // Whether the prefilter is active
+  bool fold_case;             // Found in either case, by the automaton even for one literal
+  LiteralSet set;             // The required literals
+  LiteralSearcher searcher;   // Searcher when there is one literal
+  DenseDFA automaton;         // Single pass search when there are several
+} RequiredLiterals;
+
 // Pattern types for mixed dotstar optimization
 typedef enum
 {
-  ALT_LITERAL,         // ^foo - literal pattern
-  ALT_DOTSTAR_PREFIX,  // ^.*foo - dotstar prefix pattern
-  ALT_DOTSTAR_SUFFIX,  // ^foo.* - dotstar suffix pattern
-  ALT_DOTSTAR_WRAPPER, // ^.*foo.* - dotstar wrapper pattern
-  ALT_REGEX            // ^fo+ - complex regex pattern
+  ALT_LITERAL,         // ^foo$ - the subject is the literal
+  ALT_DOTSTAR_PREFIX,  // .*foo$ or foo$ - the subject ends with the literal
+  ALT_DOTSTAR_SUFFIX,  // ^foo.* or ^foo - the subject starts with the literal
+  ALT_DOTSTAR_WRAPPER, // .*foo.* or foo - the subject contains the literal
+  ALT_REGEX            // ^fo+ - anything else, the alternative compiled as is
 } AltPatternType;
 
 // A single alternative in the advanced optimization
 typedef struct
 {
   char *literal_suffix;                // For pure literal alternatives
+  size_t literal_len;                  // Length of literal_suffix
   struct vibrex_pattern *regex_suffix; // For pre-compiled regex alternatives
   AltPatternType pattern_type;         // Type of this alternative for mixed optimization
   char *core_pattern;                  // Core pattern (without dotstar wrappers)
+  size_t core_len;                     // Length of core_pattern
 } AltSuf;
 
 // Advanced alternation optimization structures
@@ -186,8 +350,10 @@ typedef struct
   size_t prefix_len;                     // Length of common prefix
   char *suffix;                          // Common suffix for all alternations
   size_t suffix_len;                     // Length of common suffix
-  struct vibrex_pattern *suffix_pattern; // Compiled suffix pattern if it contains regex metacharacters
-  AltSuf *suffixes;                      // Array of alternatives
+  DenseDFA middles;                      // Trie of the middle parts when they are all literals
+  struct vibrex_pattern *middle_pattern; // All middle parts as one anchored pattern otherwise
+  AltSuf *suffixes;                      // Array of alternatives, for the dotstar optimizations or
+                                         // middle parts too many for one pattern
   size_t alt_count;                      // Number of alternatives
 
   // Dotstar optimization fields
@@ -197,26 +363,133 @@ typedef struct
   bool has_mixed_dotstar;   // Mixed pattern types (some dotstar, some not)
 } AlternationOpt;
 
-// DFA state for compiled patterns
-typedef struct DFAState
+// DFA for fast linear-time matching of literals and literal alternations
+typedef struct
 {
-  int id;
-  bool is_final;                                       // True if this is an accepting state
-  struct DFAState *transitions[TRANSITION_TABLE_SIZE]; // Direct character transitions
-  bool has_transitions;                                // Whether transitions are populated
-} DFAState;
+  bool enabled;        // Whether DFA is active
+  bool anchored_start; // Whether pattern is anchored at start
+  bool anchored_end;   // Whether pattern is anchored at end
+  DenseDFA automaton;  // Trie when anchored at start, Aho-Corasick automaton otherwise
+  DenseDFA trie;       // Trie of the literals when not anchored at start, to find where matches lie
+} DFA;
 
-// DFA for fast linear-time matching
+// Bit-parallel NFA limits
+#define BITNFA_MAX_STATES 64 // States that fit in the word, larger patterns use the lists
+
+// Bit-parallel NFA, bit i of a word stands for the i-th consuming, match or
+// end anchor state.  Concatenated states get consecutive bits, so most states
+// lead to just the next bit and advance with a shift.
 typedef struct
 {
-  DFAState *start_state; // Initial DFA state
-  DFAState *states;      // Array of all DFA states
-  int num_states;        // Number of DFA states
-  int max_states;        // Maximum allocated states
-  bool enabled;          // Whether DFA is active
-  bool anchored_start;   // Whether pattern is anchored at start
-  bool anchored_end;     // Whether pattern is anchored at end
-} DFA;
+  bool enabled;       // Whether the pattern is small enough
+  int nbits;          // Bits of the word in use
+  uint64_t *accept;   // Per byte class: states that consume it
+  uint64_t *follow;   // Per bit: states its closure holds
+  uint64_t shift;     // States whose closure is only the next bit
+  uint64_t jumps;     // Other consuming states, whose closures are looked up
+  uint64_t start;     // States at the text start
+  uint64_t restart;   // States of an attempt starting after the text start
+  uint64_t match;     // Match states
+  uint64_t end_match; // States that match if the text ends here
+  struct BitLoop *loops; // State sets that loop on a set of bytes
+  int nloops;            // Entries in loops
+} BitNFA;
+
+// State set of the bit-parallel NFA that runs of some bytes leave unchanged
+typedef struct BitLoop
+{
+  uint64_t state; // The state set
+  ByteSpan stay;  // Bytes that leave it unchanged
+} BitLoop;
+
+// Facts every match of a pattern obeys, checked before running an engine
+typedef struct
+{
+  bool enabled;                                      // Whether the pattern's NFA could be analyzed
+  bool anchored_start;                               // Every match starts at the text start
+  bool anchored_end;                                 // Every match ends at the text end
+  size_t min_length;                                 // Fewest bytes a match spans
+  size_t max_length;                                 // Most bytes a match spans, SIZE_MAX if unbounded
+  unsigned char first_bytes[CHAR_CLASS_BYTES];       // Bytes a non-empty match can start with
+  unsigned char last_bytes[CHAR_CLASS_BYTES];        // Bytes a non-empty match can end with
+} MatchBounds;
+
+// Match found by a pass over a buffer that is reported once no attempt in
+// progress can extend or replace it
+typedef struct
+{
+  size_t start; // Offset of the first byte
+  size_t end;   // Offset just past the last byte
+} PendingMatch;
+
+// Lazy DFA state flags
+#define LDFA_MATCH 0x01     // State contains the NFA match state
+#define LDFA_END_MATCH 0x02 // State matches if the text ends here
+#define LDFA_DEAD 0x04      // No match is reachable from this state
+
+// Lazy DFA transition or state span not computed yet, and state without a span
+#define LDFA_UNKNOWN -1
+#define LDFA_NO_SPAN -2
+
+// Lazy DFA state, identified by the set of NFA states it represents
+typedef struct
+{
+  int set_offset; // Offset of the sorted NFA state indices in the set pool
+  int set_count;  // Number of NFA states in the set
+  unsigned hash;  // Hash of the NFA state set
+  unsigned flags; // LDFA_* flags
+  int span;       // Bytes the state loops on in the span pool, LDFA_UNKNOWN or LDFA_NO_SPAN
+} LazyState;
+
+// Lazy DFA state cache, built on the fly from NFA state sets during matching
+typedef struct
+{
+  const struct vibrex_pattern *owner; // Pattern the cached states belong to
+  LazyState *states;                  // Cached DFA states
+  int32_t *transitions;               // row_size entries per state, LDFA_UNKNOWN if not computed
+  int *set_pool;                      // NFA state sets of all cached states
+  int *hash_table;                    // Open addressing table of state index + 1, 0 if empty
+  ByteSpan *spans;                    // Bytes cached states loop on, for span scans
+  int num_spans;                      // Spans in use
+  int max_spans;                      // Allocated span capacity
+  int num_states;                     // Number of cached states
+  int max_states;                     // Allocated state capacity
+  int row_size;                       // Transitions per state, the owner's byte class count
+  size_t pool_used;                   // Entries used in the set pool
+  size_t pool_capacity;               // Allocated set pool entries
+  int start_state;                    // State at text position 0, -1 if not built
+  int idle_state;                     // State with no match attempt in progress, -1 if not built
+
+  // Statistics
+  size_t cache_hits;    // Transitions taken from the cache
+  size_t cache_misses;  // Transitions computed from the NFA
+  size_t cache_flushes; // Times the cache was cleared for being full
+  size_t nfa_fallbacks; // Matches handed to the NFA after the cache thrashed
+} LazyDFA;
+
+// Matching engine, selected once at compile time
+typedef enum
+{
+  ENGINE_NFA = 0,      // Lazy DFA with NFA simulation fallback
+  ENGINE_BOTH_ANCHORS, // ^prefix.*suffix$ patterns
+  ENGINE_URL,          // https?://[char-class]+ patterns
+  ENGINE_LITERAL_ALT,  // Literal alternations
+  ENGINE_ADVANCED_ALT, // Alternations split into prefix, alternatives and suffix
+  ENGINE_DFA,          // Literals and top-level literal alternations
+  ENGINE_DOTSTAR,      // Unanchored .*
+  ENGINE_BITNFA        // Bit-parallel NFA for patterns of at most BITNFA_MAX_STATES states
+} MatchEngine;
+
+// Match counters of a top-level pattern, shared by all threads matching it
+typedef struct
+{
+  atomic_size_t subjects;          // Subjects matched
+  atomic_size_t matches;           // Subjects that matched
+  atomic_size_t bounds_rejects;    // Subjects rejected by the match bounds
+  atomic_size_t prefilter_rejects; // Subjects rejected by the required literals
+  atomic_size_t bytes_scanned;     // Bytes of subjects past the bounds check
+  atomic_size_t nfa_steps;         // Bytes stepped through by the NFA simulation
+} PatternCounters;
 
 // Complete compiled pattern
 struct vibrex_pattern
@@ -225,19 +498,35 @@ struct vibrex_pattern
   int nstate;
   State *states;
   bool anchored_end;
+
+  // Epsilon closure of the state each consuming state leads to, as the
+  // indices of the consuming, match and end anchor states in it.  NULL
+  // follow_start when the closures would be too large.
+  int *follow;       // Closures of all consuming states
+  int *follow_start; // Offset of each state's closure in follow, plus the end
+  int follow_count;  // Entries in follow
+  BitNFA bitnfa;      // Simulation in one word for small patterns
+  MatchBounds bounds; // Subject length and byte checks, top-level patterns only
+  MatchEngine engine; // Engine that matches this pattern
+  unsigned flags;     // VIBREX_* flags the pattern was compiled with
+  struct vibrex_pattern *nfa; // NFA of engines that do not keep one, for streams and searches
+
+  // Bytes no NFA state tells apart share a class, so lazy DFA rows hold one
+  // entry per class instead of one per byte
+  unsigned char byte_class[TRANSITION_TABLE_SIZE]; // Byte to byte class
+  int num_byte_classes;                            // Number of byte classes
+
   // Performance optimizations
   bool has_dotstar_unanchored; // Pattern is .* without anchors
-  State **state_list1;         // Pre-allocated state list 1
-  State **state_list2;         // Pre-allocated state list 2
 
   // Advanced optimizations
   unsigned char first_char; // First required character (if any)
   bool has_first_char;      // Whether first_char is valid
   char *literal_prefix;     // Literal prefix string (if any)
-  int prefix_len;           // Length of literal prefix
+  size_t prefix_len;        // Length of literal prefix
 
-  // Boyer-Moore bad character table
-  BadCharTable bad_char;
+  // Searcher for the literal prefix
+  LiteralSearcher prefix_search;
 
   // Both anchors optimization for ^prefix.*suffix$ patterns
   BothAnchorsOpt both_anchors; // Both anchors optimization data
@@ -251,36 +540,128 @@ struct vibrex_pattern
   // DFA optimization for linear-time matching
   DFA dfa; // Compiled DFA for fast matching
 
+  // Required literal prefilter for NFA matching
+  RequiredLiterals required; // Literals every match contains
+
   // Advanced alternation optimization
   AlternationOpt alt_opt;    // Advanced alternation optimization data
   bool has_advanced_alt_opt; // Whether advanced alternation optimization is active
+
+  // Match-time scratch space, sized for this pattern and any nested sub-patterns
+  bool packed;                   // Everything the pattern owns is in one block with it
+  size_t packed_size;            // Bytes in the block of a packed top-level pattern
+  size_t table_offset;           // Offset of the dense DFA tables in the block
+  const char *tables;            // The dense DFA tables, in the block or in the data it was loaded from
+  bool nested;                   // Compiled as part of another pattern, matched with the parent's scratch
+  bool owns_dfa_cache;           // Nested but the only pattern its parent matches, so it may use the lazy DFA
+  int max_nstate;                // Largest NFA state count of this or any nested pattern
+  struct vibrex_scratch *scratch; // Default scratch used by vibrex_match()
+  atomic_flag scratch_busy;      // Set while a thread owns the default scratch
+#ifdef VIBREX_COUNTERS
+  PatternCounters counters; // Match counters, updated by every thread
+#endif
+};
+
+// Per-thread NFA simulation state, never shared between concurrent matches
+struct vibrex_scratch
+{
+  State **list1;           // Current state list
+  State **list2;           // Next state list
+  State **list3;           // Temporary list for end anchor checks
+  unsigned *marks;         // Generation mark per NFA state, indexed by state offset
+  State **stack;           // States whose epsilon closure is still to be walked
+  int *set_buffer;         // Sorted NFA state indices for lazy DFA lookups
+  size_t *starts1;         // Start of the attempt each state of list1 belongs to, for searches
+  size_t *starts2;         // Start of the attempt each state of list2 belongs to
+  PendingMatch *pending;   // Matches of a pass not reported yet, grown as needed
+  size_t pending_capacity; // Matches the pending array can hold
+  int capacity;            // Number of states the lists and marks can hold
+  unsigned listid;         // Current generation
+  bool no_dfa_cache;       // Short-lived scratch, match with the NFA only
+  LazyDFA dfa_cache;       // Lazy DFA states of the last pattern matched
+#ifdef VIBREX_COUNTERS
+  size_t nfa_steps;        // Bytes stepped through by the NFA simulation, added to the pattern's counters
+#endif
 };
 
-// Globals for tracking during NFA construction
-static int listid = 1;
-static State *states;
-static int nstate;
+// Set of patterns merged into one NFA, matched in a single pass over the text
+struct vibrex_set
+{
+  State *states;                                    // NFA states of all patterns
+  int nstate;                                       // Number of NFA states
+  size_t count;                                     // Number of patterns
+  State **starts;                                   // Start state of each pattern
+  int *owner;                                       // Pattern index of each NFA state
+  int *idle;                                        // States reached from every start past the text start
+  int idle_count;                                   // Number of idle states
+  unsigned char byte_class[TRANSITION_TABLE_SIZE];  // Byte to byte class
+  int *idle_next;                                   // States the idle states lead to on each byte class
+  int *idle_next_start;                             // Offset of each class in idle_next, plus the end
+  unsigned char first_bytes[TRANSITION_TABLE_SIZE]; // Bytes that idle states consume
+  struct vibrex_scratch *scratch;                   // Default scratch used by vibrex_set_match()
+  atomic_flag scratch_busy;                         // Set while a thread owns the default scratch
+};
+
+// Parsing context
+typedef struct
+{
+  const char *re;
+  int pos;
+  int depth;     // Current recursion depth
+  int max_depth; // Maximum allowed recursion depth
+  bool icase;    // Letters match in either case
+
+  // NFA construction state
+  State *states;         // State array being filled
+  int nstate;            // Number of states used
+  int max_states;        // States allowed, the array holds one more
+  Ptrlist *ptrlist_pool; // Pool of dangling arrow lists
+  int nptrlist;          // Number of pointer lists used
+  int max_ptrlists;      // Pointer lists in the pool
+  bool overflow;         // Ran out of states or pointer lists
+  bool too_deep;         // Nested deeper than max_depth
+} ParseContext;
 
-// Create a new state
+// Pattern text being rewritten with its bounded repetitions expanded
+typedef struct
+{
+  char *text;        // NUL-terminated rewritten pattern
+  size_t len;        // Bytes in text
+  size_t cap;        // Bytes allocated for text
+  const char *error; // Why the rewrite failed
+} RepeatText;
+
+// Create a new state.  Past max_states the spare state at the end of the
+// array is handed out instead and the pattern is rejected once parsed.
 static State *
-state (StateType type, State *out, State *out1)
+state (ParseContext *ctx, StateType type, State *out, State *out1)
 {
-  State *s    = &states[nstate++];
-  s->type     = type;
-  s->out      = out;
-  s->out1     = out1;
-  s->lastlist = 0;
+  State *s;
+  if (ctx->nstate < ctx->max_states)
+  {
+    s = &ctx->states[ctx->nstate++];
+  }
+  else
+  {
+    s             = &ctx->states[ctx->max_states];
+    ctx->overflow = true;
+  }
+  s->type  = type;
+  s->out   = out;
+  s->out1  = out1;
   return s;
 }
 
-static Ptrlist *ptrlist_pool;
-static int nptrlist;
-
-// Get a pointer list
+// Get a pointer list, NULL once the pool is used up
 static Ptrlist *
-list1 (State **outp)
+list1 (ParseContext *ctx, State **outp)
 {
-  Ptrlist *l = &ptrlist_pool[nptrlist++];
+  if (ctx->nptrlist >= ctx->max_ptrlists)
+  {
+    ctx->overflow = true;
+    return NULL;
+  }
+  Ptrlist *l = &ctx->ptrlist_pool[ctx->nptrlist++];
   l->s       = outp;
   l->next    = NULL;
   return l;
@@ -310,15 +691,6 @@ patch (Ptrlist *l, State *s)
   }
 }
 
-// Parsing context
-typedef struct
-{
-  const char *re;
-  int pos;
-  int depth;     // Current recursion depth
-  int max_depth; // Maximum allowed recursion depth
-} ParseContext;
-
 /********************************************************************************
  * FORWARD DECLARATIONS
  ********************************************************************************/
@@ -328,37 +700,55 @@ static Frag parsealt (ParseContext *ctx);
 static Frag parsecat (ParseContext *ctx);
 static Frag parsepiece (ParseContext *ctx);
 static Frag parseatom (ParseContext *ctx);
+static bool build_nfa (const char *pattern, unsigned flags, int max_states, State **states_out, int *nstate_out,
+                       State **start_out, const char **error_message);
 
 // DFA optimization functions
 static bool can_compile_to_dfa (const char *pattern);
-static bool compile_literal_to_dfa (struct vibrex_pattern *compiled, const char *pattern);
-static bool compile_alternation_to_dfa (struct vibrex_pattern *compiled, const char *pattern);
-static DFAState *create_dfa_state (DFA *dfa, bool is_final);
-static bool dfa_match (const DFA *dfa, const char *text);
+static bool compile_literals_to_dfa (struct vibrex_pattern *compiled, const char *pattern);
+static bool dfa_match (const DFA *dfa, const char *text, size_t text_len);
 static void free_dfa (DFA *dfa);
 
+// Dense DFA functions
+static bool dense_dfa_build (DenseDFA *dfa, char *const *literals, const size_t *lengths, size_t count,
+                             bool anchored, bool fold_case, size_t max_bytes);
+static bool dense_dfa_search (const DenseDFA *dfa, const char *text, size_t text_len, bool at_end);
+static bool dense_dfa_match_anchored (const DenseDFA *dfa, const char *text, size_t text_len, bool at_end);
+static bool dense_dfa_search_trie (const DenseDFA *dfa, const char *text, size_t text_len, size_t from,
+                                   bool anchored_start, bool anchored_end, size_t *match_start, size_t *match_end);
+static void dfa_match_batch (const DFA *dfa, const char *const *texts, const size_t *lens, size_t n, uint8_t *results);
+static void dense_dfa_free (DenseDFA *dfa);
+
 // Both anchors optimization functions
 static bool can_use_both_anchors_opt (const char *pattern);
 static bool compile_both_anchors_opt (struct vibrex_pattern *compiled, const char *pattern);
-static bool match_with_both_anchors_opt (const struct vibrex_pattern *pattern, const char *text);
+static bool match_with_both_anchors_opt (const struct vibrex_pattern *pattern, const char *text, size_t text_len);
 static void free_both_anchors_opt (BothAnchorsOpt *both_anchors);
 
 // URL pattern optimization functions
 static bool can_use_url_pattern_opt (const char *pattern);
 static bool compile_url_pattern_opt (struct vibrex_pattern *compiled, const char *pattern);
-static bool match_with_url_pattern_opt (const struct vibrex_pattern *pattern, const char *text);
+static bool match_with_url_pattern_opt (const struct vibrex_pattern *pattern, const char *text, size_t text_len);
 static void free_url_pattern_opt (UrlPatternOpt *url_pattern);
 
 // Literal alternation optimization functions
-static bool can_use_literal_alt_opt (const char *pattern);
+static bool literal_set_add (LiteralSet *set, const char *literal, size_t len);
+static void literal_set_free (LiteralSet *set);
+static bool parse_literal_alternation (LiteralParser *lp, LiteralSet *out);
 static bool compile_literal_alt_opt (struct vibrex_pattern *compiled, const char *pattern);
-static bool match_with_literal_alt_opt (const struct vibrex_pattern *pattern, const char *text);
+static bool match_with_literal_alt_opt (const struct vibrex_pattern *pattern, const char *text, size_t text_len);
 static void free_literal_alt_opt (LiteralAltOpt *literal_alt);
 
+// Required literal prefilter functions
+static void compile_required_literals (struct vibrex_pattern *compiled, const char *pattern);
+static bool required_literals_present (const RequiredLiterals *required, const char *text, size_t text_len);
+static void free_required_literals (RequiredLiterals *required);
+
 // Advanced alternation optimization functions
+static bool has_top_level_alternation (const char *pattern);
 static bool can_use_advanced_alternation_opt (const char *pattern);
 static bool compile_advanced_alternation_opt (struct vibrex_pattern *compiled, const char *pattern);
-static bool match_with_advanced_alternation_opt (const struct vibrex_pattern *pattern, const char *text);
+static bool match_with_advanced_alternation_opt (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t text_len);
 static void free_alternation_opt (AlternationOpt *alt_opt);
 
 // Alternation optimization helper functions
@@ -368,67 +758,108 @@ static bool check_dotstar_consistency (const char **alternatives, size_t *alt_le
 static bool extract_core_pattern (const char *alt, size_t alt_len, AltPatternType pattern_type, char **core_pattern, size_t *core_len);
 static bool compile_dotstar_optimization (AlternationOpt *alt_opt, const char **alternatives, size_t *alt_lengths);
 static bool find_common_prefix_suffix (const char *pattern, const char **alternatives, size_t *alt_lengths, size_t alt_count, AlternationOpt *alt_opt);
-static bool compile_suffix_pattern (AlternationOpt *alt_opt);
 static bool compile_middle_parts (AlternationOpt *alt_opt, const char **alternatives, size_t *alt_lengths);
+static bool compile_middle_parts_each (AlternationOpt *alt_opt, const char **alternatives, size_t *alt_lengths);
 
 // Alternation matching helper functions
-static bool match_single_alternative (const AltSuf *alt_suffix, const char *text, size_t text_len);
-static bool match_dotstar_patterns (const AlternationOpt *alt_opt, const char *text, size_t text_len);
+static bool match_single_alternative (const AltSuf *alt_suffix, struct vibrex_scratch *scratch, const char *text, size_t text_len);
+static bool match_dotstar_patterns (const AlternationOpt *alt_opt, struct vibrex_scratch *scratch, const char *text, size_t text_len);
 static bool match_suffix_pattern (const AlternationOpt *alt_opt, const char *text, size_t text_len, const char **match_end);
-static bool match_alternatives (const AlternationOpt *alt_opt, const char *middle_text, size_t middle_len);
+static bool match_alternatives (const AlternationOpt *alt_opt, struct vibrex_scratch *scratch, const char *middle_text, size_t middle_len);
+
+// Compilation functions
+static struct vibrex_pattern *compile_pattern (const char *pattern, bool nested, unsigned flags, const char **error_message);
+static int compute_byte_classes (const State *states, int nstate, unsigned char *byte_class);
+
+// Match-time scratch functions
+static bool finish_compile (struct vibrex_pattern *compiled);
+static bool compile_follow (struct vibrex_pattern *compiled);
+static bool compile_bitnfa (struct vibrex_pattern *compiled);
+static bool compile_bitnfa_loops (struct vibrex_pattern *compiled);
+static bool compile_bounds (struct vibrex_pattern *compiled, const char *pattern);
+static bool bounds_reject (const MatchBounds *bounds, const char *text, size_t text_len);
+static bool bitnfa_match (const struct vibrex_pattern *pattern, const char *text, size_t text_len);
+static void free_bitnfa (BitNFA *bits);
+static struct vibrex_pattern *pattern_pack (struct vibrex_pattern *pattern);
+static bool scratch_reserve (struct vibrex_scratch *scratch, int nstates);
+static bool match_internal (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t text_len);
 
 // Utility functions
-static const char *boyer_moore_search (const char *text, int text_len, const struct vibrex_pattern *pattern);
+static void literal_searcher_init (LiteralSearcher *searcher, const char *literal, size_t literal_len);
+static const char *literal_searcher_find (const LiteralSearcher *searcher, const char *literal, size_t literal_len,
+                                          const char *text, size_t text_len);
+static const unsigned char *find_byte_of (const unsigned char *p, const unsigned char *end, const unsigned char *bytes, int count);
+static void byte_span_init (ByteSpan *span, const unsigned char *set);
+static const unsigned char *byte_span (const ByteSpan *span, const unsigned char *p, const unsigned char *end);
+static const unsigned char *find_pair_of (const unsigned char *p, const unsigned char *end, const unsigned char (*pairs)[2], int count);
+static const char *find_literal (const char *text, size_t text_len, const char *literal, size_t literal_len);
+static bool equal_fold_case (const char *a, const char *b, size_t len);
 
 /********************************************************************************
  * NFA CONSTRUCTION FUNCTIONS
  ********************************************************************************/
 
-// Parse alternation (|)
+// The other case of an ASCII letter, other bytes are returned unchanged
+static inline unsigned char
+other_case (unsigned char c)
+{
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 'A';
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A' + 'a';
+  return c;
+}
+
+// A state for a literal byte, a class of both cases for a letter when case
+// is ignored
+static State *
+literal_state (ParseContext *ctx, unsigned char c)
+{
+  if (!ctx->icase || other_case (c) == c)
+  {
+    State *s  = state (ctx, STATE_CHAR, NULL, NULL);
+    s->data.c = c;
+    return s;
+  }
+
+  State *s = state (ctx, STATE_CLASS, NULL, NULL);
+  memset (s->data.cclass, 0, CHAR_CLASS_BYTES);
+  s->data.cclass[c / 8] |= 1 << (c % 8);
+  c = other_case (c);
+  s->data.cclass[c / 8] |= 1 << (c % 8);
+  return s;
+}
+
+// Parse alternation (|).  The alternatives are parsed in a loop, each
+// joined to those before it by a split, so patterns of thousands of
+// alternatives nest no deeper than one.
 static Frag
 parsealt (ParseContext *ctx)
 {
   // Check recursion depth
   if (ctx->depth >= ctx->max_depth)
   {
+    ctx->too_deep = true;
     return (Frag){NULL, NULL};
   }
   ctx->depth++;
 
   Frag e1 = parsecat (ctx);
-  if (ctx->re[ctx->pos] != '|')
+  while (e1.start && ctx->re[ctx->pos] == '|')
   {
-    ctx->depth--;
-    return e1;
-  }
-
-  ctx->pos++; // skip '|'
-  Frag e2 = parsealt (ctx);
+    ctx->pos++; // skip '|'
+    Frag e2 = parsecat (ctx);
+    if (!e2.start)
+    {
+      e1 = e2;
+      break;
+    }
 
-  if (!e1.start && !e2.start)
-  {
-    State *s = state (STATE_MATCH, NULL, NULL);
-    ctx->depth--;
-    return (Frag){s, NULL};
+    State *s = state (ctx, STATE_SPLIT, e1.start, e2.start);
+    e1       = (Frag){s, append (e1.out, e2.out)};
   }
-  else if (!e1.start)
-  {
-    State *match = state (STATE_MATCH, NULL, NULL);
-    State *s     = state (STATE_SPLIT, match, e2.start);
-    ctx->depth--;
-    return (Frag){s, e2.out};
-  }
-  else if (!e2.start)
-  {
-    State *match = state (STATE_MATCH, NULL, NULL);
-    State *s     = state (STATE_SPLIT, e1.start, match);
-    ctx->depth--;
-    return (Frag){s, e1.out};
-  }
-
-  State *s = state (STATE_SPLIT, e1.start, e2.start);
   ctx->depth--;
-  return (Frag){s, append (e1.out, e2.out)};
+  return e1;
 }
 
 // Parse concatenation
@@ -437,15 +868,16 @@ parsecat (ParseContext *ctx)
 {
   if (ctx->depth >= ctx->max_depth)
   {
+    ctx->too_deep = true;
     return (Frag){NULL, NULL};
   }
   ctx->depth++;
 
   if (!ctx->re[ctx->pos] || ctx->re[ctx->pos] == ')' || ctx->re[ctx->pos] == '|')
   {
-    State *s = state (STATE_SPLIT, NULL, NULL);
+    State *s = state (ctx, STATE_SPLIT, NULL, NULL);
     ctx->depth--;
-    return (Frag){s, list1 (&s->out)};
+    return (Frag){s, list1 (ctx, &s->out)};
   }
 
   Frag e1 = parsepiece (ctx);
@@ -494,18 +926,18 @@ parsepiece (ParseContext *ctx)
   switch (op)
   {
   case '*':
-    s = state (STATE_SPLIT, e.start, NULL);
+    s = state (ctx, STATE_SPLIT, e.start, NULL);
     patch (e.out, s);
-    return (Frag){s, list1 (&s->out1)};
+    return (Frag){s, list1 (ctx, &s->out1)};
 
   case '+':
-    s = state (STATE_SPLIT, e.start, NULL);
+    s = state (ctx, STATE_SPLIT, e.start, NULL);
     patch (e.out, s);
-    return (Frag){e.start, list1 (&s->out1)};
+    return (Frag){e.start, list1 (ctx, &s->out1)};
 
   case '?':
-    s = state (STATE_SPLIT, e.start, NULL);
-    return (Frag){s, append (e.out, list1 (&s->out1))};
+    s = state (ctx, STATE_SPLIT, e.start, NULL);
+    return (Frag){s, append (e.out, list1 (ctx, &s->out1))};
   }
   return e;
 }
@@ -519,28 +951,29 @@ parseatom (ParseContext *ctx)
   if (c == '.')
   {
     ctx->pos++;
-    State *s = state (STATE_ANY, NULL, NULL);
-    return (Frag){s, list1 (&s->out)};
+    State *s = state (ctx, STATE_ANY, NULL, NULL);
+    return (Frag){s, list1 (ctx, &s->out)};
   }
 
   if (c == '^')
   {
     ctx->pos++;
-    State *s = state (STATE_START_ANCHOR, NULL, NULL);
-    return (Frag){s, list1 (&s->out)};
+    State *s = state (ctx, STATE_START_ANCHOR, NULL, NULL);
+    return (Frag){s, list1 (ctx, &s->out)};
   }
 
   if (c == '$')
   {
     ctx->pos++;
-    State *s = state (STATE_END_ANCHOR, NULL, NULL);
-    return (Frag){s, list1 (&s->out)};
+    State *s = state (ctx, STATE_END_ANCHOR, NULL, NULL);
+    return (Frag){s, list1 (ctx, &s->out)};
   }
 
   if (c == '(')
   {
     if (ctx->depth >= ctx->max_depth)
     {
+      ctx->too_deep = true;
       return (Frag){NULL, NULL};
     }
     ctx->depth++;
@@ -562,7 +995,7 @@ parseatom (ParseContext *ctx)
   if (c == '[')
   {
     ctx->pos++;
-    State *s = state (STATE_CLASS, NULL, NULL);
+    State *s = state (ctx, STATE_CLASS, NULL, NULL);
     memset (s->data.cclass, 0, CHAR_CLASS_BYTES);
 
     bool negated = false;
@@ -615,6 +1048,21 @@ parseatom (ParseContext *ctx)
     }
     ctx->pos++;
 
+    // Ignoring case, a class holding a letter holds both of its cases,
+    // before a negated class is inverted
+    if (ctx->icase)
+    {
+      for (int ch = 'A'; ch <= 'Z'; ch++)
+      {
+        int lower = ch - 'A' + 'a';
+        if (s->data.cclass[ch / 8] & (1 << (ch % 8)) || s->data.cclass[lower / 8] & (1 << (lower % 8)))
+        {
+          s->data.cclass[ch / 8] |= 1 << (ch % 8);
+          s->data.cclass[lower / 8] |= 1 << (lower % 8);
+        }
+      }
+    }
+
     if (negated)
     {
       for (int i = 0; i < CHAR_CLASS_BYTES; i++)
@@ -623,7 +1071,7 @@ parseatom (ParseContext *ctx)
       }
     }
 
-    return (Frag){s, list1 (&s->out)};
+    return (Frag){s, list1 (ctx, &s->out)};
   }
 
   if (c == '\\')
@@ -633,10 +1081,9 @@ parseatom (ParseContext *ctx)
       return (Frag){NULL, NULL};
     }
     ctx->pos++;
-    c         = ctx->re[ctx->pos++];
-    State *s  = state (STATE_CHAR, NULL, NULL);
-    s->data.c = c;
-    return (Frag){s, list1 (&s->out)};
+    c        = ctx->re[ctx->pos++];
+    State *s = literal_state (ctx, (unsigned char)c);
+    return (Frag){s, list1 (ctx, &s->out)};
   }
 
   if (c == ')')
@@ -647,187 +1094,485 @@ parseatom (ParseContext *ctx)
   if (c && c != '*' && c != '+' && c != '?' && c != '|' && c != ')')
   {
     ctx->pos++;
-    State *s  = state (STATE_CHAR, NULL, NULL);
-    s->data.c = c;
-    return (Frag){s, list1 (&s->out)};
+    State *s = literal_state (ctx, (unsigned char)c);
+    return (Frag){s, list1 (ctx, &s->out)};
   }
 
   return (Frag){NULL, NULL};
 }
 
-/********************************************************************************
- * PUBLIC API FUNCTIONS
- ********************************************************************************/
-
-// Compile regex to NFA
-struct vibrex_pattern *
-vibrex_compile (const char *pattern, const char **error_message)
+// Parse a pattern into an NFA of at most max_states states ending in a match
+// state, with VIBREX_ICASE letters match in either case.  On success the
+// caller owns the state array.
+static bool
+build_nfa (const char *pattern, unsigned flags, int max_states, State **states_out, int *nstate_out,
+           State **start_out, const char **error_message)
 {
-  if (!pattern)
+  ParseContext ctx = {pattern, 0, 0, MAX_RECURSION_DEPTH, (flags & VIBREX_ICASE) != 0,
+                      NULL, 0, max_states, NULL, 0, max_states * PTRLISTS_PER_STATE, false, false};
+  ctx.states       = malloc (((size_t)max_states + 1) * sizeof (State));
+  ctx.ptrlist_pool = malloc ((size_t)ctx.max_ptrlists * sizeof (Ptrlist));
+  if (!ctx.states || !ctx.ptrlist_pool)
   {
+    free (ctx.states);
+    free (ctx.ptrlist_pool);
     if (error_message)
-      *error_message = "NULL pattern";
-    return NULL;
+      *error_message = "Out of memory";
+    return false;
   }
 
-  // Security check: Prevent DoS via extremely long patterns
-  size_t pattern_len = strlen (pattern);
-  if (pattern_len > MAX_PATTERN_LENGTH)
+  Frag e = parsealt (&ctx);
+  if (ctx.too_deep)
   {
+    free (ctx.states);
+    free (ctx.ptrlist_pool);
     if (error_message)
-      *error_message = "Pattern too long (exceeds security limit)";
-    return NULL;
+      *error_message = "Pattern too complex (groups nested too deeply)";
+    return false;
   }
-
-  struct vibrex_pattern *compiled = calloc (1, sizeof (struct vibrex_pattern));
-  if (!compiled)
+  if (!e.start)
   {
+    free (ctx.states);
+    free (ctx.ptrlist_pool);
     if (error_message)
-      *error_message = "Out of memory";
-    return NULL;
+      *error_message = "Parse error: Invalid pattern structure";
+    return false;
   }
 
-  // Try both anchors optimization first (^prefix.*suffix$)
-  if (compile_both_anchors_opt (compiled, pattern))
+  if (ctx.pos < (int)strlen (pattern))
   {
+    free (ctx.states);
+    free (ctx.ptrlist_pool);
     if (error_message)
-      *error_message = NULL;
-    return compiled;
+      *error_message = "Parse error: Unexpected characters at end of pattern";
+    return false;
   }
 
-  // Try URL pattern optimization (https?://[char-class]+)
-  if (compile_url_pattern_opt (compiled, pattern))
+  State *match = state (&ctx, STATE_MATCH, NULL, NULL);
+  patch (e.out, match);
+  free (ctx.ptrlist_pool);
+
+  if (ctx.overflow)
   {
+    free (ctx.states);
     if (error_message)
-      *error_message = NULL;
-    return compiled;
+      *error_message = "Pattern too complex (too many NFA states)";
+    return false;
   }
 
-  // Try literal alternation optimization (literal1|literal2|...)
-  if (compile_literal_alt_opt (compiled, pattern))
+  *states_out = ctx.states;
+  *nstate_out = ctx.nstate;
+  *start_out  = e.start;
+  return true;
+}
+
+/********************************************************************************
+ * BOUNDED REPETITION
+ ********************************************************************************/
+
+// Read a repetition count, stopping the value just past MAX_REPEAT_COUNT
+// so it cannot overflow
+static long
+repeat_count (const char **p)
+{
+  long count = 0;
+  while (**p >= '0' && **p <= '9')
   {
-    if (error_message)
-      *error_message = NULL;
-    return compiled;
+    if (count <= MAX_REPEAT_COUNT)
+      count = count * 10 + (**p - '0');
+    (*p)++;
   }
+  return count;
+}
 
-  if (compile_advanced_alternation_opt (compiled, pattern))
+// Read a bounded repetition {m}, {m,} or {m,n} at p, returning its length,
+// or 0 when p does not start one and '{' is a literal byte.  max is -1 when
+// there is no upper bound.
+static size_t
+parse_repeat (const char *p, long *min, long *max)
+{
+  if (p[0] != '{' || p[1] < '0' || p[1] > '9')
+    return 0;
+
+  const char *q = p + 1;
+  *min          = repeat_count (&q);
+  *max          = *min;
+  if (*q == ',')
   {
-    if (error_message)
-      *error_message = NULL;
-    return compiled;
+    q++;
+    *max = (*q >= '0' && *q <= '9') ? repeat_count (&q) : -1;
   }
+  return *q == '}' ? (size_t)(q + 1 - p) : 0;
+}
 
-  if (can_compile_to_dfa (pattern))
+// Append bytes to a rewritten pattern, which may not grow past MAX_PATTERN_LENGTH
+static bool
+repeat_append (RepeatText *out, const char *bytes, size_t len)
+{
+  if (out->len + len > MAX_PATTERN_LENGTH)
   {
-    bool dfa_compiled      = false;
-    bool has_top_level_alt = (strchr (pattern, '|') != NULL);
-
-    if (has_top_level_alt)
-    {
-      dfa_compiled = compile_alternation_to_dfa (compiled, pattern);
-    }
-    else
-    {
-      dfa_compiled = compile_literal_to_dfa (compiled, pattern);
-    }
-
-    if (dfa_compiled)
+    out->error = "Pattern too long (exceeds security limit)";
+    return false;
+  }
+  if (out->len + len + 1 > out->cap)
+  {
+    size_t cap  = (out->len + len + 1) * 2;
+    char *grown = realloc (out->text, cap);
+    if (!grown)
     {
-      if (error_message)
-        *error_message = NULL;
-      return compiled;
+      out->error = "Out of memory";
+      return false;
     }
+    out->text = grown;
+    out->cap  = cap;
   }
+  memcpy (out->text + out->len, bytes, len);
+  out->len += len;
+  out->text[out->len] = '\0';
+  return true;
+}
 
-  states       = malloc (MAX_NFA_STATES * sizeof (State));
-  ptrlist_pool = malloc (MAX_PTRLIST_ENTRIES * sizeof (Ptrlist));
-  if (!states || !ptrlist_pool)
+// Append the expansion of atom{min,max}: min copies of the atom followed by
+// a star or plus without an upper bound, or else by nested optional copies
+// (a(a(a)?)?)?.  After any number of copies only one of the nested copies
+// can continue, where every copy of a chain a?a?a? could.  The nesting is
+// cut into blocks of REPEAT_NEST_MAX to bound the parser's recursion.
+static bool
+repeat_expand (RepeatText *out, const char *atom, size_t atom_len, long min, long max)
+{
+  if (max < 0)
   {
-    free (states);
-    free (ptrlist_pool);
-    vibrex_free (compiled);
-    if (error_message)
-      *error_message = "Out of memory";
-    return NULL;
+    for (long i = 1; i < min; i++)
+      if (!repeat_append (out, atom, atom_len))
+        return false;
+    return repeat_append (out, atom, atom_len) && repeat_append (out, min ? "+" : "*", 1);
   }
 
-  nstate   = 0;
-  nptrlist = 0;
-
-  ParseContext ctx = {pattern, 0, 0, MAX_RECURSION_DEPTH};
-  Frag e           = parsealt (&ctx);
-  if (!e.start)
-  {
-    free (states);
-    free (ptrlist_pool);
-    vibrex_free (compiled);
-    if (error_message)
-      *error_message = "Parse error: Invalid pattern structure";
-    return NULL;
-  }
+  for (long i = 0; i < min; i++)
+    if (!repeat_append (out, atom, atom_len))
+      return false;
 
-  if (ctx.pos < (int)strlen (pattern))
+  for (long left = max - min; left > 0;)
   {
-    free (states);
-    free (ptrlist_pool);
-    vibrex_free (compiled);
-    if (error_message)
-      *error_message = "Parse error: Unexpected characters at end of pattern";
-    return NULL;
+    long block = left < REPEAT_NEST_MAX ? left : REPEAT_NEST_MAX;
+    for (long i = 0; i < block; i++)
+      if (!repeat_append (out, "(", 1) || !repeat_append (out, atom, atom_len))
+        return false;
+    for (long i = 0; i < block; i++)
+      if (!repeat_append (out, ")?", 2))
+        return false;
+    left -= block;
   }
+  return true;
+}
 
-  State *match = state (STATE_MATCH, NULL, NULL);
-  patch (e.out, match);
+// Rewrite the bounded repetitions of a pattern as copies of their atoms, so
+// the parser and the pattern analysis of every engine only see *, + and ?.
+// The atom is the last character, escape, class or group, as in parsepiece.
+// expanded is left NULL when the pattern has no repetition, otherwise the
+// caller frees it.
+static bool
+expand_repetitions (const char *pattern, char **expanded, const char **error_message)
+{
+  *expanded = NULL;
+  if (!strchr (pattern, '{'))
+    return true;
 
-  compiled->start  = e.start;
-  compiled->nstate = nstate;
-  compiled->states = states;
+  RepeatText out = {0};
+  size_t groups[MAX_RECURSION_DEPTH]; // Offsets in out of the open groups
+  size_t depth  = 0;
+  size_t atom   = SIZE_MAX; // Offset in out of the last atom, SIZE_MAX when there is none
+  bool repeated = false;    // The last atom was repeated by a bound
 
-  int pat_len = strlen (pattern);
-  if (pat_len > 0 && pattern[pat_len - 1] == '$')
+  for (size_t i = 0; pattern[i] && !out.error;)
   {
-    if (pat_len == 1 || pattern[pat_len - 2] != '\\')
+    long min;
+    long max;
+    size_t len = parse_repeat (pattern + i, &min, &max);
+    if (len)
     {
-      compiled->anchored_end = true;
+      if (atom == SIZE_MAX)
+        out.error = "Parse error: Invalid repetition";
+      else if (min > MAX_REPEAT_COUNT || max > MAX_REPEAT_COUNT)
+        out.error = "Repetition count too large (exceeds security limit)";
+      else if (max >= 0 && min > max)
+        out.error = "Parse error: Invalid repetition";
+      else
+      {
+        // The atom is copied out of the text that the expansion replaces
+        size_t atom_len = out.len - atom;
+        char *copy      = malloc (atom_len ? atom_len : 1);
+        if (!copy)
+          out.error = "Out of memory";
+        else
+        {
+          memcpy (copy, out.text + atom, atom_len);
+          out.len           = atom;
+          out.text[out.len] = '\0';
+          repeat_expand (&out, copy, atom_len, min, max);
+          free (copy);
+        }
+      }
+      atom     = SIZE_MAX;
+      repeated = true;
+      i += len;
+      continue;
+    }
+
+    char c = pattern[i];
+    if (repeated && (c == '*' || c == '+' || c == '?'))
+    {
+      out.error = "Parse error: Invalid repetition";
+      break;
+    }
+    repeated = false;
+
+    // Copy the next token, an escape or a class as a whole
+    size_t start = out.len;
+    len          = 1;
+    if (c == '\\' && pattern[i + 1])
+      len = 2;
+    else if (c == '[')
+    {
+      len += (pattern[i + len] == '^');
+      while (pattern[i + len] && pattern[i + len] != ']')
+        len++;
+      len += (pattern[i + len] == ']');
+    }
+    if (!repeat_append (&out, pattern + i, len))
+      break;
+    i += len;
+
+    if (c == '(')
+    {
+      if (depth == MAX_RECURSION_DEPTH)
+        out.error = "Parse error: Invalid pattern structure";
+      else
+        groups[depth++] = start;
+      atom = SIZE_MAX;
     }
+    else if (c == ')')
+      atom = depth ? groups[--depth] : SIZE_MAX;
+    else if (c == '|' || c == '*' || c == '+' || c == '?')
+      atom = SIZE_MAX;
+    else
+      atom = start;
   }
 
-  compiled->state_list1 = malloc (nstate * sizeof (State *));
-  compiled->state_list2 = malloc (nstate * sizeof (State *));
-  if (!compiled->state_list1 || !compiled->state_list2)
+  if (out.error)
   {
-    vibrex_free (compiled);
-    free (ptrlist_pool);
+    free (out.text);
     if (error_message)
-      *error_message = "Out of memory";
-    return NULL;
+      *error_message = out.error;
+    return false;
   }
 
-  compiled->has_dotstar_unanchored = (strcmp (pattern, ".*") == 0);
+  // A pattern of nothing but zero repetitions expands to the empty pattern
+  *expanded = out.text ? out.text : calloc (1, 1);
+  if (!*expanded)
+  {
+    if (error_message)
+      *error_message = "Out of memory";
+    return false;
+  }
+  return true;
+}
 
-  // Check for top-level alternations, which make simple prefix analysis unsafe
-  bool has_top_level_alt = false;
-  if (!compiled->dfa.enabled && !compiled->has_advanced_alt_opt)
+/********************************************************************************
+ * PUBLIC API FUNCTIONS
+ ********************************************************************************/
+
+// Compile regex to NFA
+struct vibrex_pattern *
+vibrex_compile (const char *pattern, const char **error_message)
+{
+  return vibrex_compile_ex (pattern, 0, error_message);
+}
+
+// Compile regex with VIBREX_* flags
+struct vibrex_pattern *
+vibrex_compile_ex (const char *pattern, unsigned flags, const char **error_message)
+{
+  if (flags & ~(unsigned)(VIBREX_ICASE | VIBREX_NO_SPECIALIZED | VIBREX_NO_BITNFA | VIBREX_NO_LAZY_DFA))
+  {
+    if (error_message)
+      *error_message = "Unknown compile flags";
+    return NULL;
+  }
+
+  // Bounded repetitions are compiled as the pattern they expand to
+  char *expanded = NULL;
+  if (pattern && !expand_repetitions (pattern, &expanded, error_message))
+    return NULL;
+  if (expanded)
+    pattern = expanded;
+
+  struct vibrex_pattern *compiled = compile_pattern (pattern, false, flags, error_message);
+  if (!compiled)
+  {
+    free (expanded);
+    return NULL;
+  }
+
+  bool bounded = compile_bounds (compiled, pattern);
+  free (expanded);
+  if (!bounded)
+  {
+    vibrex_free (compiled);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+
+  struct vibrex_pattern *packed = pattern_pack (compiled);
+  if (!packed)
+  {
+    vibrex_free (compiled);
+    if (error_message)
+      *error_message = "Out of memory";
+  }
+  return packed;
+}
+
+// Compile a top-level pattern or a sub-pattern nested in another one
+static struct vibrex_pattern *
+compile_pattern (const char *pattern, bool nested, unsigned flags, const char **error_message)
+{
+  if (!pattern)
+  {
+    if (error_message)
+      *error_message = "NULL pattern";
+    return NULL;
+  }
+
+  // Security check: Prevent DoS via extremely long patterns
+  size_t pattern_len = strlen (pattern);
+  if (pattern_len > MAX_PATTERN_LENGTH)
+  {
+    if (error_message)
+      *error_message = "Pattern too long (exceeds security limit)";
+    return NULL;
+  }
+
+  struct vibrex_pattern *compiled = calloc (1, sizeof (struct vibrex_pattern));
+  if (!compiled)
+  {
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+  compiled->nested = nested;
+  compiled->flags  = flags;
+  bool icase       = (flags & VIBREX_ICASE) != 0;
+  bool specialize  = (flags & VIBREX_NO_SPECIALIZED) == 0;
+
+  // Try both anchors optimization first (^prefix.*suffix$)
+  if (specialize && compile_both_anchors_opt (compiled, pattern))
+  {
+    compiled->engine = ENGINE_BOTH_ANCHORS;
+    if (error_message)
+      *error_message = NULL;
+    return compiled;
+  }
+
+  // Try URL pattern optimization (https?://[char-class]+)
+  if (specialize && !icase && compile_url_pattern_opt (compiled, pattern))
+  {
+    compiled->engine = ENGINE_URL;
+    if (error_message)
+      *error_message = NULL;
+    return compiled;
+  }
+
+  // Try literal alternation optimization (literal1|literal2|...)
+  if (specialize && compile_literal_alt_opt (compiled, pattern))
+  {
+    compiled->engine = ENGINE_LITERAL_ALT;
+    if (error_message)
+      *error_message = NULL;
+    return compiled;
+  }
+
+  // Plain literals and literal alternations are matched by the dense DFA
+  // rather than split into prefix and suffix by the advanced alternation engine
+  if (specialize && can_compile_to_dfa (pattern) && compile_literals_to_dfa (compiled, pattern))
+  {
+    compiled->engine = ENGINE_DFA;
+    if (error_message)
+      *error_message = NULL;
+    return compiled;
+  }
+
+  // The advanced alternation engine compares literals byte for byte
+  if (specialize && !icase && compile_advanced_alternation_opt (compiled, pattern))
   {
-    int paren_depth       = 0;
-    const char *alt_check = pattern;
-    while (*alt_check)
+    if (!finish_compile (compiled))
     {
-      if (*alt_check == '(')
-        paren_depth++;
-      else if (*alt_check == ')')
-        paren_depth--;
-      else if (*alt_check == '|' && paren_depth == 0)
-      {
-        has_top_level_alt = true;
-        break;
-      }
-      alt_check++;
+      vibrex_free (compiled);
+      if (error_message)
+        *error_message = "Out of memory";
+      return NULL;
+    }
+    compiled->engine = ENGINE_ADVANCED_ALT;
+    if (error_message)
+      *error_message = NULL;
+    return compiled;
+  }
+
+  State *states = NULL;
+  int nstate    = 0;
+  State *start  = NULL;
+  if (!build_nfa (pattern, flags, MAX_NFA_STATES, &states, &nstate, &start, error_message))
+  {
+    vibrex_free (compiled);
+    return NULL;
+  }
+
+  compiled->start  = start;
+  compiled->nstate = nstate;
+  compiled->states = states;
+  compiled->num_byte_classes = compute_byte_classes (states, nstate, compiled->byte_class);
+  if (!compile_follow (compiled) || !compile_bitnfa (compiled))
+  {
+    vibrex_free (compiled);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+
+  int pat_len = strlen (pattern);
+  if (pat_len > 0 && pattern[pat_len - 1] == '$')
+  {
+    if (pat_len == 1 || pattern[pat_len - 2] != '\\')
+    {
+      compiled->anchored_end = true;
     }
   }
 
-  if (!has_top_level_alt && !compiled->dfa.enabled && !compiled->has_advanced_alt_opt)
+  if (!finish_compile (compiled))
+  {
+    vibrex_free (compiled);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+
+  compiled->has_dotstar_unanchored = specialize && strcmp (pattern, ".*") == 0;
+  compiled->engine                 = compiled->has_dotstar_unanchored ? ENGINE_DOTSTAR
+                                     : compiled->bitnfa.enabled     ? ENGINE_BITNFA
+                                                                    : ENGINE_NFA;
+
+  // Check for top-level alternations, which make simple prefix analysis unsafe
+  bool has_top_level_alt = !compiled->dfa.enabled && !compiled->has_advanced_alt_opt &&
+                           has_top_level_alternation (pattern);
+
+  // Required literals are looked for after a literal prefix, which is
+  // searched for already
+  const char *required_from = pattern;
+
+  // The literal prefix is searched for byte for byte; when ignoring case,
+  // the required literals cover it instead
+  if (!icase && !has_top_level_alt && !compiled->dfa.enabled && !compiled->has_advanced_alt_opt)
   {
     const char *p          = pattern;
     bool is_start_anchored = (*p == '^');
@@ -875,22 +1620,15 @@ vibrex_compile (const char *pattern, const char **error_message)
           memcpy (compiled->literal_prefix, prefix_buf, prefix_idx);
           compiled->literal_prefix[prefix_idx] = '\0';
           compiled->prefix_len                 = prefix_idx;
-
-          for (int i = 0; i < TRANSITION_TABLE_SIZE; i++)
-          {
-            compiled->bad_char.skip[i] = prefix_idx;
-          }
-          for (int i = 0; i < prefix_idx - 1; i++)
-          {
-            compiled->bad_char.skip[(unsigned char)prefix_buf[i]] = prefix_idx - 1 - i;
-          }
-          compiled->bad_char.enabled = true;
+          literal_searcher_init (&compiled->prefix_search, prefix_buf, prefix_idx);
+          required_from = end_of_prefix;
         }
       }
     }
   }
 
-  free (ptrlist_pool);
+  compile_required_literals (compiled, required_from);
+
   if (error_message)
     *error_message = NULL;
   return compiled;
@@ -907,41 +1645,99 @@ typedef struct List
   int n;
 } List;
 
-// Global state lists for matching (reused across calls)
-static List l1, l2;
+// Start a new generation of state marks, clearing them on wrap-around
+static void
+next_generation (struct vibrex_scratch *scratch)
+{
+  if (++scratch->listid == 0)
+  {
+    memset (scratch->marks, 0, scratch->capacity * sizeof (unsigned));
+    scratch->listid = 1;
+  }
+}
 
-// Add state to list with epsilon closure (position-aware)
+// Add state to list with epsilon closure (position-aware).  States are
+// marked when pushed, so the stack never holds more than every state once.
 static void
-addstate_pos (List *l, State *s, int pos)
+addstate_pos (struct vibrex_scratch *scratch, const State *base, List *l, State *s, int pos)
 {
-  if (s == NULL || s->lastlist == listid)
+  unsigned *marks = scratch->marks;
+  unsigned listid = scratch->listid;
+  State **stack   = scratch->stack;
+  int top         = 0;
+
+  if (s == NULL || marks[s - base] == listid)
     return;
-  s->lastlist = listid;
+  marks[s - base] = listid;
+  stack[top++]    = s;
+
+  while (top > 0)
+  {
+    s = stack[--top];
+
+    State *next  = NULL;
+    State *next1 = NULL;
+    if (s->type == STATE_SPLIT)
+    {
+      next  = s->out;
+      next1 = s->out1;
+    }
+    else if (s->type == STATE_START_ANCHOR)
+    {
+      if (pos == 0)
+        next = s->out;
+    }
+    else
+    {
+      l->s[l->n++] = s;
+      continue;
+    }
+
+    // Push out1 first so out is walked first, as a recursive walk would
+    if (next1 && marks[next1 - base] != listid)
+    {
+      marks[next1 - base] = listid;
+      stack[top++]        = next1;
+    }
+    if (next && marks[next - base] != listid)
+    {
+      marks[next - base] = listid;
+      stack[top++]       = next;
+    }
+  }
+}
 
-  if (s->type == STATE_SPLIT)
+// Add the epsilon closure of the state a consuming state leads to, copied
+// from its precomputed closure when there is one
+static inline void
+addstate_follow (struct vibrex_scratch *scratch, const struct vibrex_pattern *pattern, List *l, const State *s)
+{
+  const State *base = pattern->states;
+  if (!pattern->follow_start)
   {
-    addstate_pos (l, s->out, pos);
-    addstate_pos (l, s->out1, pos);
+    addstate_pos (scratch, base, l, s->out, -1);
     return;
   }
 
-  if (s->type == STATE_START_ANCHOR)
+  unsigned *marks = scratch->marks;
+  unsigned listid = scratch->listid;
+  int index       = (int)(s - base);
+  for (int i = pattern->follow_start[index]; i < pattern->follow_start[index + 1]; i++)
   {
-    if (pos == 0)
+    int target = pattern->follow[i];
+    if (marks[target] != listid)
     {
-      addstate_pos (l, s->out, pos);
+      marks[target] = listid;
+      l->s[l->n++]  = (State *)&base[target];
     }
-    return;
   }
-
-  l->s[l->n++] = s;
 }
 
 // Step simulation with one character
 static void
-step (List *clist, unsigned char c, List *nlist)
+step (struct vibrex_scratch *scratch, const struct vibrex_pattern *pattern, List *clist, unsigned char c, List *nlist)
 {
-  listid++;
+  next_generation (scratch);
   nlist->n = 0;
 
   for (int i = 0; i < clist->n; i++)
@@ -952,24 +1748,86 @@ step (List *clist, unsigned char c, List *nlist)
     {
     case STATE_CHAR:
       if (s->data.c == c)
-        addstate_pos (nlist, s->out, -1);
+        addstate_follow (scratch, pattern, nlist, s);
       break;
 
     case STATE_ANY:
-      addstate_pos (nlist, s->out, -1);
+      addstate_follow (scratch, pattern, nlist, s);
       break;
 
     case STATE_CLASS:
       if (s->data.cclass[c / 8] & (1 << (c % 8)))
-        addstate_pos (nlist, s->out, -1);
+        addstate_follow (scratch, pattern, nlist, s);
       break;
 
+    default:
+      break;
+    }
+  }
+}
 
+// Precompute the closure each consuming state leads to, so a step copies
+// it instead of walking split states.  Patterns whose closures would
+// exceed MAX_FOLLOW_ENTRIES keep walking the NFA.
+static bool
+compile_follow (struct vibrex_pattern *compiled)
+{
+  int nstate                     = compiled->nstate;
+  struct vibrex_scratch *scratch = vibrex_scratch_create (NULL);
+  int *follow_start              = malloc ((nstate + 1) * sizeof (int));
+  int *follow                    = NULL;
+  int capacity                   = 0;
+  int count                      = 0;
+  bool ok                        = scratch && follow_start && scratch_reserve (scratch, nstate);
+  bool fits                      = true;
+
+  for (int i = 0; ok && fits && i < nstate; i++)
+  {
+    const State *s  = &compiled->states[i];
+    follow_start[i] = count;
+    if (s->type != STATE_CHAR && s->type != STATE_ANY && s->type != STATE_CLASS)
+      continue;
 
-    default:
+    List l = {scratch->list1, 0};
+    next_generation (scratch);
+    addstate_pos (scratch, compiled->states, &l, s->out, -1);
+    if (l.n > MAX_FOLLOW_ENTRIES - count)
+    {
+      fits = false;
       break;
     }
+    if (count + l.n > capacity)
+    {
+      int new_capacity = capacity ? capacity * 2 : 64;
+      while (new_capacity < count + l.n)
+        new_capacity *= 2;
+      int *grown = realloc (follow, new_capacity * sizeof (int));
+      if (!grown)
+      {
+        ok = false;
+        break;
+      }
+      follow   = grown;
+      capacity = new_capacity;
+    }
+    for (int j = 0; j < l.n; j++)
+      follow[count++] = (int)(l.s[j] - compiled->states);
+  }
+
+  if (ok && fits)
+  {
+    follow_start[nstate]   = count;
+    compiled->follow       = follow;
+    compiled->follow_start = follow_start;
+    compiled->follow_count = count;
+  }
+  else
+  {
+    free (follow);
+    free (follow_start);
   }
+  vibrex_scratch_free (scratch);
+  return ok;
 }
 
 // Check if list contains match state
@@ -984,8 +1842,24 @@ ismatch (List *l)
   return false;
 }
 
+// Whether an end anchor at the end of the text leads to a match, passing
+// any end anchors behind it as well, as in a$$ or (a$|b)$
+static bool
+end_anchor_matches (struct vibrex_scratch *scratch, const State *base, const State *s)
+{
+  List temp_list = {scratch->list3, 0};
+  next_generation (scratch);
+  addstate_pos (scratch, base, &temp_list, s->out, -1);
+  for (int i = 0; i < temp_list.n; i++)
+  {
+    if (temp_list.s[i]->type == STATE_END_ANCHOR)
+      addstate_pos (scratch, base, &temp_list, temp_list.s[i]->out, -1);
+  }
+  return ismatch (&temp_list);
+}
+
 static bool
-is_end_match (List *l, bool at_end_of_text)
+is_end_match (struct vibrex_scratch *scratch, const State *base, List *l, bool at_end_of_text)
 {
   for (int i = 0; i < l->n; i++)
   {
@@ -993,1117 +1867,5929 @@ is_end_match (List *l, bool at_end_of_text)
     if (s->type == STATE_MATCH)
       return true;
 
-    if (s->type == STATE_END_ANCHOR && at_end_of_text)
-    {
-      List temp_list;
-      State *temp_states[16];
-      temp_list.s = temp_states;
-      temp_list.n = 0;
-      listid++;
-      addstate_pos (&temp_list, s->out, -1);
-      if (ismatch (&temp_list))
-        return true;
-    }
+    if (s->type == STATE_END_ANCHOR && at_end_of_text && end_anchor_matches (scratch, base, s))
+      return true;
   }
   return false;
 }
 
-// Match text against compiled pattern
-bool
-vibrex_match (const struct vibrex_pattern *pattern, const char *text)
+// NFA simulation state carried from one piece of text to the next
+typedef struct
 {
-  if (!pattern || !text)
-    return false;
+  List lists[2]; // State lists in the scratch space
+  int current;   // Index of the list of states after the text run so far
+  size_t offset; // Bytes of text run so far
+} NfaRun;
 
-  // Check both anchors optimization first (fastest)
-  if (pattern->both_anchors.enabled)
-  {
-    return match_with_both_anchors_opt (pattern, text);
-  }
+// Start an NFA simulation at the start of a text
+static void
+nfa_run_init (NfaRun *run, struct vibrex_scratch *scratch)
+{
+  run->lists[0] = (List){scratch->list1, 0};
+  run->lists[1] = (List){scratch->list2, 0};
+  run->current  = 0;
+  run->offset   = 0;
+  next_generation (scratch);
+}
 
-  // Check URL pattern optimization
-  if (pattern->url_pattern.enabled)
+// Run the NFA simulation over the next piece of a text, using the scratch
+// space for all mutable state.  One forward pass adds the start state at
+// every position, so every attempt advances in the same list and the work
+// is linear in the text length.  While no attempt is in progress the
+// literal prefix or first character skips to the next position where one
+// can start; the prefix is only searched for in a whole text, as in pieces
+// it could straddle two of them.  Returns true once a match ends.
+static bool
+nfa_run (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, NfaRun *run, const char *text,
+         size_t textlen, bool at_end, bool whole_text)
+{
+  const State *base      = pattern->states;
+  List *clist            = &run->lists[run->current];
+  List *nlist            = &run->lists[1 - run->current], *tmp;
+  const char *text_start = run->offset == 0 ? text : NULL;
+  const char *text_end   = text + textlen;
+  const char *p          = text;
+  bool is_start_anchored = (pattern->start && pattern->start->type == STATE_START_ANCHOR);
+  bool skip              = !is_start_anchored && pattern->has_first_char;
+  bool found             = false;
+
+  // A piece that is not the last stops before the start state is added for
+  // the position after it, which the next piece begins with
+  while (p < text_end || at_end)
   {
-    return match_with_url_pattern_opt (pattern, text);
-  }
+    if (p == text_start || !is_start_anchored)
+    {
+      if (skip && clist->n == 0)
+      {
+        const char *candidate;
+        if (pattern->prefix_search.enabled && whole_text)
+          candidate = literal_searcher_find (&pattern->prefix_search, pattern->literal_prefix, pattern->prefix_len, p,
+                                             text_end - p);
+        else
+          candidate = memchr (p, pattern->first_char, text_end - p);
+        if (!candidate)
+          break;
+        p = candidate;
+      }
+      addstate_pos (scratch, base, clist, pattern->start, p == text_start ? 0 : -1);
+    }
 
-  // Check literal alternation optimization
-  if (pattern->literal_alt.enabled)
-  {
-    return match_with_literal_alt_opt (pattern, text);
-  }
+    if (is_end_match (scratch, base, clist, at_end && p == text_end))
+    {
+      found = true;
+      break;
+    }
+    if (p == text_end || clist->n == 0)
+      break;
 
-  if (pattern->has_advanced_alt_opt)
-  {
-    return match_with_advanced_alternation_opt (pattern, text);
+#ifdef VIBREX_COUNTERS
+    scratch->nfa_steps++;
+#endif
+    step (scratch, pattern, clist, *p++, nlist);
+    tmp   = clist;
+    clist = nlist;
+    nlist = tmp;
   }
-  if (pattern->dfa.enabled)
-  {
-    return dfa_match (&pattern->dfa, text);
-  }
-  if (pattern->has_dotstar_unanchored)
-  {
-    return true;
-  }
-
-  l1.s                    = pattern->state_list1;
-  l2.s                    = pattern->state_list2;
-  int textlen             = strlen (text);
-  const char *text_end    = text + textlen;
-  const char *current_pos = text;
-  bool is_start_anchored  = (pattern->start && pattern->start->type == STATE_START_ANCHOR);
 
-  if (pattern->bad_char.enabled)
-  {
-    while ((current_pos = boyer_moore_search (current_pos, text_end - current_pos, pattern)) != NULL)
-    {
-      listid++;
-      l1.n = 0;
-      addstate_pos (&l1, pattern->start, current_pos - text);
+  run->current = (int)(clist - run->lists);
+  run->offset += textlen;
+  return found;
+}
 
-      List *clist = &l1, *nlist = &l2, *tmp;
+// Match a whole text with the NFA simulation
+static bool
+nfa_match (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t textlen)
+{
+  NfaRun run;
+  nfa_run_init (&run, scratch);
+  return nfa_run (pattern, scratch, &run, text, textlen, true, true);
+}
 
-      // Check for match after initialization
-      if (!pattern->anchored_end && ismatch (clist))
-        return true;
+// Whether a state in the list at some position ends a match there
+static bool
+state_ends_match (struct vibrex_scratch *scratch, const State *base, State *s, bool at_end_of_text)
+{
+  if (s->type == STATE_MATCH)
+    return true;
+  if (s->type != STATE_END_ANCHOR || !at_end_of_text)
+    return false;
+  return end_anchor_matches (scratch, base, s);
+}
 
-      // Simulate consuming the prefix that Boyer-Moore already matched
-      for (int i = 0; i < pattern->prefix_len; i++)
+// Find the leftmost-longest match with the NFA simulation.  Each state in
+// the lists carries the start of the attempt that reached it.  Attempts
+// are added in order of their start and a state keeps the first attempt to
+// reach it, so the lists stay ordered by start and the first state that
+// ends a match belongs to the leftmost attempt ending there.  Once a match
+// is found no attempts are started and later ones are dropped, and the
+// simulation runs on until the remaining attempts die to find the longest.
+// Only matches starting at or after from are found, and while no attempt is
+// in progress the search skips to the next literal prefix, first character
+// or, given idle_span, byte outside the span of bytes no match starts with.
+// Given stop, it is set to where the simulation ended, or to SIZE_MAX if it
+// gave up on a match it ran on more than run_on bytes past with attempts
+// still in progress that could extend or replace it.
+static bool
+nfa_search (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t textlen,
+            size_t from, const ByteSpan *idle_span, size_t run_on, size_t *stop, size_t *match_start,
+            size_t *match_end)
+{
+  const State *base      = pattern->states;
+  List clist             = {scratch->list1, 0};
+  List nlist             = {scratch->list2, 0};
+  size_t *cstarts        = scratch->starts1;
+  size_t *nstarts        = scratch->starts2;
+  bool is_start_anchored = (pattern->start && pattern->start->type == STATE_START_ANCHOR);
+  bool skip              = !is_start_anchored && (pattern->has_first_char || idle_span);
+  bool found             = false;
+  size_t pos             = from;
+
+  next_generation (scratch);
+  for (;; pos++)
+  {
+    if (!found && (pos == 0 || !is_start_anchored))
+    {
+      if (skip && clist.n == 0)
       {
-        step (clist, current_pos[i], nlist);
-        tmp   = clist;
-        clist = nlist;
-        nlist = tmp;
-        if (clist->n == 0)
+        const char *candidate;
+        if (pattern->prefix_search.enabled)
+          candidate = literal_searcher_find (&pattern->prefix_search, pattern->literal_prefix, pattern->prefix_len,
+                                             text + pos, textlen - pos);
+        else if (pattern->has_first_char)
+          candidate = memchr (text + pos, pattern->first_char, textlen - pos);
+        else
+          candidate = (const char *)byte_span (idle_span, (const unsigned char *)text + pos,
+                                               (const unsigned char *)text + textlen);
+        if (!candidate || candidate == text + textlen)
           break;
-        // Check for match after each character in prefix
-        if (!pattern->anchored_end && ismatch (clist))
-          return true;
+        pos = candidate - text;
       }
+      int n = clist.n;
+      addstate_pos (scratch, base, &clist, pattern->start, pos == 0 ? 0 : -1);
+      for (int i = n; i < clist.n; i++)
+        cstarts[i] = pos;
+    }
 
-      // Now continue with the rest of the pattern
-      for (const char *p = current_pos + pattern->prefix_len; p < text_end; ++p)
+    for (int i = 0; i < clist.n; i++)
+    {
+      if (state_ends_match (scratch, base, clist.s[i], pos == textlen))
       {
-        step (clist, *p, nlist);
-        tmp   = clist;
-        clist = nlist;
-        nlist = tmp;
-        if (clist->n == 0)
-          break;
-        // Check for match after each character
-        if (!pattern->anchored_end && ismatch (clist))
-          return true;
+        if (!found || cstarts[i] <= *match_start)
+        {
+          *match_start = cstarts[i];
+          *match_end   = pos;
+        }
+        found = true;
+        break;
       }
-      if (is_end_match (clist, true))
-        return true;
-      current_pos++;
     }
-    return false;
-  }
 
-  if (!is_start_anchored && pattern->has_first_char)
-  {
-    while ((current_pos = strchr (current_pos, pattern->first_char)) != NULL)
+    // Attempts that started after the match can no longer win
+    if (found)
     {
-      listid++;
-      l1.n = 0;
-      addstate_pos (&l1, pattern->start, current_pos - text);
-      List *clist = &l1, *nlist = &l2, *tmp;
-      if (!pattern->anchored_end && ismatch (clist))
-        return true;
-
-      for (const char *p = current_pos; p < text_end; ++p)
+      int n = 0;
+      while (n < clist.n && cstarts[n] <= *match_start)
+        n++;
+      clist.n = n;
+      if (n > 0 && pos - *match_end > run_on)
       {
-        step (clist, *p, nlist);
-        tmp   = clist;
-        clist = nlist;
-        nlist = tmp;
-        if (clist->n == 0)
-          break;
-        if (!pattern->anchored_end && ismatch (clist))
-          return true;
+        pos = SIZE_MAX;
+        break;
       }
-      if (is_end_match (clist, true))
-        return true;
-      current_pos++;
     }
-    return false;
+
+    if (pos == textlen || (clist.n == 0 && (found || is_start_anchored)))
+      break;
+
+    unsigned char c = (unsigned char)text[pos];
+    next_generation (scratch);
+    nlist.n = 0;
+    for (int i = 0; i < clist.n; i++)
+    {
+      const State *s = clist.s[i];
+      bool consumes  = (s->type == STATE_CHAR && s->data.c == c) || s->type == STATE_ANY ||
+                      (s->type == STATE_CLASS && (s->data.cclass[c / 8] & (1 << (c % 8))));
+      if (!consumes)
+        continue;
+      int n = nlist.n;
+      addstate_follow (scratch, pattern, &nlist, s);
+      for (int k = n; k < nlist.n; k++)
+        nstarts[k] = cstarts[i];
+    }
+
+    List tmp_list = clist;
+    clist         = nlist;
+    nlist         = tmp_list;
+    size_t *tmp   = cstarts;
+    cstarts       = nstarts;
+    nstarts       = tmp;
   }
+  if (stop)
+    *stop = pos;
+  return found;
+}
 
-  int max_start_pos = is_start_anchored ? 0 : textlen;
-  for (int i = 0; i <= max_start_pos; i++)
+/********************************************************************************
+ * MATCH BOUNDS
+ ********************************************************************************/
+
+// Add the bytes a consuming state accepts to a byte set
+static void
+state_bytes (const State *s, unsigned char *set)
+{
+  if (s->type == STATE_CHAR)
+    set[s->data.c / 8] |= 1 << (s->data.c % 8);
+  else if (s->type == STATE_ANY)
+    memset (set, 0xff, CHAR_CLASS_BYTES);
+  else if (s->type == STATE_CLASS)
   {
-    listid++;
-    l1.n = 0;
-    addstate_pos (&l1, pattern->start, i);
+    for (int i = 0; i < CHAR_CLASS_BYTES; i++)
+      set[i] |= s->data.cclass[i];
+  }
+}
+
+static inline bool
+is_consuming (const State *s)
+{
+  return s->type == STATE_CHAR || s->type == STATE_ANY || s->type == STATE_CLASS;
+}
 
-    List *clist = &l1, *nlist = &l2, *tmp;
+// Work out the length and byte bounds of every match from the closures of
+// an NFA's consuming states.  Leaves the bounds disabled if the closures
+// were too large to compute or the pattern can never match.
+static bool
+analyze_bounds (const struct vibrex_pattern *nfa, MatchBounds *bounds)
+{
+  const State *base = nfa->states;
+  int nstate        = nfa->nstate;
+  if (!nfa->follow_start || nstate == 0)
+    return true;
 
-    if (is_end_match (clist, i == textlen))
+  struct vibrex_scratch *scratch = vibrex_scratch_create (NULL);
+  bool *finishes                 = calloc (nstate, sizeof (bool)); // A match can end right after this state
+  bool *seen                     = calloc (nstate, sizeof (bool));
+  int *queue                     = malloc (nstate * sizeof (int));
+  int *indegree                  = calloc (nstate, sizeof (int));
+  size_t *longest                = calloc (nstate, sizeof (size_t));
+  bool ok = scratch && finishes && seen && queue && indegree && longest && scratch_reserve (scratch, nstate);
+  memset (bounds, 0, sizeof (*bounds));
+
+  List l = {NULL, 0};
+  if (ok)
+  {
+    // End anchors whose closure matches, directly or through more end anchors
+    for (bool changed = true; changed;)
     {
-      if (!pattern->anchored_end || i == textlen)
+      changed = false;
+      for (int i = 0; i < nstate; i++)
       {
-        return true;
+        if (base[i].type != STATE_END_ANCHOR || finishes[i])
+          continue;
+        l = (List){scratch->list1, 0};
+        next_generation (scratch);
+        addstate_pos (scratch, base, &l, base[i].out, -1);
+        for (int j = 0; j < l.n; j++)
+        {
+          int target = (int)(l.s[j] - base);
+          if (l.s[j]->type == STATE_MATCH || finishes[target])
+          {
+            finishes[i] = changed = true;
+            break;
+          }
+        }
       }
     }
 
-    for (int j = i; j < textlen; j++)
+    // Consuming states after which a match can end, and whether any match
+    // can end before the text does
+    bounds->anchored_end = true;
+    for (int i = 0; i < nstate; i++)
     {
-      step (clist, text[j], nlist);
-      tmp   = clist;
-      clist = nlist;
-      nlist = tmp;
-      if (clist->n == 0)
-        break;
-
-      if (!pattern->anchored_end && ismatch (clist))
+      if (!is_consuming (&base[i]))
+        continue;
+      for (int j = nfa->follow_start[i]; j < nfa->follow_start[i + 1]; j++)
       {
-        return true;
+        const State *target = &base[nfa->follow[j]];
+        if (target->type == STATE_MATCH)
+          bounds->anchored_end = false;
+        if (target->type == STATE_MATCH || (target->type == STATE_END_ANCHOR && finishes[nfa->follow[j]]))
+          finishes[i] = true;
       }
     }
 
-    // Check for end match only if we've consumed all characters
-    if (is_end_match (clist, true))
-    {
-      return true;
-    }
+    // Attempts starting after the text start only exist without a ^
+    l = (List){scratch->list2, 0};
+    next_generation (scratch);
+    addstate_pos (scratch, base, &l, nfa->start, -1);
+    bounds->anchored_start = (l.n == 0);
 
-    if (is_start_anchored)
-      break;
+    // The closure at the text start holds that of every other start
+    l = (List){scratch->list1, 0};
+    next_generation (scratch);
+    addstate_pos (scratch, base, &l, nfa->start, 0);
   }
 
-  return false;
-}
-
-// Free compiled pattern
-void
-vibrex_free (struct vibrex_pattern *pattern)
-{
-  if (pattern)
+  // Breadth first over the consuming states gives the shortest match, and
+  // their order by longest path the longest, unless there is a loop
+  bool can_match = false;
+  int head = 0, tail = 0;
+  for (int j = 0; ok && j < l.n; j++)
   {
-    free (pattern->states);
-    free (pattern->state_list1);
-    free (pattern->state_list2);
-    free (pattern->literal_prefix);
-
-    free_both_anchors_opt (&pattern->both_anchors);
-    free_url_pattern_opt (&pattern->url_pattern);
-    free_literal_alt_opt (&pattern->literal_alt);
-    free_dfa (&pattern->dfa);
-
-    if (pattern->has_advanced_alt_opt)
+    int i = (int)(l.s[j] - base);
+    if (l.s[j]->type == STATE_MATCH || (l.s[j]->type == STATE_END_ANCHOR && finishes[i]))
     {
-      free_alternation_opt (&pattern->alt_opt);
+      bounds->anchored_end = bounds->anchored_end && l.s[j]->type != STATE_MATCH;
+      can_match            = true;
+    }
+    if (is_consuming (l.s[j]))
+    {
+      seen[i]      = true;
+      longest[i]   = 1;
+      queue[tail++] = i;
+      state_bytes (l.s[j], bounds->first_bytes);
     }
-
-    free (pattern);
   }
-}
-
-/********************************************************************************
- * DFA OPTIMIZATION ENGINE
- ********************************************************************************/
-
-static bool
-can_compile_to_dfa (const char *pattern)
-{
-  if (!pattern)
-    return false;
-
-  const char *p = pattern;
-  if (*p == '^')
-    p++;
-
-  int paren_depth = 0;
-  while (*p)
+  for (size_t length = 1; ok && head < tail; length++)
   {
-    if (*p == '$' && *(p + 1) == '\0')
-      break;
-
-    char c = *p;
-    if (c == '\\')
+    int layer_end = tail;
+    for (; head < layer_end; head++)
     {
-      p++;
-      if (!*p)
-        return false;
+      int i = queue[head];
+      if (finishes[i])
+      {
+        if (!can_match)
+          bounds->min_length = length;
+        can_match = true;
+        state_bytes (&base[i], bounds->last_bytes);
+      }
+      for (int j = nfa->follow_start[i]; j < nfa->follow_start[i + 1]; j++)
+      {
+        int target = nfa->follow[j];
+        if (!is_consuming (&base[target]))
+          continue;
+        indegree[target]++;
+        if (!seen[target])
+        {
+          seen[target]  = true;
+          queue[tail++] = target;
+        }
+      }
     }
-    else if (strchr ("*+?.[()", c))
+  }
+
+  // Kahn's algorithm over the reachable consuming states, starting from
+  // those only entered from the text start
+  if (ok && can_match)
+  {
+    int reachable = tail;
+    head = tail = 0;
+    for (int i = 0; i < nstate; i++)
     {
-      return false;
+      if (seen[i] && indegree[i] == 0)
+        queue[tail++] = i;
     }
-    else if (c == '|')
+    bounds->max_length = 0;
+    while (head < tail)
     {
-      if (paren_depth != 0)
-        return false;
+      int i = queue[head++];
+      if (finishes[i] && longest[i] > bounds->max_length)
+        bounds->max_length = longest[i];
+      for (int j = nfa->follow_start[i]; j < nfa->follow_start[i + 1]; j++)
+      {
+        int target = nfa->follow[j];
+        if (!is_consuming (&base[target]))
+          continue;
+        if (longest[i] + 1 > longest[target])
+          longest[target] = longest[i] + 1;
+        if (--indegree[target] == 0)
+          queue[tail++] = target;
+      }
     }
-    p++;
+    if (tail < reachable)
+      bounds->max_length = SIZE_MAX;
+    bounds->enabled = true;
   }
 
-  return paren_depth == 0;
+  vibrex_scratch_free (scratch);
+  free (finishes);
+  free (seen);
+  free (queue);
+  free (indegree);
+  free (longest);
+  return ok;
 }
 
-static DFAState *
-create_dfa_state (DFA *dfa, bool is_final)
+// Work out the bounds of a top-level pattern.  Engines that do not keep an
+// NFA get one nested in the pattern, which the bounds come from and which
+// streams and searches run.  The engine already accepted the pattern, so
+// rather than MAX_NFA_STATES the NFA may have two states per pattern byte,
+// which every pattern the parser accepts fits in; alternations too large for
+// the NFA engines are searched and streamed like any other.  Patterns the
+// NFA parser rejects have neither.
+static bool
+compile_bounds (struct vibrex_pattern *compiled, const char *pattern)
 {
-  if (dfa->num_states >= dfa->max_states)
+  if (compiled->states)
+    return analyze_bounds (compiled, &compiled->bounds);
+
+  struct vibrex_pattern *nfa = calloc (1, sizeof (struct vibrex_pattern));
+  if (!nfa)
+    return false;
+  nfa->nested    = true;
+  nfa->flags     = compiled->flags;
+  int max_states = SEARCH_STATES_PER_BYTE * (int)strlen (pattern) + 2;
+  if (max_states < MAX_NFA_STATES)
+    max_states = MAX_NFA_STATES;
+  if (!build_nfa (pattern, compiled->flags, max_states, &nfa->states, &nfa->nstate, &nfa->start, NULL))
   {
-    int new_max          = dfa->max_states > 0 ? dfa->max_states * 2 : 16;
-    DFAState *new_states = realloc (dfa->states, new_max * sizeof (DFAState));
-    if (!new_states)
-      return NULL;
-    dfa->states     = new_states;
-    dfa->max_states = new_max;
+    vibrex_free (nfa);
+    return true;
   }
 
-  DFAState *state = &dfa->states[dfa->num_states];
-  state->id       = dfa->num_states;
-  dfa->num_states++;
-
-  state->is_final        = is_final;
-  state->has_transitions = false;
-  memset (state->transitions, 0, sizeof (state->transitions));
+  nfa->num_byte_classes = compute_byte_classes (nfa->states, nfa->nstate, nfa->byte_class);
+  if (!compile_follow (nfa) || !compile_bitnfa (nfa) || !analyze_bounds (nfa, &compiled->bounds))
+  {
+    vibrex_free (nfa);
+    return false;
+  }
+  nfa->engine     = nfa->bitnfa.enabled ? ENGINE_BITNFA : ENGINE_NFA;
+  nfa->max_nstate = nfa->bitnfa.enabled ? 0 : nfa->nstate;
+  compiled->nfa   = nfa;
 
-  return state;
+  // Finding every match in a buffer skips ahead to the required literals
+  compile_required_literals (nfa, pattern);
+  return true;
 }
 
-static bool
-compile_literal_to_dfa (struct vibrex_pattern *compiled, const char *pattern)
+// Whether no match of the pattern fits in the subject, from its length and
+// the bytes at its ends
+static inline bool
+bounds_reject (const MatchBounds *bounds, const char *text, size_t text_len)
 {
-  if (!pattern)
+  if (!bounds->enabled)
     return false;
-
-  compiled->dfa.max_states = strlen (pattern) + 2;
-  compiled->dfa.states     = calloc (compiled->dfa.max_states, sizeof (DFAState));
-  if (!compiled->dfa.states)
+  if (text_len < bounds->min_length)
+    return true;
+  if (bounds->anchored_start && bounds->anchored_end && text_len > bounds->max_length)
+    return true;
+  if (bounds->min_length == 0)
     return false;
-  compiled->dfa.num_states = 0;
 
-  const char *p                = pattern;
-  compiled->dfa.anchored_start = (*p == '^');
-  if (compiled->dfa.anchored_start)
-    p++;
+  unsigned char first = (unsigned char)text[0];
+  unsigned char last  = (unsigned char)text[text_len - 1];
+  if (bounds->anchored_start && !(bounds->first_bytes[first / 8] & (1 << (first % 8))))
+    return true;
+  if (bounds->anchored_end && !(bounds->last_bytes[last / 8] & (1 << (last % 8))))
+    return true;
+  return false;
+}
 
-  int len                    = strlen (p);
-  compiled->dfa.anchored_end = (len > 0 && p[len - 1] == '$' && (len == 1 || p[len - 2] != '\\'));
-  if (compiled->dfa.anchored_end)
-    len--;
+/********************************************************************************
+ * BIT-PARALLEL NFA ENGINE
+ ********************************************************************************/
 
-  if (len < 0)
-    len = 0;
+// The state set after one step of the bit-parallel NFA
+static inline uint64_t
+bitnfa_step (const BitNFA *bits, uint64_t current, int byte_class)
+{
+  uint64_t active = current & bits->accept[byte_class];
+  uint64_t next   = bits->restart | ((active & bits->shift) << 1);
+  for (uint64_t rest = active & bits->jumps; rest; rest &= rest - 1)
+    next |= bits->follow[VIBREX_CTZ64 (rest)];
+  return next;
+}
 
-  DFAState *current = create_dfa_state (&compiled->dfa, len == 0);
-  if (!current)
+// Find the state sets a match loops in, those with no attempt in progress
+// and those a self-looping state settles in, with the bytes each stays in
+// for.  Matching skips runs of such bytes with a span scan.
+static bool
+compile_bitnfa_loops (struct vibrex_pattern *compiled)
+{
+  BitNFA *bits = &compiled->bitnfa;
+  uint64_t candidates[BITNFA_MAX_STATES + 1];
+  int count = 0;
+  if (bits->restart)
+    candidates[count++] = bits->restart;
+  for (int i = 0; i < bits->nbits; i++)
   {
-    free_dfa (&compiled->dfa);
-    return false;
+    if (bits->follow[i] & ((uint64_t)1 << i))
+      candidates[count++] = bits->restart | bits->follow[i];
   }
-  compiled->dfa.start_state = current;
 
-  for (int i = 0; i < len; i++)
+  if (count == 0)
+    return true;
+
+  BitLoop *loops = malloc (count * sizeof (BitLoop));
+  if (!loops)
+    return false;
+  int nloops = 0;
+  for (int k = 0; k < count; k++)
   {
-    unsigned char c = (unsigned char)p[i];
-    if (c == '\\' && i + 1 < len)
-    {
-      i++;
-      c = (unsigned char)p[i];
-    }
+    uint64_t state = candidates[k];
+    bool known     = (state & bits->match) != 0;
+    for (int j = 0; j < nloops && !known; j++)
+      known = (loops[j].state == state);
+    if (known)
+      continue;
 
-    DFAState *next = create_dfa_state (&compiled->dfa, i == len - 1);
-    if (!next)
+    // Bytes of a class all step the same way
+    signed char class_stays[TRANSITION_TABLE_SIZE];
+    unsigned char stay[CHAR_CLASS_BYTES] = {0};
+    bool any                             = false;
+    memset (class_stays, -1, sizeof (class_stays));
+    for (int c = 0; c < TRANSITION_TABLE_SIZE; c++)
     {
-      free_dfa (&compiled->dfa);
-      return false;
+      int k = compiled->byte_class[c];
+      if (class_stays[k] < 0)
+        class_stays[k] = (bitnfa_step (bits, state, k) == state);
+      if (class_stays[k])
+      {
+        stay[c / 8] |= 1 << (c % 8);
+        any = true;
+      }
     }
-
-    current->transitions[c]  = next;
-    current->has_transitions = true;
-    current                  = next;
+    if (!any)
+      continue;
+    loops[nloops].state = state;
+    byte_span_init (&loops[nloops].stay, stay);
+    nloops++;
   }
 
-  compiled->dfa.enabled = true;
+  if (nloops == 0)
+  {
+    free (loops);
+    return true;
+  }
+  bits->loops  = loops;
+  bits->nloops = nloops;
   return true;
 }
 
+// Give each consuming, match and end anchor state of a small pattern one bit
+// of a word, so a step is a few word operations with no lists or pointers.
+// Returns true if the pattern is too large, leaving the engine disabled.
 static bool
-compile_alternation_to_dfa (struct vibrex_pattern *compiled, const char *pattern)
+compile_bitnfa (struct vibrex_pattern *compiled)
 {
-  if (!pattern)
-    return false;
+  BitNFA *bits      = &compiled->bitnfa;
+  const State *base = compiled->states;
+  int nstate        = compiled->nstate;
+  if (!compiled->follow_start || nstate == 0 || (compiled->flags & VIBREX_NO_BITNFA))
+    return true;
 
-  compiled->dfa.max_states = 256;
-  compiled->dfa.states     = calloc (compiled->dfa.max_states, sizeof (DFAState));
-  if (!compiled->dfa.states)
+  // Number the states that can be in a simulation list
+  int *bit_of = malloc (nstate * sizeof (int));
+  if (!bit_of)
     return false;
-  compiled->dfa.num_states = 0;
-
-  const char *p                = pattern;
-  compiled->dfa.anchored_start = (*p == '^');
-  if (compiled->dfa.anchored_start)
-    p++;
-
-  int pat_len                = strlen (p);
-  compiled->dfa.anchored_end = (pat_len > 0 && p[pat_len - 1] == '$' && (pat_len == 1 || p[pat_len - 2] != '\\'));
-  if (compiled->dfa.anchored_end)
-    pat_len--;
-
-  DFAState *start_state = create_dfa_state (&compiled->dfa, false);
-  if (!start_state)
+  int nbits = 0;
+  for (int i = 0; i < nstate; i++)
   {
-    free_dfa (&compiled->dfa);
-    return false;
+    StateType type = base[i].type;
+    bit_of[i]      = -1;
+    if (type == STATE_CHAR || type == STATE_ANY || type == STATE_CLASS || type == STATE_MATCH || type == STATE_END_ANCHOR)
+    {
+      if (nbits == BITNFA_MAX_STATES)
+      {
+        free (bit_of);
+        return true;
+      }
+      bit_of[i] = nbits++;
+    }
   }
-  compiled->dfa.start_state = start_state;
 
-  // Security check: Count alternations to prevent DoS
-  int alt_count       = 0;
-  const char *count_p = p;
-  while ((count_p = strchr (count_p, '|')) != NULL && count_p < p + pat_len)
+  struct vibrex_scratch *scratch = vibrex_scratch_create (NULL);
+  bits->accept                   = calloc (compiled->num_byte_classes, sizeof (uint64_t));
+  bits->follow                   = calloc (nbits, sizeof (uint64_t));
+  if (!scratch || !scratch_reserve (scratch, nstate) || !bits->accept || !bits->follow)
   {
-    alt_count++;
-    count_p++;
-    if (alt_count > MAX_ALTERNATIONS)
-    {
-      free_dfa (&compiled->dfa);
-      return false;
-    }
+    vibrex_scratch_free (scratch);
+    free (bit_of);
+    free_bitnfa (bits);
+    return false;
   }
+  bits->nbits = nbits;
 
-  const char *alt_start = p;
-  while (true)
+  // All bytes of a class are accepted by the same states, so test one of each
+  unsigned char representative[TRANSITION_TABLE_SIZE];
+  for (int c = TRANSITION_TABLE_SIZE - 1; c >= 0; c--)
+    representative[compiled->byte_class[c]] = (unsigned char)c;
+
+  // Closures from the precomputed lists, and the byte classes each
+  // consuming state accepts
+  uint64_t end_anchors = 0;
+  for (int i = 0; i < nstate; i++)
   {
-    const char *alt_end = strchr (alt_start, '|');
-    if (alt_end == NULL || alt_end > p + pat_len)
-      alt_end = p + pat_len;
+    const State *s = &base[i];
+    if (bit_of[i] < 0)
+      continue;
+    uint64_t bit = (uint64_t)1 << bit_of[i];
+    if (s->type == STATE_MATCH)
+      bits->match |= bit;
+    if (s->type == STATE_END_ANCHOR)
+      end_anchors |= bit;
+    if (s->type != STATE_CHAR && s->type != STATE_ANY && s->type != STATE_CLASS)
+      continue;
 
-    DFAState *current_state = start_state;
-    int alt_len             = alt_end - alt_start;
+    uint64_t *follow = &bits->follow[bit_of[i]];
+    for (int j = compiled->follow_start[i]; j < compiled->follow_start[i + 1]; j++)
+      *follow |= (uint64_t)1 << bit_of[compiled->follow[j]];
+    if (*follow == bit << 1)
+      bits->shift |= bit;
+    else
+      bits->jumps |= bit;
 
-    if (alt_len == 0)
+    for (int k = 0; k < compiled->num_byte_classes; k++)
     {
-      start_state->is_final = true;
+      int c = representative[k];
+      if ((s->type == STATE_CHAR && s->data.c == c) || s->type == STATE_ANY ||
+          (s->type == STATE_CLASS && (s->data.cclass[c / 8] & (1 << (c % 8)))))
+        bits->accept[k] |= bit;
     }
+  }
+
+  // Attempts starting at the text start and anywhere after it
+  List l = {scratch->list1, 0};
+  for (int pos = 0; pos >= -1; pos--)
+  {
+    uint64_t mask = 0;
+    l.n           = 0;
+    next_generation (scratch);
+    addstate_pos (scratch, base, &l, compiled->start, pos);
+    for (int j = 0; j < l.n; j++)
+      mask |= (uint64_t)1 << bit_of[l.s[j] - base];
+    if (pos == 0)
+      bits->start = mask;
     else
+      bits->restart = mask;
+  }
+
+  // End anchors whose closure matches, directly or through more end anchors
+  for (bool changed = true; changed;)
+  {
+    changed = false;
+    for (int i = 0; i < nstate; i++)
     {
-      for (int i = 0; i < alt_len; ++i)
+      uint64_t bit = bit_of[i] >= 0 ? (uint64_t)1 << bit_of[i] : 0;
+      if (!(end_anchors & bit) || (bits->end_match & bit))
+        continue;
+
+      l.n = 0;
+      next_generation (scratch);
+      addstate_pos (scratch, base, &l, base[i].out, -1);
+      for (int j = 0; j < l.n; j++)
       {
-        unsigned char c = alt_start[i];
-        if (c == '\\' && i + 1 < alt_len)
+        if (((uint64_t)1 << bit_of[l.s[j] - base]) & (bits->match | bits->end_match))
         {
-          i++;
-          c = alt_start[i];
-        }
-
-        if (!current_state->transitions[c])
-        {
-          bool is_final        = (i == alt_len - 1);
-          DFAState *next_state = create_dfa_state (&compiled->dfa, is_final);
-          if (!next_state)
-          {
-            free_dfa (&compiled->dfa);
-            return false;
-          }
-          current_state->transitions[c]  = next_state;
-          current_state->has_transitions = true;
-        }
-        else if (i == alt_len - 1)
-        {
-          current_state->transitions[c]->is_final = true;
+          bits->end_match |= bit;
+          changed = true;
+          break;
         }
-        current_state = current_state->transitions[c];
       }
     }
+  }
+
+  bits->enabled = true;
+  vibrex_scratch_free (scratch);
+  free (bit_of);
+  return compile_bitnfa_loops (compiled);
+}
 
-    if (alt_end < p + pat_len && *alt_end == '|')
+// Run the bit-parallel NFA over bytes from a state set, one pass with a new
+// attempt after every byte, skipping ahead with the literal prefix or first
+// character while no attempt is in progress and over runs of bytes a looping
+// state set stays in.  The prefix is only searched for in a whole text, as
+// in pieces it could straddle two of them.  Leaves the state set reached in
+// *state and returns true once a match ends.
+static bool
+bitnfa_run (const struct vibrex_pattern *pattern, uint64_t *state, const unsigned char *p, const unsigned char *end,
+            bool whole_text)
+{
+  const BitNFA *bits              = &pattern->bitnfa;
+  const unsigned char *byte_class = pattern->byte_class;
+  const uint64_t *accept          = bits->accept;
+  const uint64_t *follow          = bits->follow;
+  const uint64_t shift            = bits->shift;
+  const uint64_t jumps            = bits->jumps;
+  const uint64_t restart          = bits->restart;
+  const uint64_t match            = bits->match;
+  const bool skip                 = pattern->has_first_char;
+  uint64_t current                = *state;
+  uint64_t missed                 = 0; // Last looping state without a span
+
+  while (p < end)
+  {
+    if (current & match)
+      break;
+    if (current == restart)
     {
-      alt_start = alt_end + 1;
+      if (restart == 0)
+        break;
+      if (skip)
+      {
+        const char *candidate;
+        if (pattern->prefix_search.enabled && whole_text)
+          candidate = literal_searcher_find (&pattern->prefix_search, pattern->literal_prefix, pattern->prefix_len,
+                                             (const char *)p, end - p);
+        else
+          candidate = memchr (p, pattern->first_char, end - p);
+        if (!candidate)
+          break;
+        p = (const unsigned char *)candidate;
+      }
     }
-    else
+
+    uint64_t active = current & accept[byte_class[*p++]];
+    uint64_t next   = restart | ((active & shift) << 1);
+    for (uint64_t rest = active & jumps; rest; rest &= rest - 1)
+      next |= follow[VIBREX_CTZ64 (rest)];
+    if (next == current && current != missed)
     {
-      break;
+      int k = 0;
+      while (k < bits->nloops && bits->loops[k].state != current)
+        k++;
+      if (k < bits->nloops)
+        p = byte_span (&bits->loops[k].stay, p, end);
+      else
+        missed = current;
     }
+    current = next;
   }
 
-  compiled->dfa.enabled = true;
-  return true;
+  *state = current;
+  return (current & match) != 0;
 }
 
+// Match with the bit-parallel NFA
 static bool
-dfa_match (const DFA *dfa, const char *text)
+bitnfa_match (const struct vibrex_pattern *pattern, const char *text, size_t text_len)
 {
-  if (!dfa->enabled || !text)
-    return false;
-  int text_len = strlen (text);
+  const BitNFA *bits = &pattern->bitnfa;
+  uint64_t current   = bits->start;
+  if (bitnfa_run (pattern, &current, (const unsigned char *)text, (const unsigned char *)text + text_len, true))
+    return true;
+  return (current & (bits->match | bits->end_match)) != 0;
+}
 
-  if (dfa->anchored_start)
+// Free bit-parallel NFA tables
+static void
+free_bitnfa (BitNFA *bits)
+{
+  free (bits->accept);
+  free (bits->follow);
+  free (bits->loops);
+  memset (bits, 0, sizeof (*bits));
+}
+
+/********************************************************************************
+ * LAZY DFA ENGINE
+ ********************************************************************************/
+
+// Partition the bytes into classes that no character or class state tells
+// apart.  Classes are runs of consecutive bytes, split wherever the set of
+// states accepting a byte changes.  Returns the number of classes.
+static int
+compute_byte_classes (const State *states, int nstate, unsigned char *byte_class)
+{
+  bool boundary[TRANSITION_TABLE_SIZE] = {false}; // A new class starts after this byte
+
+  for (int i = 0; i < nstate; i++)
   {
-    DFAState *current = dfa->start_state;
-    if (current->is_final && !dfa->anchored_end)
-      return true;
-    for (int i = 0; i < text_len; i++)
+    const State *s = &states[i];
+    if (s->type == STATE_CHAR)
     {
-      current = current->transitions[(unsigned char)text[i]];
-      if (!current)
-      {
-        return false;
-      }
-      if (current->is_final && !dfa->anchored_end)
-      {
-        return true;
-      }
+      unsigned char c = s->data.c;
+      if (c > 0)
+        boundary[c - 1] = true;
+      boundary[c] = true;
     }
-    return current->is_final;
-  }
-  else
-  {
-    for (int i = 0; i <= text_len; i++)
+    else if (s->type == STATE_CLASS)
     {
-      DFAState *current = dfa->start_state;
-      if (current->is_final && (!dfa->anchored_end || i == text_len))
+      for (int b = 0; b < TRANSITION_TABLE_SIZE - 1; b++)
       {
-        return true;
-      }
-      for (int j = i; j < text_len; j++)
-      {
-        current = current->transitions[(unsigned char)text[j]];
-        if (!current)
-          break;
-        if (current->is_final)
-        {
-          if (!dfa->anchored_end || (j == text_len - 1))
-          {
-            return true;
-          }
-        }
+        bool in      = s->data.cclass[b / 8] & (1 << (b % 8));
+        bool next_in = s->data.cclass[(b + 1) / 8] & (1 << ((b + 1) % 8));
+        if (in != next_in)
+          boundary[b] = true;
       }
     }
   }
 
-  return false;
+  int num_classes = 0;
+  for (int b = 0; b < TRANSITION_TABLE_SIZE; b++)
+  {
+    byte_class[b] = num_classes;
+    if (boundary[b] && b < TRANSITION_TABLE_SIZE - 1)
+      num_classes++;
+  }
+  return num_classes + 1;
 }
 
+// Clear the cached states and bind the cache to a pattern
 static void
-free_dfa (DFA *dfa)
+ldfa_reset (LazyDFA *dfa, const struct vibrex_pattern *owner)
 {
-  if (dfa && dfa->states)
+  // State capacity depends on the row size, so a pattern with a different
+  // number of byte classes starts from empty tables
+  if (dfa->row_size != owner->num_byte_classes)
   {
     free (dfa->states);
-    dfa->states     = NULL;
-    dfa->num_states = 0;
-    dfa->enabled    = false;
+    free (dfa->transitions);
+    free (dfa->hash_table);
+    dfa->states      = NULL;
+    dfa->transitions = NULL;
+    dfa->hash_table  = NULL;
+    dfa->max_states  = 0;
+    dfa->row_size    = owner->num_byte_classes;
   }
-}
 
-/********************************************************************************
- * BOTH ANCHORS OPTIMIZATION ENGINE
- ********************************************************************************/
+  dfa->owner       = owner;
+  dfa->num_states  = 0;
+  dfa->num_spans   = 0;
+  dfa->pool_used   = 0;
+  dfa->start_state = -1;
+  dfa->idle_state  = -1;
+  if (dfa->hash_table)
+    memset (dfa->hash_table, 0, 2 * dfa->max_states * sizeof (int));
+}
 
-// Check if pattern is of the form ^prefix.*suffix$
-static bool
-can_use_both_anchors_opt (const char *pattern)
+// Free lazy DFA cache memory
+static void
+ldfa_free (LazyDFA *dfa)
 {
-  if (!pattern)
-    return false;
+  free (dfa->states);
+  free (dfa->transitions);
+  free (dfa->set_pool);
+  free (dfa->hash_table);
+  free (dfa->spans);
+}
+
+static int
+compare_state_index (const void *a, const void *b)
+{
+  int x = *(const int *)a;
+  int y = *(const int *)b;
+  return (x > y) - (x < y);
+}
+
+// Sorted indices of the NFA states in a list, in the scratch set buffer
+static int *
+ldfa_sort_set (struct vibrex_scratch *scratch, const State *base, const List *l)
+{
+  int *set = scratch->set_buffer;
+  for (int i = 0; i < l->n; i++)
+    set[i] = l->s[i] - base;
+  if (l->n > 1)
+    qsort (set, l->n, sizeof (int), compare_state_index);
+  return set;
+}
+
+// FNV-1a hash of a sorted NFA state set
+static unsigned
+hash_state_set (const int *set, int count)
+{
+  unsigned hash = 2166136261u;
+  for (int i = 0; i < count; i++)
+  {
+    hash ^= (unsigned)set[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Double the state capacity, returns false once the memory budget is reached
+static bool
+ldfa_grow (LazyDFA *dfa)
+{
+  if ((size_t)dfa->max_states * dfa->row_size * sizeof (int32_t) >= LAZY_DFA_CACHE_BYTES)
+    return false;
+
+  int new_max       = dfa->max_states ? dfa->max_states * 2 : LAZY_DFA_INITIAL_STATES;
+  LazyState *states = realloc (dfa->states, new_max * sizeof (LazyState));
+  if (!states)
+    return false;
+  dfa->states = states;
+
+  int32_t *transitions = realloc (dfa->transitions, (size_t)new_max * dfa->row_size * sizeof (int32_t));
+  if (!transitions)
+    return false;
+  dfa->transitions = transitions;
+
+  int *hash_table = calloc (2 * new_max, sizeof (int));
+  if (!hash_table)
+    return false;
+  free (dfa->hash_table);
+  dfa->hash_table = hash_table;
+  dfa->max_states = new_max;
+
+  // Rehash existing states into the larger table
+  unsigned mask = 2 * new_max - 1;
+  for (int i = 0; i < dfa->num_states; i++)
+  {
+    unsigned h = states[i].hash & mask;
+    while (hash_table[h])
+      h = (h + 1) & mask;
+    hash_table[h] = i + 1;
+  }
+  return true;
+}
+
+// Find or add the DFA state for an NFA state list, returns -1 if the cache is full
+static int
+ldfa_add_state (struct vibrex_scratch *scratch, const State *base, List *l)
+{
+  LazyDFA *dfa  = &scratch->dfa_cache;
+  int *set      = ldfa_sort_set (scratch, base, l);
+  unsigned hash = hash_state_set (set, l->n);
+
+  if (dfa->max_states)
+  {
+    unsigned mask = 2 * dfa->max_states - 1;
+    for (unsigned h = hash & mask; dfa->hash_table[h]; h = (h + 1) & mask)
+    {
+      int index           = dfa->hash_table[h] - 1;
+      const LazyState *ls = &dfa->states[index];
+      if (ls->hash == hash && ls->set_count == l->n &&
+          memcmp (dfa->set_pool + ls->set_offset, set, l->n * sizeof (int)) == 0)
+        return index;
+    }
+  }
+
+  if (dfa->num_states >= dfa->max_states && !ldfa_grow (dfa))
+    return -1;
+
+  if (dfa->pool_used + l->n > dfa->pool_capacity)
+  {
+    size_t new_capacity = dfa->pool_capacity ? dfa->pool_capacity * 2 : 256;
+    while (new_capacity < dfa->pool_used + l->n)
+      new_capacity *= 2;
+    if (new_capacity > LAZY_DFA_MAX_SET_POOL)
+      return -1;
+    int *pool = realloc (dfa->set_pool, new_capacity * sizeof (int));
+    if (!pool)
+      return -1;
+    dfa->set_pool      = pool;
+    dfa->pool_capacity = new_capacity;
+  }
+
+  int index     = dfa->num_states++;
+  LazyState *ls = &dfa->states[index];
+  ls->set_offset = dfa->pool_used;
+  ls->set_count  = l->n;
+  ls->hash       = hash;
+  ls->flags      = 0;
+  ls->span       = LDFA_UNKNOWN;
+  if (l->n > 0)
+    memcpy (dfa->set_pool + dfa->pool_used, set, l->n * sizeof (int));
+  dfa->pool_used += l->n;
+
+  if (ismatch (l))
+    ls->flags |= LDFA_MATCH;
+  else if (is_end_match (scratch, base, l, true))
+    ls->flags |= LDFA_END_MATCH;
+  if (l->n == 0)
+    ls->flags |= LDFA_DEAD;
+
+  memset (dfa->transitions + (size_t)index * dfa->row_size, 0xff, dfa->row_size * sizeof (int32_t));
+
+  unsigned mask = 2 * dfa->max_states - 1;
+  unsigned h    = hash & mask;
+  while (dfa->hash_table[h])
+    h = (h + 1) & mask;
+  dfa->hash_table[h] = index + 1;
+
+  return index;
+}
+
+// Add a DFA state, flushing the cache once if it is full
+static int
+ldfa_add_state_flush (struct vibrex_scratch *scratch, const struct vibrex_pattern *pattern, List *l)
+{
+  int index = ldfa_add_state (scratch, pattern->states, l);
+  if (index >= 0)
+    return index;
+
+  // The list is still intact in the scratch space, so it can seed the
+  // emptied cache
+  scratch->dfa_cache.cache_flushes++;
+  ldfa_reset (&scratch->dfa_cache, pattern);
+  return ldfa_add_state (scratch, pattern->states, l);
+}
+
+// Build the state for a new match attempt at a text position
+static int
+ldfa_attempt_state (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, int pos)
+{
+  List l = {scratch->list1, 0};
+  next_generation (scratch);
+  addstate_pos (scratch, pattern->states, &l, pattern->start, pos);
+  return ldfa_add_state_flush (scratch, pattern, &l);
+}
+
+// The NFA states a cached state leads to on a byte
+static void
+ldfa_successor (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, int from, unsigned char c, List *l)
+{
+  const State *base   = pattern->states;
+  const LazyState *ls = &scratch->dfa_cache.states[from];
+  const int *set      = scratch->dfa_cache.set_pool + ls->set_offset;
+
+  next_generation (scratch);
+  for (int i = 0; i < ls->set_count; i++)
+  {
+    const State *s = &base[set[i]];
+    switch (s->type)
+    {
+    case STATE_CHAR:
+      if (s->data.c == c)
+        addstate_follow (scratch, pattern, l, s);
+      break;
+
+    case STATE_ANY:
+      addstate_follow (scratch, pattern, l, s);
+      break;
+
+    case STATE_CLASS:
+      if (s->data.cclass[c / 8] & (1 << (c % 8)))
+        addstate_follow (scratch, pattern, l, s);
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  // Unanchored search: a new match attempt starts after every byte
+  addstate_pos (scratch, base, l, pattern->start, -1);
+}
+
+// Work out the bytes a cached state loops on, filling in those transitions,
+// and keep them for span scans.  Returns the span index or LDFA_NO_SPAN.
+static int
+ldfa_state_span (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, int index)
+{
+  LazyDFA *dfa        = &scratch->dfa_cache;
+  const LazyState *ls = &dfa->states[index];
+  int32_t *row        = dfa->transitions + (size_t)index * dfa->row_size;
+
+  // Bytes of a class all lead to the same state
+  signed char class_stays[TRANSITION_TABLE_SIZE];
+  unsigned char stay[CHAR_CLASS_BYTES] = {0};
+  bool any                             = false;
+  memset (class_stays, -1, sizeof (class_stays));
+  for (int c = 0; c < TRANSITION_TABLE_SIZE; c++)
+  {
+    int k = pattern->byte_class[c];
+    if (class_stays[k] < 0)
+    {
+      if (row[k] != LDFA_UNKNOWN)
+      {
+        class_stays[k] = (row[k] == index);
+      }
+      else
+      {
+        List l = {scratch->list1, 0};
+        ldfa_successor (pattern, scratch, index, (unsigned char)c, &l);
+        const int *set = ldfa_sort_set (scratch, pattern->states, &l);
+        class_stays[k] = (l.n == ls->set_count && memcmp (set, dfa->set_pool + ls->set_offset, l.n * sizeof (int)) == 0);
+        if (class_stays[k])
+          row[k] = index;
+      }
+    }
+    if (class_stays[k])
+    {
+      stay[c / 8] |= 1 << (c % 8);
+      any = true;
+    }
+  }
+  if (!any)
+    return LDFA_NO_SPAN;
+
+  if (dfa->num_spans == dfa->max_spans)
+  {
+    int new_max     = dfa->max_spans ? dfa->max_spans * 2 : 16;
+    ByteSpan *grown = realloc (dfa->spans, new_max * sizeof (ByteSpan));
+    if (!grown)
+      return LDFA_NO_SPAN;
+    dfa->spans     = grown;
+    dfa->max_spans = new_max;
+  }
+  byte_span_init (&dfa->spans[dfa->num_spans], stay);
+  return dfa->num_spans++;
+}
+
+// Compute the transition of a state on one byte from the NFA, the result
+// holds for every byte of the same class
+static int
+ldfa_compute (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, int from, unsigned char c)
+{
+  LazyDFA *dfa      = &scratch->dfa_cache;
+  const State *base = pattern->states;
+  List l            = {scratch->list1, 0};
+  ldfa_successor (pattern, scratch, from, c, &l);
+
+  dfa->cache_misses++;
+  int index = ldfa_add_state (scratch, base, &l);
+  if (index >= 0)
+  {
+    dfa->transitions[(size_t)from * dfa->row_size + pattern->byte_class[c]] = index;
+    return index;
+  }
+
+  dfa->cache_flushes++;
+  ldfa_reset (dfa, pattern);
+  return ldfa_add_state (scratch, base, &l);
+}
+
+// Run the lazy DFA over bytes from a cached state, skipping ahead with the
+// literal prefix or first character while no match attempt is in progress.
+// The prefix is only searched for in a whole text, as in pieces it could
+// straddle two of them.  Leaves the state reached in *state and the first
+// byte not run in *pos.  Returns 1 once a match ends, 0 when the bytes or
+// the match attempts run out, and -1 if the cache thrashed, leaving -1 in
+// *state if it could not even hold the state reached.
+static int
+ldfa_run (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, int *state, const unsigned char **pos,
+          const unsigned char *end, bool whole_text)
+{
+  LazyDFA *dfa                    = &scratch->dfa_cache;
+  const size_t flushes            = dfa->cache_flushes;
+  const unsigned char *byte_class = pattern->byte_class;
+  const size_t row_size           = dfa->row_size;
+  const unsigned char *p          = *pos;
+  size_t steps                    = 0;
+  int current                     = *state;
+  int result                      = 0;
+
+  while (p < end)
+  {
+    unsigned flags = dfa->states[current].flags;
+    if (flags & (LDFA_MATCH | LDFA_DEAD))
+      break;
+
+    if (current == dfa->idle_state)
+    {
+      const char *candidate;
+      if (pattern->prefix_search.enabled && whole_text)
+        candidate = literal_searcher_find (&pattern->prefix_search, pattern->literal_prefix, pattern->prefix_len,
+                                           (const char *)p, end - p);
+      else
+        candidate = memchr (p, pattern->first_char, end - p);
+      if (!candidate)
+      {
+        p = end;
+        break;
+      }
+      p = (const unsigned char *)candidate;
+    }
+
+    int next = dfa->transitions[current * row_size + byte_class[*p]];
+    if (next == LDFA_UNKNOWN)
+    {
+      next = ldfa_compute (pattern, scratch, current, *p);
+      if (next < 0 || dfa->cache_flushes - flushes > LAZY_DFA_MAX_FLUSHES)
+      {
+        dfa->nfa_fallbacks++;
+        current = next;
+        p++;
+        result = -1;
+        break;
+      }
+    }
+    else
+    {
+      steps++;
+
+      // Skip the rest of a run of bytes the state loops on
+      if (next == current)
+      {
+        LazyState *ls = &dfa->states[current];
+        if (ls->span == LDFA_UNKNOWN)
+          ls->span = ldfa_state_span (pattern, scratch, current);
+        if (ls->span >= 0)
+        {
+          const unsigned char *run_end = byte_span (&dfa->spans[ls->span], p + 1, end);
+          steps += run_end - (p + 1);
+          p = run_end - 1;
+        }
+      }
+    }
+    current = next;
+    p++;
+  }
+
+  dfa->cache_hits += steps;
+  *state = current;
+  *pos   = p;
+  if (result < 0)
+    return result;
+  return (dfa->states[current].flags & LDFA_MATCH) ? 1 : 0;
+}
+
+// Prepare the cache for a new text, returns the state at its start or -1
+// if the cache cannot hold it
+static int
+ldfa_text_start (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch)
+{
+  LazyDFA *dfa = &scratch->dfa_cache;
+  if (dfa->owner != pattern)
+    ldfa_reset (dfa, pattern);
+
+  if (pattern->has_first_char && dfa->idle_state < 0)
+    dfa->idle_state = ldfa_attempt_state (pattern, scratch, -1);
+  if (dfa->start_state < 0)
+    dfa->start_state = ldfa_attempt_state (pattern, scratch, 0);
+  return dfa->start_state;
+}
+
+// Match with the lazy DFA.
+// Returns 1 on match, 0 on no match and -1 if the cache thrashed and the
+// NFA simulation must decide.
+static int
+lazy_dfa_match (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t text_len)
+{
+  int state = ldfa_text_start (pattern, scratch);
+  if (state < 0)
+    return -1;
+
+  const unsigned char *p = (const unsigned char *)text;
+  int result             = ldfa_run (pattern, scratch, &state, &p, p + text_len, true);
+  if (result != 0)
+    return result;
+  return (scratch->dfa_cache.states[state].flags & LDFA_END_MATCH) ? 1 : 0;
+}
+
+// Dispatch to the optimization engine selected at compile time
+static bool
+match_dispatch (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t text_len)
+{
+  if (bounds_reject (&pattern->bounds, text, text_len))
+  {
+    VIBREX_COUNT (pattern, bounds_rejects, 1);
+    return false;
+  }
+  VIBREX_COUNT (pattern, bytes_scanned, text_len);
+
+  switch (pattern->engine)
+  {
+  case ENGINE_BOTH_ANCHORS:
+    return match_with_both_anchors_opt (pattern, text, text_len);
+  case ENGINE_URL:
+    return match_with_url_pattern_opt (pattern, text, text_len);
+  case ENGINE_LITERAL_ALT:
+    return match_with_literal_alt_opt (pattern, text, text_len);
+  case ENGINE_ADVANCED_ALT:
+    return match_with_advanced_alternation_opt (pattern, scratch, text, text_len);
+  case ENGINE_DFA:
+    return dfa_match (&pattern->dfa, text, text_len);
+  case ENGINE_DOTSTAR:
+    return true;
+  case ENGINE_NFA:
+  case ENGINE_BITNFA:
+    break;
+  }
+
+  if (pattern->required.enabled && !required_literals_present (&pattern->required, text, text_len))
+  {
+    VIBREX_COUNT (pattern, prefilter_rejects, 1);
+    return false;
+  }
+
+  if (pattern->engine == ENGINE_BITNFA)
+    return bitnfa_match (pattern, text, text_len);
+
+  // The lazy DFA cache is bound to one pattern, nested sub-patterns share
+  // their parent's scratch and would keep evicting each other
+  if (!scratch->no_dfa_cache && !(pattern->flags & VIBREX_NO_LAZY_DFA) &&
+      (!pattern->nested || pattern->owns_dfa_cache))
+  {
+    int result = lazy_dfa_match (pattern, scratch, text, text_len);
+    if (result >= 0)
+      return result;
+  }
+
+  return nfa_match (pattern, scratch, text, text_len);
+}
+
+// Match a subject, counting it when the library keeps counters
+static bool
+match_internal (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t text_len)
+{
+#ifdef VIBREX_COUNTERS
+  size_t steps = scratch ? scratch->nfa_steps : 0;
+  bool matched = match_dispatch (pattern, scratch, text, text_len);
+  VIBREX_COUNT (pattern, subjects, 1);
+  VIBREX_COUNT (pattern, matches, matched);
+  if (scratch)
+    VIBREX_COUNT (pattern, nfa_steps, scratch->nfa_steps - steps);
+  return matched;
+#else
+  return match_dispatch (pattern, scratch, text, text_len);
+#endif
+}
+
+// Match text against compiled pattern
+bool
+vibrex_match (const struct vibrex_pattern *pattern, const char *text)
+{
+  if (!pattern || !text)
+    return false;
+
+  return vibrex_match_n (pattern, text, strlen (text));
+}
+
+// Match a buffer of known length against compiled pattern
+bool
+vibrex_match_n (const struct vibrex_pattern *pattern, const char *text, size_t text_len)
+{
+  if (!pattern || !text)
+    return false;
+
+  // Patterns without an NFA never touch the scratch space
+  if (pattern->max_nstate == 0)
+    return match_internal (pattern, NULL, text, text_len);
+
+  // Claim the default scratch without blocking; the flag is the only
+  // mutable part of a compiled pattern
+  atomic_flag *busy = (atomic_flag *)&pattern->scratch_busy;
+  if (!atomic_flag_test_and_set_explicit (busy, memory_order_acquire))
+  {
+    bool result = match_internal (pattern, pattern->scratch, text, text_len);
+    atomic_flag_clear_explicit (busy, memory_order_release);
+    return result;
+  }
+
+  // Another thread owns the default scratch, use a temporary one
+  struct vibrex_scratch *scratch = vibrex_scratch_create (pattern);
+  if (!scratch)
+    return false;
+  scratch->no_dfa_cache = true;
+  bool result           = match_internal (pattern, scratch, text, text_len);
+  vibrex_scratch_free (scratch);
+  return result;
+}
+
+// Match text using caller-owned scratch space
+bool
+vibrex_match_scratch (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text)
+{
+  if (!pattern || !scratch || !text)
+    return false;
+
+  return vibrex_match_scratch_n (pattern, scratch, text, strlen (text));
+}
+
+// Match a buffer of known length using caller-owned scratch space
+bool
+vibrex_match_scratch_n (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t text_len)
+{
+  if (!pattern || !scratch || !text)
+    return false;
+
+  if (!scratch_reserve (scratch, pattern->max_nstate))
+    return false;
+
+  return match_internal (pattern, scratch, text, text_len);
+}
+
+// Match many subjects against one pattern
+size_t
+vibrex_match_batch (const struct vibrex_pattern *pattern, const char *const *texts, const size_t *lens, size_t n,
+                    uint8_t *results)
+{
+  if (!pattern || !texts || !results)
+    return 0;
+
+  // Literal DFAs run the interleaved kernel, other engines share one
+  // scratch claim for the whole batch
+  if (pattern->engine == ENGINE_DFA)
+  {
+    dfa_match_batch (&pattern->dfa, texts, lens, n, results);
+#ifdef VIBREX_COUNTERS
+    for (size_t i = 0; i < n; i++)
+    {
+      VIBREX_COUNT (pattern, subjects, 1);
+      VIBREX_COUNT (pattern, matches, results[i]);
+      if (texts[i])
+        VIBREX_COUNT (pattern, bytes_scanned, lens ? lens[i] : strlen (texts[i]));
+    }
+#endif
+  }
+  else
+  {
+    struct vibrex_scratch *scratch = NULL;
+    struct vibrex_scratch *owned   = NULL;
+    atomic_flag *busy              = (atomic_flag *)&pattern->scratch_busy;
+    bool claimed                   = false;
+    if (pattern->max_nstate > 0)
+    {
+      if (!atomic_flag_test_and_set_explicit (busy, memory_order_acquire))
+      {
+        scratch = pattern->scratch;
+        claimed = true;
+      }
+      else
+      {
+        // Another thread owns the default scratch, use a temporary one
+        scratch = owned = vibrex_scratch_create (pattern);
+        if (!owned)
+        {
+          memset (results, 0, n);
+          return 0;
+        }
+        owned->no_dfa_cache = true;
+      }
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+      if (i + 1 < n && texts[i + 1])
+        VIBREX_PREFETCH (texts[i + 1]);
+      results[i] = texts[i] && match_internal (pattern, scratch, texts[i], lens ? lens[i] : strlen (texts[i]));
+    }
+
+    if (claimed)
+      atomic_flag_clear_explicit (busy, memory_order_release);
+    vibrex_scratch_free (owned);
+  }
+
+  size_t matched = 0;
+  for (size_t i = 0; i < n; i++)
+    matched += results[i];
+  return matched;
+}
+
+// Trie that finds where the matches of a literal engine lie, NULL if the
+// pattern has none.  The anchors of a literal DFA hold for every literal.
+static const DenseDFA *
+literal_trie (const struct vibrex_pattern *pattern)
+{
+  const DenseDFA *trie = NULL;
+  if (pattern->engine == ENGINE_LITERAL_ALT)
+    trie = &pattern->literal_alt.trie;
+  else if (pattern->engine == ENGINE_DFA)
+    trie = pattern->dfa.anchored_start ? &pattern->dfa.automaton : &pattern->dfa.trie;
+  return trie && trie->enabled ? trie : NULL;
+}
+
+// Match a subject and find where the leftmost-longest match lies.  The
+// boolean engines reject most subjects that do not match before the NFA
+// or the literal trie runs.  Returns false if no match was found or the
+// pattern has neither.
+static bool
+search_internal (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text,
+                 size_t text_len, size_t *match_start, size_t *match_end)
+{
+  if (!match_internal (pattern, scratch, text, text_len))
+    return false;
+
+  // Every match of ^prefix.*suffix$ spans the whole text
+  if (pattern->engine == ENGINE_BOTH_ANCHORS)
+  {
+    *match_start = 0;
+    *match_end   = text_len;
+    return true;
+  }
+
+  const DenseDFA *trie = literal_trie (pattern);
+  if (trie)
+    return dense_dfa_search_trie (trie, text, text_len, 0, pattern->dfa.anchored_start, pattern->dfa.anchored_end,
+                                  match_start, match_end);
+
+  const struct vibrex_pattern *nfa = pattern->states ? pattern : pattern->nfa;
+  if (!nfa || !scratch_reserve (scratch, nfa->nstate))
+    return false;
+  return nfa_search (nfa, scratch, text, text_len, 0, NULL, SIZE_MAX, NULL, match_start, match_end);
+}
+
+// Find the leftmost-longest match in a buffer
+bool
+vibrex_search (const struct vibrex_pattern *pattern, const char *text, size_t text_len, size_t *match_start,
+               size_t *match_end)
+{
+  if (!pattern || !text)
+    return false;
+
+  size_t start, end;
+  match_start = match_start ? match_start : &start;
+  match_end   = match_end ? match_end : &end;
+
+  // Claim the default scratch as vibrex_match_n() does
+  atomic_flag *busy = (atomic_flag *)&pattern->scratch_busy;
+  if (pattern->scratch && !atomic_flag_test_and_set_explicit (busy, memory_order_acquire))
+  {
+    bool result = search_internal (pattern, pattern->scratch, text, text_len, match_start, match_end);
+    atomic_flag_clear_explicit (busy, memory_order_release);
+    return result;
+  }
+
+  // The pattern has no default scratch or another thread owns it
+  struct vibrex_scratch *scratch = vibrex_scratch_create (pattern);
+  if (!scratch)
+    return false;
+  scratch->no_dfa_cache = true;
+  bool result           = search_internal (pattern, scratch, text, text_len, match_start, match_end);
+  vibrex_scratch_free (scratch);
+  return result;
+}
+
+// Find the leftmost-longest match in a buffer using caller-owned scratch space
+bool
+vibrex_search_scratch (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text,
+                       size_t text_len, size_t *match_start, size_t *match_end)
+{
+  if (!pattern || !scratch || !text)
+    return false;
+
+  if (!scratch_reserve (scratch, pattern->max_nstate))
+    return false;
+
+  size_t start, end;
+  return search_internal (pattern, scratch, text, text_len, match_start ? match_start : &start,
+                          match_end ? match_end : &end);
+}
+
+// Free compiled pattern
+void
+vibrex_free (struct vibrex_pattern *pattern)
+{
+  if (pattern && pattern->packed)
+  {
+    // Nested sub-patterns are part of the block and never freed on their own
+    vibrex_scratch_free (pattern->scratch);
+    free (pattern);
+  }
+  else if (pattern)
+  {
+    free (pattern->states);
+    free (pattern->follow);
+    free (pattern->follow_start);
+    free_bitnfa (&pattern->bitnfa);
+    free (pattern->literal_prefix);
+    vibrex_free (pattern->nfa);
+    vibrex_scratch_free (pattern->scratch);
+
+    free_both_anchors_opt (&pattern->both_anchors);
+    free_url_pattern_opt (&pattern->url_pattern);
+    free_literal_alt_opt (&pattern->literal_alt);
+    free_dfa (&pattern->dfa);
+    free_required_literals (&pattern->required);
+
+    if (pattern->has_advanced_alt_opt)
+    {
+      free_alternation_opt (&pattern->alt_opt);
+    }
+
+    free (pattern);
+  }
+}
+
+/********************************************************************************
+ * PATTERN ARENA
+ ********************************************************************************/
+
+// Compilation builds a pattern from many heap blocks, which are then packed
+// into one block holding the pattern struct followed by everything it and
+// its nested sub-patterns own, so a compiled pattern is freed with one free().
+// Dense DFA tables hold offsets rather than pointers and are packed last, so
+// a serialized pattern can leave them in place in the data it is loaded from.
+
+#define ARENA_ALIGN _Alignof (max_align_t)
+
+// What a walk over everything a pattern owns does with each block
+typedef enum
+{
+  ARENA_MEASURE, // Add up the size of the packed block
+  ARENA_PACK,    // Copy each block into the packed block
+  ARENA_SAVE,    // Write each pointer as an offset into a copy of the block
+  ARENA_LOAD     // Turn each offset of a loaded block back into a pointer
+} ArenaMode;
+
+// Walk over the block of a packed pattern, which is a bump allocator while
+// packing
+typedef struct
+{
+  ArenaMode mode;
+  bool table_pass;     // Measuring or packing the dense DFA tables
+  char *base;          // Packed block
+  size_t used;         // Bytes placed so far
+  const char *tables;  // Start of the dense DFA tables of a packed block
+  size_t table_offset; // Offset of the tables in the block
+  size_t size;         // Bytes in a loaded block
+  char *out;           // Copy being saved, with each pointer at its offset in base
+  bool invalid;        // A loaded block refers to something outside itself
+} Arena;
+
+static size_t
+arena_align (size_t offset)
+{
+  return (offset + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Turn the offset + 1 in *ptr of a loaded block back into a pointer,
+// checking that the count elements it refers to lie in their part of the
+// block
+static void
+arena_load (Arena *arena, void **ptr, size_t count, size_t size, bool table)
+{
+  uintptr_t value = (uintptr_t)*ptr;
+  if (!value)
+  {
+    // Only empty blocks are ever left out
+    if (count > 0 && size > 0)
+      arena->invalid = true;
+    return;
+  }
+
+  size_t offset = value - 1;
+  size_t start  = table ? arena->table_offset : 0;
+  size_t end    = table ? arena->size : arena->table_offset;
+  if (offset < start || offset > end || offset % ARENA_ALIGN != 0 || (size && count > (end - offset) / size))
+  {
+    arena->invalid = true;
+    *ptr           = NULL;
+    return;
+  }
+  *ptr = table ? (void *)(arena->tables + (offset - start)) : (void *)(arena->base + offset);
+}
+
+// Place a block of count elements of the given size that *slot points to.
+// Measuring and packing place tables in a second pass, after everything
+// that holds pointers.
+static void
+arena_place (Arena *arena, void *slot, size_t count, size_t size, bool table)
+{
+  void **ptr = (void **)slot;
+  switch (arena->mode)
+  {
+  case ARENA_MEASURE:
+  case ARENA_PACK:
+    if (!*ptr || table != arena->table_pass)
+      return;
+    size_t offset = arena_align (arena->used);
+    arena->used   = offset + count * size;
+    if (arena->mode == ARENA_PACK)
+    {
+      memcpy (arena->base + offset, *ptr, count * size);
+      *ptr = arena->base + offset;
+    }
+    break;
+
+  case ARENA_SAVE:
+  {
+    // Offsets are stored + 1 so NULL stays NULL
+    void *value = NULL;
+    if (*ptr && table)
+      value = (void *)((uintptr_t)((const char *)*ptr - arena->tables) + arena->table_offset + 1);
+    else if (*ptr)
+      value = (void *)((uintptr_t)((char *)*ptr - arena->base) + 1);
+    memcpy (arena->out + ((char *)slot - arena->base), &value, sizeof (value));
+    break;
+  }
+
+  case ARENA_LOAD:
+    arena_load (arena, ptr, count, size, table);
+    break;
+  }
+}
+
+// Place a NUL-terminated string of known length
+static void
+arena_place_string (Arena *arena, char **slot, size_t len)
+{
+  if (arena->mode == ARENA_LOAD && (len >= arena->size || !*slot))
+  {
+    if (*slot || len > 0)
+      arena->invalid = true;
+    *slot = NULL;
+    return;
+  }
+  arena_place (arena, slot, len + 1, 1, false);
+}
+
+// Check that a loaded searcher's rare bytes lie within its literal
+static bool
+literal_searcher_valid (const LiteralSearcher *searcher, size_t literal_len)
+{
+  return !searcher->enabled || (searcher->offset1 < literal_len && searcher->offset2 < literal_len);
+}
+
+// Check that every transition of a loaded dense DFA leads to one of its rows
+static bool
+dense_dfa_valid (const DenseDFA *dfa)
+{
+  if (dfa->num_classes <= 0 || dfa->num_classes > TRANSITION_TABLE_SIZE || dfa->num_states <= 0 ||
+      dfa->start_count < 0 || dfa->start_count > TRANSITION_TABLE_SIZE || dfa->pair_count < 0 ||
+      dfa->pair_count > DENSE_DFA_MAX_PAIRS || !literal_searcher_valid (&dfa->pair_search, 2))
+    return false;
+
+  for (int i = 0; i < TRANSITION_TABLE_SIZE; i++)
+    if (dfa->classmap[i] >= dfa->num_classes)
+      return false;
+
+  size_t entries = (size_t)dfa->num_states * dfa->num_classes;
+  for (size_t i = 0; i <= entries; i++)
+  {
+    uint32_t row = (i < entries ? dfa->table[i] : dfa->start) & DENSE_DFA_ROW_MASK;
+    if (row >= entries || row % dfa->num_classes != 0)
+      return false;
+  }
+  return true;
+}
+
+// Place a dense DFA table
+static void
+arena_place_dense_dfa (Arena *arena, DenseDFA *dfa)
+{
+  if (arena->mode == ARENA_LOAD && (dfa->num_states < 0 || dfa->num_classes < 0))
+  {
+    arena->invalid = true;
+    dfa->table     = NULL;
+    return;
+  }
+
+  arena_place (arena, &dfa->table, (size_t)dfa->num_states * dfa->num_classes, sizeof (uint32_t), true);
+
+  if (arena->mode == ARENA_LOAD && (dfa->table || dfa->enabled) && !(dfa->table && dense_dfa_valid (dfa)))
+    arena->invalid = true;
+}
+
+// Place a literal set
+static void
+arena_place_literal_set (Arena *arena, LiteralSet *set)
+{
+  arena_place (arena, &set->lengths, set->count, sizeof (size_t), false);
+  arena_place (arena, &set->literals, set->count, sizeof (char *), false);
+  for (size_t i = 0; set->literals && set->lengths && i < set->count; i++)
+    arena_place_string (arena, &set->literals[i], set->lengths[i]);
+  if (arena->mode == ARENA_PACK)
+    set->capacity = set->count;
+}
+
+// Place a link between two NFA states of a pattern, whose states are
+// already placed.  Packing moves links with the states array and loading
+// checks that they land on a state of the same pattern.
+static void
+arena_place_link (Arena *arena, struct vibrex_pattern *pattern, State **link, const State *old_states)
+{
+  if (!*link)
+    return;
+
+  if (arena->mode == ARENA_PACK)
+  {
+    *link = pattern->states + (*link - old_states);
+  }
+  else if (arena->mode == ARENA_SAVE)
+  {
+    arena_place (arena, link, 1, sizeof (State), false);
+  }
+  else if (arena->mode == ARENA_LOAD)
+  {
+    size_t offset = (uintptr_t)*link - 1;
+    size_t first  = pattern->states ? (size_t)((char *)pattern->states - arena->base) : 0;
+    if (!pattern->states || offset < first || (offset - first) % sizeof (State) != 0 ||
+        (offset - first) / sizeof (State) >= (size_t)pattern->nstate)
+    {
+      arena->invalid = true;
+      *link          = NULL;
+      return;
+    }
+    *link = pattern->states + (offset - first) / sizeof (State);
+  }
+}
+
+// Check what matching a loaded pattern relies on beyond its references
+static bool
+pattern_loaded_valid (const struct vibrex_pattern *pattern)
+{
+  const LiteralSet *required = &pattern->required.set;
+  if (!literal_searcher_valid (&pattern->prefix_search, pattern->prefix_len) ||
+      !literal_searcher_valid (&pattern->required.searcher, required->count > 0 ? required->lengths[0] : 0))
+    return false;
+
+  if ((int)pattern->engine < ENGINE_NFA || (int)pattern->engine > ENGINE_BITNFA ||
+      (pattern->engine == ENGINE_NFA && pattern->bitnfa.enabled) ||
+      (pattern->engine == ENGINE_BITNFA && !pattern->bitnfa.enabled) ||
+      (pattern->engine == ENGINE_NFA && pattern->nstate <= 0))
+    return false;
+
+  if (pattern->nstate > 0)
+  {
+    if (!pattern->start || pattern->num_byte_classes <= 0 || pattern->num_byte_classes > TRANSITION_TABLE_SIZE)
+      return false;
+    for (int i = 0; i < TRANSITION_TABLE_SIZE; i++)
+      if (pattern->byte_class[i] >= pattern->num_byte_classes)
+        return false;
+  }
+
+  // Looked up states must have a closure
+  const BitNFA *bits = &pattern->bitnfa;
+  if (bits->enabled && (bits->nbits < 1 || bits->nbits > BITNFA_MAX_STATES || pattern->nstate == 0 ||
+                        (bits->nbits < BITNFA_MAX_STATES && (bits->jumps >> bits->nbits) != 0)))
+    return false;
+  if (bits->nloops < 0 || bits->nloops > BITNFA_MAX_STATES + 1)
+    return false;
+
+  // Closures must be ordered runs of state indices
+  if (pattern->follow_start)
+  {
+    if (pattern->follow_start[0] != 0 || pattern->follow_start[pattern->nstate] != pattern->follow_count)
+      return false;
+    for (int i = 0; i < pattern->nstate; i++)
+      if (pattern->follow_start[i] > pattern->follow_start[i + 1])
+        return false;
+    for (int i = 0; i < pattern->follow_count; i++)
+      if (pattern->follow[i] < 0 || pattern->follow[i] >= pattern->nstate)
+        return false;
+  }
+
+  // A split without a second branch is the epsilon state parsecat() makes
+  // for an empty concatenation, such as () or a{0}
+  for (int i = 0; i < pattern->nstate; i++)
+  {
+    const State *s = &pattern->states[i];
+    if ((int)s->type < STATE_CHAR || (int)s->type > STATE_END_ANCHOR || (s->type != STATE_MATCH && !s->out))
+      return false;
+  }
+
+  // Scratch space is sized by max_nstate, which must be what compiling
+  // recorded: the largest state count of the pattern and its nested ones
+  int max_nstate                = pattern->bitnfa.enabled ? 0 : pattern->nstate;
+  const AlternationOpt *alt_opt = &pattern->alt_opt;
+  if (alt_opt->middle_pattern && alt_opt->middle_pattern->max_nstate > max_nstate)
+    max_nstate = alt_opt->middle_pattern->max_nstate;
+  for (size_t i = 0; alt_opt->suffixes && i < alt_opt->alt_count; i++)
+  {
+    const struct vibrex_pattern *sub = alt_opt->suffixes[i].regex_suffix;
+    if (sub && sub->max_nstate > max_nstate)
+      max_nstate = sub->max_nstate;
+  }
+  return pattern->max_nstate == max_nstate;
+}
+
+static void arena_place_pattern (Arena *arena, struct vibrex_pattern **slot);
+
+// Place everything a pattern owns.  The pattern itself is already in place,
+// or is the original while measuring, and its pointers still refer to the
+// blocks being placed.
+static void
+arena_place_contents (Arena *arena, struct vibrex_pattern *pattern)
+{
+  State *old_states = pattern->states;
+  arena_place (arena, &pattern->states, (size_t)pattern->nstate, sizeof (State), false);
+  if (arena->mode != ARENA_MEASURE && !arena->table_pass && pattern->states)
+  {
+    for (int i = 0; i < pattern->nstate; i++)
+    {
+      arena_place_link (arena, pattern, &pattern->states[i].out, old_states);
+      arena_place_link (arena, pattern, &pattern->states[i].out1, old_states);
+    }
+    arena_place_link (arena, pattern, &pattern->start, old_states);
+  }
+  if (pattern->follow_start)
+    arena_place (arena, &pattern->follow_start, (size_t)pattern->nstate + 1, sizeof (int), false);
+  arena_place (arena, &pattern->follow, (size_t)pattern->follow_count, sizeof (int), false);
+  arena_place (arena, &pattern->bitnfa.accept, pattern->bitnfa.accept ? (size_t)pattern->num_byte_classes : 0,
+               sizeof (uint64_t), true);
+  arena_place (arena, &pattern->bitnfa.follow, (size_t)pattern->bitnfa.nbits, sizeof (uint64_t), true);
+  arena_place (arena, &pattern->bitnfa.loops, (size_t)pattern->bitnfa.nloops, sizeof (BitLoop), true);
+  arena_place_pattern (arena, &pattern->nfa);
+
+  arena_place_string (arena, &pattern->literal_prefix, pattern->prefix_len);
+  arena_place_string (arena, &pattern->both_anchors.prefix, pattern->both_anchors.prefix_len);
+  arena_place_string (arena, &pattern->both_anchors.suffix, pattern->both_anchors.suffix_len);
+
+  LiteralAltOpt *literal_alt = &pattern->literal_alt;
+  arena_place (arena, &literal_alt->alt_lengths, literal_alt->alt_count, sizeof (size_t), false);
+  arena_place (arena, &literal_alt->alternatives, literal_alt->alt_count, sizeof (char *), false);
+  for (size_t i = 0; literal_alt->alternatives && literal_alt->alt_lengths && i < literal_alt->alt_count; i++)
+    arena_place_string (arena, &literal_alt->alternatives[i], literal_alt->alt_lengths[i]);
+  arena_place_dense_dfa (arena, &literal_alt->automaton);
+  arena_place_dense_dfa (arena, &literal_alt->trie);
+
+  arena_place_dense_dfa (arena, &pattern->dfa.automaton);
+  arena_place_dense_dfa (arena, &pattern->dfa.trie);
+
+  arena_place_literal_set (arena, &pattern->required.set);
+  arena_place_dense_dfa (arena, &pattern->required.automaton);
+
+  AlternationOpt *alt_opt = &pattern->alt_opt;
+  arena_place_string (arena, &alt_opt->prefix, alt_opt->prefix_len);
+  arena_place_string (arena, &alt_opt->suffix, alt_opt->suffix_len);
+  arena_place_dense_dfa (arena, &alt_opt->middles);
+  arena_place_pattern (arena, &alt_opt->middle_pattern);
+  arena_place (arena, &alt_opt->suffixes, alt_opt->suffixes ? alt_opt->alt_count : 0, sizeof (AltSuf), false);
+  for (size_t i = 0; alt_opt->suffixes && i < alt_opt->alt_count; i++)
+  {
+    AltSuf *alt = &alt_opt->suffixes[i];
+    arena_place_string (arena, &alt->literal_suffix, alt->literal_len);
+    arena_place_string (arena, &alt->core_pattern, alt->core_len);
+    arena_place_pattern (arena, &alt->regex_suffix);
+  }
+
+  if (arena->mode == ARENA_LOAD && !arena->invalid && !pattern_loaded_valid (pattern))
+    arena->invalid = true;
+}
+
+// Place a nested sub-pattern and everything it owns
+static void
+arena_place_pattern (Arena *arena, struct vibrex_pattern **slot)
+{
+  if (!*slot)
+    return;
+  arena_place (arena, slot, 1, sizeof (struct vibrex_pattern), false);
+  if (!*slot)
+    return;
+  if (arena->mode == ARENA_PACK)
+    (*slot)->packed = true;
+  arena_place_contents (arena, *slot);
+}
+
+// Pack a compiled pattern into a single block.  The default scratch moves
+// to the packed pattern and the unpacked one is freed; returns NULL if out
+// of memory, leaving the unpacked pattern to the caller
+static struct vibrex_pattern *
+pattern_pack (struct vibrex_pattern *pattern)
+{
+  Arena measure = {.mode = ARENA_MEASURE, .used = sizeof (struct vibrex_pattern)};
+  arena_place_contents (&measure, pattern);
+  size_t table_offset = arena_align (measure.used);
+  measure.used        = table_offset;
+  measure.table_pass  = true;
+  arena_place_contents (&measure, pattern);
+
+  Arena arena = {.mode = ARENA_PACK, .base = malloc (measure.used)};
+  if (!arena.base)
+    return NULL;
+
+  struct vibrex_pattern *packed = pattern;
+  arena_place (&arena, &packed, 1, sizeof (struct vibrex_pattern), false);
+  packed->packed = true;
+  atomic_flag_clear (&packed->scratch_busy);
+  arena_place_contents (&arena, packed);
+  arena.used       = table_offset;
+  arena.table_pass = true;
+  arena_place_contents (&arena, packed);
+
+  packed->packed_size  = measure.used;
+  packed->table_offset = table_offset;
+  packed->tables       = arena.base + table_offset;
+
+  pattern->scratch = NULL;
+  vibrex_free (pattern);
+  return packed;
+}
+
+/********************************************************************************
+ * PATTERN SERIALIZATION
+ ********************************************************************************/
+
+// A serialized pattern is a header followed by the packed block with each
+// pointer replaced by its offset in the block + 1.  The layout is that of
+// the library build that wrote it, which the header identifies.
+
+#define SERIAL_MAGIC "VIBREX\r\n"
+#define SERIAL_VERSION 9
+#define SERIAL_BYTE_ORDER 0x01020304u
+
+typedef struct
+{
+  char magic[8];         // SERIAL_MAGIC
+  uint32_t version;      // SERIAL_VERSION
+  uint32_t byte_order;   // SERIAL_BYTE_ORDER in the byte order of the writer
+  uint32_t pattern_size; // sizeof (struct vibrex_pattern) of the writer
+  uint32_t state_size;   // sizeof (State) of the writer
+  uint64_t block_size;   // Bytes in the packed block
+  uint64_t table_offset; // Offset of the dense DFA tables in the block
+  uint64_t reserved;     // Zero
+} SerialHeader;
+
+// The block follows the header aligned as it was in memory
+_Static_assert (sizeof (SerialHeader) % ARENA_ALIGN == 0, "serialized block must stay aligned");
+
+// Serialize a compiled pattern
+size_t
+vibrex_serialize (const struct vibrex_pattern *pattern, void *buffer, size_t buffer_size)
+{
+  if (!pattern)
+    return 0;
+
+  size_t total = sizeof (SerialHeader) + pattern->packed_size;
+  if (!buffer || buffer_size < total)
+    return total;
+
+  SerialHeader header = {.version      = SERIAL_VERSION,
+                         .byte_order   = SERIAL_BYTE_ORDER,
+                         .pattern_size = sizeof (struct vibrex_pattern),
+                         .state_size   = sizeof (State),
+                         .block_size   = pattern->packed_size,
+                         .table_offset = pattern->table_offset};
+  memcpy (header.magic, SERIAL_MAGIC, sizeof (header.magic));
+  memcpy (buffer, &header, sizeof (header));
+
+  // Copy the block, then overwrite each pointer of the copy with an offset.
+  // The walk only reads the pattern, so it is safe alongside matching.
+  char *out = (char *)buffer + sizeof (header);
+  memcpy (out, pattern, pattern->table_offset);
+  memcpy (out + pattern->table_offset, pattern->tables, pattern->packed_size - pattern->table_offset);
+
+  Arena arena = {.mode         = ARENA_SAVE,
+                 .base         = (char *)pattern,
+                 .tables       = pattern->tables,
+                 .table_offset = pattern->table_offset,
+                 .out          = out};
+  arena_place_contents (&arena, (struct vibrex_pattern *)pattern);
+
+  // Clear what only makes sense in this process
+  memset (out + offsetof (struct vibrex_pattern, tables), 0, sizeof (pattern->tables));
+  memset (out + offsetof (struct vibrex_pattern, scratch), 0, sizeof (pattern->scratch));
+  memset (out + offsetof (struct vibrex_pattern, scratch_busy), 0, sizeof (pattern->scratch_busy));
+  return total;
+}
+
+// Load a serialized pattern, leaving its dense DFA tables in the data when
+// share_tables is set and the data is suitably aligned
+static struct vibrex_pattern *
+deserialize_pattern (const void *data, size_t data_size, bool share_tables, const char **error_message)
+{
+  SerialHeader header;
+  if (!data || data_size < sizeof (header))
+  {
+    if (error_message)
+      *error_message = "Serialized pattern truncated";
+    return NULL;
+  }
+
+  memcpy (&header, data, sizeof (header));
+  if (memcmp (header.magic, SERIAL_MAGIC, sizeof (header.magic)) != 0 || header.version != SERIAL_VERSION)
+  {
+    if (error_message)
+      *error_message = "Not a serialized pattern of this version";
+    return NULL;
+  }
+  if (header.byte_order != SERIAL_BYTE_ORDER || header.pattern_size != sizeof (struct vibrex_pattern) ||
+      header.state_size != sizeof (State))
+  {
+    if (error_message)
+      *error_message = "Serialized pattern from an incompatible build";
+    return NULL;
+  }
+  if (header.block_size > data_size - sizeof (header) || header.table_offset > header.block_size ||
+      header.table_offset < sizeof (struct vibrex_pattern) || header.table_offset % ARENA_ALIGN != 0)
+  {
+    if (error_message)
+      *error_message = "Serialized pattern truncated or corrupt";
+    return NULL;
+  }
+
+  const char *block = (const char *)data + sizeof (header);
+  if ((uintptr_t)block % ARENA_ALIGN != 0)
+    share_tables = false;
+  size_t copy_size = share_tables ? header.table_offset : header.block_size;
+
+  char *base = malloc (copy_size);
+  if (!base)
+  {
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+  memcpy (base, block, copy_size);
+
+  struct vibrex_pattern *pattern = (struct vibrex_pattern *)base;
+  pattern->packed                = true;
+  pattern->nested                = false;
+  pattern->tables                = (share_tables ? block : base) + header.table_offset;
+  pattern->packed_size           = header.block_size;
+  pattern->table_offset          = header.table_offset;
+  pattern->scratch               = NULL;
+  atomic_flag_clear (&pattern->scratch_busy);
+#ifdef VIBREX_COUNTERS
+  memset (&pattern->counters, 0, sizeof (pattern->counters));
+#endif
+
+  Arena arena = {.mode         = ARENA_LOAD,
+                 .base         = base,
+                 .tables       = pattern->tables,
+                 .table_offset = header.table_offset,
+                 .size         = header.block_size};
+  arena_place_contents (&arena, pattern);
+  if (arena.invalid)
+  {
+    free (base);
+    if (error_message)
+      *error_message = "Serialized pattern corrupt";
+    return NULL;
+  }
+
+  if (pattern->max_nstate > 0)
+  {
+    pattern->scratch = vibrex_scratch_create (pattern);
+    if (!pattern->scratch)
+    {
+      free (base);
+      if (error_message)
+        *error_message = "Out of memory";
+      return NULL;
+    }
+  }
+  return pattern;
+}
+
+// Load a serialized pattern into memory of its own
+struct vibrex_pattern *
+vibrex_deserialize (const void *data, size_t data_size, const char **error_message)
+{
+  return deserialize_pattern (data, data_size, false, error_message);
+}
+
+// Load a serialized pattern whose dense DFA tables stay in the data
+struct vibrex_pattern *
+vibrex_deserialize_mapped (const void *data, size_t data_size, const char **error_message)
+{
+  return deserialize_pattern (data, data_size, true, error_message);
+}
+
+/********************************************************************************
+ * MATCH SCRATCH SPACE
+ ********************************************************************************/
+
+// Grow scratch space to hold at least nstates NFA states
+static bool
+scratch_reserve (struct vibrex_scratch *scratch, int nstates)
+{
+  if (nstates <= scratch->capacity)
+    return true;
+
+  State **list1   = malloc (nstates * sizeof (State *));
+  State **list2   = malloc (nstates * sizeof (State *));
+  State **list3   = malloc (nstates * sizeof (State *));
+  unsigned *marks = calloc (nstates, sizeof (unsigned));
+  int *set_buffer = malloc (nstates * sizeof (int));
+  State **stack   = malloc (nstates * sizeof (State *));
+  size_t *starts1 = malloc (nstates * sizeof (size_t));
+  size_t *starts2 = malloc (nstates * sizeof (size_t));
+  if (!list1 || !list2 || !list3 || !marks || !set_buffer || !stack || !starts1 || !starts2)
+  {
+    free (list1);
+    free (list2);
+    free (list3);
+    free (marks);
+    free (set_buffer);
+    free (stack);
+    free (starts1);
+    free (starts2);
+    return false;
+  }
+
+  free (scratch->list1);
+  free (scratch->list2);
+  free (scratch->list3);
+  free (scratch->marks);
+  free (scratch->set_buffer);
+  free (scratch->stack);
+  free (scratch->starts1);
+  free (scratch->starts2);
+  scratch->list1      = list1;
+  scratch->list2      = list2;
+  scratch->list3      = list3;
+  scratch->marks      = marks;
+  scratch->set_buffer = set_buffer;
+  scratch->stack      = stack;
+  scratch->starts1    = starts1;
+  scratch->starts2    = starts2;
+  scratch->capacity = nstates;
+  scratch->listid   = 0;
+  return true;
+}
+
+// Record scratch requirements and allocate the default scratch space
+static bool
+finish_compile (struct vibrex_pattern *compiled)
+{
+  // The bit-parallel NFA keeps its state in a word and needs no scratch
+  int max_nstate = compiled->bitnfa.enabled ? 0 : compiled->nstate;
+
+  if (compiled->has_advanced_alt_opt)
+  {
+    const AlternationOpt *alt_opt = &compiled->alt_opt;
+    if (alt_opt->middle_pattern && alt_opt->middle_pattern->max_nstate > max_nstate)
+      max_nstate = alt_opt->middle_pattern->max_nstate;
+
+    for (size_t i = 0; alt_opt->suffixes && i < alt_opt->alt_count; i++)
+    {
+      const struct vibrex_pattern *sub = alt_opt->suffixes[i].regex_suffix;
+      if (sub && sub->max_nstate > max_nstate)
+        max_nstate = sub->max_nstate;
+    }
+  }
+
+  compiled->max_nstate = max_nstate;
+  atomic_flag_clear (&compiled->scratch_busy);
+
+  // Nested patterns are only matched with their parent's scratch
+  if (max_nstate == 0 || compiled->nested)
+    return true;
+
+  compiled->scratch = vibrex_scratch_create (compiled);
+  return compiled->scratch != NULL;
+}
+
+// Create scratch space for matching against a pattern
+struct vibrex_scratch *
+vibrex_scratch_create (const struct vibrex_pattern *pattern)
+{
+  struct vibrex_scratch *scratch = calloc (1, sizeof (struct vibrex_scratch));
+  if (!scratch)
+    return NULL;
+
+  if (pattern && !scratch_reserve (scratch, pattern->max_nstate))
+  {
+    vibrex_scratch_free (scratch);
+    return NULL;
+  }
+
+  return scratch;
+}
+
+// Report the length and byte bounds of every match
+bool
+vibrex_bounds (const struct vibrex_pattern *pattern, vibrex_bounds_t *bounds)
+{
+  if (!pattern || !bounds || !pattern->bounds.enabled)
+    return false;
+
+  const MatchBounds *b   = &pattern->bounds;
+  bounds->min_length     = b->min_length;
+  bounds->max_length     = b->max_length;
+  bounds->anchored_start = b->anchored_start;
+  bounds->anchored_end   = b->anchored_end;
+  memcpy (bounds->first_bytes, b->first_bytes, sizeof (bounds->first_bytes));
+  memcpy (bounds->last_bytes, b->last_bytes, sizeof (bounds->last_bytes));
+  return true;
+}
+
+// Names of the engines reported by vibrex_info(), indexed by MatchEngine
+static const char *const engine_names[] = {"nfa", "both-anchors", "url", "literal-alt", "advanced-alt", "dfa",
+                                           "dotstar", "bitnfa"};
+_Static_assert (sizeof (engine_names) / sizeof (engine_names[0]) == ENGINE_BITNFA + 1, "every engine needs a name");
+
+// Add the size of a dense DFA's tables to a pattern description
+static void
+info_add_dense_dfa (const DenseDFA *dfa, vibrex_info_t *info)
+{
+  if (!dfa->enabled)
+    return;
+  info->dfa_states += dfa->num_states;
+  info->dfa_bytes += (size_t)dfa->num_states * dfa->num_classes * sizeof (uint32_t);
+}
+
+// Report how a compiled pattern is matched
+bool
+vibrex_info (const struct vibrex_pattern *pattern, vibrex_info_t *info)
+{
+  if (!pattern || !info)
+    return false;
+
+  memset (info, 0, sizeof (*info));
+  info->engine        = engine_names[pattern->engine];
+  info->nfa_states    = pattern->nstate;
+  info->bitnfa_states = pattern->bitnfa.enabled ? pattern->bitnfa.nbits : 0;
+  info->byte_classes  = pattern->num_byte_classes;
+
+  // The start search only runs in the NFA engines, and not at all when
+  // attempts can only start at the text start
+  bool nfa_engine = pattern->engine == ENGINE_NFA || pattern->engine == ENGINE_BITNFA;
+  bool anchored   = pattern->engine == ENGINE_BITNFA ? pattern->bitnfa.restart == 0
+                                                     : pattern->start && pattern->start->type == STATE_START_ANCHOR;
+  if (nfa_engine && !anchored && pattern->has_first_char)
+  {
+    info->start_search = pattern->prefix_search.enabled ? "prefix" : "first-byte";
+    if (pattern->prefix_search.enabled)
+    {
+      info->prefix     = pattern->literal_prefix;
+      info->prefix_len = pattern->prefix_len;
+    }
+  }
+  if (nfa_engine && pattern->required.enabled)
+  {
+    info->required_literals = pattern->required.set.count;
+    if (pattern->required.set.count == 1)
+    {
+      info->literal     = pattern->required.set.literals[0];
+      info->literal_len = pattern->required.set.lengths[0];
+    }
+  }
+
+  info_add_dense_dfa (&pattern->dfa.automaton, info);
+  info_add_dense_dfa (&pattern->dfa.trie, info);
+  info_add_dense_dfa (&pattern->literal_alt.automaton, info);
+  info_add_dense_dfa (&pattern->literal_alt.trie, info);
+  info_add_dense_dfa (&pattern->required.automaton, info);
+  info_add_dense_dfa (&pattern->alt_opt.middles, info);
+
+  // DFA tables used in place from a mapping are not held by the pattern
+  bool shared_tables = pattern->tables != (const char *)pattern + pattern->table_offset;
+  info->memory_bytes = shared_tables ? pattern->table_offset : pattern->packed_size;
+  if (pattern->max_nstate > 0)
+    info->scratch_bytes = sizeof (struct vibrex_scratch) +
+                          (size_t)pattern->max_nstate * (4 * sizeof (State *) + sizeof (unsigned) + sizeof (int) + 2 * sizeof (size_t));
+  return true;
+}
+
+// Report the match counters of a pattern
+bool
+vibrex_counters (const struct vibrex_pattern *pattern, vibrex_counters_t *counters, bool reset)
+{
+#ifdef VIBREX_COUNTERS
+  if (!pattern || !counters)
+    return false;
+
+  PatternCounters *c = (PatternCounters *)&pattern->counters;
+  if (reset)
+  {
+    counters->subjects          = atomic_exchange_explicit (&c->subjects, 0, memory_order_relaxed);
+    counters->matches           = atomic_exchange_explicit (&c->matches, 0, memory_order_relaxed);
+    counters->bounds_rejects    = atomic_exchange_explicit (&c->bounds_rejects, 0, memory_order_relaxed);
+    counters->prefilter_rejects = atomic_exchange_explicit (&c->prefilter_rejects, 0, memory_order_relaxed);
+    counters->bytes_scanned     = atomic_exchange_explicit (&c->bytes_scanned, 0, memory_order_relaxed);
+    counters->nfa_steps         = atomic_exchange_explicit (&c->nfa_steps, 0, memory_order_relaxed);
+  }
+  else
+  {
+    counters->subjects          = atomic_load_explicit (&c->subjects, memory_order_relaxed);
+    counters->matches           = atomic_load_explicit (&c->matches, memory_order_relaxed);
+    counters->bounds_rejects    = atomic_load_explicit (&c->bounds_rejects, memory_order_relaxed);
+    counters->prefilter_rejects = atomic_load_explicit (&c->prefilter_rejects, memory_order_relaxed);
+    counters->bytes_scanned     = atomic_load_explicit (&c->bytes_scanned, memory_order_relaxed);
+    counters->nfa_steps         = atomic_load_explicit (&c->nfa_steps, memory_order_relaxed);
+  }
+  return true;
+#else
+  (void)pattern;
+  (void)reset;
+  if (counters)
+    memset (counters, 0, sizeof (*counters));
+  return false;
+#endif
+}
+
+// Report lazy DFA cache statistics
+bool
+vibrex_dfa_stats (const struct vibrex_pattern *pattern, const struct vibrex_scratch *scratch, vibrex_dfa_stats_t *stats)
+{
+  if (!stats)
+    return false;
+
+  if (!scratch)
+    scratch = pattern ? pattern->scratch : NULL;
+  if (!scratch)
+    return false;
+
+  const LazyDFA *dfa   = &scratch->dfa_cache;
+  stats->cache_hits    = dfa->cache_hits;
+  stats->cache_misses  = dfa->cache_misses;
+  stats->cache_flushes = dfa->cache_flushes;
+  stats->nfa_fallbacks = dfa->nfa_fallbacks;
+  stats->cache_states  = dfa->num_states;
+  return true;
+}
+
+// Free scratch space
+void
+vibrex_scratch_free (struct vibrex_scratch *scratch)
+{
+  if (scratch)
+  {
+    free (scratch->list1);
+    free (scratch->list2);
+    free (scratch->list3);
+    free (scratch->marks);
+    free (scratch->set_buffer);
+    free (scratch->stack);
+    free (scratch->starts1);
+    free (scratch->starts2);
+    free (scratch->pending);
+    ldfa_free (&scratch->dfa_cache);
+    free (scratch);
+  }
+}
+
+/********************************************************************************
+ * STREAMING MATCH
+ ********************************************************************************/
+
+// How a stream carries its match state
+typedef enum
+{
+  STREAM_BITNFA, // Bit-parallel NFA state set
+  STREAM_DFA,    // Lazy DFA state
+  STREAM_NFA,    // NFA simulation lists, once the lazy DFA thrashed
+  STREAM_FAILED  // Ran out of memory
+} StreamMode;
+
+// Match state carried from one chunk of a text to the next
+struct vibrex_stream
+{
+  const struct vibrex_pattern *nfa; // Pattern whose NFA is run
+  struct vibrex_scratch *scratch;   // Lazy DFA cache and NFA lists of this stream
+  StreamMode mode;                  // How the match state is carried
+  bool matched;                     // A match ended in the text so far
+  uint64_t bits;                    // Bit-parallel NFA state set
+  int dfa_state;                    // Lazy DFA state
+  NfaRun run;                       // NFA simulation lists
+  size_t offset;                    // Bytes fed so far
+};
+
+// Free a stream and everything it owns
+static void
+stream_free (struct vibrex_stream *stream)
+{
+  vibrex_scratch_free (stream->scratch);
+  free (stream);
+}
+
+// Carry on in the NFA simulation from the NFA states of the lazy DFA state,
+// which already hold the start state for the position after it
+static void
+stream_switch_to_nfa (struct vibrex_stream *stream, size_t offset)
+{
+  struct vibrex_scratch *scratch = stream->scratch;
+  const LazyDFA *dfa             = &scratch->dfa_cache;
+  const LazyState *ls            = &dfa->states[stream->dfa_state];
+  const int *set                 = dfa->set_pool + ls->set_offset;
+
+  nfa_run_init (&stream->run, scratch);
+  List *l = &stream->run.lists[0];
+  for (int i = 0; i < ls->set_count; i++)
+  {
+    l->s[l->n++]           = (State *)&stream->nfa->states[set[i]];
+    scratch->marks[set[i]] = scratch->listid;
+  }
+  stream->run.offset = offset;
+  stream->mode       = STREAM_NFA;
+}
+
+// Start matching a pattern against text that arrives in chunks
+struct vibrex_stream *
+vibrex_stream_begin (const struct vibrex_pattern *pattern)
+{
+  if (!pattern)
+    return NULL;
+
+  struct vibrex_stream *stream = calloc (1, sizeof (struct vibrex_stream));
+  if (!stream)
+    return NULL;
+  stream->nfa = pattern->states ? pattern : pattern->nfa;
+  if (!stream->nfa)
+  {
+    stream_free (stream);
+    return NULL;
+  }
+
+  const struct vibrex_pattern *nfa = stream->nfa;
+  if (nfa->bitnfa.enabled)
+  {
+    stream->mode = STREAM_BITNFA;
+    stream->bits = nfa->bitnfa.start;
+    return stream;
+  }
+
+  stream->scratch = vibrex_scratch_create (NULL);
+  if (!stream->scratch || !scratch_reserve (stream->scratch, nfa->nstate))
+  {
+    stream_free (stream);
+    return NULL;
+  }
+  stream->mode      = STREAM_DFA;
+  stream->dfa_state = (nfa->flags & VIBREX_NO_LAZY_DFA) ? -1 : ldfa_text_start (nfa, stream->scratch);
+  if (stream->dfa_state < 0)
+  {
+    nfa_run_init (&stream->run, stream->scratch);
+    stream->mode = STREAM_NFA;
+  }
+  return stream;
+}
+
+// Match the next chunk of a stream
+bool
+vibrex_stream_feed (struct vibrex_stream *stream, const char *chunk, size_t chunk_len)
+{
+  if (!stream || stream->mode == STREAM_FAILED)
+    return false;
+  if (stream->matched || !chunk)
+    return stream->matched;
+
+  const struct vibrex_pattern *nfa = stream->nfa;
+  const unsigned char *p           = (const unsigned char *)chunk;
+  const unsigned char *end         = p + chunk_len;
+  switch (stream->mode)
+  {
+  case STREAM_BITNFA:
+    stream->matched = bitnfa_run (nfa, &stream->bits, p, end, false);
+    break;
+
+  case STREAM_DFA:
+  {
+    int result = ldfa_run (nfa, stream->scratch, &stream->dfa_state, &p, end, false);
+    if (result >= 0)
+    {
+      stream->matched = result;
+      break;
+    }
+    if (stream->dfa_state < 0)
+    {
+      stream->mode = STREAM_FAILED;
+      break;
+    }
+
+    // The cache thrashed, the NFA simulation runs the rest of the stream
+    stream_switch_to_nfa (stream, stream->offset + (size_t)((const char *)p - chunk));
+    stream->matched = nfa_run (nfa, stream->scratch, &stream->run, (const char *)p, end - p, false, false);
+    break;
+  }
+
+  case STREAM_NFA:
+    stream->matched = nfa_run (nfa, stream->scratch, &stream->run, chunk, chunk_len, false, false);
+    break;
+
+  case STREAM_FAILED:
+    break;
+  }
+
+  stream->offset += chunk_len;
+  return stream->matched;
+}
+
+// End the text of a stream, report whether it matched and free the stream
+bool
+vibrex_stream_end (struct vibrex_stream *stream)
+{
+  if (!stream)
+    return false;
+
+  const struct vibrex_pattern *nfa = stream->nfa;
+  bool matched                     = stream->matched;
+  if (!matched)
+  {
+    switch (stream->mode)
+    {
+    case STREAM_BITNFA:
+      matched = (stream->bits & (nfa->bitnfa.match | nfa->bitnfa.end_match)) != 0;
+      break;
+
+    case STREAM_DFA:
+      matched = (stream->scratch->dfa_cache.states[stream->dfa_state].flags & (LDFA_MATCH | LDFA_END_MATCH)) != 0;
+      break;
+
+    case STREAM_NFA:
+      matched = nfa_run (nfa, stream->scratch, &stream->run, "", 0, true, false);
+      break;
+
+    case STREAM_FAILED:
+      break;
+    }
+  }
+
+  stream_free (stream);
+  return matched;
+}
+
+/********************************************************************************
+ * FIND ALL MATCHES
+ ********************************************************************************/
+
+// Position of a pass over a buffer that finds every match, carried from one
+// match to the next so the prefilters scan the buffer once and the NFA
+// simulation at most about twice
+struct vibrex_iter
+{
+  const struct vibrex_pattern *pattern; // Top-level pattern, whose bounds and literals prefilter
+  const struct vibrex_pattern *nfa;     // Pattern whose NFA finds the bounds of each match
+  const DenseDFA *trie;                 // Literal trie that finds them instead, if the pattern has one
+  struct vibrex_scratch *scratch;       // Scratch space, owned unless borrowed by vibrex_count()
+  bool owns_scratch;                    // Free the scratch space with the iterator
+  const char *text;                     // Buffer searched
+  size_t text_len;                      // Bytes in the buffer
+  size_t offset;                        // Where the next match may start
+  bool started;                         // The buffer passed the boolean match
+  bool done;                            // No more matches
+  size_t literal_at;                    // Start of the next required literal at or after offset, if literal_valid
+  bool literal_valid;                   // literal_at is known
+  bool has_idle_span;                   // idle_span is used to skip to match starts
+  ByteSpan idle_span;                   // Bytes no match starts with
+  size_t rescanned;                     // Bytes searches ran on past their match, to be stepped through again
+  bool eager;                           // Attempts go on starting while a match is pending
+  bool scanning;                        // The eager NFA simulation is in progress
+  bool stopped;                         // No attempts are started, the simulation starts over after the pending matches
+  size_t pos;                           // Position the simulation has reached
+  List clist;                           // States at pos, in the scratch space
+  List nlist;                           // The other list of the scratch space
+  size_t *cstarts;                      // Start of the attempt each state of clist belongs to
+  size_t *nstarts;                      // The other starts of the scratch space
+  size_t pending_head;                  // First pending match of the scratch space not reported
+  size_t pending_count;                 // Pending matches in the scratch space, reported or not
+};
+
+// Set up a pass over a buffer, false if the pattern has no NFA or literal
+// trie to search with
+static bool
+find_init (struct vibrex_iter *iter, const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch,
+           const char *text, size_t text_len)
+{
+  memset (iter, 0, sizeof (*iter));
+  iter->pattern  = pattern;
+  iter->nfa      = pattern->states ? pattern : pattern->nfa;
+  iter->trie     = literal_trie (pattern);
+  iter->scratch  = scratch;
+  iter->text     = text;
+  iter->text_len = text_len;
+  if (!iter->nfa && !iter->trie && pattern->engine != ENGINE_BOTH_ANCHORS)
+    return false;
+
+  // Matches that cannot be empty start with one of the first bytes
+  const MatchBounds *bounds = &pattern->bounds;
+  if (bounds->enabled && bounds->min_length > 0 && !bounds->anchored_start)
+  {
+    unsigned char idle[CHAR_CLASS_BYTES];
+    int count = 0;
+    for (int i = 0; i < CHAR_CLASS_BYTES; i++)
+      idle[i] = (unsigned char)~bounds->first_bytes[i];
+    for (int b = 0; b < TRANSITION_TABLE_SIZE; b++)
+      count += (bounds->first_bytes[b / 8] >> (b % 8)) & 1;
+    // Skipping pays off only while most bytes cannot start a match
+    if (count <= TRANSITION_TABLE_SIZE / 2)
+    {
+      byte_span_init (&iter->idle_span, idle);
+      iter->has_idle_span = true;
+    }
+  }
+  return true;
+}
+
+// Make room for count pending matches, at most PENDING_MATCHES_MAX
+static bool
+pending_reserve (struct vibrex_scratch *scratch, size_t count)
+{
+  if (count <= scratch->pending_capacity)
+    return true;
+  if (count > PENDING_MATCHES_MAX)
+    return false;
+
+  size_t capacity = scratch->pending_capacity ? scratch->pending_capacity * 2 : 16;
+  if (capacity > PENDING_MATCHES_MAX)
+    capacity = PENDING_MATCHES_MAX;
+  PendingMatch *pending = realloc (scratch->pending, capacity * sizeof (PendingMatch));
+  if (!pending)
+    return false;
+  scratch->pending          = pending;
+  scratch->pending_capacity = capacity;
+  return true;
+}
+
+// Reserve the scratch space a pass searches with, false if memory ran out
+static bool
+find_reserve (struct vibrex_iter *iter)
+{
+  return iter->trie || (scratch_reserve (iter->scratch, iter->nfa->nstate) && pending_reserve (iter->scratch, 1));
+}
+
+// Record a match an attempt of the simulation reached.  It extends the
+// pending match of its attempt, replaces the first one starting after it
+// or follows the last one; pending matches after it are dropped.  Returns
+// where the next match may start, or 0 when there is no room to follow.
+static inline size_t
+find_pending (struct vibrex_iter *iter, size_t start, size_t end)
+{
+  struct vibrex_scratch *scratch = iter->scratch;
+  size_t j                       = iter->pending_count;
+  if (j > iter->pending_head && scratch->pending[j - 1].start == start)
+  {
+    // Most matches extend the last one
+    scratch->pending[j - 1].end = end;
+    return end + (end == start ? 1 : 0);
+  }
+  while (j > iter->pending_head && scratch->pending[j - 1].start >= start)
+    j--;
+
+  if (j == iter->pending_count)
+  {
+    // Attempts not started since the simulation stopped could lead
+    if (iter->stopped)
+      return 0;
+    if (j == scratch->pending_capacity)
+    {
+      size_t head = iter->pending_head;
+      bool grown  = head < j / 2 && pending_reserve (scratch, j + 1);
+      if (!grown && head == 0)
+        return 0;
+      // Reported matches are dropped from the front instead
+      if (!grown)
+      {
+        memmove (scratch->pending, scratch->pending + head, (j - head) * sizeof (PendingMatch));
+        j -= head;
+        iter->pending_head = 0;
+      }
+    }
+  }
+
+  scratch->pending[j] = (PendingMatch){start, end};
+  iter->pending_count = j + 1;
+  return end + (end == start ? 1 : 0);
+}
+
+// Record the matches the states of the simulation from index first on end
+// at the position it has reached.  The lists are ordered by start, so the
+// attempts that start after a match and before the next one may start,
+// which can no longer be reported, follow the states of its own attempt.
+// Returns whether a state may have ended a match.
+static inline bool
+find_ends (struct vibrex_iter *iter, int first)
+{
+  const State *base  = iter->nfa->states;
+  State **states     = iter->clist.s;
+  size_t *cstarts    = iter->cstarts;
+  int n              = iter->clist.n;
+  size_t pos         = iter->pos;
+  bool at_end        = pos == iter->text_len;
+  size_t drop_after  = 0;
+  size_t drop_before = 0;
+
+  // Most positions end no match and keep every state
+  int kept = first;
+  while (kept < n && states[kept]->type != STATE_MATCH && (states[kept]->type != STATE_END_ANCHOR || !at_end))
+    kept++;
+  if (kept == n)
+    return false;
+
+  for (int i = kept; i < n; i++)
+  {
+    State *s     = states[i];
+    size_t start = cstarts[i];
+    if (start > drop_after && start < drop_before)
+      continue;
+    states[kept]    = s;
+    cstarts[kept++] = start;
+    if (!state_ends_match (iter->scratch, base, s, at_end))
+      continue;
+
+    // A match that cannot follow the pending ones and the attempts after
+    // it are found again when the simulation starts over
+    size_t next = find_pending (iter, start, pos);
+    if (next == 0)
+    {
+      iter->stopped = true;
+      kept--;
+      break;
+    }
+    drop_after  = start;
+    drop_before = next;
+  }
+  iter->clist.n = kept;
+  return true;
+}
+
+// Record the matches that end at the position the simulation has reached
+// and start an attempt there, first skipping to where one can start while
+// none is in progress
+static void
+find_at (struct vibrex_iter *iter)
+{
+  const struct vibrex_pattern *nfa = iter->nfa;
+  struct vibrex_scratch *scratch   = iter->scratch;
+  const State *base                = nfa->states;
+  List *clist                      = &iter->clist;
+  const char *text                 = iter->text;
+  size_t text_len                  = iter->text_len;
+  const MatchBounds *bounds        = &iter->pattern->bounds;
+  bool is_start_anchored           = (nfa->start && nfa->start->type == STATE_START_ANCHOR);
+  bool may_be_empty                = !bounds->enabled || bounds->min_length == 0;
+  bool attempt = !iter->stopped && (iter->pos == 0 || !is_start_anchored) && (iter->pos < text_len || may_be_empty);
+
+  if (attempt && clist->n == 0 && !is_start_anchored && (nfa->has_first_char || iter->has_idle_span))
+  {
+    const char *candidate;
+    if (nfa->prefix_search.enabled)
+      candidate = literal_searcher_find (&nfa->prefix_search, nfa->literal_prefix, nfa->prefix_len, text + iter->pos,
+                                         text_len - iter->pos);
+    else if (nfa->has_first_char)
+      candidate = memchr (text + iter->pos, nfa->first_char, text_len - iter->pos);
+    else
+      candidate = (const char *)byte_span (&iter->idle_span, (const unsigned char *)text + iter->pos,
+                                           (const unsigned char *)text + text_len);
+    if (!candidate || candidate == text + text_len)
+    {
+      iter->pos = text_len;
+      return;
+    }
+    iter->pos = candidate - text;
+  }
+
+  int n      = clist->n;
+  bool ended = find_ends (iter, 0);
+  if (!attempt || iter->stopped)
+    return;
+
+  // States dropped here stay marked, as does the way to them, and so do
+  // states that ended a match, which lead nowhere.  These are dropped and
+  // the others marked again, so the attempt starting here reaches in full
+  // the states the dropped attempts had and an empty match it can end.
+  int kept = clist->n;
+  if (kept < n || (ended && may_be_empty))
+  {
+    kept = 0;
+    for (int i = 0; i < clist->n; i++)
+    {
+      if (clist->s[i]->type == STATE_MATCH || clist->s[i]->type == STATE_END_ANCHOR)
+        continue;
+      clist->s[kept]        = clist->s[i];
+      iter->cstarts[kept++] = iter->cstarts[i];
+    }
+    clist->n = kept;
+    next_generation (scratch);
+    for (int i = 0; i < kept; i++)
+      scratch->marks[clist->s[i] - base] = scratch->listid;
+  }
+
+  // Matches that cannot be empty start with one of the first bytes, and
+  // inside a match the attempts in progress mostly have every state an
+  // attempt would add already
+  unsigned char c = iter->pos < text_len ? (unsigned char)text[iter->pos] : 0;
+  if ((!may_be_empty && !(bounds->first_bytes[c / 8] & (1 << (c % 8)))) ||
+      (nfa->start && scratch->marks[nfa->start - base] == scratch->listid))
+    return;
+  addstate_pos (scratch, base, clist, nfa->start, iter->pos == 0 ? 0 : -1);
+  for (int i = kept; i < clist->n; i++)
+    iter->cstarts[i] = iter->pos;
+  if (may_be_empty)
+    find_ends (iter, kept);
+}
+
+// Find where the next match of a pass can start, false if none can
+static bool
+find_from (struct vibrex_iter *iter, size_t *from_out)
+{
+  const MatchBounds *bounds = &iter->pattern->bounds;
+  size_t from               = iter->offset;
+  if (bounds->enabled && iter->text_len - from < bounds->min_length)
+    return false;
+
+  // Every match contains the required literal, so the next one starts no
+  // earlier than the longest match ending with the next occurrence of it
+  const RequiredLiterals *required = &iter->nfa->required;
+  if (required->enabled && required->set.count == 1 && !required->fold_case)
+  {
+    const char *literal = required->set.literals[0];
+    size_t literal_len  = required->set.lengths[0];
+    if (!iter->literal_valid || iter->literal_at < from)
+    {
+      const char *found = literal_searcher_find (&required->searcher, literal, literal_len, iter->text + from,
+                                                 iter->text_len - from);
+      if (!found)
+        return false;
+      iter->literal_at    = found - iter->text;
+      iter->literal_valid = true;
+    }
+    if (bounds->enabled && bounds->max_length != SIZE_MAX && iter->literal_at + literal_len > from + bounds->max_length)
+      from = iter->literal_at + literal_len - bounds->max_length;
+  }
+  *from_out = from;
+  return true;
+}
+
+// Start the eager simulation at from
+static void
+find_restart (struct vibrex_iter *iter, size_t from)
+{
+  struct vibrex_scratch *scratch = iter->scratch;
+  iter->scanning                 = true;
+  iter->stopped                  = false;
+  iter->pos                      = from;
+  iter->clist                    = (List){scratch->list1, 0};
+  iter->nlist                    = (List){scratch->list2, 0};
+  iter->cstarts                  = scratch->starts1;
+  iter->nstarts                  = scratch->starts2;
+  next_generation (scratch);
+}
+
+// Step the simulation over the byte at the position it has reached
+static void
+find_step (struct vibrex_iter *iter)
+{
+  struct vibrex_scratch *scratch   = iter->scratch;
+  const struct vibrex_pattern *nfa = iter->nfa;
+  List clist                       = iter->clist;
+  List nlist                       = {iter->nlist.s, 0};
+  size_t *cstarts                  = iter->cstarts;
+  size_t *nstarts                  = iter->nstarts;
+  unsigned char c                  = (unsigned char)iter->text[iter->pos++];
+
+  next_generation (scratch);
+  for (int i = 0; i < clist.n; i++)
+  {
+    const State *s = clist.s[i];
+    bool consumes  = (s->type == STATE_CHAR && s->data.c == c) || s->type == STATE_ANY ||
+                    (s->type == STATE_CLASS && (s->data.cclass[c / 8] & (1 << (c % 8))));
+    if (!consumes)
+      continue;
+    int n = nlist.n;
+    addstate_follow (scratch, nfa, &nlist, s);
+    for (int k = n; k < nlist.n; k++)
+      nstarts[k] = cstarts[i];
+  }
+
+  iter->clist   = nlist;
+  iter->nlist   = clist;
+  iter->cstarts = nstarts;
+  iter->nstarts = cstarts;
+}
+
+// Find the next match of a pass, leftmost-longest and not overlapping the
+// ones before it.  An empty match moves the next search on by one byte.
+// Each search runs on past its match until the attempts that could extend
+// or replace it end, and the next starts over after the match.  Before the
+// bytes stepped through again outnumber those the pass has come by, the
+// simulation turns eager until no attempt is in progress: it goes on
+// starting attempts, holding matches pending while an attempt that started
+// no later is in progress, so it never steps through a byte twice.
+static bool
+find_next (struct vibrex_iter *iter, size_t *match_start, size_t *match_end)
+{
+  const struct vibrex_pattern *pattern = iter->pattern;
+  const MatchBounds *bounds            = &pattern->bounds;
+  if (iter->done || iter->offset > iter->text_len)
+    return false;
+
+  // Most buffers without a match are rejected once by the boolean engines
+  if (!iter->started)
+  {
+    iter->started = true;
+    if (!match_internal (pattern, iter->scratch, iter->text, iter->text_len))
+    {
+      iter->done = true;
+      return false;
+    }
+    if (pattern->engine == ENGINE_BOTH_ANCHORS)
+    {
+      *match_start = 0;
+      *match_end   = iter->text_len;
+      iter->done   = true;
+      return true;
+    }
+    if (!find_reserve (iter))
+    {
+      iter->done = true;
+      return false;
+    }
+  }
+  else if (bounds->enabled && (bounds->anchored_start || iter->text_len - iter->offset < bounds->min_length))
+  {
+    iter->done = true;
+    return false;
+  }
+
+  // Literal engines run their trie from each position a literal begins at
+  if (iter->trie)
+  {
+    if (!dense_dfa_search_trie (iter->trie, iter->text, iter->text_len, iter->offset, pattern->dfa.anchored_start,
+                                pattern->dfa.anchored_end, match_start, match_end))
+    {
+      iter->done = true;
+      return false;
+    }
+    iter->offset = *match_end + (*match_end == *match_start ? 1 : 0);
+    return true;
+  }
+
+  const struct vibrex_pattern *nfa = iter->nfa;
+  bool is_start_anchored           = (nfa->start && nfa->start->type == STATE_START_ANCHOR);
+  while (true)
+  {
+    if (iter->scanning)
+    {
+      // The first pending match is reported once no attempt can replace it
+      if (iter->pending_head < iter->pending_count)
+      {
+        const PendingMatch *match = &iter->scratch->pending[iter->pending_head];
+        if (iter->clist.n == 0 || iter->cstarts[0] > match->start)
+        {
+          *match_start = match->start;
+          *match_end   = match->end;
+          iter->offset = match->end + (match->end == match->start ? 1 : 0);
+          if (++iter->pending_head == iter->pending_count)
+          {
+            iter->pending_head  = 0;
+            iter->pending_count = 0;
+            if (iter->stopped)
+              iter->scanning = false;
+          }
+          return true;
+        }
+      }
+
+      // At the end every attempt stops, leaving the pending matches final
+      if (iter->pos == iter->text_len || (iter->clist.n == 0 && (iter->stopped || is_start_anchored)))
+      {
+        if (iter->pending_head == iter->pending_count)
+        {
+          iter->done = true;
+          return false;
+        }
+        iter->clist.n = 0;
+        continue;
+      }
+
+      // Once every attempt has ended the prefilters find where to go on
+      find_step (iter);
+      if (iter->clist.n == 0 && iter->pending_head == iter->pending_count)
+      {
+        iter->offset   = iter->pos;
+        iter->eager    = false;
+        iter->scanning = false;
+      }
+    }
+
+    if (!iter->scanning)
+    {
+      size_t from, stop;
+      if (!find_from (iter, &from))
+      {
+        iter->done = true;
+        return false;
+      }
+
+      // The search runs on past a match at most as far again as the pass has
+      // come, less what it stepped through again before, else turns eager
+      if (!iter->eager)
+      {
+        size_t allowed = iter->offset + RESCAN_SLACK_BYTES;
+        size_t run_on  = allowed > iter->rescanned ? allowed - iter->rescanned : 0;
+        if (!nfa_search (iter->nfa, iter->scratch, iter->text, iter->text_len, from,
+                         iter->has_idle_span ? &iter->idle_span : NULL, run_on, &stop, match_start, match_end))
+        {
+          iter->done = true;
+          return false;
+        }
+        if (stop != SIZE_MAX)
+        {
+          iter->offset = *match_end + (*match_end == *match_start ? 1 : 0);
+          iter->rescanned += stop > iter->offset ? stop - iter->offset : 0;
+          return true;
+        }
+        iter->eager = true;
+      }
+      find_restart (iter, from);
+    }
+    find_at (iter);
+  }
+}
+
+// Start finding every match of a pattern in a buffer
+struct vibrex_iter *
+vibrex_find_iter (const struct vibrex_pattern *pattern, const char *text, size_t text_len)
+{
+  if (!pattern || !text)
+    return NULL;
+
+  struct vibrex_iter *iter = malloc (sizeof (struct vibrex_iter));
+  if (!iter)
+    return NULL;
+  struct vibrex_scratch *scratch = vibrex_scratch_create (pattern);
+  if (!scratch || !find_init (iter, pattern, scratch, text, text_len))
+  {
+    vibrex_scratch_free (scratch);
+    free (iter);
+    return NULL;
+  }
+  iter->owns_scratch = true;
+  return iter;
+}
+
+// Report the next match of a pass over a buffer
+bool
+vibrex_iter_next (struct vibrex_iter *iter, size_t *match_start, size_t *match_end)
+{
+  if (!iter)
+    return false;
+
+  size_t start, end;
+  return find_next (iter, match_start ? match_start : &start, match_end ? match_end : &end);
+}
+
+// Free an iterator and its scratch space
+void
+vibrex_iter_free (struct vibrex_iter *iter)
+{
+  if (!iter)
+    return;
+  if (iter->owns_scratch)
+    vibrex_scratch_free (iter->scratch);
+  free (iter);
+}
+
+// Count the matches of a pass over a buffer with the given scratch space
+static size_t
+count_internal (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text,
+                size_t text_len)
+{
+  struct vibrex_iter iter;
+  if (!find_init (&iter, pattern, scratch, text, text_len))
+    return 0;
+
+  size_t count = 0;
+  size_t start, end;
+  while (find_next (&iter, &start, &end))
+    count++;
+  return count;
+}
+
+// Count the non-overlapping matches of a pattern in a buffer
+size_t
+vibrex_count (const struct vibrex_pattern *pattern, const char *text, size_t text_len)
+{
+  if (!pattern || !text)
+    return 0;
+
+  // Claim the default scratch as vibrex_match_n() does
+  atomic_flag *busy = (atomic_flag *)&pattern->scratch_busy;
+  if (pattern->scratch && !atomic_flag_test_and_set_explicit (busy, memory_order_acquire))
+  {
+    size_t count = count_internal (pattern, pattern->scratch, text, text_len);
+    atomic_flag_clear_explicit (busy, memory_order_release);
+    return count;
+  }
+
+  // The pattern has no default scratch or another thread owns it
+  struct vibrex_scratch *scratch = vibrex_scratch_create (pattern);
+  if (!scratch)
+    return 0;
+  scratch->no_dfa_cache = true;
+  size_t count          = count_internal (pattern, scratch, text, text_len);
+  vibrex_scratch_free (scratch);
+  return count;
+}
+
+/********************************************************************************
+ * PARALLEL SCAN
+ ********************************************************************************/
+
+#ifndef VIBREX_NO_THREADS
+// How a buffer is cut into chunks whose matches can be found separately
+typedef enum
+{
+  SPLIT_NONE,    // Scanned on one thread
+  SPLIT_OVERLAP, // Each chunk is read on by the longest match less one byte
+  SPLIT_LINES    // Chunks end after a newline, which no match contains
+} SplitMode;
+
+// A piece of a buffer scanned by one thread.  Matches starting in [begin,
+// end) belong to it, and it is read on to view_end to finish those.
+typedef struct
+{
+  size_t begin;                       // First byte of the chunk
+  size_t end;                         // Just past its last byte
+  size_t view_end;                    // Just past the last byte read
+  size_t count;                       // Matches found searching from begin
+  size_t exit;                        // Where the search goes on after them, begin if none
+  size_t sync_count;                  // Entries in sync
+  size_t sync[PARALLEL_SYNC_OFFSETS]; // Where the search went on after each of the first matches
+} ScanChunk;
+
+// Work shared by the threads of a parallel scan
+typedef struct
+{
+  const struct vibrex_pattern *pattern; // Pattern searched for
+  const char *text;                     // Whole buffer
+  size_t text_len;                      // Bytes in the buffer
+  ScanChunk *chunks;                    // The buffer's chunks, in order
+  size_t chunk_count;                   // Number of chunks
+  bool count_matches;                   // Count every match rather than stop at the first
+  atomic_size_t next;                   // Next chunk to claim
+  atomic_bool found;                    // A chunk has a match, ending a boolean scan
+} ParallelScan;
+
+// Choose how a pattern's matches can be found in separate chunks.  Anchors
+// hold only at the ends of the whole buffer, so patterns with anchors are
+// scanned on one thread, as are patterns with unbounded matches that may
+// contain a newline.
+static SplitMode
+parallel_split_mode (const struct vibrex_pattern *pattern)
+{
+  const struct vibrex_pattern *nfa = pattern->states ? pattern : pattern->nfa;
+  if (!nfa)
+    return SPLIT_NONE;
+
+  bool newline = false;
+  for (int i = 0; i < nfa->nstate; i++)
+  {
+    const State *s = &nfa->states[i];
+    if (s->type == STATE_START_ANCHOR || s->type == STATE_END_ANCHOR)
+      return SPLIT_NONE;
+    if (s->type == STATE_ANY || (s->type == STATE_CHAR && s->data.c == '\n') ||
+        (s->type == STATE_CLASS && (s->data.cclass['\n' / 8] & (1 << ('\n' % 8)))))
+      newline = true;
+  }
+
+  if (pattern->bounds.enabled && pattern->bounds.max_length != SIZE_MAX)
+    return SPLIT_OVERLAP;
+  return newline ? SPLIT_NONE : SPLIT_LINES;
+}
+
+// Whether a match starting at an offset in a chunk's view belongs to it;
+// the last chunk also owns an empty match at the end of the buffer
+static inline bool
+chunk_owns (const ScanChunk *chunk, size_t text_len, size_t start)
+{
+  return chunk->begin + start < chunk->end || chunk->end == text_len;
+}
+
+// Count the matches a chunk owns, searching from its start, and record
+// where the search goes on after each of the first ones
+static void
+scan_chunk (const ParallelScan *scan, struct vibrex_scratch *scratch, ScanChunk *chunk)
+{
+  chunk->count      = 0;
+  chunk->exit       = chunk->begin;
+  chunk->sync_count = 0;
+
+  struct vibrex_iter iter;
+  if (!find_init (&iter, scan->pattern, scratch, scan->text + chunk->begin, chunk->view_end - chunk->begin))
+    return;
+
+  size_t start, end;
+  while (find_next (&iter, &start, &end) && chunk_owns (chunk, scan->text_len, start))
+  {
+    chunk->count++;
+    chunk->exit = chunk->begin + iter.offset;
+    if (chunk->sync_count < PARALLEL_SYNC_OFFSETS)
+      chunk->sync[chunk->sync_count++] = chunk->exit;
+  }
+}
+
+// Count the matches a chunk owns when the search enters it at entry, past
+// its start, because a match crossed into it.  Once this search goes on
+// from an offset the chunk's own search went on from, both find the same
+// matches from there.
+static size_t
+rescan_chunk (const ParallelScan *scan, struct vibrex_scratch *scratch, const ScanChunk *chunk, size_t entry,
+              size_t *exit)
+{
+  *exit = entry;
+  if (entry >= chunk->end && chunk->end != scan->text_len)
+    return 0;
+
+  struct vibrex_iter iter;
+  if (!find_init (&iter, scan->pattern, scratch, scan->text + chunk->begin, chunk->view_end - chunk->begin) ||
+      !find_reserve (&iter))
+    return 0;
+
+  // The chunk is known to have matches, skip the boolean engines
+  iter.offset  = entry - chunk->begin;
+  iter.started = true;
+
+  size_t count = 0;
+  size_t j     = 0;
+  size_t start, end;
+  while (true)
+  {
+    while (j < chunk->sync_count && chunk->sync[j] < *exit)
+      j++;
+    if (j < chunk->sync_count && chunk->sync[j] == *exit)
+    {
+      *exit = chunk->exit;
+      return count + chunk->count - (j + 1);
+    }
+    if (!find_next (&iter, &start, &end) || !chunk_owns (chunk, scan->text_len, start))
+      return count;
+    count++;
+    *exit = chunk->begin + iter.offset;
+  }
+}
+
+// Claim and scan chunks until none are left or a boolean scan has its match
+static void *
+parallel_worker (void *arg)
+{
+  ParallelScan *scan             = arg;
+  struct vibrex_scratch *scratch = vibrex_scratch_create (scan->pattern);
+  if (!scratch)
+    return NULL;
+
+  while (!atomic_load_explicit (&scan->found, memory_order_relaxed))
+  {
+    size_t k = atomic_fetch_add_explicit (&scan->next, 1, memory_order_relaxed);
+    if (k >= scan->chunk_count)
+      break;
+
+    ScanChunk *chunk = &scan->chunks[k];
+    if (scan->count_matches)
+      scan_chunk (scan, scratch, chunk);
+    else if (match_internal (scan->pattern, scratch, scan->text + chunk->begin, chunk->view_end - chunk->begin))
+      atomic_store_explicit (&scan->found, true, memory_order_relaxed);
+  }
+
+  vibrex_scratch_free (scratch);
+  return NULL;
+}
+
+// Scan a buffer in chunks on up to nthreads threads, counting its matches
+// or finding whether it has one.  Returns false when the buffer is to be
+// scanned on one thread instead.
+static bool
+parallel_scan (const struct vibrex_pattern *pattern, const char *text, size_t text_len, int nthreads,
+               bool count_matches, size_t *result)
+{
+  SplitMode mode = nthreads > 1 ? parallel_split_mode (pattern) : SPLIT_NONE;
+  if (mode == SPLIT_NONE || text_len / PARALLEL_MIN_CHUNK < 2)
+    return false;
+  if (nthreads > PARALLEL_MAX_THREADS)
+    nthreads = PARALLEL_MAX_THREADS;
+
+  size_t chunk_len = text_len / ((size_t)nthreads * PARALLEL_CHUNKS_PER_THREAD);
+  if (chunk_len < PARALLEL_MIN_CHUNK)
+    chunk_len = PARALLEL_MIN_CHUNK;
+
+  ParallelScan scan = {pattern, text, text_len, NULL, 0, count_matches, 0, false};
+  scan.chunks       = malloc ((text_len / chunk_len + 1) * sizeof (ScanChunk));
+  if (!scan.chunks)
+    return false;
+
+  // Matches that cross the end of a chunk are finished by reading on, or
+  // cannot cross a chunk that ends after a newline
+  size_t overlap = mode == SPLIT_OVERLAP && pattern->bounds.max_length > 0 ? pattern->bounds.max_length - 1 : 0;
+  for (size_t begin = 0; begin < text_len;)
+  {
+    size_t end = text_len - begin > chunk_len ? begin + chunk_len : text_len;
+    if (mode == SPLIT_LINES && end < text_len)
+    {
+      const char *newline = memchr (text + end - 1, '\n', text_len - end + 1);
+      end                 = newline ? (size_t)(newline - text) + 1 : text_len;
+    }
+    ScanChunk *chunk = &scan.chunks[scan.chunk_count++];
+    chunk->begin     = begin;
+    chunk->end       = end;
+    chunk->view_end  = text_len - end > overlap ? end + overlap : text_len;
+    begin            = end;
+  }
+  if (scan.chunk_count < 2)
+  {
+    free (scan.chunks);
+    return false;
+  }
+
+  // The calling thread is one of the workers
+  pthread_t threads[PARALLEL_MAX_THREADS];
+  int started = 0;
+  while (started < nthreads - 1 && (size_t)started + 1 < scan.chunk_count &&
+         pthread_create (&threads[started], NULL, parallel_worker, &scan) == 0)
+    started++;
+  parallel_worker (&scan);
+  for (int i = 0; i < started; i++)
+    pthread_join (threads[i], NULL);
+
+  // No worker could allocate its scratch space and claim a chunk
+  if (!atomic_load (&scan.found) && atomic_load (&scan.next) < scan.chunk_count)
+  {
+    free (scan.chunks);
+    return false;
+  }
+
+  if (!count_matches)
+  {
+    *result = atomic_load (&scan.found) ? 1 : 0;
+    free (scan.chunks);
+    return true;
+  }
+
+  // Merge the counts in order.  A chunk entered at its start counts what its
+  // own search found; where a match crossed into it, it is searched again
+  // from the end of that match until the two searches join.
+  struct vibrex_scratch *scratch = NULL;
+  size_t total                   = 0;
+  size_t pos                     = 0;
+  bool ok                        = true;
+  for (size_t k = 0; k < scan.chunk_count && ok; k++)
+  {
+    const ScanChunk *chunk = &scan.chunks[k];
+    if (pos <= chunk->begin)
+    {
+      total += chunk->count;
+      pos = chunk->exit;
+    }
+    else if ((ok = (scratch || (scratch = vibrex_scratch_create (pattern)))))
+      total += rescan_chunk (&scan, scratch, chunk, pos, &pos);
+  }
+  vibrex_scratch_free (scratch);
+  free (scan.chunks);
+  *result = total;
+  return ok;
+}
+#else
+// Built without threads, every buffer is scanned on the calling thread
+static bool
+parallel_scan (const struct vibrex_pattern *pattern, const char *text, size_t text_len, int nthreads,
+               bool count_matches, size_t *result)
+{
+  (void)pattern;
+  (void)text;
+  (void)text_len;
+  (void)nthreads;
+  (void)count_matches;
+  (void)result;
+  return false;
+}
+#endif
+
+// Find whether a buffer has a match, scanning chunks of it in parallel
+bool
+vibrex_match_parallel (const struct vibrex_pattern *pattern, const char *text, size_t text_len, int nthreads)
+{
+  if (!pattern || !text)
+    return false;
+
+  size_t found;
+  if (parallel_scan (pattern, text, text_len, nthreads, false, &found))
+    return found != 0;
+  return vibrex_match_n (pattern, text, text_len);
+}
+
+// Count the non-overlapping matches in a buffer, scanning chunks of it in parallel
+size_t
+vibrex_count_parallel (const struct vibrex_pattern *pattern, const char *text, size_t text_len, int nthreads)
+{
+  if (!pattern || !text)
+    return 0;
+
+  size_t count;
+  if (parallel_scan (pattern, text, text_len, nthreads, true, &count))
+    return count;
+  return vibrex_count (pattern, text, text_len);
+}
+
+/********************************************************************************
+ * PATTERN CACHE
+ ********************************************************************************/
+
+// A compiled pattern shared by a cache.  Entries are in the text table and
+// the LRU list while cached, and in the pattern table until the last
+// reference is released, so a pattern evicted while in use stays valid.
+typedef struct CacheEntry
+{
+  char *text;                     // Pattern text, the key
+  size_t text_len;                // Length of the pattern text
+  unsigned hash;                  // Hash of the pattern text
+  struct vibrex_pattern *pattern; // Compiled pattern
+  size_t bytes;                   // Memory charged to the cache budget
+  size_t refs;                    // References returned and not released
+  bool cached;                    // In the text table and the LRU list
+  struct CacheEntry *next_text;   // Next entry in the text bucket
+  struct CacheEntry *next_ptr;    // Next entry in the pattern bucket
+  struct CacheEntry *lru_prev;    // More recently used entry
+  struct CacheEntry *lru_next;    // Less recently used entry
+} CacheEntry;
+
+// Compiled patterns keyed by their text, evicted least recently used first
+struct vibrex_cache
+{
+  CacheEntry **by_text;    // Buckets of cached entries by text hash
+  CacheEntry **by_pattern; // Buckets of live entries by pattern address
+  size_t buckets;          // Buckets in each table, a power of two
+  size_t live;             // Entries in the pattern table
+  CacheEntry *lru_head;    // Most recently used cached entry
+  CacheEntry *lru_tail;    // Least recently used cached entry
+  size_t budget;           // Most bytes of cached patterns, 0 for no limit
+  size_t bytes;            // Bytes of cached patterns
+  size_t entries;          // Cached patterns
+  size_t hits;             // Lookups served from the cache
+  size_t misses;           // Lookups that compiled the pattern
+  size_t evictions;        // Patterns evicted to stay within the budget
+#ifndef VIBREX_NO_THREADS
+  pthread_mutex_t lock; // Held while the tables and list are changed
+#else
+  atomic_flag lock;     // Held while the tables and list are changed
+#endif
+};
+
+// FNV-1a hash of a pattern text
+static unsigned
+hash_pattern_text (const char *text, size_t len)
+{
+  unsigned hash = 2166136261u;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash ^= (unsigned char)text[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// Bucket of a pattern address in a table of the given size
+static inline size_t
+cache_pattern_bucket (const struct vibrex_pattern *pattern, size_t buckets)
+{
+  uintptr_t address = (uintptr_t)pattern;
+  return (size_t)((address >> 4) ^ (address >> 12)) & (buckets - 1);
+}
+
+// The lock is held for table and list updates, including growing the
+// tables, but never while compiling.  Threads waiting for it sleep, or
+// without pthreads give up the processor between attempts.
+static inline void
+cache_lock (struct vibrex_cache *cache)
+{
+#ifndef VIBREX_NO_THREADS
+  pthread_mutex_lock (&cache->lock);
+#else
+  while (atomic_flag_test_and_set_explicit (&cache->lock, memory_order_acquire))
+    sched_yield ();
+#endif
+}
+
+static inline void
+cache_unlock (struct vibrex_cache *cache)
+{
+#ifndef VIBREX_NO_THREADS
+  pthread_mutex_unlock (&cache->lock);
+#else
+  atomic_flag_clear_explicit (&cache->lock, memory_order_release);
+#endif
+}
+
+static void
+cache_lru_unlink (struct vibrex_cache *cache, CacheEntry *entry)
+{
+  if (entry->lru_prev)
+    entry->lru_prev->lru_next = entry->lru_next;
+  else
+    cache->lru_head = entry->lru_next;
+  if (entry->lru_next)
+    entry->lru_next->lru_prev = entry->lru_prev;
+  else
+    cache->lru_tail = entry->lru_prev;
+  entry->lru_prev = NULL;
+  entry->lru_next = NULL;
+}
+
+static void
+cache_lru_push (struct vibrex_cache *cache, CacheEntry *entry)
+{
+  entry->lru_next = cache->lru_head;
+  if (cache->lru_head)
+    cache->lru_head->lru_prev = entry;
+  cache->lru_head = entry;
+  if (!cache->lru_tail)
+    cache->lru_tail = entry;
+}
+
+// Find the cached entry of a pattern text
+static CacheEntry *
+cache_find_text (const struct vibrex_cache *cache, const char *text, size_t len, unsigned hash)
+{
+  for (CacheEntry *entry = cache->by_text[hash & (cache->buckets - 1)]; entry; entry = entry->next_text)
+  {
+    if (entry->hash == hash && entry->text_len == len && memcmp (entry->text, text, len) == 0)
+      return entry;
+  }
+  return NULL;
+}
+
+// Take an entry out of the text table, the LRU list and the budget
+static void
+cache_uncache (struct vibrex_cache *cache, CacheEntry *entry)
+{
+  CacheEntry **link = &cache->by_text[entry->hash & (cache->buckets - 1)];
+  while (*link != entry)
+    link = &(*link)->next_text;
+  *link = entry->next_text;
+  cache_lru_unlink (cache, entry);
+  entry->cached = false;
+  cache->bytes -= entry->bytes;
+  cache->entries--;
+}
+
+// Take an entry out of the pattern table, after which it can be freed
+static void
+cache_unlink_pattern (struct vibrex_cache *cache, CacheEntry *entry)
+{
+  CacheEntry **link = &cache->by_pattern[cache_pattern_bucket (entry->pattern, cache->buckets)];
+  while (*link != entry)
+    link = &(*link)->next_ptr;
+  *link = entry->next_ptr;
+  cache->live--;
+}
+
+// Double the buckets of both tables, false if out of memory
+static bool
+cache_grow (struct vibrex_cache *cache)
+{
+  size_t buckets          = cache->buckets * 2;
+  CacheEntry **by_text    = calloc (buckets, sizeof (CacheEntry *));
+  CacheEntry **by_pattern = calloc (buckets, sizeof (CacheEntry *));
+  if (!by_text || !by_pattern)
+  {
+    free (by_text);
+    free (by_pattern);
+    return false;
+  }
+
+  for (size_t b = 0; b < cache->buckets; b++)
+  {
+    for (CacheEntry *entry = cache->by_pattern[b], *next; entry; entry = next)
+    {
+      next = entry->next_ptr;
+      if (entry->cached)
+      {
+        size_t t         = entry->hash & (buckets - 1);
+        entry->next_text = by_text[t];
+        by_text[t]       = entry;
+      }
+      size_t p        = cache_pattern_bucket (entry->pattern, buckets);
+      entry->next_ptr = by_pattern[p];
+      by_pattern[p]   = entry;
+    }
+  }
+  free (cache->by_text);
+  free (cache->by_pattern);
+  cache->by_text    = by_text;
+  cache->by_pattern = by_pattern;
+  cache->buckets    = buckets;
+  return true;
+}
+
+static void
+cache_entry_free (CacheEntry *entry)
+{
+  vibrex_free (entry->pattern);
+  free (entry->text);
+  free (entry);
+}
+
+// Create a cache of compiled patterns
+struct vibrex_cache *
+vibrex_cache_create (size_t memory_budget)
+{
+  struct vibrex_cache *cache = calloc (1, sizeof (struct vibrex_cache));
+  if (!cache)
+    return NULL;
+#ifndef VIBREX_NO_THREADS
+  if (pthread_mutex_init (&cache->lock, NULL) != 0)
+  {
+    free (cache);
+    return NULL;
+  }
+#else
+  atomic_flag_clear (&cache->lock);
+#endif
+  cache->buckets    = CACHE_INITIAL_BUCKETS;
+  cache->budget     = memory_budget;
+  cache->by_text    = calloc (cache->buckets, sizeof (CacheEntry *));
+  cache->by_pattern = calloc (cache->buckets, sizeof (CacheEntry *));
+  if (!cache->by_text || !cache->by_pattern)
+  {
+    vibrex_cache_free (cache);
+    return NULL;
+  }
+  return cache;
+}
+
+// Return the compiled pattern of a text, compiling it on a miss
+const struct vibrex_pattern *
+vibrex_cache_get (struct vibrex_cache *cache, const char *pattern, const char **error_message)
+{
+  if (!cache || !pattern)
+  {
+    if (error_message)
+      *error_message = cache ? "NULL pattern" : "NULL cache";
+    return NULL;
+  }
+
+  size_t len    = strlen (pattern);
+  unsigned hash = hash_pattern_text (pattern, len);
+
+  cache_lock (cache);
+  CacheEntry *entry = cache_find_text (cache, pattern, len, hash);
+  if (entry)
+  {
+    entry->refs++;
+    cache->hits++;
+    cache_lru_unlink (cache, entry);
+    cache_lru_push (cache, entry);
+    cache_unlock (cache);
+    if (error_message)
+      *error_message = NULL;
+    return entry->pattern;
+  }
+  cache->misses++;
+  cache_unlock (cache);
+
+  // Compile outside the lock, other threads may compile the same text
+  struct vibrex_pattern *compiled = vibrex_compile (pattern, error_message);
+  if (!compiled)
+    return NULL;
+  CacheEntry *added = calloc (1, sizeof (CacheEntry));
+  char *text        = malloc (len + 1);
+  if (!added || !text)
+  {
+    free (added);
+    free (text);
+    vibrex_free (compiled);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+  memcpy (text, pattern, len + 1);
+  *added = (CacheEntry){.text     = text,
+                        .text_len = len,
+                        .hash     = hash,
+                        .pattern  = compiled,
+                        .bytes    = compiled->packed_size + sizeof (CacheEntry) + len + 1,
+                        .refs     = 1,
+                        .cached   = true};
+
+  CacheEntry *evicted = NULL;
+  cache_lock (cache);
+  entry = cache_find_text (cache, pattern, len, hash);
+  if (entry)
+  {
+    // Another thread cached the text first, share its pattern
+    entry->refs++;
+    cache_lru_unlink (cache, entry);
+    cache_lru_push (cache, entry);
+    cache_unlock (cache);
+    cache_entry_free (added);
+    if (error_message)
+      *error_message = NULL;
+    return entry->pattern;
+  }
+  if (cache->live >= cache->buckets && !cache_grow (cache))
+  {
+    cache_unlock (cache);
+    cache_entry_free (added);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+
+  size_t t             = hash & (cache->buckets - 1);
+  size_t p             = cache_pattern_bucket (compiled, cache->buckets);
+  added->next_text     = cache->by_text[t];
+  cache->by_text[t]    = added;
+  added->next_ptr      = cache->by_pattern[p];
+  cache->by_pattern[p] = added;
+  cache_lru_push (cache, added);
+  cache->live++;
+  cache->entries++;
+  cache->bytes += added->bytes;
+
+  // Evict the least recently used patterns beyond the budget, those still
+  // in use are freed when they are released
+  while (cache->budget && cache->bytes > cache->budget && cache->lru_tail)
+  {
+    CacheEntry *victim = cache->lru_tail;
+    cache_uncache (cache, victim);
+    cache->evictions++;
+    if (victim->refs == 0)
+    {
+      cache_unlink_pattern (cache, victim);
+      victim->lru_next = evicted;
+      evicted          = victim;
+    }
+  }
+  cache_unlock (cache);
+
+  while (evicted)
+  {
+    CacheEntry *next = evicted->lru_next;
+    cache_entry_free (evicted);
+    evicted = next;
+  }
+  return compiled;
+}
+
+// Release a pattern returned by vibrex_cache_get()
+void
+vibrex_cache_release (struct vibrex_cache *cache, const struct vibrex_pattern *pattern)
+{
+  if (!cache || !pattern)
+    return;
+
+  cache_lock (cache);
+  CacheEntry *entry = cache->by_pattern[cache_pattern_bucket (pattern, cache->buckets)];
+  while (entry && entry->pattern != pattern)
+    entry = entry->next_ptr;
+  if (!entry || entry->refs == 0)
+  {
+    cache_unlock (cache);
+    return;
+  }
+  entry->refs--;
+  bool free_entry = (entry->refs == 0 && !entry->cached);
+  if (free_entry)
+    cache_unlink_pattern (cache, entry);
+  cache_unlock (cache);
+
+  if (free_entry)
+    cache_entry_free (entry);
+}
+
+// Report the contents and use of a cache
+bool
+vibrex_cache_stats (struct vibrex_cache *cache, vibrex_cache_stats_t *stats)
+{
+  if (!cache || !stats)
+    return false;
+
+  cache_lock (cache);
+  stats->entries   = cache->entries;
+  stats->bytes     = cache->bytes;
+  stats->hits      = cache->hits;
+  stats->misses    = cache->misses;
+  stats->evictions = cache->evictions;
+  cache_unlock (cache);
+  return true;
+}
+
+// Free a cache and every pattern in it
+void
+vibrex_cache_free (struct vibrex_cache *cache)
+{
+  if (!cache)
+    return;
+
+  for (size_t b = 0; cache->by_pattern && b < cache->buckets; b++)
+  {
+    for (CacheEntry *entry = cache->by_pattern[b], *next; entry; entry = next)
+    {
+      next = entry->next_ptr;
+      cache_entry_free (entry);
+    }
+  }
+  free (cache->by_text);
+  free (cache->by_pattern);
+#ifndef VIBREX_NO_THREADS
+  pthread_mutex_destroy (&cache->lock);
+#endif
+  free (cache);
+}
+
+/********************************************************************************
+ * PATTERN SET ENGINE
+ ********************************************************************************/
+
+// Compile patterns into one NFA whose match states report the pattern they
+// belong to
+struct vibrex_set *
+vibrex_set_compile (const char **patterns, size_t count, const char **error_message)
+{
+  if (!patterns && count > 0)
+  {
+    if (error_message)
+      *error_message = "NULL pattern";
+    return NULL;
+  }
+
+  struct vibrex_set *set = calloc (1, sizeof (struct vibrex_set));
+  if (!set || !(set->starts = calloc (count ? count : 1, sizeof (State *))))
+  {
+    free (set);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+  set->count = count;
+  atomic_flag_clear (&set->scratch_busy);
+
+  // Parse each pattern once to validate it and size the merged NFA
+  for (size_t i = 0; i < count; i++)
+  {
+    if (!patterns[i] || strlen (patterns[i]) > MAX_PATTERN_LENGTH)
+    {
+      if (error_message)
+        *error_message = patterns[i] ? "Pattern too long (exceeds security limit)" : "NULL pattern";
+      vibrex_set_free (set);
+      return NULL;
+    }
+
+    State *states  = NULL;
+    int nstate     = 0;
+    State *start   = NULL;
+    char *expanded = NULL;
+    if (!expand_repetitions (patterns[i], &expanded, error_message) ||
+        !build_nfa (expanded ? expanded : patterns[i], 0, MAX_NFA_STATES, &states, &nstate, &start, error_message))
+    {
+      free (expanded);
+      vibrex_set_free (set);
+      return NULL;
+    }
+    free (expanded);
+    free (states);
+    set->nstate += nstate;
+  }
+
+  set->states = malloc ((set->nstate ? set->nstate : 1) * sizeof (State));
+  set->owner  = malloc ((set->nstate ? set->nstate : 1) * sizeof (int));
+  set->idle   = malloc ((set->nstate ? set->nstate : 1) * sizeof (int));
+  if (!set->states || !set->owner || !set->idle)
+  {
+    vibrex_set_free (set);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+
+  // Parse again and append each NFA to the merged one, rebasing transitions
+  int offset = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    State *states  = NULL;
+    int nstate     = 0;
+    State *start   = NULL;
+    char *expanded = NULL;
+    if (!expand_repetitions (patterns[i], &expanded, error_message) ||
+        !build_nfa (expanded ? expanded : patterns[i], 0, MAX_NFA_STATES, &states, &nstate, &start, error_message))
+    {
+      free (expanded);
+      vibrex_set_free (set);
+      return NULL;
+    }
+    free (expanded);
+
+    State *merged = set->states + offset;
+    for (int j = 0; j < nstate; j++)
+    {
+      merged[j]              = states[j];
+      merged[j].out          = states[j].out ? merged + (states[j].out - states) : NULL;
+      merged[j].out1         = states[j].out1 ? merged + (states[j].out1 - states) : NULL;
+      set->owner[offset + j] = (int)i;
+    }
+    set->starts[i] = merged + (start - states);
+    offset += nstate;
+    free (states);
+  }
+
+  set->scratch = vibrex_scratch_create (NULL);
+  if (!set->scratch || !scratch_reserve (set->scratch, set->nstate ? set->nstate : 1))
+  {
+    vibrex_set_free (set);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+
+  // Every pattern may begin a match at each position past the start of the
+  // text.  Rather than stepping these idle states after every byte, record
+  // the states they lead to on each byte class.
+  List l = {set->scratch->list1, 0};
+  next_generation (set->scratch);
+  for (size_t i = 0; i < count; i++)
+    addstate_pos (set->scratch, set->states, &l, set->starts[i], -1);
+  for (int j = 0; j < l.n; j++)
+    set->idle[j] = l.s[j] - set->states;
+  set->idle_count = l.n;
+
+  int num_classes      = compute_byte_classes (set->states, set->nstate, set->byte_class);
+  set->idle_next_start = malloc ((num_classes + 1) * sizeof (int));
+  if (!set->idle_next_start)
+  {
+    vibrex_set_free (set);
+    if (error_message)
+      *error_message = "Out of memory";
+    return NULL;
+  }
+
+  size_t used     = 0;
+  size_t capacity = 0;
+  for (int cls = 0; cls < num_classes; cls++)
+  {
+    int c = 0;
+    while (set->byte_class[c] != cls)
+      c++;
+
+    List next = {set->scratch->list2, 0};
+    next_generation (set->scratch);
+    for (int j = 0; j < set->idle_count; j++)
+    {
+      const State *s = &set->states[set->idle[j]];
+      if ((s->type == STATE_CHAR && s->data.c == c) || s->type == STATE_ANY ||
+          (s->type == STATE_CLASS && (s->data.cclass[c / 8] & (1 << (c % 8)))))
+        addstate_pos (set->scratch, set->states, &next, s->out, -1);
+    }
+
+    if (used + next.n > capacity)
+    {
+      size_t new_capacity = capacity ? capacity * 2 : 256;
+      while (new_capacity < used + next.n)
+        new_capacity *= 2;
+      int *idle_next = realloc (set->idle_next, new_capacity * sizeof (int));
+      if (!idle_next)
+      {
+        vibrex_set_free (set);
+        if (error_message)
+          *error_message = "Out of memory";
+        return NULL;
+      }
+      set->idle_next = idle_next;
+      capacity       = new_capacity;
+    }
+
+    set->idle_next_start[cls] = used;
+    for (int j = 0; j < next.n; j++)
+      set->idle_next[used++] = next.s[j] - set->states;
+  }
+  set->idle_next_start[num_classes] = used;
+
+  for (int b = 0; b < TRANSITION_TABLE_SIZE; b++)
+  {
+    int cls             = set->byte_class[b];
+    set->first_bytes[b] = set->idle_next_start[cls + 1] > set->idle_next_start[cls];
+  }
+
+  if (error_message)
+    *error_message = NULL;
+  return set;
+}
+
+// Record the patterns whose match states are in a list, returns the number
+// of newly matched patterns
+static size_t
+set_record_matches (const struct vibrex_set *set, const List *l, unsigned char *matches)
+{
+  size_t found = 0;
+  for (int i = 0; i < l->n; i++)
+  {
+    if (l->s[i]->type != STATE_MATCH)
+      continue;
+    int id = set->owner[l->s[i] - set->states];
+    if (!(matches[id / 8] & (1 << (id % 8))))
+    {
+      matches[id / 8] |= 1 << (id % 8);
+      found++;
+    }
+  }
+  return found;
+}
+
+// Run all patterns of a set over the text in a single pass
+static size_t
+set_match_internal (const struct vibrex_set *set, struct vibrex_scratch *scratch, const char *text, size_t text_len,
+                    unsigned char *matches)
+{
+  const State *base        = set->states;
+  const unsigned char *p   = (const unsigned char *)text;
+  const unsigned char *end = p + text_len;
+  List l1                  = {scratch->list1, 0};
+  List l2                  = {scratch->list2, 0};
+  List *clist              = &l1;
+  List *nlist              = &l2;
+  size_t matched           = 0;
+
+  memset (matches, 0, (set->count + 7) / 8);
+
+  next_generation (scratch);
+  for (size_t i = 0; i < set->count; i++)
+    addstate_pos (scratch, base, clist, set->starts[i], 0);
+  matched += set_record_matches (set, clist, matches);
+
+  while (p < end && matched < set->count)
+  {
+    // With no match attempt in progress, skip bytes that no pattern can
+    // begin with
+    if (clist->n == 0)
+    {
+      while (p < end && !set->first_bytes[*p])
+        p++;
+      if (p == end)
+        break;
+    }
+
+    // Step the states of patterns that have not matched yet, then start
+    // new attempts from the idle states
+    unsigned char c = *p++;
+    next_generation (scratch);
+    nlist->n = 0;
+    for (int i = 0; i < clist->n; i++)
+    {
+      State *s = clist->s[i];
+      int id   = set->owner[s - base];
+      if (matches[id / 8] & (1 << (id % 8)))
+        continue;
+
+      if ((s->type == STATE_CHAR && s->data.c == c) || s->type == STATE_ANY ||
+          (s->type == STATE_CLASS && (s->data.cclass[c / 8] & (1 << (c % 8)))))
+        addstate_pos (scratch, base, nlist, s->out, -1);
+    }
+
+    int cls = set->byte_class[c];
+    for (int i = set->idle_next_start[cls]; i < set->idle_next_start[cls + 1]; i++)
+    {
+      int index = set->idle_next[i];
+      int id    = set->owner[index];
+      if (!(matches[id / 8] & (1 << (id % 8))))
+        addstate_pos (scratch, base, nlist, &set->states[index], -1);
+    }
+    matched += set_record_matches (set, nlist, matches);
+
+    List *tmp = clist;
+    clist     = nlist;
+    nlist     = tmp;
+  }
+
+  // At the end of the text, end anchors in the current or idle states let
+  // the states behind them match
+  if (matched < set->count)
+  {
+    List l3 = {scratch->list3, 0};
+    next_generation (scratch);
+    for (int i = 0; i < clist->n; i++)
+    {
+      if (clist->s[i]->type == STATE_END_ANCHOR)
+        addstate_pos (scratch, base, &l3, clist->s[i]->out, -1);
+    }
+    for (int i = 0; i < set->idle_count; i++)
+    {
+      State *s = &set->states[set->idle[i]];
+      if (s->type == STATE_END_ANCHOR)
+        addstate_pos (scratch, base, &l3, s->out, -1);
+    }
+    for (int i = 0; i < l3.n; i++)
+    {
+      if (l3.s[i]->type == STATE_END_ANCHOR)
+        addstate_pos (scratch, base, &l3, l3.s[i]->out, -1);
+    }
+    matched += set_record_matches (set, &l3, matches);
+  }
+  return matched;
+}
+
+// Match a buffer against every pattern of a set
+size_t
+vibrex_set_match (const struct vibrex_set *set, const char *text, size_t text_len, unsigned char *matches)
+{
+  if (!set || !text || !matches)
+    return 0;
+
+  // Claim the default scratch without blocking, as vibrex_match_n() does
+  atomic_flag *busy = (atomic_flag *)&set->scratch_busy;
+  if (!atomic_flag_test_and_set_explicit (busy, memory_order_acquire))
+  {
+    size_t result = set_match_internal (set, set->scratch, text, text_len, matches);
+    atomic_flag_clear_explicit (busy, memory_order_release);
+    return result;
+  }
+
+  // Another thread owns the default scratch, use a temporary one
+  struct vibrex_scratch *scratch = vibrex_scratch_create (NULL);
+  if (!scratch || !scratch_reserve (scratch, set->nstate ? set->nstate : 1))
+  {
+    vibrex_scratch_free (scratch);
+    memset (matches, 0, (set->count + 7) / 8);
+    return 0;
+  }
+  size_t result = set_match_internal (set, scratch, text, text_len, matches);
+  vibrex_scratch_free (scratch);
+  return result;
+}
+
+// Number of patterns in a set
+size_t
+vibrex_set_size (const struct vibrex_set *set)
+{
+  return set ? set->count : 0;
+}
+
+// Free a pattern set
+void
+vibrex_set_free (struct vibrex_set *set)
+{
+  if (set)
+  {
+    free (set->states);
+    free (set->starts);
+    free (set->owner);
+    free (set->idle);
+    free (set->idle_next);
+    free (set->idle_next_start);
+    vibrex_scratch_free (set->scratch);
+    free (set);
+  }
+}
+
+/********************************************************************************
+ * DFA OPTIMIZATION ENGINE
+ ********************************************************************************/
+
+static bool
+can_compile_to_dfa (const char *pattern)
+{
+  if (!pattern)
+    return false;
+
+  int alternatives  = 1;
+  int start_anchors = 0;
+  int end_anchors   = 0;
+  bool alt_start    = true;
+  for (const char *p = pattern; *p; p++)
+  {
+    char c        = *p;
+    bool at_start = alt_start;
+    alt_start     = false;
+    if (c == '^' && at_start)
+    {
+      start_anchors++;
+    }
+    else if (c == '$' && (p[1] == '\0' || p[1] == '|'))
+    {
+      end_anchors++;
+    }
+    else if (c == '\\')
+    {
+      p++;
+      if (!*p)
+        return false;
+    }
+    else if (strchr ("*+?.[(){^$", c))
+    {
+      // Anchors are only understood at the start and end of alternatives
+      return false;
+    }
+    else if (c == '|')
+    {
+      alternatives++;
+      alt_start = true;
+    }
+  }
+
+  // Anchors must hold for every alternative.  Several alternatives anchored
+  // at both ends are left to the alternation engine, which compares their
+  // common prefix and suffix once.
+  if ((start_anchors != 0 && start_anchors != alternatives) || (end_anchors != 0 && end_anchors != alternatives))
+    return false;
+  return alternatives == 1 || start_anchors == 0 || end_anchors == 0;
+}
+
+// Compile a literal or a top-level alternation of literals, like ^abc$ or
+// cat$|dog$, into a dense DFA: a trie when anchored at the start, otherwise an
+// Aho-Corasick automaton that searches in a single pass
+static bool
+compile_literals_to_dfa (struct vibrex_pattern *compiled, const char *pattern)
+{
+  if (!pattern)
+    return false;
+
+  // can_compile_to_dfa() checked every alternative has the same anchors
+  DFA *dfa            = &compiled->dfa;
+  const char *p       = pattern;
+  size_t pat_len      = strlen (p);
+  dfa->anchored_start = (*p == '^');
+  dfa->anchored_end   = false;
+
+  // Split on unescaped '|', drop the anchors and resolve escapes
+  char *buffer = malloc (pat_len + 1);
+  if (!buffer)
+    return false;
+
+  LiteralSet set = {0};
+  size_t len     = 0;
+  bool ok        = true;
+  bool alt_start = true;
+  for (size_t i = 0; ok; i++)
+  {
+    if (i == pat_len || p[i] == '|')
+    {
+      // Security check: limit alternations to prevent DoS
+      ok        = literal_set_add (&set, buffer, len);
+      len       = 0;
+      alt_start = true;
+      if (i == pat_len)
+        break;
+      continue;
+    }
+    bool at_start = alt_start;
+    alt_start     = false;
+    if (p[i] == '^' && at_start)
+      continue;
+    if (p[i] == '$' && (i + 1 == pat_len || p[i + 1] == '|'))
+    {
+      dfa->anchored_end = true;
+      continue;
+    }
+    if (p[i] == '\\' && i + 1 < pat_len)
+      i++;
+    buffer[len++] = p[i];
+  }
+  free (buffer);
+
+  // Without a table budget the dense DFA is never larger than the pattern
+  // length times the byte classes in use
+  bool icase = (compiled->flags & VIBREX_ICASE) != 0;
+  if (ok)
+    ok = dense_dfa_build (&dfa->automaton, set.literals, set.lengths, set.count, dfa->anchored_start, icase,
+                          SIZE_MAX);
+
+  // The Aho-Corasick automaton finds that a literal ends somewhere, not
+  // where it starts; without the trie searches run the NFA
+  if (ok && !dfa->anchored_start && !compiled->nested)
+    dense_dfa_build (&dfa->trie, set.literals, set.lengths, set.count, true, icase, SIZE_MAX);
+  literal_set_free (&set);
+  if (!ok)
+    return false;
+
+  dfa->enabled = true;
+  return true;
+}
+
+static bool
+dfa_match (const DFA *dfa, const char *text, size_t text_len)
+{
+  if (!dfa->enabled || !text)
+    return false;
+
+  if (dfa->anchored_start)
+    return dense_dfa_match_anchored (&dfa->automaton, text, text_len, dfa->anchored_end);
+
+  return dense_dfa_search (&dfa->automaton, text, text_len, dfa->anchored_end);
+}
+
+static void
+free_dfa (DFA *dfa)
+{
+  if (dfa)
+  {
+    dense_dfa_free (&dfa->automaton);
+    dense_dfa_free (&dfa->trie);
+    dfa->enabled = false;
+  }
+}
+
+/********************************************************************************
+ * BOTH ANCHORS OPTIMIZATION ENGINE
+ ********************************************************************************/
+
+// Check if pattern is of the form ^prefix.*suffix$
+static bool
+can_use_both_anchors_opt (const char *pattern)
+{
+  if (!pattern)
+    return false;
 
   size_t len = strlen (pattern);
 
-  // Must start with ^ and end with $
-  if (len < 3 || pattern[0] != '^' || pattern[len - 1] != '$')
+  // Must start with ^ and end with $
+  if (len < 3 || pattern[0] != '^' || pattern[len - 1] != '$')
+    return false;
+
+  // Find .* in the middle
+  const char *dotstar = strstr (pattern + 1, ".*");
+  if (!dotstar)
+    return false;
+
+  // Check that .* appears only once and is followed by suffix then $
+  const char *second_dotstar = strstr (dotstar + 2, ".*");
+  if (second_dotstar)
+    return false;
+
+  // Must have some prefix before .* and some suffix after .*
+  size_t prefix_len = dotstar - (pattern + 1);
+  size_t suffix_len = (pattern + len - 1) - (dotstar + 2);
+
+  // Both prefix and suffix must be non-empty for meaningful optimization
+  if (prefix_len == 0 || suffix_len == 0)
+    return false;
+
+  // Check that prefix and suffix contain only literal characters (no regex metacharacters)
+  for (size_t i = 1; i <= prefix_len; i++)
+  {
+    if (strchr (".?*+[]()|\\", pattern[i]))
+      return false;
+  }
+
+  for (size_t i = dotstar + 2 - pattern; i < len - 1; i++)
+  {
+    if (strchr (".?*+[]()|\\", pattern[i]))
+      return false;
+  }
+
+  return true;
+}
+
+// Compile both anchors optimization
+static bool
+compile_both_anchors_opt (struct vibrex_pattern *compiled, const char *pattern)
+{
+  if (!can_use_both_anchors_opt (pattern))
+    return false;
+
+  size_t len          = strlen (pattern);
+  const char *dotstar = strstr (pattern + 1, ".*");
+
+  size_t prefix_len = dotstar - (pattern + 1);
+  size_t suffix_len = (pattern + len - 1) - (dotstar + 2);
+
+  // Allocate and copy prefix
+  compiled->both_anchors.prefix = malloc (prefix_len + 1);
+  if (!compiled->both_anchors.prefix)
+    return false;
+
+  memcpy (compiled->both_anchors.prefix, pattern + 1, prefix_len);
+  compiled->both_anchors.prefix[prefix_len] = '\0';
+  compiled->both_anchors.prefix_len         = prefix_len;
+
+  // Allocate and copy suffix
+  compiled->both_anchors.suffix = malloc (suffix_len + 1);
+  if (!compiled->both_anchors.suffix)
+  {
+    free (compiled->both_anchors.prefix);
+    return false;
+  }
+
+  memcpy (compiled->both_anchors.suffix, dotstar + 2, suffix_len);
+  compiled->both_anchors.suffix[suffix_len] = '\0';
+  compiled->both_anchors.suffix_len         = suffix_len;
+
+  compiled->both_anchors.fold_case = (compiled->flags & VIBREX_ICASE) != 0;
+  compiled->both_anchors.enabled   = true;
+  return true;
+}
+
+// Match using both anchors optimization - ultra-simple approach!
+static bool
+match_with_both_anchors_opt (const struct vibrex_pattern *pattern, const char *text, size_t text_len)
+{
+  if (!pattern->both_anchors.enabled || !text)
+    return false;
+
+  const BothAnchorsOpt *opt = &pattern->both_anchors;
+
+  // Check if text is long enough to contain both prefix and suffix
+  if (text_len < opt->prefix_len + opt->suffix_len)
+    return false;
+
+  // Check prefix at start and suffix at end
+  if (opt->fold_case)
+    return equal_fold_case (text, opt->prefix, opt->prefix_len) &&
+           equal_fold_case (text + text_len - opt->suffix_len, opt->suffix, opt->suffix_len);
+  if (memcmp (text, opt->prefix, opt->prefix_len) != 0)
+    return false;
+
+  return (memcmp (text + text_len - opt->suffix_len, opt->suffix, opt->suffix_len) == 0);
+}
+
+// Free both anchors optimization data
+static void
+free_both_anchors_opt (BothAnchorsOpt *both_anchors)
+{
+  if (both_anchors)
+  {
+    free (both_anchors->prefix);
+    free (both_anchors->suffix);
+    memset (both_anchors, 0, sizeof (*both_anchors));
+  }
+}
+
+/********************************************************************************
+ * URL PATTERN OPTIMIZATION ENGINE
+ ********************************************************************************/
+
+// Check if pattern is of the form https?://[char-class]+
+static bool
+can_use_url_pattern_opt (const char *pattern)
+{
+  if (!pattern)
+    return false;
+
+  // Must start with "http"
+  if (strncmp (pattern, "http", 4) != 0)
+    return false;
+
+  const char *p = pattern + 4;
+
+  // Check for optional 's'
+  if (*p == 's')
+  {
+    // Must be followed by '?'
+    if (*(p + 1) != '?')
+      return false;
+    p += 2;
+  }
+
+  // Must be followed by "://"
+  if (strncmp (p, "://", 3) != 0)
+    return false;
+  p += 3;
+
+  // Must be followed by character class
+  if (*p != '[')
+    return false;
+  p++;
+
+  // Skip to end of character class
+  while (*p && *p != ']')
+    p++;
+
+  if (*p != ']')
+    return false;
+  p++;
+
+  // Must be followed by '+'
+  if (*p != '+')
+    return false;
+  p++;
+
+  // Must be end of pattern
+  return (*p == '\0');
+}
+
+// Compile URL pattern optimization
+static bool
+compile_url_pattern_opt (struct vibrex_pattern *compiled, const char *pattern)
+{
+  if (!can_use_url_pattern_opt (pattern))
+    return false;
+
+  // Initialize character lookup table to all false
+  memset (compiled->url_pattern.char_table, 0, sizeof (compiled->url_pattern.char_table));
+
+  // Find the character class
+  const char *class_start = strchr (pattern, '[');
+  if (!class_start)
+    return false;
+  class_start++; // skip '['
+
+  const char *class_end = strchr (class_start, ']');
+  if (!class_end)
+    return false;
+
+  // Parse character class and populate lookup table
+  const char *p = class_start;
+  while (p < class_end)
+  {
+    unsigned char start = *p++;
+    unsigned char end   = start;
+
+    // Check for range (e.g., a-z)
+    if (p < class_end - 1 && *p == '-')
+    {
+      p++; // skip '-'
+      end = *p++;
+      if (end < start)
+        return false;
+    }
+
+    // Set bits for this range
+    for (unsigned char ch = start; ch <= end; ch++)
+    {
+      compiled->url_pattern.char_table[ch] = 1;
+      if (ch == 255)
+        break; // Prevent overflow
+    }
+  }
+
+  compiled->url_pattern.enabled = true;
+  return true;
+}
+
+// Match using URL pattern optimization - very fast!
+static bool
+match_with_url_pattern_opt (const struct vibrex_pattern *pattern, const char *text, size_t text_len)
+{
+  if (!pattern->url_pattern.enabled || !text)
+    return false;
+
+  const char *p                   = text;
+  const char *text_end            = text + text_len;
+  const unsigned char *char_table = pattern->url_pattern.char_table;
+
+  // Search for "http" in the text
+  while ((p = find_literal (p, text_end - p, "http", 4)) != NULL)
+  {
+    const char *url_start = p;
+    p += 4; // skip "http"
+
+    // Check for optional 's'
+    if (p < text_end && *p == 's')
+      p++;
+
+    // Must be followed by "://" and at least one character from the allowed class
+    if (text_end - p < 4 || memcmp (p, "://", 3) != 0 || !char_table[(unsigned char)p[3]])
+    {
+      p = url_start + 1; // Try next position
+      continue;
+    }
+
+    // Found a match!
+    return true;
+  }
+
+  return false;
+}
+
+// Free URL pattern optimization data
+static void
+free_url_pattern_opt (UrlPatternOpt *url_pattern)
+{
+  if (url_pattern)
+  {
+    url_pattern->enabled = false;
+  }
+}
+
+/********************************************************************************
+ * DENSE DFA TABLES
+ ********************************************************************************/
+
+// Turn a trie into an Aho-Corasick automaton: compute failure links breadth
+// first and fold them into the missing transitions (-1, state 0 is the root)
+static bool
+dense_dfa_link (int32_t *next, unsigned char *accept, int num_states, int num_classes)
+{
+  int32_t *fail  = malloc (num_states * sizeof (int32_t));
+  int32_t *queue = malloc (num_states * sizeof (int32_t));
+  if (!fail || !queue)
+  {
+    free (fail);
+    free (queue);
+    return false;
+  }
+
+  int head = 0;
+  int tail = 0;
+  for (int c = 0; c < num_classes; c++)
+  {
+    if (next[c] < 0)
+    {
+      next[c] = 0;
+    }
+    else
+    {
+      fail[next[c]] = 0;
+      queue[tail++] = next[c];
+    }
+  }
+  while (head < tail)
+  {
+    int u         = queue[head++];
+    int32_t *row  = &next[(size_t)u * num_classes];
+    int32_t *frow = &next[(size_t)fail[u] * num_classes];
+    accept[u] |= accept[fail[u]];
+    for (int c = 0; c < num_classes; c++)
+    {
+      if (row[c] < 0)
+      {
+        row[c] = frow[c];
+      }
+      else
+      {
+        fail[row[c]]  = frow[c];
+        queue[tail++] = row[c];
+      }
+    }
+  }
+  free (fail);
+  free (queue);
+  return true;
+}
+
+// Minimize a trie by merging the states with the same transitions and
+// acceptance, so literals with a common ending, such as the channel codes of
+// station selectors, share the states of that ending.  A trie is acyclic and
+// children always have higher indexes than their parents, so one pass from
+// the last state back visits every child before its parent and finds the
+// minimal DFA.  The remaining states are renumbered in their original order,
+// keeping the root at 0.  The number of states is updated in place.
+static bool
+dense_dfa_minimize (int32_t *next, unsigned char *accept, int *num_states, int num_classes)
+{
+  int n           = *num_states;
+  size_t buckets  = 1;
+  while (buckets < (size_t)n * 2)
+    buckets <<= 1;
+  int32_t *canon  = malloc (n * sizeof (int32_t));
+  int32_t *bucket = malloc (buckets * sizeof (int32_t));
+  if (!canon || !bucket)
+  {
+    free (canon);
+    free (bucket);
     return false;
+  }
+  memset (bucket, 0xff, buckets * sizeof (int32_t));
 
-  // Find .* in the middle
-  const char *dotstar = strstr (pattern + 1, ".*");
-  if (!dotstar)
+  for (int i = n - 1; i >= 0; i--)
+  {
+    int32_t *row  = &next[(size_t)i * num_classes];
+    uint32_t hash = 2166136261u ^ accept[i];
+    for (int c = 0; c < num_classes; c++)
+    {
+      if (row[c] >= 0)
+        row[c] = canon[row[c]];
+      hash = (hash ^ (uint32_t)row[c]) * 16777619u;
+    }
+
+    size_t h = hash & (buckets - 1);
+    while (bucket[h] >= 0)
+    {
+      int32_t other = bucket[h];
+      if (accept[other] == accept[i] &&
+          memcmp (&next[(size_t)other * num_classes], row, num_classes * sizeof (int32_t)) == 0)
+        break;
+      h = (h + 1) & (buckets - 1);
+    }
+    if (bucket[h] < 0)
+      bucket[h] = i;
+    canon[i] = bucket[h];
+  }
+
+  // Number the distinct states, reusing the buckets to hold the numbers
+  int32_t *number = bucket;
+  int count       = 0;
+  for (int i = 0; i < n; i++)
+    number[i] = canon[i] == i ? count++ : -1;
+
+  // Move the rows up, a state only moves to its own row or the row of a
+  // state already moved, so every row is read before it is overwritten
+  for (int i = 0; i < n; i++)
+  {
+    if (number[i] < 0)
+      continue;
+    int32_t *row = &next[(size_t)i * num_classes];
+    int32_t *dst = &next[(size_t)number[i] * num_classes];
+    for (int c = 0; c < num_classes; c++)
+      dst[c] = row[c] >= 0 ? number[row[c]] : -1;
+    accept[number[i]] = accept[i];
+  }
+  *num_states = count;
+
+  free (canon);
+  free (bucket);
+  return true;
+}
+
+// Build a dense DFA for a set of literals.  Anchored DFAs are minimized tries
+// that die on a missing transition; unanchored ones are Aho-Corasick automata
+// that find any literal in a single pass.  With fold_case both cases of a
+// letter share a byte class, so the automaton ignores case at no cost.
+// Returns false, leaving the DFA disabled, if the table would exceed max_bytes.
+static bool
+dense_dfa_build (DenseDFA *dfa, char *const *literals, const size_t *lengths, size_t count,
+                 bool anchored, bool fold_case, size_t max_bytes)
+{
+  memset (dfa, 0, sizeof (*dfa));
+
+  // Bytes that appear in no literal share byte class 0
+  size_t total_len = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    for (size_t j = 0; j < lengths[i]; j++)
+    {
+      unsigned char c = (unsigned char)literals[i][j];
+      dfa->classmap[fold_case && c >= 'A' && c <= 'Z' ? other_case (c) : c] = 1;
+    }
+    total_len += lengths[i];
+  }
+  int num_classes = 1;
+  for (int b = 0; b < TRANSITION_TABLE_SIZE; b++)
+  {
+    if (dfa->classmap[b])
+      dfa->classmap[b] = num_classes++;
+  }
+  if (fold_case)
+  {
+    for (int b = 'A'; b <= 'Z'; b++)
+      dfa->classmap[b] = dfa->classmap[other_case (b)];
+  }
+
+  // Anchored tries need one extra row for the dead state
+  size_t max_states = total_len + 1;
+  size_t rows       = max_states + (anchored ? 1 : 0);
+  if (rows * num_classes > DENSE_DFA_ROW_MASK || rows * num_classes * sizeof (uint32_t) > max_bytes)
     return false;
 
-  // Check that .* appears only once and is followed by suffix then $
-  const char *second_dotstar = strstr (dotstar + 2, ".*");
-  if (second_dotstar)
+  int32_t *next         = malloc (max_states * num_classes * sizeof (int32_t));
+  unsigned char *accept = calloc (max_states, 1);
+  if (!next || !accept)
+  {
+    free (next);
+    free (accept);
     return false;
+  }
+  memset (next, 0xff, max_states * num_classes * sizeof (int32_t));
 
-  // Must have some prefix before .* and some suffix after .*
-  size_t prefix_len = dotstar - (pattern + 1);
-  size_t suffix_len = (pattern + len - 1) - (dotstar + 2);
+  // Insert the literals into a trie
+  int num_states = 1;
+  for (size_t i = 0; i < count; i++)
+  {
+    int s = 0;
+    for (size_t j = 0; j < lengths[i]; j++)
+    {
+      int32_t *entry = &next[(size_t)s * num_classes + dfa->classmap[(unsigned char)literals[i][j]]];
+      if (*entry < 0)
+        *entry = num_states++;
+      s = *entry;
+    }
+    accept[s] = 1;
+  }
 
-  // Both prefix and suffix must be non-empty for meaningful optimization
-  if (prefix_len == 0 || suffix_len == 0)
+  if (anchored ? !dense_dfa_minimize (next, accept, &num_states, num_classes)
+               : !dense_dfa_link (next, accept, num_states, num_classes))
+  {
+    free (next);
+    free (accept);
     return false;
+  }
 
-  // Check that prefix and suffix contain only literal characters (no regex metacharacters)
-  for (size_t i = 1; i <= prefix_len; i++)
+  // Pack the transitions as premultiplied row offsets, anchored tries shift
+  // every state down one row to make room for the dead state at row 0
+  int shift      = anchored ? 1 : 0;
+  size_t entries = (size_t)(num_states + shift) * num_classes;
+  dfa->table     = calloc (entries, sizeof (uint32_t));
+  if (!dfa->table)
   {
-    if (strchr (".?*+[]()|\\", pattern[i]))
+    free (next);
+    free (accept);
+    return false;
+  }
+  for (int i = 0; i < num_states; i++)
+  {
+    uint32_t *row = &dfa->table[(size_t)(i + shift) * num_classes];
+    for (int c = 0; c < num_classes; c++)
+    {
+      int32_t target = next[(size_t)i * num_classes + c];
+      if (target >= 0)
+        row[c] = (uint32_t)(target + shift) * num_classes | (accept[target] ? DENSE_DFA_FINAL : 0);
+    }
+  }
+  dfa->start = (uint32_t)shift * num_classes | (accept[0] ? DENSE_DFA_FINAL : 0);
+
+  // Record the bytes that leave the start state, to skip over all others
+  unsigned char idle[TRANSITION_TABLE_SIZE / 8] = {0};
+  for (int b = 0; b < TRANSITION_TABLE_SIZE; b++)
+  {
+    int32_t target = next[dfa->classmap[b]];
+    if (target > 0)
+    {
+      if (dfa->start_count < 3)
+        dfa->start_set[dfa->start_count] = b;
+      dfa->start_count++;
+    }
+    else
+      idle[b / 8] |= 1 << (b % 8);
+  }
+  byte_span_init (&dfa->idle, idle);
+
+  // With few distinct two-byte prefixes, skipping to the next pair filters
+  // out far more bytes than skipping to a starting byte.  The pairs are
+  // compared byte for byte, so they are not used when case is folded.
+  if (!anchored && !fold_case)
+  {
+    for (size_t i = 0; i < count && dfa->pair_count >= 0; i++)
+    {
+      if (lengths[i] < 2)
+      {
+        dfa->pair_count = -1;
+        break;
+      }
+      int k = 0;
+      while (k < dfa->pair_count && memcmp (dfa->start_pairs[k], literals[i], 2) != 0)
+        k++;
+      if (k == dfa->pair_count)
+      {
+        if (k == DENSE_DFA_MAX_PAIRS)
+          dfa->pair_count = -1;
+        else
+        {
+          memcpy (dfa->start_pairs[k], literals[i], 2);
+          dfa->pair_count++;
+        }
+      }
+    }
+    if (dfa->pair_count < 0)
+      dfa->pair_count = 0;
+    if (dfa->pair_count == 1)
+      literal_searcher_init (&dfa->pair_search, (const char *)dfa->start_pairs[0], 2);
+  }
+
+  free (next);
+  free (accept);
+  dfa->num_classes = num_classes;
+  dfa->num_states  = num_states + shift;
+  dfa->anchored    = anchored;
+  dfa->enabled     = true;
+  return true;
+}
+
+// Check whether any literal of an unanchored dense DFA occurs in text, or
+// with at_end whether the text ends with one
+static bool
+dense_dfa_search (const DenseDFA *dfa, const char *text, size_t text_len, bool at_end)
+{
+  const uint32_t *table         = dfa->table;
+  const unsigned char *classmap = dfa->classmap;
+  const unsigned char *p        = (const unsigned char *)text;
+  const unsigned char *end      = p + text_len;
+  uint32_t s                    = dfa->start;
+
+  if (s & DENSE_DFA_FINAL)
+    return true;
+
+  while (p < end)
+  {
+    // In the root state no match is in progress, skip to the next byte
+    // that begins a literal
+    if (s == 0)
+    {
+      if (dfa->pair_count == 1)
+      {
+        p = (const unsigned char *)literal_searcher_find (&dfa->pair_search, (const char *)dfa->start_pairs[0], 2,
+                                                          (const char *)p, end - p);
+        if (!p)
+          return false;
+      }
+      else if (dfa->pair_count > 0)
+      {
+        p = find_pair_of (p, end, dfa->start_pairs, dfa->pair_count);
+        if (!p)
+          return false;
+      }
+      else if (dfa->start_count <= 3)
+      {
+        p = find_byte_of (p, end, dfa->start_set, dfa->start_count);
+        if (!p)
+          return false;
+      }
+      else
+      {
+        p = byte_span (&dfa->idle, p, end);
+        if (p == end)
+          return false;
+      }
+    }
+
+    s = table[(s & DENSE_DFA_ROW_MASK) + classmap[*p++]];
+    if ((s & DENSE_DFA_FINAL) && !at_end)
+      return true;
+  }
+  return (s & DENSE_DFA_FINAL) != 0;
+}
+
+// Match an anchored dense DFA at the start of text, with at_end the whole
+// text must be consumed
+static bool
+dense_dfa_match_anchored (const DenseDFA *dfa, const char *text, size_t text_len, bool at_end)
+{
+  const uint32_t *table         = dfa->table;
+  const unsigned char *classmap = dfa->classmap;
+  const unsigned char *p        = (const unsigned char *)text;
+  const unsigned char *end      = p + text_len;
+  uint32_t s                    = dfa->start;
+
+  if ((s & DENSE_DFA_FINAL) && !at_end)
+    return true;
+
+  while (p < end)
+  {
+    s = table[(s & DENSE_DFA_ROW_MASK) + classmap[*p++]];
+    if (s == 0)
+      return false;
+    if ((s & DENSE_DFA_FINAL) && !at_end)
+      return true;
+  }
+  return (s & DENSE_DFA_FINAL) != 0;
+}
+
+// Find the leftmost-longest match of the literals of an anchored dense DFA
+// starting at or after from, by running the trie from each position a
+// literal begins at.  With anchored_start matches start at the text start,
+// with anchored_end they end at the text end.
+static bool
+dense_dfa_search_trie (const DenseDFA *dfa, const char *text, size_t text_len, size_t from, bool anchored_start,
+                       bool anchored_end, size_t *match_start, size_t *match_end)
+{
+  const uint32_t *table         = dfa->table;
+  const unsigned char *classmap = dfa->classmap;
+  const unsigned char *base     = (const unsigned char *)text;
+  const unsigned char *end      = base + text_len;
+  bool empty                    = (dfa->start & DENSE_DFA_FINAL) != 0; // The empty literal matches anywhere
+
+  for (size_t pos = from; pos <= text_len; pos++)
+  {
+    if (anchored_start && pos != 0)
+      return false;
+
+    // Skip to the next byte that begins a literal
+    const unsigned char *p = base + pos;
+    if (!empty && !anchored_start)
+    {
+      p = dfa->start_count <= 3 ? find_byte_of (p, end, dfa->start_set, dfa->start_count)
+                                : byte_span (&dfa->idle, p, end);
+      if (!p || p == end)
+        return false;
+      pos = p - base;
+    }
+
+    const unsigned char *last = empty && (!anchored_end || p == end) ? p : NULL;
+    uint32_t s                = dfa->start;
+    for (const unsigned char *q = p; q < end;)
+    {
+      s = table[(s & DENSE_DFA_ROW_MASK) + classmap[*q++]];
+      if (s == 0)
+        break;
+      if ((s & DENSE_DFA_FINAL) && (!anchored_end || q == end))
+        last = q;
+    }
+    if (last)
+    {
+      *match_start = p - base;
+      *match_end   = last - base;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Match a batch of short subjects against a literal DFA.  Anchored tries
+// advance BATCH_LANES subjects one byte per round, so the table loads of
+// independent subjects overlap instead of waiting on each other.  States
+// that can no longer change the result drop to the dead state 0.
+static void
+dfa_match_batch (const DFA *dfa, const char *const *texts, const size_t *lens, size_t n, uint8_t *results)
+{
+  const DenseDFA *dense         = &dfa->automaton;
+  const uint32_t *table         = dense->table;
+  const unsigned char *classmap = dense->classmap;
+  const bool at_end             = dfa->anchored_end;
+  const uint32_t stop           = at_end ? 0 : DENSE_DFA_FINAL; // Flags that settle the result
+  size_t i                      = 0;
+
+  if (dfa->anchored_start)
+  {
+    for (; i + BATCH_LANES <= n; i += BATCH_LANES)
+    {
+      const unsigned char *p[BATCH_LANES];
+      size_t len[BATCH_LANES];
+      uint32_t s[BATCH_LANES];
+      uint32_t seen[BATCH_LANES];
+      size_t common = SIZE_MAX;
+      bool valid    = true;
+
+      for (int lane = 0; lane < BATCH_LANES; lane++)
+      {
+        valid = valid && texts[i + lane];
+        if (!valid)
+          break;
+        p[lane]    = (const unsigned char *)texts[i + lane];
+        len[lane]  = lens ? lens[i + lane] : strlen (texts[i + lane]);
+        seen[lane] = dense->start;
+        s[lane]    = (dense->start & stop) ? 0 : dense->start;
+        if (len[lane] < common)
+          common = len[lane];
+        if (i + lane + BATCH_LANES < n && texts[i + lane + BATCH_LANES])
+          VIBREX_PREFETCH (texts[i + lane + BATCH_LANES]);
+      }
+      if (!valid)
+      {
+        for (int lane = 0; lane < BATCH_LANES; lane++)
+        {
+          const char *text  = texts[i + lane];
+          results[i + lane] = text && dfa_match (dfa, text, lens ? lens[i + lane] : strlen (text));
+        }
+        continue;
+      }
+
+      // Step all lanes over their common length, until every one is settled
+      uint32_t s0 = s[0], s1 = s[1], s2 = s[2], s3 = s[3];
+      size_t k    = 0;
+      for (; k < common && (s0 | s1 | s2 | s3); k++)
+      {
+        uint32_t n0 = table[(s0 & DENSE_DFA_ROW_MASK) + classmap[p[0][k]]];
+        uint32_t n1 = table[(s1 & DENSE_DFA_ROW_MASK) + classmap[p[1][k]]];
+        uint32_t n2 = table[(s2 & DENSE_DFA_ROW_MASK) + classmap[p[2][k]]];
+        uint32_t n3 = table[(s3 & DENSE_DFA_ROW_MASK) + classmap[p[3][k]]];
+        seen[0] |= n0;
+        seen[1] |= n1;
+        seen[2] |= n2;
+        seen[3] |= n3;
+        s0 = (n0 & stop) ? 0 : n0;
+        s1 = (n1 & stop) ? 0 : n1;
+        s2 = (n2 & stop) ? 0 : n2;
+        s3 = (n3 & stop) ? 0 : n3;
+      }
+      s[0] = s0;
+      s[1] = s1;
+      s[2] = s2;
+      s[3] = s3;
+
+      // Finish the longer subjects one at a time
+      for (int lane = 0; lane < BATCH_LANES; lane++)
+      {
+        for (size_t j = k; s[lane] && j < len[lane]; j++)
+        {
+          uint32_t next = table[(s[lane] & DENSE_DFA_ROW_MASK) + classmap[p[lane][j]]];
+          seen[lane] |= next;
+          s[lane] = (next & stop) ? 0 : next;
+        }
+        results[i + lane] = at_end ? (s[lane] & DENSE_DFA_FINAL) != 0 : (seen[lane] & DENSE_DFA_FINAL) != 0;
+      }
+    }
+  }
+
+  // Unanchored automata skip ahead with memchr, which beats lockstep
+  // stepping, and the remainder of an anchored batch is matched singly
+  for (; i < n; i++)
+  {
+    size_t len = texts[i] ? (lens ? lens[i] : strlen (texts[i])) : 0;
+    results[i] = texts[i] && dfa_match (dfa, texts[i], len);
+  }
+}
+
+// Free dense DFA tables
+static void
+dense_dfa_free (DenseDFA *dfa)
+{
+  free (dfa->table);
+  memset (dfa, 0, sizeof (*dfa));
+}
+
+/********************************************************************************
+ * LITERAL ALTERNATION OPTIMIZATION ENGINE
+ ********************************************************************************/
+
+// Add a copy of a literal to a literal set
+static bool
+literal_set_add (LiteralSet *set, const char *literal, size_t len)
+{
+  if (set->count >= MAX_ALTERNATIONS || set->total_len + len > MAX_PATTERN_LENGTH)
+    return false;
+
+  if (set->count == set->capacity)
+  {
+    size_t new_capacity = set->capacity ? set->capacity * 2 : 8;
+    char **literals     = realloc (set->literals, new_capacity * sizeof (char *));
+    if (!literals)
+      return false;
+    set->literals = literals;
+    size_t *lengths = realloc (set->lengths, new_capacity * sizeof (size_t));
+    if (!lengths)
+      return false;
+    set->lengths  = lengths;
+    set->capacity = new_capacity;
+  }
+
+  char *copy = malloc (len + 1);
+  if (!copy)
+    return false;
+  memcpy (copy, literal, len);
+  copy[len] = '\0';
+
+  set->literals[set->count] = copy;
+  set->lengths[set->count]  = len;
+  set->count++;
+  set->total_len += len;
+  return true;
+}
+
+// Free a literal set and its literals
+static void
+literal_set_free (LiteralSet *set)
+{
+  for (size_t i = 0; i < set->count; i++)
+    free (set->literals[i]);
+  free (set->literals);
+  free (set->lengths);
+  memset (set, 0, sizeof (*set));
+}
+
+// Parse a sequence of literal characters and groups, expanding groups into
+// every combination of their alternatives
+static bool
+parse_literal_sequence (LiteralParser *lp, LiteralSet *out)
+{
+  if (!literal_set_add (out, "", 0))
+    return false;
+
+  while (true)
+  {
+    char c = lp->re[lp->pos];
+    if (c == '\0' || c == '|' || c == ')')
+      return true;
+
+    if (c == '(')
+    {
+      // Same nesting limit as the NFA parser, which recurses twice per group
+      if (++lp->depth > MAX_RECURSION_DEPTH / 2)
+        return false;
+      lp->pos++;
+
+      LiteralSet group = {0};
+      if (!parse_literal_alternation (lp, &group) || lp->re[lp->pos] != ')')
+      {
+        literal_set_free (&group);
+        return false;
+      }
+      lp->pos++;
+      lp->depth--;
+
+      // Concatenate every literal so far with every alternative of the group
+      LiteralSet product = {0};
+      bool ok            = true;
+      for (size_t i = 0; ok && i < out->count; i++)
+      {
+        for (size_t j = 0; ok && j < group.count; j++)
+        {
+          size_t len = out->lengths[i] + group.lengths[j];
+          char *buf  = malloc (len + 1);
+          ok         = (buf != NULL);
+          if (ok)
+          {
+            memcpy (buf, out->literals[i], out->lengths[i]);
+            memcpy (buf + out->lengths[i], group.literals[j], group.lengths[j]);
+            ok = literal_set_add (&product, buf, len);
+            free (buf);
+          }
+        }
+      }
+      literal_set_free (&group);
+      literal_set_free (out);
+      *out = product;
+      if (!ok)
+        return false;
+      continue;
+    }
+
+    // Gather a run of literal characters and append it to every literal
+    size_t run_start = lp->pos;
+    size_t run_len   = 0;
+    char *run        = malloc (strlen (lp->re + run_start) + 1);
+    if (!run)
       return false;
+    while ((c = lp->re[lp->pos]) != '\0' && c != '|' && c != '(' && c != ')')
+    {
+      if (c == '\\')
+      {
+        c = lp->re[++lp->pos];
+        if (c == '\0')
+        {
+          free (run);
+          return false; // Trailing escape
+        }
+      }
+      else if (strchr (".?*+[]^$", c))
+      {
+        free (run);
+        return false; // Contains regex metacharacters
+      }
+      run[run_len++] = c;
+      lp->pos++;
+    }
+
+    for (size_t i = 0; i < out->count; i++)
+    {
+      if (out->total_len + run_len > MAX_PATTERN_LENGTH)
+      {
+        free (run);
+        return false;
+      }
+      char *grown = realloc (out->literals[i], out->lengths[i] + run_len + 1);
+      if (!grown)
+      {
+        free (run);
+        return false;
+      }
+      memcpy (grown + out->lengths[i], run, run_len);
+      out->lengths[i] += run_len;
+      grown[out->lengths[i]] = '\0';
+      out->literals[i]       = grown;
+      out->total_len += run_len;
+    }
+    free (run);
   }
+}
+
+// Parse alternatives separated by | into one literal set
+static bool
+parse_literal_alternation (LiteralParser *lp, LiteralSet *out)
+{
+  if (!parse_literal_sequence (lp, out))
+    return false;
 
-  for (size_t i = dotstar + 2 - pattern; i < len - 1; i++)
+  while (lp->re[lp->pos] == '|')
   {
-    if (strchr (".?*+[]()|\\", pattern[i]))
+    lp->pos++;
+    LiteralSet branch = {0};
+    bool ok           = parse_literal_sequence (lp, &branch);
+    for (size_t i = 0; ok && i < branch.count; i++)
+      ok = literal_set_add (out, branch.literals[i], branch.lengths[i]);
+    literal_set_free (&branch);
+    if (!ok)
       return false;
   }
-
   return true;
 }
 
-// Compile both anchors optimization
+// Compile literal alternation optimization for patterns made only of literal
+// characters, escapes, groups and alternation, like cat|dog, (cat|dog)s or a\.b|c
 static bool
-compile_both_anchors_opt (struct vibrex_pattern *compiled, const char *pattern)
+compile_literal_alt_opt (struct vibrex_pattern *compiled, const char *pattern)
 {
-  if (!can_use_both_anchors_opt (pattern))
+  if (!pattern || !strchr (pattern, '|'))
     return false;
 
-  size_t len          = strlen (pattern);
-  const char *dotstar = strstr (pattern + 1, ".*");
-
-  size_t prefix_len = dotstar - (pattern + 1);
-  size_t suffix_len = (pattern + len - 1) - (dotstar + 2);
-
-  // Allocate and copy prefix
-  compiled->both_anchors.prefix = malloc (prefix_len + 1);
-  if (!compiled->both_anchors.prefix)
+  LiteralParser lp = {pattern, 0, 0};
+  LiteralSet set   = {0};
+  if (!parse_literal_alternation (&lp, &set) || pattern[lp.pos] != '\0')
+  {
+    literal_set_free (&set);
     return false;
+  }
 
-  memcpy (compiled->both_anchors.prefix, pattern + 1, prefix_len);
-  compiled->both_anchors.prefix[prefix_len] = '\0';
-  compiled->both_anchors.prefix_len         = prefix_len;
-
-  // Allocate and copy suffix
-  compiled->both_anchors.suffix = malloc (suffix_len + 1);
-  if (!compiled->both_anchors.suffix)
+  // Build the automaton that finds all literals in one pass; if the tables
+  // would be too large, each literal is searched for on its own, which only
+  // works when case matters
+  bool icase = (compiled->flags & VIBREX_ICASE) != 0;
+  if (!dense_dfa_build (&compiled->literal_alt.automaton, set.literals, set.lengths, set.count, false, icase,
+                        LITERAL_AUTOMATON_MAX_BYTES) &&
+      icase)
   {
-    free (compiled->both_anchors.prefix);
+    literal_set_free (&set);
     return false;
   }
 
-  memcpy (compiled->both_anchors.suffix, dotstar + 2, suffix_len);
-  compiled->both_anchors.suffix[suffix_len] = '\0';
-  compiled->both_anchors.suffix_len         = suffix_len;
+  // Searches find where matches lie with the trie, or run the NFA if the
+  // trie is too large too
+  if (!compiled->nested)
+    dense_dfa_build (&compiled->literal_alt.trie, set.literals, set.lengths, set.count, true, icase,
+                     LITERAL_AUTOMATON_MAX_BYTES);
+
+  compiled->literal_alt.alternatives = set.literals;
+  compiled->literal_alt.alt_lengths  = set.lengths;
+  compiled->literal_alt.alt_count    = set.count;
+  compiled->literal_alt.enabled      = true;
 
-  compiled->both_anchors.enabled = true;
   return true;
 }
 
-// Match using both anchors optimization - ultra-simple approach!
+// Match using literal alternation optimization - very fast multi-string search!
 static bool
-match_with_both_anchors_opt (const struct vibrex_pattern *pattern, const char *text)
+match_with_literal_alt_opt (const struct vibrex_pattern *pattern, const char *text, size_t text_len)
 {
-  if (!pattern->both_anchors.enabled || !text)
-    return false;
-
-  const BothAnchorsOpt *opt = &pattern->both_anchors;
-
-  // Check prefix at start first (this is very fast)
-  if (strncmp (text, opt->prefix, opt->prefix_len) != 0)
+  if (!pattern->literal_alt.enabled || !text)
     return false;
 
-  // For suffix check: find the end once and check suffix directly
-  if (opt->suffix_len == 0)
-    return true;
+  const LiteralAltOpt *opt = &pattern->literal_alt;
 
-  // Find the end of the string (starting from after prefix)
-  const char *p = text + opt->prefix_len;
-  while (*p)
-    p++;
+  if (opt->automaton.enabled)
+    return dense_dfa_search (&opt->automaton, text, text_len, false);
 
-  // Check if string is long enough to contain both prefix and suffix
-  size_t total_len = p - text;
-  if (total_len < opt->prefix_len + opt->suffix_len)
-    return false;
+  // Try each alternative - return true as soon as any is found
+  for (size_t i = 0; i < opt->alt_count; i++)
+  {
+    if (find_literal (text, text_len, opt->alternatives[i], opt->alt_lengths[i]) != NULL)
+      return true;
+  }
 
-  // Check if the string ends with our suffix
-  const char *suffix_start = p - opt->suffix_len;
-  return (strncmp (suffix_start, opt->suffix, opt->suffix_len) == 0);
+  return false;
 }
 
-// Free both anchors optimization data
+// Free literal alternation optimization data
 static void
-free_both_anchors_opt (BothAnchorsOpt *both_anchors)
+free_literal_alt_opt (LiteralAltOpt *literal_alt)
 {
-  if (both_anchors)
+  if (literal_alt && literal_alt->enabled)
   {
-    free (both_anchors->prefix);
-    free (both_anchors->suffix);
-    both_anchors->prefix  = NULL;
-    both_anchors->suffix  = NULL;
-    both_anchors->enabled = false;
+    if (literal_alt->alternatives)
+    {
+      for (size_t i = 0; i < literal_alt->alt_count; i++)
+      {
+        free (literal_alt->alternatives[i]);
+      }
+      free (literal_alt->alternatives);
+    }
+    free (literal_alt->alt_lengths);
+    dense_dfa_free (&literal_alt->automaton);
+    dense_dfa_free (&literal_alt->trie);
+    memset (literal_alt, 0, sizeof (*literal_alt));
   }
 }
 
 /********************************************************************************
- * URL PATTERN OPTIMIZATION ENGINE
+ * REQUIRED LITERAL PREFILTER
  ********************************************************************************/
 
-// Check if pattern is of the form https?://[char-class]+
-static bool
-can_use_url_pattern_opt (const char *pattern)
+// What the analysis knows about a sub-expression: when exact, the set holds
+// every string it matches; otherwise each match contains one of the set's
+// literals, and an empty set means nothing is required
+typedef struct
 {
-  if (!pattern)
-    return false;
+  bool exact;
+  LiteralSet set;
+} LiteralInfo;
 
-  // Must start with "http"
-  if (strncmp (pattern, "http", 4) != 0)
-    return false;
+static bool required_alt (LiteralParser *lp, LiteralInfo *out);
 
-  const char *p = pattern + 4;
+// Set an info to a single exact string
+static bool
+literal_info_exact (LiteralInfo *info, const char *literal, size_t len)
+{
+  memset (info, 0, sizeof (*info));
+  info->exact = true;
+  return literal_set_add (&info->set, literal, len);
+}
 
-  // Check for optional 's'
-  if (*p == 's')
+// Add a literal to a set unless it is already there
+static bool
+literal_set_add_unique (LiteralSet *set, const char *literal, size_t len)
+{
+  for (size_t i = 0; i < set->count; i++)
   {
-    // Must be followed by '?'
-    if (*(p + 1) != '?')
-      return false;
-    p += 2;
+    if (set->lengths[i] == len && memcmp (set->literals[i], literal, len) == 0)
+      return true;
   }
+  return literal_set_add (set, literal, len);
+}
 
-  // Must be followed by "://"
-  if (strncmp (p, "://", 3) != 0)
-    return false;
-  p += 3;
-
-  // Must be followed by character class
-  if (*p != '[')
-    return false;
-  p++;
-
-  // Skip to end of character class
-  while (*p && *p != ']')
-    p++;
+// Turn an exact info into a required one; a set containing the empty string
+// or too many literals requires nothing
+static void
+literal_info_require (LiteralInfo *info)
+{
+  if (!info->exact)
+    return;
+  info->exact = false;
 
-  if (*p != ']')
-    return false;
-  p++;
+  bool useful = info->set.count <= REQUIRED_SET_MAX;
+  for (size_t i = 0; useful && i < info->set.count; i++)
+    useful = info->set.lengths[i] > 0;
+  if (!useful)
+    literal_set_free (&info->set);
+}
 
-  // Must be followed by '+'
-  if (*p != '+')
-    return false;
-  p++;
+// Rank a required set by its shortest literal, then by fewer literals
+static size_t
+literal_info_score (const LiteralInfo *info)
+{
+  if (info->set.count == 0)
+    return 0;
+  size_t min_len = SIZE_MAX;
+  for (size_t i = 0; i < info->set.count; i++)
+  {
+    if (info->set.lengths[i] < min_len)
+      min_len = info->set.lengths[i];
+  }
+  return min_len * (REQUIRED_SET_MAX + 1) + (REQUIRED_SET_MAX - info->set.count);
+}
 
-  // Must be end of pattern
-  return (*p == '\0');
+// Keep the better of two required infos in best, preferring later ones on ties
+static void
+literal_info_keep_better (LiteralInfo *best, LiteralInfo *candidate)
+{
+  literal_info_require (candidate);
+  if (literal_info_score (candidate) >= literal_info_score (best) && candidate->set.count > 0)
+  {
+    literal_set_free (&best->set);
+    *best = *candidate;
+  }
+  else
+  {
+    literal_set_free (&candidate->set);
+  }
+  memset (candidate, 0, sizeof (*candidate));
 }
 
-// Compile URL pattern optimization
+// Replace an exact set with its concatenation with another exact set
 static bool
-compile_url_pattern_opt (struct vibrex_pattern *compiled, const char *pattern)
+literal_info_concat (LiteralInfo *info, const LiteralInfo *next)
 {
-  if (!can_use_url_pattern_opt (pattern))
-    return false;
-
-  // Initialize character lookup table to all false
-  memset (compiled->url_pattern.char_table, 0, sizeof (compiled->url_pattern.char_table));
-
-  // Find the character class
-  const char *class_start = strchr (pattern, '[');
-  if (!class_start)
-    return false;
-  class_start++; // skip '['
-
-  const char *class_end = strchr (class_start, ']');
-  if (!class_end)
-    return false;
-
-  // Parse character class and populate lookup table
-  const char *p = class_start;
-  while (p < class_end)
+  LiteralSet product = {0};
+  for (size_t i = 0; i < info->set.count; i++)
   {
-    unsigned char start = *p++;
-    unsigned char end   = start;
-
-    // Check for range (e.g., a-z)
-    if (p < class_end - 1 && *p == '-')
+    for (size_t j = 0; j < next->set.count; j++)
     {
-      p++; // skip '-'
-      end = *p++;
-      if (end < start)
+      size_t len = info->set.lengths[i] + next->set.lengths[j];
+      char *buf  = malloc (len + 1);
+      bool ok    = (buf != NULL);
+      if (ok)
+      {
+        memcpy (buf, info->set.literals[i], info->set.lengths[i]);
+        memcpy (buf + info->set.lengths[i], next->set.literals[j], next->set.lengths[j]);
+        ok = literal_set_add_unique (&product, buf, len);
+        free (buf);
+      }
+      if (!ok)
+      {
+        literal_set_free (&product);
         return false;
-    }
-
-    // Set bits for this range
-    for (unsigned char ch = start; ch <= end; ch++)
-    {
-      compiled->url_pattern.char_table[ch] = 1;
-      if (ch == 255)
-        break; // Prevent overflow
+      }
     }
   }
-
-  compiled->url_pattern.enabled = true;
+  literal_set_free (&info->set);
+  info->set = product;
   return true;
 }
 
-// Match using URL pattern optimization - very fast!
+// Analyze an atom, following the grammar of parseatom
 static bool
-match_with_url_pattern_opt (const struct vibrex_pattern *pattern, const char *text)
+required_atom (LiteralParser *lp, LiteralInfo *out)
 {
-  if (!pattern->url_pattern.enabled || !text)
-    return false;
+  char c = lp->re[lp->pos];
+  memset (out, 0, sizeof (*out));
 
-  const char *p                   = text;
-  const unsigned char *char_table = pattern->url_pattern.char_table;
+  if (c == '.')
+  {
+    lp->pos++;
+    return true;
+  }
 
-  // Search for "http" in the text
-  while ((p = strstr (p, "http")) != NULL)
+  if (c == '^' || c == '$')
   {
-    const char *url_start = p;
-    p += 4; // skip "http"
+    lp->pos++;
+    return literal_info_exact (out, "", 0);
+  }
 
-    // Check for optional 's'
-    if (*p == 's')
-      p++;
+  if (c == '(')
+  {
+    if (++lp->depth > MAX_RECURSION_DEPTH / 2)
+      return false;
+    lp->pos++;
+    if (!required_alt (lp, out) || lp->re[lp->pos] != ')')
+    {
+      literal_set_free (&out->set);
+      return false;
+    }
+    lp->pos++;
+    lp->depth--;
+    return true;
+  }
 
-    // Must be followed by "://"
-    if (strncmp (p, "://", 3) != 0)
+  if (c == '[')
+  {
+    unsigned char members[CHAR_CLASS_BYTES] = {0};
+    bool negated                            = false;
+    lp->pos++;
+    if (lp->re[lp->pos] == '^')
     {
-      p = url_start + 1; // Try next position
-      continue;
+      negated = true;
+      lp->pos++;
     }
-    p += 3; // skip "://"
+    if (lp->re[lp->pos] == ']')
+      return false;
 
-    // Must have at least one character from the allowed class
-    if (*p == '\0' || !char_table[(unsigned char)*p])
+    while (lp->re[lp->pos] && lp->re[lp->pos] != ']')
     {
-      p = url_start + 1; // Try next position
-      continue;
+      unsigned char start = lp->re[lp->pos++];
+      unsigned char end   = start;
+      if (lp->re[lp->pos] == '-' && lp->re[lp->pos + 1] && lp->re[lp->pos + 1] != ']')
+      {
+        lp->pos++;
+        end = lp->re[lp->pos++];
+        if (end < start)
+          return false;
+      }
+      for (int ch = start; ch <= end; ch++)
+        members[ch / 8] |= 1 << (ch % 8);
     }
+    if (lp->re[lp->pos] != ']')
+      return false;
+    lp->pos++;
 
-    // Scan characters from the allowed class
-    while (*p && char_table[(unsigned char)*p])
-      p++;
+    // Small classes are a set of single-byte strings, larger ones require nothing
+    int count = 0;
+    for (int ch = 0; ch < TRANSITION_TABLE_SIZE; ch++)
+      count += ((members[ch / 8] >> (ch % 8)) & 1) != negated;
+    if (count > REQUIRED_CLASS_MAX)
+      return true;
 
-    // Found a match!
+    out->exact = true;
+    for (int ch = 0; ch < TRANSITION_TABLE_SIZE; ch++)
+    {
+      char byte = (char)ch;
+      if (((members[ch / 8] >> (ch % 8)) & 1) != negated && !literal_set_add (&out->set, &byte, 1))
+        return false;
+    }
     return true;
   }
 
-  return false;
-}
+  if (c == '\\')
+  {
+    if (!lp->re[lp->pos + 1])
+      return false;
+    lp->pos += 2;
+    return literal_info_exact (out, &lp->re[lp->pos - 1], 1);
+  }
 
-// Free URL pattern optimization data
-static void
-free_url_pattern_opt (UrlPatternOpt *url_pattern)
-{
-  if (url_pattern)
+  if (c && c != '*' && c != '+' && c != '?' && c != '|' && c != ')')
   {
-    url_pattern->enabled = false;
+    lp->pos++;
+    return literal_info_exact (out, &lp->re[lp->pos - 1], 1);
   }
-}
 
-/********************************************************************************
- * LITERAL ALTERNATION OPTIMIZATION ENGINE
- ********************************************************************************/
+  return false;
+}
 
-// Check if pattern is pure literal alternation like cat|dog|bird|fish, (cat|dog), or (cat|dog)|(bird|fish)
-// Must be ONLY alternations of literals with no additional regex structure
+// Analyze an atom and its quantifier, following the grammar of parsepiece
 static bool
-can_use_literal_alt_opt (const char *pattern)
+required_piece (LiteralParser *lp, LiteralInfo *out)
 {
-  if (!pattern)
+  if (!required_atom (lp, out))
     return false;
 
-  const char *p           = pattern;
-  bool has_alternation    = false;
-  int paren_depth         = 0;
-  bool in_top_level_group = false;
-
-  // Check if the pattern is wrapped in a single outer group like (a|b)
-  if (*p == '(' && pattern[strlen (pattern) - 1] == ')')
+  char op = lp->re[lp->pos];
+  if (op == '*')
   {
-    // Check if this is a complete wrapper - no additional content outside
-    const char *check_p = p + 1;
-    int check_depth     = 0;
-
-    while (*check_p && check_p < pattern + strlen (pattern) - 1)
+    // Zero repetitions require nothing
+    literal_set_free (&out->set);
+    out->exact = false;
+  }
+  else if (op == '?')
+  {
+    // An optional exact atom adds the empty string to its set
+    if (out->exact && out->set.count < REQUIRED_EXACT_MAX)
     {
-      if (*check_p == '(')
-        check_depth++;
-      else if (*check_p == ')')
-      {
-        check_depth--;
-        if (check_depth < 0)
-          break; // Found the closing paren of outer group
-      }
-      check_p++;
+      if (!literal_set_add_unique (&out->set, "", 0))
+        return false;
     }
-
-    // If we reached the end-1 position with balanced parens, it's a wrapper
-    if (check_p == pattern + strlen (pattern) - 1 && check_depth == 0)
-      in_top_level_group = true;
+    else
+    {
+      literal_set_free (&out->set);
+      out->exact = false;
+    }
+  }
+  else if (op == '+')
+  {
+    // Every repetition count includes one match of the atom
+    literal_info_require (out);
+  }
+  else
+  {
+    return true;
   }
+  lp->pos++;
+  return true;
+}
 
-  // The pattern should be one of these forms:
-  // 1. a|b|c (simple alternation)
-  // 2. (a|b) (grouped alternation)
-  // 3. (a|b)|(c|d) (multiple grouped alternations)
+// Analyze a concatenation, following the grammar of parsecat.  Exact pieces
+// are joined into runs, and the best run or inexact piece is what the
+// concatenation requires if it is not exact as a whole
+static bool
+required_cat (LiteralParser *lp, LiteralInfo *out)
+{
+  LiteralInfo best = {0};
+  bool exact       = true;
+  if (!literal_info_exact (out, "", 0))
+    return false;
 
-  // Scan through the pattern to validate structure
-  while (*p)
+  while (lp->re[lp->pos] && lp->re[lp->pos] != ')' && lp->re[lp->pos] != '|')
   {
-    char c = *p;
-
-    if (c == '(')
+    LiteralInfo piece;
+    if (!required_piece (lp, &piece))
     {
-      paren_depth++;
+      literal_set_free (&best.set);
+      return false;
     }
-    else if (c == ')')
-    {
-      paren_depth--;
-      if (paren_depth < 0)
-        return false; // Unbalanced parentheses
 
-      // After closing a group, we should only see | or end of pattern
-      if (*(p + 1) != '\0' && *(p + 1) != '|')
+    if (piece.exact && out->set.count * piece.set.count <= REQUIRED_EXACT_MAX)
+    {
+      bool ok = literal_info_concat (out, &piece);
+      literal_set_free (&piece.set);
+      if (!ok)
       {
-        if (!in_top_level_group || paren_depth > 0)
-          return false; // Additional content after group
+        literal_set_free (&best.set);
+        return false;
       }
+      continue;
     }
-    else if (c == '|')
-    {
-      has_alternation = true;
-    }
-    else if (c == '\\' && *(p + 1))
+
+    // The run ends here: keep the better of it and the piece, and start a
+    // new run with the piece if it is exact
+    exact = false;
+    literal_info_keep_better (&best, out);
+    if (piece.exact)
     {
-      // Skip escaped character
-      p++;
+      *out = piece;
     }
-    else if (strchr (".?*+[]^$", c))
+    else
     {
-      // Contains regex metacharacters
-      return false;
+      literal_info_keep_better (&best, &piece);
+      if (!literal_info_exact (out, "", 0))
+      {
+        literal_set_free (&best.set);
+        return false;
+      }
     }
-    // Regular literal characters are allowed
-
-    p++;
   }
 
-  // Must have balanced parentheses and at least one alternation
-  return has_alternation && paren_depth == 0;
+  if (exact)
+    return true;
+  literal_info_keep_better (&best, out);
+  *out = best;
+  return true;
 }
 
-// Parse literal alternatives from pattern - handles patterns like (cat|dog)|(bird|fish)
+// Analyze alternatives, following the grammar of parsealt.  Each match
+// contains what one of the alternatives requires
 static bool
-parse_literal_alternatives (const char *pattern, char ***alternatives, size_t **alt_lengths, size_t *alt_count)
+required_alt (LiteralParser *lp, LiteralInfo *out)
 {
-  // Count how many alternatives we'll have
-  *alt_count      = 0;
-  const char *p   = pattern;
-  int paren_depth = 0;
+  if (!required_cat (lp, out))
+    return false;
 
-  // First pass: count alternatives, accounting for nested groups
-  while (*p)
+  while (lp->re[lp->pos] == '|')
   {
-    if (*p == '(')
-      paren_depth++;
-    else if (*p == ')')
-      paren_depth--;
-    else if (*p == '|')
+    lp->pos++;
+    LiteralInfo branch;
+    if (!required_cat (lp, &branch))
     {
-      if (paren_depth == 0)
-        (*alt_count)++; // Top-level alternation
-      else
-        (*alt_count)++; // Nested alternation will become separate alternatives
+      literal_set_free (&out->set);
+      return false;
     }
-    p++;
-  }
-  (*alt_count)++; // Add one for the final alternative
-
-  // Allocate arrays with extra space for nested alternatives
-  size_t capacity = (*alt_count) * 2; // Allow for expansion
-  *alternatives   = malloc (capacity * sizeof (char *));
-  *alt_lengths    = malloc (capacity * sizeof (size_t));
-  if (!*alternatives || !*alt_lengths)
-  {
-    free (*alternatives);
-    free (*alt_lengths);
-    return false;
-  }
-
-  // Second pass: extract alternatives
-  p                     = pattern;
-  const char *alt_start = p;
-  paren_depth           = 0;
-  size_t alt_idx        = 0;
 
-  while (*p)
-  {
-    if (*p == '(')
-      paren_depth++;
-    else if (*p == ')')
-      paren_depth--;
-    else if (*p == '|' && paren_depth == 0)
+    if (!(out->exact && branch.exact && out->set.count + branch.set.count <= REQUIRED_EXACT_MAX))
     {
-      // Top-level alternation - process current alternative
-      size_t alt_len = p - alt_start;
-
-      // Check if this is a grouped alternative like (cat|dog)
-      if (alt_start[0] == '(' && alt_start[alt_len - 1] == ')')
-      {
-        // Extract alternatives from inside the group
-        const char *inner           = alt_start + 1;
-        const char *inner_end       = alt_start + alt_len - 1;
-        const char *inner_alt_start = inner;
-
-        while (inner < inner_end)
-        {
-          if (*inner == '|')
-          {
-            // Found inner alternation
-            size_t inner_len         = inner - inner_alt_start;
-            (*alternatives)[alt_idx] = malloc (inner_len + 1);
-            if (!(*alternatives)[alt_idx])
-              return false;
-            memcpy ((*alternatives)[alt_idx], inner_alt_start, inner_len);
-            (*alternatives)[alt_idx][inner_len] = '\0';
-            (*alt_lengths)[alt_idx]             = inner_len;
-            alt_idx++;
-
-            inner_alt_start = inner + 1;
-          }
-          inner++;
-        }
-        // Add final inner alternative
-        size_t final_inner_len   = inner_end - inner_alt_start;
-        (*alternatives)[alt_idx] = malloc (final_inner_len + 1);
-        if (!(*alternatives)[alt_idx])
-          return false;
-        memcpy ((*alternatives)[alt_idx], inner_alt_start, final_inner_len);
-        (*alternatives)[alt_idx][final_inner_len] = '\0';
-        (*alt_lengths)[alt_idx]                   = final_inner_len;
-        alt_idx++;
-      }
-      else
+      literal_info_require (out);
+      literal_info_require (&branch);
+      if (out->set.count == 0 || branch.set.count == 0 || out->set.count + branch.set.count > REQUIRED_SET_MAX)
       {
-        // Simple literal alternative
-        (*alternatives)[alt_idx] = malloc (alt_len + 1);
-        if (!(*alternatives)[alt_idx])
-          return false;
-        memcpy ((*alternatives)[alt_idx], alt_start, alt_len);
-        (*alternatives)[alt_idx][alt_len] = '\0';
-        (*alt_lengths)[alt_idx]           = alt_len;
-        alt_idx++;
+        literal_set_free (&out->set);
+        literal_set_free (&branch.set);
+        continue;
       }
+    }
 
-      alt_start = p + 1;
+    bool ok = true;
+    for (size_t i = 0; ok && i < branch.set.count; i++)
+      ok = literal_set_add_unique (&out->set, branch.set.literals[i], branch.set.lengths[i]);
+    literal_set_free (&branch.set);
+    if (!ok)
+    {
+      literal_set_free (&out->set);
+      return false;
     }
-    p++;
   }
+  return true;
+}
 
-  // Process final alternative
-  size_t final_len = p - alt_start;
-  if (alt_start[0] == '(' && alt_start[final_len - 1] == ')')
+// Find the literals every match of an NFA pattern, or of the part after its
+// literal prefix, contains and set up the prefilter when they are long
+// enough to be worth searching for; it is left disabled if the analysis fails
+static void
+compile_required_literals (struct vibrex_pattern *compiled, const char *pattern)
+{
+  LiteralParser lp = {pattern, 0, 0};
+  LiteralInfo info;
+  if (!required_alt (&lp, &info) || pattern[lp.pos] != '\0')
   {
-    // Extract alternatives from inside the final group
-    const char *inner           = alt_start + 1;
-    const char *inner_end       = alt_start + final_len - 1;
-    const char *inner_alt_start = inner;
-
-    while (inner < inner_end)
-    {
-      if (*inner == '|')
-      {
-        size_t inner_len         = inner - inner_alt_start;
-        (*alternatives)[alt_idx] = malloc (inner_len + 1);
-        if (!(*alternatives)[alt_idx])
-          return false;
-        memcpy ((*alternatives)[alt_idx], inner_alt_start, inner_len);
-        (*alternatives)[alt_idx][inner_len] = '\0';
-        (*alt_lengths)[alt_idx]             = inner_len;
-        alt_idx++;
+    literal_set_free (&info.set);
+    return;
+  }
+  literal_info_require (&info);
 
-        inner_alt_start = inner + 1;
-      }
-      inner++;
-    }
-    // Add final inner alternative
-    size_t final_inner_len   = inner_end - inner_alt_start;
-    (*alternatives)[alt_idx] = malloc (final_inner_len + 1);
-    if (!(*alternatives)[alt_idx])
-      return false;
-    memcpy ((*alternatives)[alt_idx], inner_alt_start, final_inner_len);
-    (*alternatives)[alt_idx][final_inner_len] = '\0';
-    (*alt_lengths)[alt_idx]                   = final_inner_len;
-    alt_idx++;
+  size_t min_len = SIZE_MAX;
+  for (size_t i = 0; i < info.set.count; i++)
+  {
+    if (info.set.lengths[i] < min_len)
+      min_len = info.set.lengths[i];
   }
-  else
+
+  if (info.set.count == 0 || min_len < REQUIRED_MIN_LEN)
   {
-    // Simple final alternative
-    (*alternatives)[alt_idx] = malloc (final_len + 1);
-    if (!(*alternatives)[alt_idx])
-      return false;
-    memcpy ((*alternatives)[alt_idx], alt_start, final_len);
-    (*alternatives)[alt_idx][final_len] = '\0';
-    (*alt_lengths)[alt_idx]             = final_len;
-    alt_idx++;
+    literal_set_free (&info.set);
+    return;
   }
 
-  *alt_count = alt_idx;
-  return alt_idx > 0;
+  // The literal searcher compares bytes, ignoring case the automaton with
+  // folded byte classes is used even for a single literal
+  RequiredLiterals *required = &compiled->required;
+  required->set              = info.set;
+  required->fold_case        = (compiled->flags & VIBREX_ICASE) != 0;
+  if (info.set.count == 1 && !required->fold_case)
+    literal_searcher_init (&required->searcher, info.set.literals[0], info.set.lengths[0]);
+  else if (!dense_dfa_build (&required->automaton, info.set.literals, info.set.lengths, info.set.count, false,
+                             required->fold_case, LITERAL_AUTOMATON_MAX_BYTES) &&
+           required->fold_case)
+  {
+    free_required_literals (required);
+    return;
+  }
+  required->enabled = true;
 }
 
-// Compile literal alternation optimization
+// Check whether text contains one of the required literals
 static bool
-compile_literal_alt_opt (struct vibrex_pattern *compiled, const char *pattern)
+required_literals_present (const RequiredLiterals *required, const char *text, size_t text_len)
 {
-  if (!can_use_literal_alt_opt (pattern))
-    return false;
-
-  char **alternatives;
-  size_t *alt_lengths;
-  size_t alt_count;
+  const LiteralSet *set = &required->set;
+  if (set->count == 1 && !required->fold_case)
+    return literal_searcher_find (&required->searcher, set->literals[0], set->lengths[0], text, text_len) != NULL;
+  if (required->automaton.enabled)
+    return dense_dfa_search (&required->automaton, text, text_len, false);
+  for (size_t i = 0; i < set->count; i++)
+  {
+    if (find_literal (text, text_len, set->literals[i], set->lengths[i]) != NULL)
+      return true;
+  }
+  return false;
+}
 
-  if (!parse_literal_alternatives (pattern, &alternatives, &alt_lengths, &alt_count))
-    return false;
+// Free required literal prefilter data
+static void
+free_required_literals (RequiredLiterals *required)
+{
+  literal_set_free (&required->set);
+  dense_dfa_free (&required->automaton);
+  memset (required, 0, sizeof (*required));
+}
 
-  compiled->literal_alt.alternatives = alternatives;
-  compiled->literal_alt.alt_lengths  = alt_lengths;
-  compiled->literal_alt.alt_count    = alt_count;
-  compiled->literal_alt.enabled      = true;
+/********************************************************************************
+ * ADVANCED ALTERNATION OPTIMIZATION ENGINE
+ ********************************************************************************/
 
-  return true;
+// Skip a bracket expression starting at p, returning its closing ']' or
+// the end of the pattern
+static const char *
+skip_bracket_expression (const char *p)
+{
+  p++;
+  if (*p == '^')
+    p++;
+  if (*p == ']')
+    p++;
+  while (*p && *p != ']')
+  {
+    if (*p == '\\' && p[1])
+      p++;
+    p++;
+  }
+  return p;
 }
 
-// Match using literal alternation optimization - very fast multi-string search!
+// Check whether a pattern has a '|' outside of any group, unescaped and
+// outside bracket expressions
 static bool
-match_with_literal_alt_opt (const struct vibrex_pattern *pattern, const char *text)
+has_top_level_alternation (const char *pattern)
 {
-  if (!pattern->literal_alt.enabled || !text)
-    return false;
-
-  const LiteralAltOpt *opt = &pattern->literal_alt;
-
-  // Try each alternative - return true as soon as any is found
-  for (size_t i = 0; i < opt->alt_count; i++)
+  int depth = 0;
+  for (const char *p = pattern; *p; p++)
   {
-    if (strstr (text, opt->alternatives[i]) != NULL)
+    if (*p == '\\')
+    {
+      if (!*++p)
+        break;
+    }
+    else if (*p == '[')
+    {
+      p = skip_bracket_expression (p);
+      if (!*p)
+        break;
+    }
+    else if (*p == '(')
+      depth++;
+    else if (*p == ')')
+      depth--;
+    else if (*p == '|' && depth == 0)
       return true;
   }
-
   return false;
 }
 
-// Free literal alternation optimization data
-static void
-free_literal_alt_opt (LiteralAltOpt *literal_alt)
+// Check that every '|' of a pattern separates top-level alternatives, that
+// none is escaped or inside a group or bracket expression
+static bool
+alternations_at_top_level (const char *pattern)
 {
-  if (literal_alt && literal_alt->enabled)
+  int depth = 0;
+  for (const char *p = pattern; *p; p++)
   {
-    if (literal_alt->alternatives)
+    if (*p == '\\')
     {
-      for (size_t i = 0; i < literal_alt->alt_count; i++)
+      if (!*++p)
+        break;
+      if (*p == '|')
+        return false;
+    }
+    else if (*p == '[')
+    {
+      p++;
+      if (*p == '^')
+        p++;
+      if (*p == ']')
+        p++;
+      while (*p && *p != ']')
       {
-        free (literal_alt->alternatives[i]);
+        if (*p == '\\' && p[1])
+          p++;
+        if (*p == '|')
+          return false;
+        p++;
       }
-      free (literal_alt->alternatives);
+      if (!*p)
+        break;
     }
-    free (literal_alt->alt_lengths);
-    literal_alt->alternatives = NULL;
-    literal_alt->alt_lengths  = NULL;
-    literal_alt->enabled      = false;
+    else if (*p == '(')
+      depth++;
+    else if (*p == ')')
+      depth--;
+    else if (*p == '|' && depth != 0)
+      return false;
   }
+  return true;
 }
 
-/********************************************************************************
- * ADVANCED ALTERNATION OPTIMIZATION ENGINE
- ********************************************************************************/
-
 static bool
 can_use_advanced_alternation_opt (const char *pattern)
 {
@@ -2125,7 +7811,7 @@ can_use_advanced_alternation_opt (const char *pattern)
     }
   }
 
-  if (alt_count == 0)
+  if (alt_count == 0 || !alternations_at_top_level (pattern))
     return false;
 
   // Check for consistent dotstar patterns in all alternations
@@ -2234,7 +7920,10 @@ compile_advanced_alternation_opt (struct vibrex_pattern *compiled, const char *p
   const char **alternatives;
   size_t *alt_lengths;
   if (!parse_alternatives (pattern, &alternatives, &alt_lengths, &alt_opt->alt_count))
+  {
+    free_alternation_opt (alt_opt);
     return false;
+  }
 
   // Check for dotstar patterns and handle them specially
   if (check_dotstar_consistency (alternatives, alt_lengths, alt_opt->alt_count, alt_opt))
@@ -2255,14 +7944,6 @@ compile_advanced_alternation_opt (struct vibrex_pattern *compiled, const char *p
 
   // Standard prefix/suffix optimization for anchored patterns
   if (!find_common_prefix_suffix (pattern, alternatives, alt_lengths, alt_opt->alt_count, alt_opt))
-  {
-    free (alternatives);
-    free (alt_lengths);
-    return false;
-  }
-
-  // Compile suffix pattern if it contains regex metacharacters
-  if (!compile_suffix_pattern (alt_opt))
   {
     free (alternatives);
     free (alt_lengths);
@@ -2288,11 +7969,12 @@ compile_advanced_alternation_opt (struct vibrex_pattern *compiled, const char *p
 // Match a single alternative based on its classified pattern type
 // Handles different matching strategies for literal, dotstar prefix/suffix/wrapper, and regex patterns
 static bool
-match_single_alternative (const AltSuf *alt_suffix, const char *text, size_t text_len)
+match_single_alternative (const AltSuf *alt_suffix, struct vibrex_scratch *scratch, const char *text, size_t text_len)
 {
   const char *core = alt_suffix->core_pattern;
+  size_t core_len  = alt_suffix->core_len;
 
-  if (!core || strlen (core) == 0)
+  if (!core || core_len == 0)
   {
     // Empty core pattern handling
     switch (alt_suffix->pattern_type)
@@ -2303,42 +7985,40 @@ match_single_alternative (const AltSuf *alt_suffix, const char *text, size_t tex
     case ALT_DOTSTAR_PREFIX:
     case ALT_DOTSTAR_SUFFIX:
     case ALT_DOTSTAR_WRAPPER:
-      // ^.*, ^.*.*, .* - matches everything
+      // ^, $, ^.*, .* - matches everything
       return true;
     case ALT_REGEX:
       return false;
     }
   }
 
-  size_t core_len = strlen (core);
-
   switch (alt_suffix->pattern_type)
   {
   case ALT_LITERAL:
     // ^foo - exact match
-    return (text_len == core_len && strcmp (text, core) == 0);
+    return (text_len == core_len && memcmp (text, core, core_len) == 0);
 
   case ALT_DOTSTAR_PREFIX:
-    // ^.*foo - text must contain core (foo can appear anywhere, not necessarily at end)
-    return (strstr (text, core) != NULL);
+    // .*foo$ - text must end with core
+    return (text_len >= core_len && memcmp (text + text_len - core_len, core, core_len) == 0);
 
   case ALT_DOTSTAR_SUFFIX:
     // ^foo.* - text must start with core
     if (text_len >= core_len)
     {
-      return (strncmp (text, core, core_len) == 0);
+      return (memcmp (text, core, core_len) == 0);
     }
     return false;
 
   case ALT_DOTSTAR_WRAPPER:
-    // ^.*foo.* - core can appear anywhere
-    return (strstr (text, core) != NULL);
+    // .*foo.* - core can appear anywhere
+    return (find_literal (text, text_len, core, core_len) != NULL);
 
   case ALT_REGEX:
     // Complex regex - use compiled pattern
     if (alt_suffix->regex_suffix)
     {
-      return vibrex_match (alt_suffix->regex_suffix, text);
+      return match_internal (alt_suffix->regex_suffix, scratch, text, text_len);
     }
     return false;
   }
@@ -2346,87 +8026,20 @@ match_single_alternative (const AltSuf *alt_suffix, const char *text, size_t tex
   return false;
 }
 
-// Helper function to match dotstar patterns
+// Helper function to match dotstar patterns, consistent or mixed, one
+// alternative at a time
 static bool
-match_dotstar_patterns (const AlternationOpt *alt_opt, const char *text, size_t text_len)
+match_dotstar_patterns (const AlternationOpt *alt_opt, struct vibrex_scratch *scratch, const char *text, size_t text_len)
 {
-  // Handle mixed patterns
-  if (alt_opt->has_mixed_dotstar)
-  {
-    for (size_t i = 0; i < alt_opt->alt_count; i++)
-    {
-      if (match_single_alternative (&alt_opt->suffixes[i], text, text_len))
-        return true;
-    }
-    return false;
-  }
-
-  // Handle consistent patterns (original logic)
-  if (alt_opt->has_dotstar_wrapper)
-  {
-    // Pattern: .*core.* - core can appear anywhere
-    for (size_t i = 0; i < alt_opt->alt_count; i++)
-    {
-      if (alt_opt->suffixes[i].literal_suffix)
-      {
-        if (strstr (text, alt_opt->suffixes[i].literal_suffix) != NULL)
-          return true;
-      }
-      else if (!alt_opt->suffixes[i].literal_suffix && !alt_opt->suffixes[i].regex_suffix)
-      {
-        // Empty core - .*.* matches everything
-        return true;
-      }
-    }
-  }
-  else if (alt_opt->has_dotstar_prefix)
-  {
-    // Pattern: .*core - core must be at end
-    for (size_t i = 0; i < alt_opt->alt_count; i++)
-    {
-      if (alt_opt->suffixes[i].literal_suffix)
-      {
-        size_t core_len = strlen (alt_opt->suffixes[i].literal_suffix);
-        if (text_len >= core_len)
-        {
-          const char *end_match = text + text_len - core_len;
-          if (strcmp (end_match, alt_opt->suffixes[i].literal_suffix) == 0)
-            return true;
-        }
-      }
-      else if (!alt_opt->suffixes[i].literal_suffix && !alt_opt->suffixes[i].regex_suffix)
-      {
-        // Empty core - .* matches everything
-        return true;
-      }
-    }
-  }
-  else if (alt_opt->has_dotstar_suffix)
+  for (size_t i = 0; i < alt_opt->alt_count; i++)
   {
-    // Pattern: core.* - core must be at start
-    for (size_t i = 0; i < alt_opt->alt_count; i++)
-    {
-      if (alt_opt->suffixes[i].literal_suffix)
-      {
-        size_t core_len = strlen (alt_opt->suffixes[i].literal_suffix);
-        if (text_len >= core_len)
-        {
-          if (strncmp (text, alt_opt->suffixes[i].literal_suffix, core_len) == 0)
-            return true;
-        }
-      }
-      else if (!alt_opt->suffixes[i].literal_suffix && !alt_opt->suffixes[i].regex_suffix)
-      {
-        // Empty core - .* matches everything
-        return true;
-      }
-    }
+    if (match_single_alternative (&alt_opt->suffixes[i], scratch, text, text_len))
+      return true;
   }
-
   return false;
 }
 
-// Helper function to match suffix pattern
+// Helper function to match the literal suffix
 static bool
 match_suffix_pattern (const AlternationOpt *alt_opt, const char *text, size_t text_len, const char **match_end)
 {
@@ -2436,89 +8049,55 @@ match_suffix_pattern (const AlternationOpt *alt_opt, const char *text, size_t te
     return true;
   }
 
-  if (alt_opt->suffix_pattern)
+  if (text_len < alt_opt->suffix_len ||
+      memcmp (text + text_len - alt_opt->suffix_len, alt_opt->suffix, alt_opt->suffix_len) != 0)
   {
-    // Use compiled regex pattern for suffix matching
-    // We need to find the longest suffix that matches the pattern
-    for (size_t i = 0; i <= text_len && i <= alt_opt->suffix_len + 10; i++)
-    {
-      const char *suffix_text = text + text_len - i;
-      if (vibrex_match (alt_opt->suffix_pattern, suffix_text))
-      {
-        *match_end = text + text_len - i;
-        return true;
-      }
-    }
     return false;
   }
-  else
-  {
-    // Use literal string comparison for suffix
-    if (text_len < alt_opt->suffix_len ||
-        strcmp (text + text_len - alt_opt->suffix_len, alt_opt->suffix) != 0)
-    {
-      return false;
-    }
-    *match_end = text + text_len - alt_opt->suffix_len;
-    return true;
-  }
+  *match_end = text + text_len - alt_opt->suffix_len;
+  return true;
 }
 
-// Helper function to match alternatives
+// Helper function to match alternatives against the middle of the text,
+// given as a view into the subject, in a single pass over all of them, or
+// one at a time when they did not fit in one pattern
 static bool
-match_alternatives (const AlternationOpt *alt_opt, const char *middle_text, size_t middle_len)
+match_alternatives (const AlternationOpt *alt_opt, struct vibrex_scratch *scratch, const char *middle_text, size_t middle_len)
 {
+  if (alt_opt->middle_pattern)
+    return match_internal (alt_opt->middle_pattern, scratch, middle_text, middle_len);
+
+  if (!alt_opt->suffixes)
+    return dense_dfa_match_anchored (&alt_opt->middles, middle_text, middle_len, true);
+
   for (size_t i = 0; i < alt_opt->alt_count; i++)
   {
-    bool matches = false;
-
-    if (alt_opt->suffixes[i].literal_suffix)
-    {
-      if (middle_text && strcmp (middle_text, alt_opt->suffixes[i].literal_suffix) == 0)
-      {
-        matches = true;
-      }
-      else if (!middle_text && strlen (alt_opt->suffixes[i].literal_suffix) == 0)
-      {
-        matches = true;
-      }
-    }
-    else if (alt_opt->suffixes[i].regex_suffix)
-    {
-      if (middle_text && vibrex_match (alt_opt->suffixes[i].regex_suffix, middle_text))
-      {
-        matches = true;
-      }
-    }
+    const AltSuf *alt = &alt_opt->suffixes[i];
+    bool matches;
+    if (alt->literal_suffix)
+      matches = (alt->literal_len == middle_len && memcmp (middle_text, alt->literal_suffix, middle_len) == 0);
+    else if (alt->regex_suffix)
+      matches = match_internal (alt->regex_suffix, scratch, middle_text, middle_len);
     else
-    {
-      // Empty middle part
-      if (!middle_text || middle_len == 0)
-      {
-        matches = true;
-      }
-    }
-
+      matches = (middle_len == 0); // Empty middle part
     if (matches)
       return true;
   }
-
   return false;
 }
 
 static bool
-match_with_advanced_alternation_opt (const struct vibrex_pattern *pattern, const char *text)
+match_with_advanced_alternation_opt (const struct vibrex_pattern *pattern, struct vibrex_scratch *scratch, const char *text, size_t text_len)
 {
   if (!pattern->has_advanced_alt_opt || !text)
     return false;
 
   const AlternationOpt *alt_opt = &pattern->alt_opt;
-  size_t text_len               = strlen (text);
 
   // Handle dotstar optimizations (consistent or mixed)
   if (alt_opt->has_dotstar_prefix || alt_opt->has_dotstar_suffix || alt_opt->has_mixed_dotstar)
   {
-    return match_dotstar_patterns (alt_opt, text, text_len);
+    return match_dotstar_patterns (alt_opt, scratch, text, text_len);
   }
 
   // Handle standard prefix/suffix optimization
@@ -2529,7 +8108,7 @@ match_with_advanced_alternation_opt (const struct vibrex_pattern *pattern, const
   if (alt_opt->prefix_len > 0)
   {
     if (text_len < alt_opt->prefix_len ||
-        strncmp (text, alt_opt->prefix, alt_opt->prefix_len) != 0)
+        memcmp (text, alt_opt->prefix, alt_opt->prefix_len) != 0)
     {
       return false;
     }
@@ -2542,22 +8121,12 @@ match_with_advanced_alternation_opt (const struct vibrex_pattern *pattern, const
     return false;
   }
 
-  // Extract middle part
-  size_t middle_len = match_end - match_start;
-  char *middle_text = NULL;
-  if (middle_len > 0)
-  {
-    middle_text = malloc (middle_len + 1);
-    if (!middle_text)
-      return false;
-    memcpy (middle_text, match_start, middle_len);
-    middle_text[middle_len] = '\0';
-  }
+  // The prefix and suffix must not overlap
+  if (match_end < match_start)
+    return false;
 
-  // Check alternatives
-  bool result = match_alternatives (alt_opt, middle_text, middle_len);
-  free (middle_text);
-  return result;
+  // Check alternatives against the middle part in place
+  return match_alternatives (alt_opt, scratch, match_start, match_end - match_start);
 }
 
 static void
@@ -2567,13 +8136,9 @@ free_alternation_opt (AlternationOpt *alt_opt)
     return;
 
   free (alt_opt->prefix);
-  alt_opt->prefix = NULL;
-
   free (alt_opt->suffix);
-  alt_opt->suffix = NULL;
-
-  vibrex_free (alt_opt->suffix_pattern);
-  alt_opt->suffix_pattern = NULL;
+  dense_dfa_free (&alt_opt->middles);
+  vibrex_free (alt_opt->middle_pattern);
 
   if (alt_opt->suffixes)
   {
@@ -2584,8 +8149,8 @@ free_alternation_opt (AlternationOpt *alt_opt)
       vibrex_free (alt_opt->suffixes[i].regex_suffix);
     }
     free (alt_opt->suffixes);
-    alt_opt->suffixes = NULL;
   }
+  memset (alt_opt, 0, sizeof (*alt_opt));
 }
 
 // Helper function to parse alternatives from pattern
@@ -2632,50 +8197,63 @@ parse_alternatives (const char *pattern, const char ***alternatives, size_t **al
       break;
     alt_start = alt_end + 1;
   }
-
-  return true;
+
+  return true;
+}
+
+// Strip the anchors and a .* at either end of an alternative, leaving its
+// core and whether the core is anchored at each end of the subject
+static void
+strip_alternative (const char **alt, size_t *len, bool *anchored_start, bool *anchored_end)
+{
+  *anchored_start = (*len > 0 && (*alt)[0] == '^');
+  if (*anchored_start)
+  {
+    (*alt)++;
+    (*len)--;
+  }
+
+  // An escaped $ leaves a backslash in the core, which classifies it as a regex
+  *anchored_end = (*len > 0 && (*alt)[*len - 1] == '$');
+  if (*anchored_end)
+    (*len)--;
+
+  if (*len >= 2 && (*alt)[0] == '.' && (*alt)[1] == '*')
+  {
+    *anchored_start = false;
+    *alt += 2;
+    *len -= 2;
+  }
+  if (*len >= 2 && (*alt)[*len - 2] == '.' && (*alt)[*len - 1] == '*')
+  {
+    *anchored_end = false;
+    *len -= 2;
+  }
 }
 
 // Classify the type of an alternative pattern for optimization purposes
-// Determines whether the pattern is literal, has dotstar prefix/suffix/wrapper, or is complex regex
+// Determines whether the core is a literal and which ends of the subject it
+// is anchored to, or whether the alternative is a complex regex
 static AltPatternType
 classify_alternative_pattern (const char *alt, size_t len)
 {
-  // Skip ^ anchor if present
-  if (len > 0 && alt[0] == '^')
-  {
-    alt++;
-    len--;
-  }
+  bool anchored_start;
+  bool anchored_end;
+  strip_alternative (&alt, &len, &anchored_start, &anchored_end);
 
-  // Skip $ anchor at end
-  if (len > 0 && alt[len - 1] == '$')
+  for (size_t i = 0; i < len; i++)
   {
-    len--;
+    if (strchr (ALT_METACHARACTERS, alt[i]))
+      return ALT_REGEX;
   }
 
-  if (len < 2)
+  if (anchored_start && anchored_end)
     return ALT_LITERAL;
-
-  bool has_prefix = (alt[0] == '.' && alt[1] == '*');
-  bool has_suffix = (len >= 2 && alt[len - 2] == '.' && alt[len - 1] == '*');
-
-  if (has_prefix && has_suffix)
-    return ALT_DOTSTAR_WRAPPER;
-  else if (has_prefix)
-    return ALT_DOTSTAR_PREFIX;
-  else if (has_suffix)
+  if (anchored_start)
     return ALT_DOTSTAR_SUFFIX;
-  else
-  {
-    // Check if it's a simple literal pattern or complex regex
-    for (size_t i = 0; i < len; i++)
-    {
-      if (strchr (".?*+[]()|\\", alt[i]))
-        return ALT_REGEX;
-    }
-    return ALT_LITERAL;
-  }
+  if (anchored_end)
+    return ALT_DOTSTAR_PREFIX;
+  return ALT_DOTSTAR_WRAPPER;
 }
 
 // Helper function to check dotstar consistency across alternatives
@@ -2739,7 +8317,8 @@ check_dotstar_consistency (const char **alternatives, size_t *alt_lengths, size_
   return all_have_dotstar_prefix || all_have_dotstar_suffix || has_mixed_patterns;
 }
 
-// Extract the core pattern from an alternative by removing dotstar wrappers
+// Extract the core pattern from an alternative by removing its anchors and
+// dotstar wrappers, or the whole alternative for a regex
 // For example: "^.*foo.*" -> "foo", "^bar.*" -> "bar", "^baz" -> "baz"
 static bool
 extract_core_pattern (const char *alt, size_t alt_len, AltPatternType pattern_type, char **core_pattern, size_t *core_len)
@@ -2747,57 +8326,11 @@ extract_core_pattern (const char *alt, size_t alt_len, AltPatternType pattern_ty
   const char *start = alt;
   size_t len        = alt_len;
 
-  // Skip ^ anchor
-  if (len > 0 && start[0] == '^')
+  if (pattern_type != ALT_REGEX)
   {
-    start++;
-    len--;
-  }
-
-  // Skip $ anchor at end
-  if (len > 0 && start[len - 1] == '$')
-  {
-    len--;
-  }
-
-  // Extract core based on pattern type
-  switch (pattern_type)
-  {
-  case ALT_DOTSTAR_PREFIX:
-    // ^.*foo -> foo
-    if (len >= 2)
-    {
-      start += 2; // skip .*
-      len -= 2;
-    }
-    break;
-
-  case ALT_DOTSTAR_SUFFIX:
-    // ^foo.* -> foo
-    if (len >= 2)
-    {
-      len -= 2; // remove .*
-    }
-    break;
-
-  case ALT_DOTSTAR_WRAPPER:
-    // ^.*foo.* -> foo
-    if (len >= 4)
-    {
-      start += 2; // skip .*
-      len -= 4;   // remove .* from both ends
-    }
-    else if (len == 2)
-    {
-      // Just ^.* - empty core
-      len = 0;
-    }
-    break;
-
-  case ALT_LITERAL:
-  case ALT_REGEX:
-    // Use as-is
-    break;
+    bool anchored_start;
+    bool anchored_end;
+    strip_alternative (&start, &len, &anchored_start, &anchored_end);
   }
 
   // Store the core pattern
@@ -2819,6 +8352,28 @@ extract_core_pattern (const char *alt, size_t alt_len, AltPatternType pattern_ty
   return true;
 }
 
+// Compile part of a pattern as a nested pattern, anchored to match whole
+// subjects or as it is
+static struct vibrex_pattern *
+compile_part (const char *part, size_t part_len, bool anchored)
+{
+  char *text = malloc (part_len + 3);
+  if (!text)
+    return NULL;
+  size_t len = 0;
+  if (anchored)
+    text[len++] = '^';
+  memcpy (text + len, part, part_len);
+  len += part_len;
+  if (anchored)
+    text[len++] = '$';
+  text[len] = '\0';
+
+  struct vibrex_pattern *compiled = compile_pattern (text, true, 0, NULL);
+  free (text);
+  return compiled;
+}
+
 // Helper function to compile dotstar optimization
 static bool
 compile_dotstar_optimization (AlternationOpt *alt_opt, const char **alternatives, size_t *alt_lengths)
@@ -2844,23 +8399,26 @@ compile_dotstar_optimization (AlternationOpt *alt_opt, const char **alternatives
       return false;
 
     alt_opt->suffixes[i].core_pattern = core_pattern;
+    alt_opt->suffixes[i].core_len     = core_pattern ? core_len : 0;
 
     // For mixed patterns, we store both literal_suffix (for simple cases)
     // and core_pattern (for type-specific matching)
     if (pattern_type == ALT_LITERAL || pattern_type == ALT_DOTSTAR_PREFIX ||
         pattern_type == ALT_DOTSTAR_SUFFIX || pattern_type == ALT_DOTSTAR_WRAPPER)
     {
-      alt_opt->suffixes[i].literal_suffix = core_pattern ? strdup (core_pattern) : NULL;
+      if (core_pattern)
+      {
+        alt_opt->suffixes[i].literal_suffix = malloc (core_len + 1);
+        if (!alt_opt->suffixes[i].literal_suffix)
+          return false;
+        memcpy (alt_opt->suffixes[i].literal_suffix, core_pattern, core_len + 1);
+        alt_opt->suffixes[i].literal_len = core_len;
+      }
     }
     else if (pattern_type == ALT_REGEX && core_pattern)
     {
-      // Compile regex patterns
-      char regex_pattern[PATTERN_BUFFER_SIZE];
-      int offset = sprintf (regex_pattern, "^");
-      strcpy (regex_pattern + offset, core_pattern);
-      strcat (regex_pattern, "$");
-
-      alt_opt->suffixes[i].regex_suffix = vibrex_compile (regex_pattern, NULL);
+      // Compile regex alternatives with their own anchors
+      alt_opt->suffixes[i].regex_suffix = compile_part (core_pattern, core_len, false);
       if (!alt_opt->suffixes[i].regex_suffix)
         return false;
     }
@@ -2873,10 +8431,17 @@ compile_dotstar_optimization (AlternationOpt *alt_opt, const char **alternatives
 static bool
 find_common_prefix_suffix (const char *pattern, const char **alternatives, size_t *alt_lengths, size_t alt_count, AlternationOpt *alt_opt)
 {
-  const char *p    = pattern;
-  bool is_anchored = (p[0] == '^');
-  if (is_anchored)
-    p++;
+  // The prefix and suffix are compared at the ends of the subject, so every
+  // alternative must be anchored at both
+  for (size_t i = 0; i < alt_count; i++)
+  {
+    const char *alt = alternatives[i];
+    size_t len      = alt_lengths[i];
+    if (len < 2 || alt[0] != '^' || alt[len - 1] != '$' || alt[len - 2] == '\\')
+      return false;
+  }
+
+  const char *p = pattern + 1;
 
   const char *first_pipe = strchr (p, '|');
   if (!first_pipe)
@@ -2906,6 +8471,23 @@ find_common_prefix_suffix (const char *pattern, const char **alternatives, size_
       break;
   }
 
+  // The prefix is compared byte for byte, so it ends before a metacharacter
+  // and before a byte that any alternative repeats
+  for (size_t k = 0; k < prefix_len; k++)
+  {
+    if (strchr (ALT_METACHARACTERS, p[k]))
+    {
+      prefix_len = k;
+      break;
+    }
+  }
+  for (size_t i = 0; i < alt_count && prefix_len > 0; i++)
+  {
+    const char *alt = alternatives[i] + 1;
+    if (prefix_len < alt_lengths[i] - 2 && strchr ("*+?{", alt[prefix_len]))
+      prefix_len--;
+  }
+
   // Find common suffix
   size_t suffix_len = 0;
   if (alt_count > 1)
@@ -2990,6 +8572,24 @@ find_common_prefix_suffix (const char *pattern, const char **alternatives, size_
 
     if (suffix_len > min_len - prefix_len)
       suffix_len = min_len - prefix_len;
+
+    // Likewise the suffix holds no metacharacter and no escaped byte
+    const char *first_end = alternatives[0] + alt_lengths[0] - 1;
+    for (size_t k = 1; k <= suffix_len; k++)
+    {
+      if (strchr (ALT_METACHARACTERS, first_end[-(ptrdiff_t)k]))
+      {
+        suffix_len = k - 1;
+        break;
+      }
+    }
+    for (size_t i = 0; i < alt_count && suffix_len > 0; i++)
+    {
+      const char *alt = alternatives[i] + 1;
+      size_t len      = alt_lengths[i] - 2;
+      if (len > prefix_len + suffix_len && alt[len - suffix_len - 1] == '\\')
+        suffix_len--;
+    }
   }
 
   // Only proceed if we have meaningful optimization
@@ -3036,134 +8636,596 @@ find_common_prefix_suffix (const char *pattern, const char **alternatives, size_
   return true;
 }
 
-// Helper function to compile suffix pattern if it contains regex metacharacters
+// Helper function to compile the middle parts of alternatives one by one,
+// for those too many to fit in one pattern, which are then tried in turn
 static bool
-compile_suffix_pattern (AlternationOpt *alt_opt)
+compile_middle_parts_each (AlternationOpt *alt_opt, const char **alternatives, size_t *alt_lengths)
 {
-  if (alt_opt->suffix_len == 0)
-    return true;
+  alt_opt->suffixes = calloc (alt_opt->alt_count, sizeof (AltSuf));
+  if (!alt_opt->suffixes)
+    return false;
 
-  // Check if suffix contains regex metacharacters
-  bool suffix_is_literal = true;
-  for (size_t i = 0; i < alt_opt->suffix_len; i++)
+  for (size_t i = 0; i < alt_opt->alt_count; i++)
   {
-    if (strchr (".?*+[]()|\\", alt_opt->suffix[i]))
+    AltSuf *alt              = &alt_opt->suffixes[i];
+    const char *middle_start = alternatives[i] + 1 + alt_opt->prefix_len;
+    size_t middle_len        = alt_lengths[i] - 2 - alt_opt->prefix_len - alt_opt->suffix_len;
+    if (middle_len == 0)
+      continue;
+
+    bool is_literal = true;
+    for (size_t j = 0; j < middle_len && is_literal; j++)
     {
-      suffix_is_literal = false;
-      break;
+      if (strchr (ALT_METACHARACTERS, middle_start[j]))
+        is_literal = false;
     }
-  }
-
-  // If suffix contains regex metacharacters, compile it as a pattern
-  if (!suffix_is_literal)
-  {
-    char suffix_pattern_str[PATTERN_BUFFER_SIZE];
-    int offset = sprintf (suffix_pattern_str, "^");
-    memcpy (suffix_pattern_str + offset, alt_opt->suffix, alt_opt->suffix_len);
-    offset += alt_opt->suffix_len;
-    suffix_pattern_str[offset++] = '$';
-    suffix_pattern_str[offset]   = '\0';
 
-    alt_opt->suffix_pattern = vibrex_compile (suffix_pattern_str, NULL);
-    if (!alt_opt->suffix_pattern)
-      return false;
+    if (is_literal)
+    {
+      alt->literal_suffix = malloc (middle_len + 1);
+      if (!alt->literal_suffix)
+        return false;
+      memcpy (alt->literal_suffix, middle_start, middle_len);
+      alt->literal_suffix[middle_len] = '\0';
+      alt->literal_len                = middle_len;
+    }
+    else
+    {
+      alt->regex_suffix = compile_part (middle_start, middle_len, true);
+      if (!alt->regex_suffix)
+        return false;
+    }
   }
-
   return true;
 }
 
-// Helper function to compile middle parts of alternatives
+// Helper function to compile the middle parts of alternatives into one
+// automaton, so a subject is checked against all of them in a single pass:
+// a minimized trie when they are all literals, which shares the states of
+// common endings, or else one anchored pattern alternating between them
 static bool
 compile_middle_parts (AlternationOpt *alt_opt, const char **alternatives, size_t *alt_lengths)
 {
-  alt_opt->suffixes = calloc (alt_opt->alt_count, sizeof (AltSuf));
-  if (!alt_opt->suffixes)
-    return false;
+  LiteralSet set     = {0};
+  bool all_literal   = true;
+  bool has_empty     = false;
+  size_t pattern_len = 0;
 
-  // Store middle parts of alternatives
   for (size_t i = 0; i < alt_opt->alt_count; i++)
   {
-    const char *alt = alternatives[i];
-    size_t len      = alt_lengths[i];
+    // Alternatives are anchored at both ends, see find_common_prefix_suffix()
+    const char *middle_start = alternatives[i] + 1 + alt_opt->prefix_len;
+    size_t middle_len        = alt_lengths[i] - 2 - alt_opt->prefix_len - alt_opt->suffix_len;
 
-    if (alt[0] == '^')
+    if (middle_len == 0)
+      has_empty = true;
+    for (size_t j = 0; j < middle_len && all_literal; j++)
     {
-      alt++;
-      len--;
+      if (strchr (ALT_METACHARACTERS, middle_start[j]))
+        all_literal = false;
     }
-    if (len > 0 && alt[len - 1] == '$')
+    pattern_len += middle_len + 1;
+
+    if (all_literal && !literal_set_add (&set, middle_start, middle_len))
     {
-      len--;
+      literal_set_free (&set);
+      return false;
     }
+  }
 
-    const char *middle_start = alt + alt_opt->prefix_len;
-    size_t middle_len        = len - alt_opt->prefix_len - alt_opt->suffix_len;
+  if (all_literal)
+  {
+    bool ok = dense_dfa_build (&alt_opt->middles, set.literals, set.lengths, set.count, true, false, SIZE_MAX);
+    literal_set_free (&set);
+    return ok;
+  }
+  literal_set_free (&set);
 
-    if (middle_len > 0)
-    {
-      bool is_literal = true;
-      for (size_t j = 0; j < middle_len; j++)
-      {
-        if (strchr (".?*+[]()|\\", middle_start[j]))
-        {
-          is_literal = false;
-          break;
-        }
-      }
+  // (middle|middle|...), made optional when a middle part is empty
+  char *combined = malloc (pattern_len + 3);
+  if (!combined)
+    return false;
+  size_t len      = 0;
+  bool first      = true;
+  combined[len++] = '(';
+  for (size_t i = 0; i < alt_opt->alt_count; i++)
+  {
+    size_t middle_len = alt_lengths[i] - 2 - alt_opt->prefix_len - alt_opt->suffix_len;
+    if (middle_len == 0)
+      continue;
+    if (!first)
+      combined[len++] = '|';
+    first = false;
+    memcpy (combined + len, alternatives[i] + 1 + alt_opt->prefix_len, middle_len);
+    len += middle_len;
+  }
+  combined[len++] = ')';
+  if (has_empty)
+    combined[len++] = '?';
+
+  // The parent is matched by comparing bytes, so the combined pattern is
+  // the only one to use the scratch space's lazy DFA
+  alt_opt->middle_pattern = compile_part (combined, len, true);
+  free (combined);
+  if (!alt_opt->middle_pattern)
+    return compile_middle_parts_each (alt_opt, alternatives, alt_lengths);
+  alt_opt->middle_pattern->owns_dfa_cache = true;
+  return true;
+}
 
-      if (is_literal)
-      {
-        alt_opt->suffixes[i].literal_suffix = malloc (middle_len + 1);
-        if (!alt_opt->suffixes[i].literal_suffix)
-          return false;
-        memcpy (alt_opt->suffixes[i].literal_suffix, middle_start, middle_len);
-        alt_opt->suffixes[i].literal_suffix[middle_len] = '\0';
-      }
-      else
-      {
-        char sub_pattern_str[PATTERN_BUFFER_SIZE];
-        int offset = sprintf (sub_pattern_str, "^");
-        memcpy (sub_pattern_str + offset, middle_start, middle_len);
-        offset += middle_len;
-        sub_pattern_str[offset++] = '$';
-        sub_pattern_str[offset]   = '\0';
+/********************************************************************************
+ * LITERAL SEARCH
+ ********************************************************************************/
 
-        alt_opt->suffixes[i].regex_suffix = vibrex_compile (sub_pattern_str, NULL);
-        if (!alt_opt->suffixes[i].regex_suffix)
-          return false;
-      }
-    }
+// Rough rank of how common a byte is in text, higher is more common; bytes
+// not listed (control, high and most punctuation bytes) are the rarest
+static int
+byte_rank (unsigned char c)
+{
+  static const char common[] = "\n0123456789_:/.,-ZQJXKVBYWGPFMUCDLHRSNIOATEzqjxkvbywgpfmucdlhrsnioate ";
+  const char *p              = c ? memchr (common, c, sizeof (common) - 1) : NULL;
+  return p ? (int)(p - common) + 1 : 0;
+}
+
+// Choose the two rarest bytes of a literal at distinct offsets, preferring
+// distinct byte values so candidates are filtered by both
+static void
+literal_searcher_init (LiteralSearcher *searcher, const char *literal, size_t literal_len)
+{
+  memset (searcher, 0, sizeof (*searcher));
+  if (literal_len == 0)
+    return;
+
+  size_t best = 0;
+  for (size_t i = 1; i < literal_len; i++)
+  {
+    if (byte_rank ((unsigned char)literal[i]) < byte_rank ((unsigned char)literal[best]))
+      best = i;
   }
 
-  return true;
+  size_t second = (best == 0 && literal_len > 1) ? 1 : 0;
+  for (size_t i = 0; i < literal_len; i++)
+  {
+    if (i == best)
+      continue;
+    bool i_differs      = literal[i] != literal[best];
+    bool second_differs = literal[second] != literal[best] && second != best;
+    if ((i_differs && !second_differs) ||
+        (i_differs == second_differs && byte_rank ((unsigned char)literal[i]) < byte_rank ((unsigned char)literal[second])))
+      second = i;
+  }
+
+  searcher->rare1   = (unsigned char)literal[best];
+  searcher->offset1 = best;
+  searcher->rare2   = (unsigned char)literal[second];
+  searcher->offset2 = second;
+  searcher->enabled = true;
+}
+
+#if VIBREX_SIMD_X86
+// Check the candidates of one block of positions, lowest first
+static inline const char *
+verify_candidates (uint32_t mask, const char *block, const char *literal, size_t literal_len)
+{
+  while (mask)
+  {
+    const char *candidate = block + __builtin_ctz (mask);
+    if (memcmp (candidate, literal, literal_len) == 0)
+      return candidate;
+    mask &= mask - 1;
+  }
+  return NULL;
 }
 
+// Scan 16 positions per step, leaving *pos at the first position not scanned
 static const char *
-boyer_moore_search (const char *text, int text_len, const struct vibrex_pattern *pattern)
+literal_find_sse2 (const LiteralSearcher *searcher, const char *literal, size_t literal_len,
+                   const char *text, size_t last, size_t *pos)
 {
-  if (!pattern->bad_char.enabled || pattern->prefix_len > text_len)
-    return NULL;
+  const __m128i rare1 = _mm_set1_epi8 ((char)searcher->rare1);
+  const __m128i rare2 = _mm_set1_epi8 ((char)searcher->rare2);
+  size_t i            = *pos;
+
+  for (; i <= last && last - i >= 15; i += 16)
+  {
+    __m128i a     = _mm_loadu_si128 ((const __m128i *)(text + i + searcher->offset1));
+    __m128i b     = _mm_loadu_si128 ((const __m128i *)(text + i + searcher->offset2));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8 (_mm_and_si128 (_mm_cmpeq_epi8 (a, rare1), _mm_cmpeq_epi8 (b, rare2)));
+    const char *found = verify_candidates (mask, text + i, literal, literal_len);
+    if (found)
+      return found;
+  }
+  *pos = i;
+  return NULL;
+}
+
+// Scan 64 positions per step, then 32, leaving *pos at the first position
+// not scanned
+__attribute__ ((target ("avx2"))) static const char *
+literal_find_avx2 (const LiteralSearcher *searcher, const char *literal, size_t literal_len,
+                   const char *text, size_t last, size_t *pos)
+{
+  const __m256i rare1 = _mm256_set1_epi8 ((char)searcher->rare1);
+  const __m256i rare2 = _mm256_set1_epi8 ((char)searcher->rare2);
+  const char *text1   = text + searcher->offset1;
+  const char *text2   = text + searcher->offset2;
+  size_t i            = *pos;
+
+  for (; i <= last && last - i >= 63; i += 64)
+  {
+    __m256i lo = _mm256_and_si256 (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)(text1 + i)), rare1),
+                                   _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)(text2 + i)), rare2));
+    __m256i hi = _mm256_and_si256 (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)(text1 + i + 32)), rare1),
+                                   _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)(text2 + i + 32)), rare2));
+    if (_mm256_testz_si256 (_mm256_or_si256 (lo, hi), _mm256_or_si256 (lo, hi)))
+      continue;
+    const char *found = verify_candidates ((uint32_t)_mm256_movemask_epi8 (lo), text + i, literal, literal_len);
+    if (!found)
+      found = verify_candidates ((uint32_t)_mm256_movemask_epi8 (hi), text + i + 32, literal, literal_len);
+    if (found)
+      return found;
+  }
+  for (; i <= last && last - i >= 31; i += 32)
+  {
+    __m256i eq = _mm256_and_si256 (_mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)(text1 + i)), rare1),
+                                   _mm256_cmpeq_epi8 (_mm256_loadu_si256 ((const __m256i *)(text2 + i)), rare2));
+    const char *found = verify_candidates ((uint32_t)_mm256_movemask_epi8 (eq), text + i, literal, literal_len);
+    if (found)
+      return found;
+  }
+  *pos = i;
+  return NULL;
+}
+
+// Vector extensions beyond SSE2 the CPU runs, detected once
+#define CPU_DETECTED 0x1
+#define CPU_SSSE3 0x2
+#define CPU_AVX2 0x4
+
+static int
+cpu_features (void)
+{
+  static atomic_int features; // CPU_* bits, 0 before detection
+  int value = atomic_load_explicit (&features, memory_order_relaxed);
+  if (value == 0)
+  {
+    __builtin_cpu_init ();
+    value = CPU_DETECTED | (__builtin_cpu_supports ("ssse3") ? CPU_SSSE3 : 0) |
+            (__builtin_cpu_supports ("avx2") ? CPU_AVX2 : 0);
+    atomic_store_explicit (&features, value, memory_order_relaxed);
+  }
+  return value;
+}
 
-  const char *pattern_str = pattern->literal_prefix;
-  int pattern_len         = pattern->prefix_len;
-  const int *skip_table   = pattern->bad_char.skip;
+// Whether the CPU runs AVX2 code
+static inline bool
+cpu_has_avx2 (void)
+{
+  return (cpu_features () & CPU_AVX2) != 0;
+}
+#elif VIBREX_SIMD_NEON
+// Scan 16 positions per step, leaving *pos at the first position not scanned
+static const char *
+literal_find_neon (const LiteralSearcher *searcher, const char *literal, size_t literal_len,
+                   const char *text, size_t last, size_t *pos)
+{
+  const uint8x16_t rare1 = vdupq_n_u8 (searcher->rare1);
+  const uint8x16_t rare2 = vdupq_n_u8 (searcher->rare2);
+  size_t i               = *pos;
 
-  int skip = 0;
-  while (skip <= text_len - pattern_len)
+  for (; i <= last && last - i >= 15; i += 16)
   {
-    int j = pattern_len - 1;
-    while (j >= 0 && pattern_str[j] == text[skip + j])
-      j--;
+    uint8x16_t a  = vld1q_u8 ((const uint8_t *)text + i + searcher->offset1);
+    uint8x16_t b  = vld1q_u8 ((const uint8_t *)text + i + searcher->offset2);
+    uint8x16_t eq = vandq_u8 (vceqq_u8 (a, rare1), vceqq_u8 (b, rare2));
 
-    if (j < 0)
+    // Narrow to four mask bits per position
+    uint64_t mask = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8 (eq), 4)), 0);
+    while (mask)
     {
-      return text + skip;
+      const char *candidate = text + i + (__builtin_ctzll (mask) >> 2);
+      if (memcmp (candidate, literal, literal_len) == 0)
+        return candidate;
+      mask &= ~(0xfull << ((candidate - text - i) * 4));
     }
-    else
+  }
+  *pos = i;
+  return NULL;
+}
+#endif
+
+// Find the first occurrence of a literal using its searcher, stopping at
+// text_len rather than at NUL bytes
+static const char *
+literal_searcher_find (const LiteralSearcher *searcher, const char *literal, size_t literal_len,
+                       const char *text, size_t text_len)
+{
+  if (literal_len == 0)
+    return text;
+  if (literal_len > text_len)
+    return NULL;
+  if (literal_len == 1)
+    return memchr (text, literal[0], text_len);
+
+  size_t last = text_len - literal_len; // Last possible starting position
+  size_t pos  = 0;
+
+#if VIBREX_SIMD_X86
+  const char *found = cpu_has_avx2 () ? literal_find_avx2 (searcher, literal, literal_len, text, last, &pos)
+                                      : literal_find_sse2 (searcher, literal, literal_len, text, last, &pos);
+  if (found)
+    return found;
+#elif VIBREX_SIMD_NEON
+  const char *found = literal_find_neon (searcher, literal, literal_len, text, last, &pos);
+  if (found)
+    return found;
+#endif
+
+  // Scalar search for the rarest byte, used for the tail of vector scans
+  while (pos <= last)
+  {
+    const char *candidate = memchr (text + pos + searcher->offset1, searcher->rare1, last - pos + 1);
+    if (!candidate)
+      return NULL;
+    pos = candidate - text - searcher->offset1;
+    if ((unsigned char)text[pos + searcher->offset2] == searcher->rare2 &&
+        memcmp (text + pos, literal, literal_len) == 0)
+      return text + pos;
+    pos++;
+  }
+  return NULL;
+}
+
+// Find the first occurrence of a byte string, stopping at text_len rather than at NUL bytes
+static const char *
+find_literal (const char *text, size_t text_len, const char *literal, size_t literal_len)
+{
+  if (literal_len < 2 || literal_len > text_len)
+    return literal_searcher_find (NULL, literal, literal_len, text, text_len);
+
+  LiteralSearcher searcher;
+  literal_searcher_init (&searcher, literal, literal_len);
+  return literal_searcher_find (&searcher, literal, literal_len, text, text_len);
+}
+
+// Compare two byte strings with letters of either case equal
+static bool
+equal_fold_case (const char *a, const char *b, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned char x = (unsigned char)a[i];
+    unsigned char y = (unsigned char)b[i];
+    if (x != y && other_case (x) != y)
+      return false;
+  }
+  return true;
+}
+
+// Find the first byte in [p, end) that is one of count (at most 3) bytes,
+// returning NULL if there is none
+static const unsigned char *
+find_byte_of (const unsigned char *p, const unsigned char *end, const unsigned char *bytes, int count)
+{
+  if (count == 0)
+    return NULL;
+  if (count == 1)
+    return memchr (p, bytes[0], end - p);
+
+  unsigned char b0 = bytes[0];
+  unsigned char b1 = bytes[1];
+  unsigned char b2 = count > 2 ? bytes[2] : bytes[1];
+
+#if VIBREX_SIMD_X86
+  const __m128i v0 = _mm_set1_epi8 ((char)b0);
+  const __m128i v1 = _mm_set1_epi8 ((char)b1);
+  const __m128i v2 = _mm_set1_epi8 ((char)b2);
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i block = _mm_loadu_si128 ((const __m128i *)p);
+    __m128i eq    = _mm_or_si128 (_mm_or_si128 (_mm_cmpeq_epi8 (block, v0), _mm_cmpeq_epi8 (block, v1)),
+                                  _mm_cmpeq_epi8 (block, v2));
+    uint32_t mask = (uint32_t)_mm_movemask_epi8 (eq);
+    if (mask)
+      return p + __builtin_ctz (mask);
+  }
+#elif VIBREX_SIMD_NEON
+  const uint8x16_t v0 = vdupq_n_u8 (b0);
+  const uint8x16_t v1 = vdupq_n_u8 (b1);
+  const uint8x16_t v2 = vdupq_n_u8 (b2);
+  for (; end - p >= 16; p += 16)
+  {
+    uint8x16_t block = vld1q_u8 (p);
+    uint8x16_t eq    = vorrq_u8 (vorrq_u8 (vceqq_u8 (block, v0), vceqq_u8 (block, v1)), vceqq_u8 (block, v2));
+    uint64_t mask    = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8 (eq), 4)), 0);
+    if (mask)
+      return p + (__builtin_ctzll (mask) >> 2);
+  }
+#endif
+
+  for (; p < end; p++)
+  {
+    if (*p == b0 || *p == b1 || *p == b2)
+      return p;
+  }
+  return NULL;
+}
+
+// Find the first position in [p, end) that begins one of count (at most
+// DENSE_DFA_MAX_PAIRS) byte pairs, returning NULL if there is none
+static const unsigned char *
+find_pair_of (const unsigned char *p, const unsigned char *end, const unsigned char (*pairs)[2], int count)
+{
+  if (end - p < 2)
+    return NULL;
+
+#if VIBREX_SIMD_X86
+  // Unused slots repeat the last pair
+  const unsigned char *q0 = pairs[0];
+  const unsigned char *q1 = pairs[count > 1 ? 1 : count - 1];
+  const unsigned char *q2 = pairs[count > 2 ? 2 : count - 1];
+  const unsigned char *q3 = pairs[count > 3 ? 3 : count - 1];
+  const __m128i a0 = _mm_set1_epi8 ((char)q0[0]), b0 = _mm_set1_epi8 ((char)q0[1]);
+  const __m128i a1 = _mm_set1_epi8 ((char)q1[0]), b1 = _mm_set1_epi8 ((char)q1[1]);
+  const __m128i a2 = _mm_set1_epi8 ((char)q2[0]), b2 = _mm_set1_epi8 ((char)q2[1]);
+  const __m128i a3 = _mm_set1_epi8 ((char)q3[0]), b3 = _mm_set1_epi8 ((char)q3[1]);
+  for (; end - p >= 17; p += 16)
+  {
+    __m128i first  = _mm_loadu_si128 ((const __m128i *)p);
+    __m128i second = _mm_loadu_si128 ((const __m128i *)(p + 1));
+    __m128i eq01   = _mm_or_si128 (_mm_and_si128 (_mm_cmpeq_epi8 (first, a0), _mm_cmpeq_epi8 (second, b0)),
+                                   _mm_and_si128 (_mm_cmpeq_epi8 (first, a1), _mm_cmpeq_epi8 (second, b1)));
+    __m128i eq23   = _mm_or_si128 (_mm_and_si128 (_mm_cmpeq_epi8 (first, a2), _mm_cmpeq_epi8 (second, b2)),
+                                   _mm_and_si128 (_mm_cmpeq_epi8 (first, a3), _mm_cmpeq_epi8 (second, b3)));
+    uint32_t mask  = (uint32_t)_mm_movemask_epi8 (_mm_or_si128 (eq01, eq23));
+    if (mask)
+      return p + __builtin_ctz (mask);
+  }
+#elif VIBREX_SIMD_NEON
+  // Unused slots repeat the last pair
+  const unsigned char *q0 = pairs[0];
+  const unsigned char *q1 = pairs[count > 1 ? 1 : count - 1];
+  const unsigned char *q2 = pairs[count > 2 ? 2 : count - 1];
+  const unsigned char *q3 = pairs[count > 3 ? 3 : count - 1];
+  const uint8x16_t a0 = vdupq_n_u8 (q0[0]), b0 = vdupq_n_u8 (q0[1]);
+  const uint8x16_t a1 = vdupq_n_u8 (q1[0]), b1 = vdupq_n_u8 (q1[1]);
+  const uint8x16_t a2 = vdupq_n_u8 (q2[0]), b2 = vdupq_n_u8 (q2[1]);
+  const uint8x16_t a3 = vdupq_n_u8 (q3[0]), b3 = vdupq_n_u8 (q3[1]);
+  for (; end - p >= 17; p += 16)
+  {
+    uint8x16_t first  = vld1q_u8 (p);
+    uint8x16_t second = vld1q_u8 (p + 1);
+    uint8x16_t eq01   = vorrq_u8 (vandq_u8 (vceqq_u8 (first, a0), vceqq_u8 (second, b0)),
+                                  vandq_u8 (vceqq_u8 (first, a1), vceqq_u8 (second, b1)));
+    uint8x16_t eq23   = vorrq_u8 (vandq_u8 (vceqq_u8 (first, a2), vceqq_u8 (second, b2)),
+                                  vandq_u8 (vceqq_u8 (first, a3), vceqq_u8 (second, b3)));
+    uint8x16_t eq     = vorrq_u8 (eq01, eq23);
+    uint64_t mask     = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8 (eq), 4)), 0);
+    if (mask)
+      return p + (__builtin_ctzll (mask) >> 2);
+  }
+#endif
+
+  for (; end - p >= 2; p++)
+  {
+    for (int k = 0; k < count; k++)
     {
-      int char_skip = skip_table[(unsigned char)text[skip + j]];
-      skip += (char_skip > 0 ? char_skip : 1);
+      if (p[0] == pairs[k][0] && p[1] == pairs[k][1])
+        return p;
     }
   }
   return NULL;
 }
+
+// Lay out a byte set bitmap for span scans
+static void
+byte_span_init (ByteSpan *span, const unsigned char *set)
+{
+  memset (span, 0, sizeof (*span));
+  for (int b = 0; b < TRANSITION_TABLE_SIZE; b++)
+  {
+    if (set[b / 8] & (1 << (b % 8)))
+      (b < 128 ? span->low : span->high)[b & 15] |= 1 << ((b >> 4) & 7);
+  }
+}
+
+static inline bool
+byte_span_has (const ByteSpan *span, unsigned char b)
+{
+  return ((b < 128 ? span->low : span->high)[b & 15] >> ((b >> 4) & 7)) & 1;
+}
+
+#if VIBREX_SIMD_X86
+// Scan 16 bytes per step, returning the first byte not in the set or the
+// start of the unscanned tail.  PSHUFB yields zero for indices with the top
+// bit set, so each table answers only for its half of the bytes.
+__attribute__ ((target ("ssse3"))) static const unsigned char *
+byte_span_ssse3 (const ByteSpan *span, const unsigned char *p, const unsigned char *end)
+{
+  const __m128i low    = _mm_loadu_si128 ((const __m128i *)span->low);
+  const __m128i high   = _mm_loadu_si128 ((const __m128i *)span->high);
+  const __m128i bits   = _mm_setr_epi8 (1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m128i nibble = _mm_set1_epi8 (0x0f);
+  const __m128i top    = _mm_set1_epi8 (-128);
+  for (; end - p >= 16; p += 16)
+  {
+    __m128i block = _mm_loadu_si128 ((const __m128i *)p);
+    __m128i rows  = _mm_or_si128 (_mm_shuffle_epi8 (low, block), _mm_shuffle_epi8 (high, _mm_xor_si128 (block, top)));
+    __m128i bit   = _mm_shuffle_epi8 (bits, _mm_and_si128 (_mm_srli_epi16 (block, 4), nibble));
+    uint32_t miss = ~(uint32_t)_mm_movemask_epi8 (_mm_cmpeq_epi8 (_mm_and_si128 (rows, bit), bit)) & 0xffff;
+    if (miss)
+      return p + __builtin_ctz (miss);
+  }
+  return p;
+}
+
+// Scan 32 bytes per step, as byte_span_ssse3()
+__attribute__ ((target ("avx2"))) static const unsigned char *
+byte_span_avx2 (const ByteSpan *span, const unsigned char *p, const unsigned char *end)
+{
+  const __m256i low    = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *)span->low));
+  const __m256i high   = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *)span->high));
+  const __m256i bits   = _mm256_setr_epi8 (1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16,
+                                           32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+  const __m256i nibble = _mm256_set1_epi8 (0x0f);
+  const __m256i top    = _mm256_set1_epi8 (-128);
+  for (; end - p >= 32; p += 32)
+  {
+    __m256i block = _mm256_loadu_si256 ((const __m256i *)p);
+    __m256i rows  = _mm256_or_si256 (_mm256_shuffle_epi8 (low, block),
+                                     _mm256_shuffle_epi8 (high, _mm256_xor_si256 (block, top)));
+    __m256i bit   = _mm256_shuffle_epi8 (bits, _mm256_and_si256 (_mm256_srli_epi16 (block, 4), nibble));
+    uint32_t miss = ~(uint32_t)_mm256_movemask_epi8 (_mm256_cmpeq_epi8 (_mm256_and_si256 (rows, bit), bit));
+    if (miss)
+      return p + __builtin_ctz (miss);
+  }
+  return p;
+}
+#elif VIBREX_SIMD_NEON
+// Scan 16 bytes per step, returning the first byte not in the set or the
+// start of the unscanned tail
+static const unsigned char *
+byte_span_neon (const ByteSpan *span, const unsigned char *p, const unsigned char *end)
+{
+  static const uint8_t bit_values[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t low                = vld1q_u8 (span->low);
+  const uint8x16_t high               = vld1q_u8 (span->high);
+  const uint8x16_t bits               = vld1q_u8 (bit_values);
+  const uint8x16_t nibble             = vdupq_n_u8 (0x0f);
+  const uint8x16_t top                = vdupq_n_u8 (0x80);
+  for (; end - p >= 16; p += 16)
+  {
+    uint8x16_t block = vld1q_u8 (p);
+    uint8x16_t index = vandq_u8 (block, nibble);
+    uint8x16_t rows  = vbslq_u8 (vcgeq_u8 (block, top), vqtbl1q_u8 (high, index), vqtbl1q_u8 (low, index));
+    uint8x16_t miss  = vceqq_u8 (vtstq_u8 (rows, vqtbl1q_u8 (bits, vshrq_n_u8 (block, 4))), vdupq_n_u8 (0));
+    uint64_t mask    = vget_lane_u64 (vreinterpret_u64_u8 (vshrn_n_u16 (vreinterpretq_u16_u8 (miss), 4)), 0);
+    if (mask)
+      return p + (__builtin_ctzll (mask) >> 2);
+  }
+  return p;
+}
+#endif
+
+// Find the first byte in [p, end) that is not in the set, returning end if
+// there is none
+static const unsigned char *
+byte_span (const ByteSpan *span, const unsigned char *p, const unsigned char *end)
+{
+  if (p == end || !byte_span_has (span, *p))
+    return p;
+
+#if VIBREX_SIMD_X86
+  int features = cpu_features ();
+  if (features & CPU_AVX2)
+    p = byte_span_avx2 (span, p, end);
+  else if (features & CPU_SSSE3)
+    p = byte_span_ssse3 (span, p, end);
+#elif VIBREX_SIMD_NEON
+  p = byte_span_neon (span, p, end);
+#endif
+
+  while (p < end && byte_span_has (span, *p))
+    p++;
+  return p;
+}
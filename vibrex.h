@@ -17,13 +17,100 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* Opaque type for compiled regex pattern */
 typedef struct vibrex_pattern vibrex_t;
 
+/* Opaque type for per-thread match scratch space */
+typedef struct vibrex_scratch vibrex_scratch_t;
+
+/* Opaque type for a compiled set of patterns */
+typedef struct vibrex_set vibrex_set_t;
+
+/* Opaque type for matching text that arrives in chunks */
+typedef struct vibrex_stream vibrex_stream_t;
+
+/* Opaque type for finding every match in a buffer */
+typedef struct vibrex_iter vibrex_iter_t;
+
+/* Opaque type for a thread-safe cache of compiled patterns */
+typedef struct vibrex_cache vibrex_cache_t;
+
+/* Lazy DFA cache statistics of a scratch space */
+typedef struct vibrex_dfa_stats
+{
+  size_t cache_hits;    /* Transitions taken from the state cache */
+  size_t cache_misses;  /* Transitions computed from the NFA */
+  size_t cache_flushes; /* Times the state cache was cleared for being full */
+  size_t nfa_fallbacks; /* Matches handed to the NFA after the cache thrashed */
+  size_t cache_states;  /* DFA states currently cached */
+} vibrex_dfa_stats_t;
+
+/* Contents and use of a pattern cache */
+typedef struct vibrex_cache_stats
+{
+  size_t entries;   /* Patterns cached */
+  size_t bytes;     /* Memory charged to the budget by the cached patterns */
+  size_t hits;      /* Lookups served from the cache */
+  size_t misses;    /* Lookups that compiled the pattern */
+  size_t evictions; /* Patterns evicted to stay within the budget */
+} vibrex_cache_stats_t;
+
+/* Length and byte bounds every match of a pattern obeys */
+typedef struct vibrex_bounds
+{
+  size_t min_length;             /* Fewest bytes a match spans */
+  size_t max_length;             /* Most bytes a match spans, SIZE_MAX if unbounded */
+  bool anchored_start;           /* Every match starts at the start of the text */
+  bool anchored_end;             /* Every match ends at the end of the text */
+  unsigned char first_bytes[32]; /* Bitmap of bytes a non-empty match can start with */
+  unsigned char last_bytes[32];  /* Bitmap of bytes a non-empty match can end with */
+} vibrex_bounds_t;
+
+/* How a compiled pattern is matched, as chosen by vibrex_compile() */
+typedef struct vibrex_info
+{
+  const char *engine;       /* Engine name, one of "nfa", "bitnfa", "both-anchors", "url",
+                               "literal-alt", "advanced-alt", "dfa" or "dotstar" */
+  const char *start_search; /* How the NFA engines skip to where a match can start:
+                               "prefix", "first-byte" or NULL */
+  const char *prefix;       /* Literal prefix the start search looks for, NULL if none */
+  size_t prefix_len;        /* Length of prefix */
+  size_t required_literals; /* Literals one of which every match contains, checked first */
+  const char *literal;      /* The required literal when there is just one, NULL otherwise */
+  size_t literal_len;       /* Length of literal */
+  int nfa_states;           /* NFA states, 0 for engines without an NFA */
+  int bitnfa_states;        /* States of the bit-parallel NFA, 0 if it is not used */
+  int byte_classes;         /* Byte classes of lazy DFA rows */
+  int dfa_states;           /* States of the literal tries and Aho-Corasick automata */
+  size_t dfa_bytes;         /* Bytes of their transition tables */
+  size_t memory_bytes;      /* Bytes held by the compiled pattern, not counting scratch space */
+  size_t scratch_bytes;     /* Bytes of a scratch space before any lazy DFA states are cached */
+} vibrex_info_t;
+
+/* Match counters of a pattern, kept when the library is built with VIBREX_COUNTERS */
+typedef struct vibrex_counters
+{
+  size_t subjects;          /* Subjects matched against the pattern */
+  size_t matches;           /* Subjects that matched */
+  size_t bounds_rejects;    /* Subjects rejected by their length or first and last bytes */
+  size_t prefilter_rejects; /* Subjects rejected for lacking a required literal */
+  size_t bytes_scanned;     /* Bytes of the subjects that were not rejected by the bounds */
+  size_t nfa_steps;         /* Bytes stepped through by the NFA state list simulation */
+} vibrex_counters_t;
+
 /********************************************************************************
  * @brief Compiles a regular expression pattern
  *
+ * Bounded repetitions {m}, {m,} and {m,n} are expanded into copies of
+ * their atom, so they count against the limits of the expanded pattern:
+ * bounds of at most 1000 and at most 4096 NFA states.  Each copy adds the
+ * states of its atom and each optional copy one more, so [a-z]{0,1000}
+ * takes about 2000 states and (a{1,40}){1,40} about 3200, while
+ * (a{1,70}){1,70} is rejected as too complex.  Patterns of more than 64
+ * positions are matched by the lazy DFA rather than the bit-parallel NFA.
+ *
  * @param pattern The null-terminated regular expression string.
  * @param error_message If not NULL, will be set to a pointer to a
  * description of the error on failure.
@@ -33,9 +120,43 @@ typedef struct vibrex_pattern vibrex_t;
  *********************************************************************************/
 extern vibrex_t* vibrex_compile(const char* pattern, const char **error_message);
 
+/* Flags for vibrex_compile_ex() */
+#define VIBREX_ICASE 0x01u /* Letters match in either case, ASCII letters only */
+
+/* Flags that turn engines off, to test the engines against each other */
+#define VIBREX_NO_SPECIALIZED 0x02u /* Only the NFA engines, no literal, anchor or alternation engines */
+#define VIBREX_NO_BITNFA 0x04u      /* No bit-parallel NFA */
+#define VIBREX_NO_LAZY_DFA 0x08u    /* Simulate the NFA without building DFA states */
+
+/********************************************************************************
+ * @brief Compiles a regular expression pattern with flags
+ *
+ * Same as vibrex_compile() with VIBREX_* flags.  With VIBREX_ICASE, case
+ * is folded into the compiled automata, literal searches and comparisons,
+ * so subjects are matched as they are without being converted first.
+ * The VIBREX_NO_* flags give the same results more slowly, by matching
+ * with fewer of the engines; they exist to check the engines against
+ * each other.
+ *
+ * @param pattern The null-terminated regular expression string.
+ * @param flags Any of the VIBREX_* flags combined with or, or 0
+ * @param error_message If not NULL, will be set to a pointer to a
+ * description of the error on failure.
+ *
+ * @return A pointer to a compiled vibrex_t object on success, or NULL if
+ * the pattern has a syntax error, a flag is unknown or on memory
+ * allocation failure.
+ *********************************************************************************/
+extern vibrex_t* vibrex_compile_ex(const char* pattern, unsigned flags, const char **error_message);
+
 /********************************************************************************
  * @brief Match a compiled pattern against a string
  *
+ * Safe to call concurrently from multiple threads on the same compiled
+ * pattern.  Each pattern carries one default scratch space; a thread
+ * that finds it in use allocates a temporary one for the call.  Use
+ * vibrex_match_scratch() to avoid that allocation under contention.
+ *
  * @param compiled_pattern The compiled regex pattern
  * @param text The text to match against
  *
@@ -43,6 +164,500 @@ extern vibrex_t* vibrex_compile(const char* pattern, const char **error_message)
  *********************************************************************************/
 extern bool vibrex_match(const vibrex_t* compiled_pattern, const char* text);
 
+/********************************************************************************
+ * @brief Match a compiled pattern against a buffer of known length
+ *
+ * Same as vibrex_match() but the text need not be NUL-terminated and may
+ * contain NUL bytes, which are matched like any other byte.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param text The text to match against
+ * @param text_len The number of bytes in text
+ *
+ * @return true if match found, false otherwise
+ *********************************************************************************/
+extern bool vibrex_match_n(const vibrex_t* compiled_pattern, const char* text, size_t text_len);
+
+/********************************************************************************
+ * @brief Match a compiled pattern against many subjects
+ *
+ * Equivalent to calling vibrex_match_n() on each subject, but the engine
+ * is dispatched once for the whole batch and literal patterns advance
+ * several subjects in lockstep.  Intended for large numbers of short
+ * subjects.  Safe to call concurrently like vibrex_match().
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param texts Array of n subjects, a NULL entry never matches
+ * @param lens Array of n subject lengths, or NULL if every subject is
+ * NUL-terminated
+ * @param n The number of subjects
+ * @param results Receives 1 for each matching subject and 0 otherwise
+ *
+ * @return The number of matching subjects
+ *********************************************************************************/
+extern size_t vibrex_match_batch(const vibrex_t* compiled_pattern, const char* const* texts, const size_t* lens, size_t n,
+                                 uint8_t* results);
+
+/********************************************************************************
+ * @brief Create scratch space for matching
+ *
+ * Scratch space holds all mutable state used while matching.  It may be
+ * used with any compiled pattern, and grows if a pattern needs more room
+ * than it was created for, but must only be used by one thread at a time.
+ *
+ * @param compiled_pattern The pattern to size the scratch space for, may
+ * be NULL to create an empty scratch space that grows on first use
+ *
+ * @return A pointer to the scratch space, or NULL on memory allocation failure
+ *********************************************************************************/
+extern vibrex_scratch_t* vibrex_scratch_create(const vibrex_t* compiled_pattern);
+
+/********************************************************************************
+ * @brief Match a compiled pattern against a string using caller-owned scratch
+ *
+ * Performs no memory allocation unless the scratch space must grow,
+ * including its lazy DFA state cache.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param scratch Scratch space owned by the calling thread
+ * @param text The text to match against
+ *
+ * @return true if match found, false otherwise
+ *********************************************************************************/
+extern bool vibrex_match_scratch(const vibrex_t* compiled_pattern, vibrex_scratch_t* scratch, const char* text);
+
+/********************************************************************************
+ * @brief Match a buffer of known length using caller-owned scratch
+ *
+ * Same as vibrex_match_scratch() but for text that need not be
+ * NUL-terminated, as with vibrex_match_n().
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param scratch Scratch space owned by the calling thread
+ * @param text The text to match against
+ * @param text_len The number of bytes in text
+ *
+ * @return true if match found, false otherwise
+ *********************************************************************************/
+extern bool vibrex_match_scratch_n(const vibrex_t* compiled_pattern, vibrex_scratch_t* scratch, const char* text, size_t text_len);
+
+/********************************************************************************
+ * @brief Find where a compiled pattern matches in a buffer
+ *
+ * Reports the leftmost-longest match, as POSIX regexec() does: the match
+ * that starts first and, of those starting there, the one that ends last.
+ * Subjects that do not match are rejected by the same engines as in
+ * vibrex_match_n(), so only matching subjects pay for the NFA simulation
+ * that finds the bounds, or for literal alternations the trie of their
+ * literals.  Safe to call concurrently like vibrex_match();
+ * patterns matched without scratch space, such as literals and small
+ * patterns, allocate a temporary one for each call, which
+ * vibrex_search_scratch() avoids.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param text The text to search, which may contain NUL bytes
+ * @param text_len The number of bytes in text
+ * @param match_start Receives the offset of the first byte of the match,
+ * may be NULL
+ * @param match_end Receives the offset just past the last byte of the
+ * match, may be NULL
+ *
+ * @return true if a match was found, false if not or on memory allocation
+ * failure
+ *********************************************************************************/
+extern bool vibrex_search(const vibrex_t* compiled_pattern, const char* text, size_t text_len, size_t* match_start,
+                          size_t* match_end);
+
+/********************************************************************************
+ * @brief Find where a compiled pattern matches using caller-owned scratch
+ *
+ * Same as vibrex_search() but performs no memory allocation unless the
+ * scratch space must grow.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param scratch Scratch space owned by the calling thread
+ * @param text The text to search
+ * @param text_len The number of bytes in text
+ * @param match_start Receives the offset of the first byte of the match,
+ * may be NULL
+ * @param match_end Receives the offset just past the last byte of the
+ * match, may be NULL
+ *
+ * @return true if a match was found, false otherwise
+ *********************************************************************************/
+extern bool vibrex_search_scratch(const vibrex_t* compiled_pattern, vibrex_scratch_t* scratch, const char* text,
+                                  size_t text_len, size_t* match_start, size_t* match_end);
+
+/********************************************************************************
+ * @brief Report lazy DFA cache statistics
+ *
+ * Patterns matched with the NFA engine build DFA states on demand and
+ * cache them in the scratch space, up to a fixed memory budget.  The
+ * counters accumulate over every match made with the scratch space.
+ *
+ * @param compiled_pattern The pattern whose default scratch space to report
+ * on when scratch is NULL
+ * @param scratch The scratch space to report on, or NULL
+ * @param stats Receives the statistics
+ *
+ * @return true on success, false if there is no scratch space to report on
+ *********************************************************************************/
+extern bool vibrex_dfa_stats(const vibrex_t* compiled_pattern, const vibrex_scratch_t* scratch, vibrex_dfa_stats_t* stats);
+
+/********************************************************************************
+ * @brief Report the length and byte bounds of every match of a pattern
+ *
+ * Worked out when the pattern is compiled.  Matching rejects subjects
+ * shorter than min_length, or that break the bounds of an anchored
+ * pattern, before running an engine.  In the bitmaps, bit (b % 8) of byte
+ * (b / 8) is set for each byte b.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param bounds Receives the bounds
+ *
+ * @return true on success, false if the pattern was too large to analyze
+ * or can never match
+ *********************************************************************************/
+extern bool vibrex_bounds(const vibrex_t* compiled_pattern, vibrex_bounds_t* bounds);
+
+/********************************************************************************
+ * @brief Report how a compiled pattern is matched
+ *
+ * Names the engine vibrex_compile() selected and the literal searches that
+ * run before it, and reports the size of the automata and of the pattern.
+ * Intended for finding out why a pattern is slow.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param info Receives the description
+ *
+ * @return true on success, false if either argument is NULL
+ *********************************************************************************/
+extern bool vibrex_info(const vibrex_t* compiled_pattern, vibrex_info_t* info);
+
+/********************************************************************************
+ * @brief Report the match counters of a pattern
+ *
+ * The counters are only kept when the library is compiled with
+ * VIBREX_COUNTERS defined, which costs a few atomic additions per match.
+ * They accumulate over every vibrex_match*() and vibrex_match_batch() call
+ * made with the pattern from any thread; streams are not counted.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param counters Receives the counters
+ * @param reset Whether to clear the counters after reading them
+ *
+ * @return true on success, false if the library keeps no counters or an
+ * argument is NULL
+ *********************************************************************************/
+extern bool vibrex_counters(const vibrex_t* compiled_pattern, vibrex_counters_t* counters, bool reset);
+
+/********************************************************************************
+ * @brief Free scratch space
+ *
+ * @param scratch The scratch space to free
+ *********************************************************************************/
+extern void vibrex_scratch_free(vibrex_scratch_t* scratch);
+
+/********************************************************************************
+ * @brief Start matching a pattern against text that arrives in chunks
+ *
+ * The stream carries the match state from one chunk to the next, so a
+ * match may span any number of chunks and the text is never copied or
+ * reassembled.  Each stream has its own scratch space, so many streams may
+ * match the same pattern concurrently, one thread per stream.  The pattern
+ * must outlive the stream.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ *
+ * @return A new stream, or NULL on memory allocation failure
+ *********************************************************************************/
+extern vibrex_stream_t* vibrex_stream_begin(const vibrex_t* compiled_pattern);
+
+/********************************************************************************
+ * @brief Match the next chunk of a stream
+ *
+ * @param stream The stream
+ * @param chunk The next bytes of the text, which may contain NUL bytes
+ * @param chunk_len The number of bytes in chunk, may be 0
+ *
+ * @return true once a match has been found in the text so far, after which
+ * further chunks are not scanned; false otherwise.  Matches that must end
+ * at the end of the text are only reported by vibrex_stream_end().
+ *********************************************************************************/
+extern bool vibrex_stream_feed(vibrex_stream_t* stream, const char* chunk, size_t chunk_len);
+
+/********************************************************************************
+ * @brief End the text of a stream and free the stream
+ *
+ * @param stream The stream to end, may be NULL
+ *
+ * @return true if the pattern matches the whole text fed, false if not or
+ * if memory ran out while matching
+ *********************************************************************************/
+extern bool vibrex_stream_end(vibrex_stream_t* stream);
+
+/********************************************************************************
+ * @brief Start finding every match of a pattern in a buffer
+ *
+ * Matches are reported in order by vibrex_iter_next(), each the
+ * leftmost-longest match starting at or after the end of the one before
+ * it, as vibrex_search() would find it.  An empty match moves the next
+ * search on by one byte.  The pass carries its position and the position
+ * of the next required literal from one match to the next.  Where a
+ * search would have to step through many bytes again after a match, as
+ * with "A.*Z|A" over a run of 'A's, the pass goes on finding the matches
+ * that follow while the match is decided, so finding every match takes
+ * time linear in the buffer length.  Each iterator has its own
+ * scratch space; the pattern and the buffer must outlive the iterator.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param text The buffer to search, which may contain NUL bytes
+ * @param text_len The number of bytes in text
+ *
+ * @return A new iterator, or NULL on memory allocation failure
+ *********************************************************************************/
+extern vibrex_iter_t* vibrex_find_iter(const vibrex_t* compiled_pattern, const char* text, size_t text_len);
+
+/********************************************************************************
+ * @brief Find the next match of an iterator
+ *
+ * @param iter The iterator
+ * @param match_start Receives the offset of the first byte of the match,
+ * may be NULL
+ * @param match_end Receives the offset just past the last byte of the
+ * match, may be NULL
+ *
+ * @return true if another match was found, false once there are no more
+ *********************************************************************************/
+extern bool vibrex_iter_next(vibrex_iter_t* iter, size_t* match_start, size_t* match_end);
+
+/********************************************************************************
+ * @brief Free an iterator
+ *
+ * @param iter The iterator to free, may be NULL
+ *********************************************************************************/
+extern void vibrex_iter_free(vibrex_iter_t* iter);
+
+/********************************************************************************
+ * @brief Count the matches of a pattern in a buffer
+ *
+ * Counts the matches vibrex_iter_next() would report, without allocating
+ * an iterator.  Safe to call concurrently like vibrex_match().
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param text The buffer to search, which may contain NUL bytes
+ * @param text_len The number of bytes in text
+ *
+ * @return The number of non-overlapping matches, 0 if there are none or on
+ * memory allocation failure
+ *********************************************************************************/
+extern size_t vibrex_count(const vibrex_t* compiled_pattern, const char* text, size_t text_len);
+
+/********************************************************************************
+ * @brief Match a large buffer on several threads
+ *
+ * Same result as vibrex_match_n(), found by splitting the buffer into
+ * chunks that are matched on up to nthreads threads.  Chunks are read on
+ * by the longest match of the pattern, or end after a newline when its
+ * matches are unbounded but cannot contain one, so matches crossing chunk
+ * boundaries are found.  Patterns with anchors, and unbounded patterns
+ * that can match a newline, are matched on the calling thread alone, as
+ * are buffers too small to split.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param text The buffer to match, which may contain NUL bytes
+ * @param text_len The number of bytes in text
+ * @param nthreads The most threads to use, including the calling thread
+ *
+ * @return true if match found, false otherwise
+ *********************************************************************************/
+extern bool vibrex_match_parallel(const vibrex_t* compiled_pattern, const char* text, size_t text_len, int nthreads);
+
+/********************************************************************************
+ * @brief Count the matches of a pattern in a large buffer on several threads
+ *
+ * Same result as vibrex_count(), with the buffer split as by
+ * vibrex_match_parallel().  The counts of the chunks are merged in order,
+ * and a chunk that a match crosses into is searched again from the end of
+ * that match until its matches agree with the ones counted by its thread.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param text The buffer to search, which may contain NUL bytes
+ * @param text_len The number of bytes in text
+ * @param nthreads The most threads to use, including the calling thread
+ *
+ * @return The number of non-overlapping matches, 0 if there are none or on
+ * memory allocation failure
+ *********************************************************************************/
+extern size_t vibrex_count_parallel(const vibrex_t* compiled_pattern, const char* text, size_t text_len, int nthreads);
+
+/********************************************************************************
+ * @brief Compiles a set of patterns to be matched together
+ *
+ * All patterns are merged into one automaton so that a single pass over
+ * the text reports every pattern that matches.
+ *
+ * @param patterns Array of null-terminated regular expression strings
+ * @param count The number of patterns
+ * @param error_message If not NULL, will be set to a pointer to a
+ * description of the error on failure.
+ *
+ * @return A pointer to a compiled vibrex_set_t object on success, or NULL
+ * if any pattern has a syntax error or on memory allocation failure.
+ *********************************************************************************/
+extern vibrex_set_t* vibrex_set_compile(const char **patterns, size_t count, const char **error_message);
+
+/********************************************************************************
+ * @brief Match a buffer against every pattern of a set
+ *
+ * Safe to call concurrently from multiple threads on the same set.
+ *
+ * @param set The compiled pattern set
+ * @param text The text to match against
+ * @param text_len The number of bytes in text
+ * @param matches Receives a bitmap of the matching patterns, bit (i % 8)
+ * of byte (i / 8) is set if pattern i matches; must hold at least
+ * (count + 7) / 8 bytes
+ *
+ * @return The number of matching patterns
+ *********************************************************************************/
+extern size_t vibrex_set_match(const vibrex_set_t* set, const char* text, size_t text_len, unsigned char* matches);
+
+/********************************************************************************
+ * @brief Report the number of patterns in a set
+ *
+ * @param set The compiled pattern set
+ *
+ * @return The number of patterns, 0 if set is NULL
+ *********************************************************************************/
+extern size_t vibrex_set_size(const vibrex_set_t* set);
+
+/********************************************************************************
+ * @brief Free a compiled pattern set
+ *
+ * @param set The pattern set to free
+ *********************************************************************************/
+extern void vibrex_set_free(vibrex_set_t* set);
+
+/********************************************************************************
+ * @brief Serialize a compiled pattern
+ *
+ * Writes the compiled pattern, including its DFA tables, NFA states and
+ * literal prefilters, so it can be loaded with vibrex_deserialize() or
+ * vibrex_deserialize_mapped() without compiling it again.  The format is
+ * versioned and only loads into the same build of the library on the
+ * same platform; it is meant for caching compiled patterns, not for
+ * exchange.  Call with a NULL buffer to learn the size needed.
+ *
+ * @param compiled_pattern The compiled regex pattern
+ * @param buffer Receives the serialized pattern, may be NULL
+ * @param buffer_size The number of bytes buffer can hold
+ *
+ * @return The size of the serialized pattern, which is only written if
+ * it fits in buffer_size bytes, or 0 if compiled_pattern is NULL
+ *********************************************************************************/
+extern size_t vibrex_serialize(const vibrex_t* compiled_pattern, void* buffer, size_t buffer_size);
+
+/********************************************************************************
+ * @brief Load a serialized pattern
+ *
+ * Every reference inside the data is checked to lie within it and the
+ * DFA tables are checked to stay in range, but the data should otherwise
+ * come from vibrex_serialize().
+ *
+ * @param data The serialized pattern
+ * @param data_size The number of bytes of data
+ * @param error_message If not NULL, will be set to a pointer to a
+ * description of the error on failure.
+ *
+ * @return A pointer to a compiled vibrex_t object independent of data, or
+ * NULL if the data is not a valid serialized pattern for this build or on
+ * memory allocation failure.
+ *********************************************************************************/
+extern vibrex_t* vibrex_deserialize(const void* data, size_t data_size, const char **error_message);
+
+/********************************************************************************
+ * @brief Load a serialized pattern that stays in memory, such as a mapped file
+ *
+ * Same as vibrex_deserialize(), but the dense DFA tables, usually the
+ * bulk of a large pattern, are used where they are in data rather than
+ * copied, so processes mapping the same file share them.  Only the small
+ * remainder of the pattern is copied.  The tables are copied anyway if
+ * data is not aligned for them; memory from mmap() or malloc() always is.
+ *
+ * @param data The serialized pattern, which must stay valid and unchanged
+ * until the pattern is freed
+ * @param data_size The number of bytes of data
+ * @param error_message If not NULL, will be set to a pointer to a
+ * description of the error on failure.
+ *
+ * @return A pointer to a compiled vibrex_t object, or NULL if the data is
+ * not a valid serialized pattern for this build or on memory allocation
+ * failure.
+ *********************************************************************************/
+extern vibrex_t* vibrex_deserialize_mapped(const void* data, size_t data_size, const char **error_message);
+
+/********************************************************************************
+ * @brief Create a cache of compiled patterns keyed by their text
+ *
+ * Programs that compile the same patterns over and over can look them up
+ * in a cache instead.  The cache may be shared by many threads, and each
+ * pattern it returns is shared by everyone who looked up the same text;
+ * like any compiled pattern it may be matched concurrently.  When the
+ * patterns cached use more memory than the budget, the least recently
+ * used ones are evicted, and those still in use are freed once they are
+ * released.
+ *
+ * @param memory_budget Most bytes the cached patterns may use, about what
+ * vibrex_info() reports for them, or 0 for no limit
+ *
+ * @return A new cache, or NULL on memory allocation failure
+ *********************************************************************************/
+extern vibrex_cache_t* vibrex_cache_create(size_t memory_budget);
+
+/********************************************************************************
+ * @brief Look up a compiled pattern in a cache, compiling it on a miss
+ *
+ * The pattern must not be freed with vibrex_free(); release it with
+ * vibrex_cache_release() when done.  Patterns that fail to compile are
+ * not cached.
+ *
+ * @param cache The pattern cache
+ * @param pattern The regex pattern string to look up
+ * @param error_message Receives the error message from vibrex_compile()
+ * on failure, may be NULL
+ *
+ * @return The compiled pattern, or NULL if it could not be compiled
+ *********************************************************************************/
+extern const vibrex_t* vibrex_cache_get(vibrex_cache_t* cache, const char* pattern, const char **error_message);
+
+/********************************************************************************
+ * @brief Release a pattern returned by vibrex_cache_get()
+ *
+ * @param cache The cache the pattern was returned by
+ * @param compiled_pattern The pattern to release, may be NULL
+ *********************************************************************************/
+extern void vibrex_cache_release(vibrex_cache_t* cache, const vibrex_t* compiled_pattern);
+
+/********************************************************************************
+ * @brief Report the contents and use of a pattern cache
+ *
+ * @param cache The pattern cache
+ * @param stats Receives the statistics
+ *
+ * @return true on success, false if an argument is NULL
+ *********************************************************************************/
+extern bool vibrex_cache_stats(vibrex_cache_t* cache, vibrex_cache_stats_t* stats);
+
+/********************************************************************************
+ * @brief Free a pattern cache and every pattern in it
+ *
+ * Every pattern returned by the cache must be released or no longer used.
+ *
+ * @param cache The cache to free, may be NULL
+ *********************************************************************************/
+extern void vibrex_cache_free(vibrex_cache_t* cache);
+
 /********************************************************************************
  * @brief Free a compiled pattern
  *